@@ -5,6 +5,7 @@
 #include "audio_codec.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
+#include "recording_protocol.h"
 #include "assets/lang_config.h"
 #include "mcp_server.h"
 
@@ -197,7 +198,7 @@ void Application::ShowActivationCode(const std::string& code, const std::string&
         digit_sound{'9', Lang::Sounds::OGG_9}
     }};
 
-    // This sentence uses 9KB of SRAM, so we need to wait for it to finish
+    // Sounds are queued as views of the flash assets, the digits follow the sentence without extra SRAM
     Alert(Lang::Strings::ACTIVATION, message.c_str(), "link", Lang::Sounds::OGG_ACTIVATION);
 
     for (const auto& digit : code) {
@@ -250,8 +251,10 @@ void Application::ToggleChatState() {
 
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
+            auto channel_lock = AcquireAudioChannel();
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
+                SelectFrameDuration();
                 if (!protocol_->OpenAudioChannel()) {
                     return;
                 }
@@ -287,8 +290,10 @@ void Application::StartListening() {
     
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
+            auto channel_lock = AcquireAudioChannel();
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
+                SelectFrameDuration();
                 if (!protocol_->OpenAudioChannel()) {
                     return;
                 }
@@ -363,6 +368,19 @@ void Application::Start() {
     callbacks.on_vad_change = [this](bool speaking) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
     };
+    callbacks.on_audio_testing_queue_full = [this]() {
+        Schedule([this]() {
+            if (device_state_ == kDeviceStateAudioTesting) {
+                audio_service_.EnableAudioTesting(false);
+                SetDeviceState(kDeviceStateWifiConfiguring);
+            }
+        });
+    };
+#if CONFIG_USE_AUDIO_CHANNEL_PRECONNECT
+    callbacks.on_wake_word_speech = [this]() {
+        StartChannelWarmup();
+    };
+#endif
     audio_service_.SetCallbacks(callbacks);
 
     /* Start the clock timer to update the status bar */
@@ -419,12 +437,23 @@ void Application::Start() {
         ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
         protocol_ = std::make_unique<MqttProtocol>();
     }
+#if CONFIG_USE_PROTOCOL_RECORDER
+    protocol_ = std::make_unique<RecordingProtocol>(std::move(protocol_));
+#endif
 
     protocol_->OnConnected([this]() {
         DismissAlert();
     });
 
     protocol_->OnNetworkError([this](const std::string& message) {
+#if CONFIG_USE_AUDIO_CHANNEL_PRECONNECT
+        // Nobody asked for this channel yet, errors of a speculative connect stay silent
+        uint32_t attempt = warmup_.owner();
+        if (attempt != 0) {
+            ESP_LOGW(TAG, "Pre-connect attempt %lu failed: %s", (unsigned long)attempt, message.c_str());
+            return;
+        }
+#endif
         last_error_message_ = message;
         xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
     });
@@ -442,6 +471,9 @@ void Application::Start() {
     });
     protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
+#if CONFIG_USE_AUDIO_CHANNEL_PRECONNECT
+        warmup_.Drop(warmup_.owner());
+#endif
         Schedule([this]() {
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("system", "");
@@ -451,8 +483,15 @@ void Application::Start() {
     protocol_->OnIncomingJson([this, display](const cJSON* root) {
         // Parse JSON data
         auto type = cJSON_GetObjectItem(root, "type");
+        if (!cJSON_IsString(type)) {
+            ESP_LOGW(TAG, "Missing message type");
+            return;
+        }
         if (strcmp(type->valuestring, "tts") == 0) {
             auto state = cJSON_GetObjectItem(root, "state");
+            if (!cJSON_IsString(state)) {
+                return;
+            }
             if (strcmp(state->valuestring, "start") == 0) {
                 Schedule([this]() {
                     aborted_ = false;
@@ -524,11 +563,13 @@ void Application::Start() {
 #if CONFIG_RECEIVE_CUSTOM_MESSAGE
         } else if (strcmp(type->valuestring, "custom") == 0) {
             auto payload = cJSON_GetObjectItem(root, "payload");
-            ESP_LOGI(TAG, "Received custom message: %s", cJSON_PrintUnformatted(root));
             if (cJSON_IsObject(payload)) {
-                Schedule([this, display, payload_str = std::string(cJSON_PrintUnformatted(payload))]() {
-                    display->SetChatMessage("system", payload_str.c_str());
+                auto payload_str = cJSON_PrintUnformatted(payload);
+                ESP_LOGI(TAG, "Received custom message: %s", payload_str);
+                Schedule([this, display, message = std::string(payload_str)]() {
+                    display->SetChatMessage("system", message.c_str());
                 });
+                cJSON_free(payload_str);
             } else {
                 ESP_LOGW(TAG, "Invalid custom message format: missing payload");
             }
@@ -564,8 +605,25 @@ void Application::OnClockTimer() {
     if (clock_ticks_ % 10 == 0) {
         // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
         // SystemInfo::PrintTaskList();
+        // SystemInfo::PrintPcmFramePoolStats();
+        // SystemInfo::PrintAudioPacketPoolStats();
+        // audio_service_.PrintCodecStats();
         SystemInfo::PrintHeapStats();
     }
+
+#if CONFIG_USE_AUDIO_CHANNEL_PRECONNECT
+    // Close a pre-connected channel that was never used, unless another attempt has the channel by then
+    uint32_t expired = warmup_.Expired(std::chrono::steady_clock::now());
+    if (expired != 0 && device_state_ == kDeviceStateIdle) {
+        Schedule([this, expired]() {
+            std::lock_guard<std::mutex> lock(audio_channel_mutex_);
+            if (device_state_ == kDeviceStateIdle && warmup_.Drop(expired)) {
+                ESP_LOGI(TAG, "Closing unused pre-connected audio channel");
+                protocol_->CloseAudioChannel();
+            }
+        });
+    }
+#endif
 }
 
 // Add a async task to MainLoop
@@ -596,11 +654,7 @@ void Application::MainEventLoop() {
         }
 
         if (bits & MAIN_EVENT_SEND_AUDIO) {
-            while (auto packet = audio_service_.PopPacketFromSendQueue()) {
-                if (!protocol_->SendAudio(std::move(packet))) {
-                    break;
-                }
-            }
+            SendQueuedAudio();
         }
 
         if (bits & MAIN_EVENT_WAKE_WORD_DETECTED) {
@@ -631,9 +685,15 @@ void Application::OnWakeWordDetected() {
     }
 
     if (device_state_ == kDeviceStateIdle) {
+        // The wake word audio goes out in the frames of the session it opens
+        auto channel_lock = AcquireAudioChannel();
+        bool channel_opened = protocol_->IsAudioChannelOpened();
+        if (!channel_opened) {
+            SelectFrameDuration();
+        }
         audio_service_.EncodeWakeWord();
 
-        if (!protocol_->IsAudioChannelOpened()) {
+        if (!channel_opened) {
             SetDeviceState(kDeviceStateConnecting);
             if (!protocol_->OpenAudioChannel()) {
                 audio_service_.EnableWakeWordDetection(true);
@@ -646,7 +706,11 @@ void Application::OnWakeWordDetected() {
 #if CONFIG_USE_AFE_WAKE_WORD || CONFIG_USE_CUSTOM_WAKE_WORD
         // Encode and send the wake word data to the server
         while (auto packet = audio_service_.PopWakeWordPacket()) {
-            protocol_->SendAudio(std::move(packet));
+            // Wake word frames carry no stage times, they are recorded so the frame numbers stay in step
+            AUDIO_TRACE(LatencyTrace trace = packet->trace);
+            if (protocol_->SendAudio(std::move(packet))) {
+                AUDIO_TRACE(LatencyTracer::GetInstance().RecordUplink(trace, LatencyTracer::Now()));
+            }
         }
         // Set the chat state to wake word detected
         protocol_->SendWakeWordDetected(wake_word);
@@ -663,6 +727,116 @@ void Application::OnWakeWordDetected() {
     }
 }
 
+void Application::SendQueuedAudio() {
+    audio_service_.DropStaleSendPackets();
+    size_t queued = audio_service_.GetSendQueueSize();
+    if (queued == 0) {
+        return;
+    }
+
+    /* Coalesced frames wait for a full batch, the rest goes out once the microphone has stopped */
+    size_t frames_per_packet = audio_service_.GetUplinkFramesPerPacket(protocol_->audio_frames_per_packet());
+    bool flush = !audio_service_.IsAudioProcessorRunning();
+    while (queued >= frames_per_packet || (flush && queued > 0)) {
+        send_batch_.clear();
+        while (send_batch_.size() < frames_per_packet) {
+            auto packet = audio_service_.PopPacketFromSendQueue();
+            if (!packet) {
+                break;
+            }
+            send_batch_.push_back(std::move(packet));
+        }
+        bool sent = !send_batch_.empty() && protocol_->SendAudio(send_batch_);
+#if CONFIG_USE_AUDIO_LATENCY_TRACER
+        // Only frames that made it to the transport count as sent
+        if (sent) {
+            uint32_t send_us = LatencyTracer::Now();
+            for (auto& packet : send_batch_) {
+                LatencyTracer::GetInstance().RecordUplink(packet->trace, send_us);
+            }
+        }
+#endif
+        send_batch_.clear();
+        if (!sent) {
+            break;
+        }
+        queued = audio_service_.GetSendQueueSize();
+    }
+}
+
+void Application::SelectFrameDuration() {
+    int frame_duration = OPUS_FRAME_DURATION_MS;
+#if CONFIG_USE_LOW_LATENCY_FRAMES
+    // Realtime conversations get short frames end to end, the server answers in kind
+    if (aec_mode_ != kAecOff) {
+        frame_duration = audio_service_.AdaptUplinkFrameDuration(OPUS_MIN_FRAME_DURATION_MS);
+    }
+#endif
+    protocol_->SetFrameDuration(frame_duration);
+    audio_service_.SetUplinkFrameDuration(frame_duration);
+}
+
+// Called by the audio task on a speech onset while idle
+void Application::StartChannelWarmup() {
+#if CONFIG_USE_AUDIO_CHANNEL_PRECONNECT
+    if (!protocol_ || device_state_ != kDeviceStateIdle || protocol_->IsAudioChannelOpened()) {
+        return;
+    }
+    uint32_t attempt = warmup_.Begin(std::chrono::steady_clock::now());
+    if (attempt == 0) {
+        return;
+    }
+    // The handshake takes hundreds of milliseconds, the main loop keeps running meanwhile
+    if (xTaskCreate([](void* arg) {
+        auto app = (Application*)arg;
+        app->PreconnectAudioChannel();
+        vTaskDelete(NULL);
+    }, "preconnect", 4096 * 2, this, 2, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create pre-connect task");
+        warmup_.Finish(attempt, false, std::chrono::steady_clock::now());
+    }
+#endif
+}
+
+void Application::PreconnectAudioChannel() {
+#if CONFIG_USE_AUDIO_CHANNEL_PRECONNECT
+    std::lock_guard<std::mutex> lock(audio_channel_mutex_);
+    // A session may have taken the channel over before the task got the lock
+    uint32_t attempt = warmup_.owner();
+    if (attempt == 0) {
+        return;
+    }
+    if (device_state_ != kDeviceStateIdle || protocol_->IsAudioChannelOpened()) {
+        warmup_.Finish(attempt, false, std::chrono::steady_clock::now());
+        return;
+    }
+
+    /* The handshake and the server hello overlap with the rest of the wake word */
+    ESP_LOGI(TAG, "Speech detected, pre-connecting audio channel");
+    auto start = std::chrono::steady_clock::now();
+    SelectFrameDuration();
+    bool opened = protocol_->OpenAudioChannel();
+    auto now = std::chrono::steady_clock::now();
+    warmup_.Finish(attempt, opened, now);
+    if (opened) {
+        ESP_LOGI(TAG, "Audio channel pre-connected in %d ms",
+            (int)std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count());
+    }
+#endif
+}
+
+// For a session about to use the audio channel: waits for a pre-connect in progress and takes over its channel
+std::unique_lock<std::mutex> Application::AcquireAudioChannel() {
+    std::unique_lock<std::mutex> lock(audio_channel_mutex_);
+#if CONFIG_USE_AUDIO_CHANNEL_PRECONNECT
+    int saved_ms = warmup_.Claim();
+    if (saved_ms >= 0 && protocol_->IsAudioChannelOpened()) {
+        ESP_LOGI(TAG, "Using pre-connected audio channel, saved %d ms of handshake", saved_ms);
+    }
+#endif
+    return lock;
+}
+
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
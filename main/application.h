@@ -11,8 +11,10 @@
 #include <deque>
 #include <vector>
 #include <memory>
+#include <chrono>
 
 #include "protocol.h"
+#include "channel_warmup.h"
 #include "ota.h"
 #include "audio_service.h"
 #include "device_state_event.h"
@@ -83,11 +85,23 @@ private:
     bool has_server_time_ = false;
     bool aborted_ = false;
     int clock_ticks_ = 0;
+    std::vector<std::unique_ptr<AudioStreamPacket>> send_batch_;
     TaskHandle_t check_new_version_task_handle_ = nullptr;
 
     bool ble_wifi_config_enabled_ = true;
 
+    // Held while the audio channel is opened, the warm-up task opens it off the main loop
+    std::mutex audio_channel_mutex_;
+#if CONFIG_USE_AUDIO_CHANNEL_PRECONNECT
+    ChannelWarmup warmup_{std::chrono::seconds(CONFIG_AUDIO_CHANNEL_WARM_TTL_SECONDS)};
+#endif
+
     void OnWakeWordDetected();
+    void StartChannelWarmup();
+    void PreconnectAudioChannel();
+    std::unique_lock<std::mutex> AcquireAudioChannel();
+    void SelectFrameDuration();
+    void SendQueuedAudio();
     void CheckNewVersion(Ota& ota);
     void ShowActivationCode(const std::string& code, const std::string& message);
     void OnClockTimer();
@@ -0,0 +1,181 @@
+#include "audio_frame.h"
+
+#include <sdkconfig.h>
+#include <esp_log.h>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstring>
+
+#if CONFIG_IDF_TARGET_ESP32S3 && __has_include(<dsps_dotprod.h>)
+#include <dsps_dotprod.h>
+#define AUDIO_FRAME_USE_ESP_DSP 1
+#else
+#define AUDIO_FRAME_USE_ESP_DSP 0
+#endif
+
+#define TAG "AudioFrame"
+
+// Prototype filter length per unit of max(up, down), ~60dB stopband with the Kaiser window below
+#define RESAMPLER_TAPS_PER_RATIO 40
+#define RESAMPLER_KAISER_BETA 6.0
+// Cutoff relative to the lower of the two sample rates
+#define RESAMPLER_CUTOFF 0.475
+
+void AudioFrameExtractChannel(const int16_t* in, size_t frames, int channels, int channel, int16_t* out) {
+    // Reads stay ahead of writes, so the copy is safe in place
+    const int16_t* src = in + channel;
+    for (size_t i = 0; i < frames; i++) {
+        out[i] = *src;
+        src += channels;
+    }
+}
+
+// Rounds like dsps_dotprod_s16(shift = 0) and saturates the result
+static inline int16_t DotProduct(const int16_t* x, const int16_t* h, int length) {
+    int32_t acc = 0x7fff;
+    for (int i = 0; i < length; i++) {
+        acc += static_cast<int32_t>(x[i]) * h[i];
+    }
+    return static_cast<int16_t>(std::clamp<int32_t>(acc >> 15, INT16_MIN, INT16_MAX));
+}
+
+#if AUDIO_FRAME_USE_ESP_DSP
+// dsps_dotprod_s16 wraps instead of saturating, only for blocks whose peak cannot reach the int16 limits
+static inline int16_t DotProductFast(const int16_t* x, const int16_t* h, int length) {
+    int16_t result;
+    dsps_dotprod_s16(x, h, &result, length, 0);
+    return result;
+}
+#endif
+
+static double BesselI0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+void AudioFrameResampler::Configure(int input_sample_rate, int output_sample_rate, int channels, size_t max_input_frames) {
+    int divisor = std::gcd(input_sample_rate, output_sample_rate);
+    up_ = output_sample_rate / divisor;
+    down_ = input_sample_rate / divisor;
+    channels_ = channels;
+    position_ = 0;
+
+    // Round up to a multiple of 8 taps per phase, the SIMD dot product works on 8 samples at a time
+    int length = RESAMPLER_TAPS_PER_RATIO * std::max(up_, down_);
+    taps_ = ((length + up_ - 1) / up_ + 7) & ~7;
+    length = taps_ * up_;
+
+    // Windowed sinc at the upsampled rate, with a gain of up_ to make up for the zero stuffing
+    double cutoff = RESAMPLER_CUTOFF * std::min(input_sample_rate, output_sample_rate) / (input_sample_rate * (double)up_);
+    double center = (length - 1) / 2.0;
+    double window_norm = BesselI0(RESAMPLER_KAISER_BETA);
+    std::vector<double> prototype(length);
+    for (int n = 0; n < length; n++) {
+        double t = n - center;
+        double sinc = t == 0 ? 2.0 * cutoff : std::sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+        double r = t / (center + 1.0);
+        double window = BesselI0(RESAMPLER_KAISER_BETA * std::sqrt(std::max(0.0, 1.0 - r * r))) / window_norm;
+        prototype[n] = sinc * window * up_;
+    }
+
+    // Normalize every phase to the same DC gain
+    coefficients_.assign(up_ * taps_, 0);
+    for (int p = 0; p < up_; p++) {
+        double sum = 0;
+        for (int t = 0; t < taps_; t++) {
+            sum += prototype[p + t * up_];
+        }
+        for (int t = 0; t < taps_; t++) {
+            // Reversed, coefficient j multiplies the input sample (taps_ - 1 - j) frames back
+            double value = prototype[p + t * up_] / sum * 32767.0;
+            coefficients_[p * taps_ + (taps_ - 1 - t)] = static_cast<int16_t>(std::lround(value));
+        }
+    }
+
+    // Largest possible |output| for a full scale input, the ripple of the sinc makes it exceed unity gain
+    max_l1_norm_ = 0;
+    for (int p = 0; p < up_; p++) {
+        int32_t norm = 0;
+        for (int t = 0; t < taps_; t++) {
+            norm += std::abs(coefficients_[p * taps_ + t]);
+        }
+        max_l1_norm_ = std::max(max_l1_norm_, norm);
+    }
+
+    history_.assign(channels_, std::vector<int16_t>());
+    for (auto& history : history_) {
+        history.assign(taps_ - 1, 0);
+        history.reserve(taps_ - 1 + max_input_frames);
+    }
+    ESP_LOGI(TAG, "Resampler %d -> %d Hz, %d channels, %d taps x %d phases%s", input_sample_rate, output_sample_rate,
+        channels_, taps_, up_, AUDIO_FRAME_USE_ESP_DSP ? " (esp-dsp)" : "");
+}
+
+size_t AudioFrameResampler::GetOutputFrames(size_t input_frames) const {
+    return (input_frames * up_ + down_ - 1) / down_ + 1;
+}
+
+size_t AudioFrameResampler::Process(const int16_t* in, size_t input_frames, int16_t* out, bool mono_output) {
+    // Deinterleave the input once, appending each channel after its history
+    for (int c = 0; c < channels_; c++) {
+        auto& history = history_[c];
+        history.resize(taps_ - 1 + input_frames);
+        int16_t* dst = history.data() + taps_ - 1;
+        if (channels_ == 1) {
+            memcpy(dst, in, input_frames * sizeof(int16_t));
+        } else {
+            const int16_t* src = in + c;
+            for (size_t i = 0; i < input_frames; i++) {
+                dst[i] = *src;
+                src += channels_;
+            }
+        }
+    }
+
+    // The input is fully copied, so `out` is free to overwrite it
+    int output_channels = mono_output ? 1 : channels_;
+#if AUDIO_FRAME_USE_ESP_DSP
+    // Loud blocks that could clip take the saturating path, so both paths always produce the same samples
+    int32_t peak = 0;
+    for (int c = 0; c < output_channels; c++) {
+        for (int16_t sample : history_[c]) {
+            peak = std::max(peak, std::abs(static_cast<int32_t>(sample)));
+        }
+    }
+    bool fast = (static_cast<int64_t>(peak) * max_l1_norm_ + 0x7fff) >> 15 < INT16_MAX;
+#endif
+    size_t output_frames = 0;
+    size_t limit = input_frames * up_;
+    while (static_cast<size_t>(position_) < limit) {
+        int index = position_ / up_;
+        const int16_t* h = coefficients_.data() + (position_ % up_) * taps_;
+        for (int c = 0; c < output_channels; c++) {
+#if AUDIO_FRAME_USE_ESP_DSP
+            if (fast) {
+                out[output_frames * output_channels + c] = DotProductFast(history_[c].data() + index, h, taps_);
+                continue;
+            }
+#endif
+            out[output_frames * output_channels + c] = DotProduct(history_[c].data() + index, h, taps_);
+        }
+        output_frames++;
+        position_ += down_;
+    }
+    position_ -= limit;
+
+    // Keep the last taps_ - 1 frames for the next block
+    for (auto& history : history_) {
+        std::copy(history.end() - (taps_ - 1), history.end(), history.begin());
+        history.resize(taps_ - 1);
+    }
+    return output_frames;
+}
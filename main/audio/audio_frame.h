@@ -0,0 +1,52 @@
+#ifndef AUDIO_FRAME_H
+#define AUDIO_FRAME_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Frame level DSP helpers for interleaved int16 PCM.
+ *
+ * AudioFrameResampler is a polyphase FIR resampler that works directly on interleaved N-channel
+ * frames: the input is deinterleaved once into per-channel history, then every output frame is
+ * one dot product per channel, written either interleaved or as mono (channel 0 only).
+ *
+ * The filter has unity passband gain. The dot product has a portable scalar implementation that
+ * saturates, and on ESP32-S3 with esp-dsp available, uses the optimized dsps_dotprod_s16 for blocks
+ * whose peak cannot clip, so both produce the same samples.
+ */
+
+// Copy one channel out of interleaved PCM. `out` may be the same buffer as `in`.
+void AudioFrameExtractChannel(const int16_t* in, size_t frames, int channels, int channel, int16_t* out);
+
+class AudioFrameResampler {
+public:
+    void Configure(int input_sample_rate, int output_sample_rate, int channels, size_t max_input_frames = 0);
+
+    // Upper bound of output frames for `input_frames` input frames
+    size_t GetOutputFrames(size_t input_frames) const;
+
+    // Resample `input_frames` interleaved frames. `out` may be the same buffer as `in`, as long as it holds
+    // GetOutputFrames() frames. Returns the number of output frames written.
+    size_t Process(const int16_t* in, size_t input_frames, int16_t* out, bool mono_output = false);
+
+    inline bool configured() const { return up_ > 0; }
+    inline int channels() const { return channels_; }
+
+private:
+    int channels_ = 0;
+    int up_ = 0;
+    int down_ = 0;
+    int taps_ = 0;
+    // Next output position in upsampled units, relative to the first input frame of the next block
+    int position_ = 0;
+    // Largest sum of |coefficient| over the phases, bounds the output for a given input peak
+    int32_t max_l1_norm_ = 0;
+    // up_ phases of taps_ coefficients (Q15), stored reversed so each output is a contiguous dot product
+    std::vector<int16_t> coefficients_;
+    // Per channel: taps_ - 1 frames of history followed by the current block
+    std::vector<std::vector<int16_t>> history_;
+};
+
+#endif // AUDIO_FRAME_H
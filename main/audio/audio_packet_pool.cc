@@ -0,0 +1,49 @@
+#include "audio_packet_pool.h"
+
+void AudioPacketPool::Initialize(size_t max_free_packets) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_free_packets_ = max_free_packets;
+    free_packets_.reserve(max_free_packets_);
+}
+
+std::unique_ptr<AudioStreamPacket> AudioPacketPool::Acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stats_.acquired++;
+    if (free_packets_.empty()) {
+        stats_.heap_allocations++;
+        lock.unlock();
+        return std::make_unique<AudioStreamPacket>();
+    }
+    auto packet = std::move(free_packets_.back());
+    free_packets_.pop_back();
+    stats_.free = free_packets_.size();
+    lock.unlock();
+
+    // Everything but the payload capacity starts over
+    packet->sample_rate = 0;
+    packet->frame_duration = 0;
+    packet->timestamp = 0;
+    packet->sequence = 0;
+    packet->payload.clear();
+#if CONFIG_USE_AUDIO_LATENCY_TRACER
+    packet->trace = {};
+#endif
+    return packet;
+}
+
+void AudioPacketPool::Release(std::unique_ptr<AudioStreamPacket> packet) {
+    if (!packet) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.released++;
+    if (free_packets_.size() < max_free_packets_) {
+        free_packets_.push_back(std::move(packet));
+        stats_.free = free_packets_.size();
+    }
+}
+
+AudioPacketPoolStats AudioPacketPool::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
@@ -0,0 +1,48 @@
+#ifndef AUDIO_PACKET_POOL_H
+#define AUDIO_PACKET_POOL_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+#include "protocol.h"
+
+struct AudioPacketPoolStats {
+    uint32_t free = 0;
+    uint32_t acquired = 0;
+    uint32_t released = 0;
+    // Packets created because the free list was empty, stays constant once the downlink reached its peak rate
+    uint32_t heap_allocations = 0;
+};
+
+/*
+ * Free list of incoming audio packets. A packet given back with Release() keeps its payload capacity,
+ * so the next frame of a similar size is received without touching the heap.
+ * Packets that are dropped instead (late, duplicated, flushed) are simply freed, Acquire() creates a new one when it runs dry.
+ */
+class AudioPacketPool {
+public:
+    static AudioPacketPool& GetInstance() {
+        static AudioPacketPool instance;
+        return instance;
+    }
+    AudioPacketPool(const AudioPacketPool&) = delete;
+    AudioPacketPool& operator=(const AudioPacketPool&) = delete;
+
+    void Initialize(size_t max_free_packets);
+    std::unique_ptr<AudioStreamPacket> Acquire();
+    void Release(std::unique_ptr<AudioStreamPacket> packet);
+    AudioPacketPoolStats GetStats();
+
+private:
+    AudioPacketPool() = default;
+
+    std::mutex mutex_;
+    size_t max_free_packets_ = 0;
+    std::vector<std::unique_ptr<AudioStreamPacket>> free_packets_;
+    AudioPacketPoolStats stats_;
+};
+
+#endif // AUDIO_PACKET_POOL_H
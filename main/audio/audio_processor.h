@@ -12,11 +12,15 @@ public:
     virtual ~AudioProcessor() = default;
     
     virtual void Initialize(AudioCodec* codec, int frame_duration_ms) = 0;
-    virtual void Feed(std::vector<int16_t>&& data) = 0;
+    // Only called while stopped
+    virtual void SetFrameDuration(int frame_duration_ms) = 0;
+    // Works on the caller's buffer, which may be modified in place but keeps its storage
+    virtual void Feed(std::vector<int16_t>& data) = 0;
     virtual void Start() = 0;
     virtual void Stop() = 0;
     virtual bool IsRunning() = 0;
-    virtual void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) = 0;
+    // The callback copies what it keeps, the processor reuses the buffer for the next frame
+    virtual void OnOutput(std::function<void(const std::vector<int16_t>& data)> callback) = 0;
     virtual void OnVadStateChange(std::function<void(bool speaking)> callback) = 0;
     virtual size_t GetFeedSize() = 0;
     virtual void EnableDeviceAec(bool enable) = 0;
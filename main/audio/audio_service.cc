@@ -1,6 +1,7 @@
 #include "audio_service.h"
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -18,6 +19,40 @@
 
 #define TAG "AudioService"
 
+// Duration of an Opus packet from its TOC byte (RFC 6716, section 3.1), rounded up to whole milliseconds
+static int OpusPacketDurationMs(std::string_view packet) {
+    if (packet.empty()) {
+        return OPUS_FRAME_DURATION_MS;
+    }
+    uint8_t toc = packet[0];
+    int config = toc >> 3;
+    // Frame sizes in 1/10 ms: SILK, hybrid, CELT
+    int frame_tenths;
+    if (config < 12) {
+        static const int silk[] = {100, 200, 400, 600};
+        frame_tenths = silk[config & 3];
+    } else if (config < 16) {
+        frame_tenths = (config & 1) ? 200 : 100;
+    } else {
+        static const int celt[] = {25, 50, 100, 200};
+        frame_tenths = celt[config & 3];
+    }
+    int frames;
+    switch (toc & 3) {
+        case 0:
+            frames = 1;
+            break;
+        case 3:
+            frames = packet.size() > 1 ? std::max(packet[1] & 0x3f, 1) : 1;
+            break;
+        default:
+            frames = 2;
+            break;
+    }
+    // A packet holds at most 120 ms
+    return std::min((frame_tenths * frames + 9) / 10, 120);
+}
+
 
 AudioService::AudioService() {
     event_group_ = xEventGroupCreate();
@@ -40,10 +75,23 @@ void AudioService::Initialize(AudioCodec* codec) {
     opus_encoder_->SetComplexity(0);
 
     if (codec->input_sample_rate() != 16000) {
-        input_resampler_.Configure(codec->input_sample_rate(), 16000);
-        reference_resampler_.Configure(codec->input_sample_rate(), 16000);
+        // Mic and reference channels are resampled together, straight from the interleaved codec frame
+        input_resampler_.Configure(codec->input_sample_rate(), 16000, codec->input_channels(),
+            codec->input_sample_rate() * OPUS_FRAME_DURATION_MS / 1000);
     }
 
+    /* A pooled frame must hold one raw input frame or one decoded (and resampled) output frame */
+    size_t input_frame_samples = std::max(codec->input_sample_rate(), 16000) * OPUS_FRAME_DURATION_MS / 1000 * codec->input_channels();
+    size_t output_frame_samples = std::max(codec->output_sample_rate(), 24000) * OPUS_FRAME_DURATION_MS / 1000;
+    pcm_frame_pool_.Initialize(PCM_FRAME_POOL_SIZE, std::max(input_frame_samples, output_frame_samples));
+    /* Incoming packets are recycled after decoding, enough for a full jitter buffer of the shortest frames */
+    AudioPacketPool::GetInstance().Initialize(MAX_PACKETS_IN_DURATION(MAX_DECODE_QUEUE_DURATION_MS) + 2);
+    audio_send_queue_.SetLimit(MAX_SEND_QUEUE_DURATION_MS / uplink_frame_duration_ms_);
+
+#if CONFIG_USE_SOUND_CACHE
+    sound_cache_.Initialize(CONFIG_SOUND_CACHE_SIZE_KB * 1024);
+#endif
+
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_ = std::make_unique<AfeAudioProcessor>();
 #else
@@ -60,8 +108,8 @@ void AudioService::Initialize(AudioCodec* codec) {
     wake_word_ = nullptr;
 #endif
 
-    audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data));
+    audio_processor_->OnOutput([this](const std::vector<int16_t>& data) {
+        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, data);
     });
 
     audio_processor_->OnVadStateChange([this](bool speaking) {
@@ -77,6 +125,11 @@ void AudioService::Initialize(AudioCodec* codec) {
                 callbacks_.on_wake_word_detected(wake_word);
             }
         });
+        wake_word_->OnSpeechDetected([this]() {
+            if (callbacks_.on_wake_word_speech) {
+                callbacks_.on_wake_word_speech();
+            }
+        });
     }
 
     esp_timer_create_args_t audio_power_timer_args = {
@@ -128,12 +181,28 @@ void AudioService::Start() {
     }, "audio_output", 2048, this, 3, &audio_output_task_handle_);
 #endif
 
+#if CONFIG_USE_SPLIT_OPUS_CODEC_TASKS
+    /* Start the opus encoder and decoder tasks, the encoder needs most of the stack */
+    uplink_first_ = false;
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusEncodeTask();
+        vTaskDelete(NULL);
+    }, "opus_encode", 2048 * 12, this, OPUS_CODEC_TASK_PRIORITY, &opus_encode_task_handle_, OPUS_ENCODE_TASK_CORE);
+
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusDecodeTask();
+        vTaskDelete(NULL);
+    }, "opus_decode", 2048 * 6, this, OPUS_CODEC_TASK_PRIORITY_BOOST, &opus_decode_task_handle_, OPUS_DECODE_TASK_CORE);
+#else
     /* Start the opus codec task */
     xTaskCreate([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
         audio_service->OpusCodecTask();
         vTaskDelete(NULL);
-    }, "opus_codec", 2048 * 13, this, 2, &opus_codec_task_handle_);
+    }, "opus_codec", 2048 * 13, this, OPUS_CODEC_TASK_PRIORITY, &opus_codec_task_handle_);
+#endif
 }
 
 void AudioService::Stop() {
@@ -143,15 +212,19 @@ void AudioService::Stop() {
         AS_EVENT_WAKE_WORD_RUNNING |
         AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    audio_encode_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(decode_queue_mutex_);
+        jitter_buffer_.Reset();
+    }
+    StopSounds();
+    audio_encode_queue_.RequestFlush();
+    audio_playback_queue_.RequestFlush();
+    audio_testing_queue_.RequestFlush();
+    /* Wake up every task blocked on a queue so it can see the service is stopped */
+    xEventGroupSetBits(event_group_, AS_EVENT_QUEUE_ALL);
 }
 
-bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
+bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples, bool mono) {
     if (!codec_->input_enabled()) {
         esp_timer_stop(audio_power_timer_);
         esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
@@ -163,32 +236,23 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
         if (!codec_->InputData(data)) {
             return false;
         }
-        if (codec_->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
-        } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+        size_t input_frames = data.size() / codec_->input_channels();
+        size_t output_frames = input_resampler_.GetOutputFrames(input_frames);
+        int output_channels = mono ? 1 : codec_->input_channels();
+        if (output_frames * output_channels > data.size()) {
+            data.resize(output_frames * output_channels);
         }
+        output_frames = input_resampler_.Process(data.data(), input_frames, data.data(), mono);
+        data.resize(output_frames * output_channels);
     } else {
         data.resize(samples * codec_->input_channels());
         if (!codec_->InputData(data)) {
             return false;
         }
+        if (mono && codec_->input_channels() > 1) {
+            AudioFrameExtractChannel(data.data(), samples, codec_->input_channels(), 0, data.data());
+            data.resize(samples);
+        }
     }
 
     /* Update the last input time */
@@ -223,34 +287,32 @@ void AudioService::AudioInputTask() {
 
         /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
         if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
-            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+            if (audio_testing_queue_.Full()) {
                 ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
-                EnableAudioTesting(false);
+                // Only stop capturing here, the application drains the queue through EnableAudioTesting(false)
+                xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
+                if (callbacks_.on_audio_testing_queue_full) {
+                    callbacks_.on_audio_testing_queue_full();
+                }
                 continue;
             }
-            std::vector<int16_t> data;
+            auto frame = pcm_frame_pool_.Acquire();
+            auto& data = *frame;
             int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
-            if (ReadAudioData(data, 16000, samples)) {
-                // If input channels is 2, we need to fetch the left channel data
-                if (codec_->input_channels() == 2) {
-                    auto mono_data = std::vector<int16_t>(data.size() / 2);
-                    for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                        mono_data[i] = data[j];
-                    }
-                    data = std::move(mono_data);
-                }
-                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
+            // Only the mic channel is encoded
+            if (ReadAudioData(data, 16000, samples, true)) {
+                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(frame));
                 continue;
             }
         }
 
         /* Feed the wake word */
         if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
+            auto frame = pcm_frame_pool_.Acquire();
             int samples = wake_word_->GetFeedSize();
             if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
-                    wake_word_->Feed(data);
+                if (ReadAudioData(*frame, 16000, samples)) {
+                    wake_word_->Feed(*frame);
                     continue;
                 }
             }
@@ -258,11 +320,14 @@ void AudioService::AudioInputTask() {
 
         /* Feed the audio processor */
         if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
-            std::vector<int16_t> data;
+            auto frame = pcm_frame_pool_.Acquire();
             int samples = audio_processor_->GetFeedSize();
             if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
-                    audio_processor_->Feed(std::move(data));
+                if (ReadAudioData(*frame, 16000, samples)) {
+                    AUDIO_TRACE(LatencyTracer::GetInstance().MarkCaptured(samples));
+                    // Processors work on the pooled buffer and copy what they keep, the frame goes back to the
+                    // pool with its capacity afterwards
+                    audio_processor_->Feed(*frame);
                     continue;
                 }
             }
@@ -277,23 +342,27 @@ void AudioService::AudioInputTask() {
 
 void AudioService::AudioOutputTask() {
     while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() { return !audio_playback_queue_.empty() || service_stopped_; });
+        AudioTask task;
+        bool was_full = false;
+        bool popped = audio_playback_queue_.Pop(task, &was_full);
+        if (was_full) {
+            xEventGroupSetBits(event_group_, AS_EVENT_PLAYBACK_NOT_FULL);
+        }
         if (service_stopped_) {
             break;
         }
-
-        auto task = std::move(audio_playback_queue_.front());
-        audio_playback_queue_.pop_front();
-        audio_queue_cv_.notify_all();
-        lock.unlock();
+        if (!popped) {
+            xEventGroupWaitBits(event_group_, AS_EVENT_PLAYBACK_NOT_EMPTY, pdTRUE, pdFALSE, portMAX_DELAY);
+            continue;
+        }
 
         if (!codec_->output_enabled()) {
             esp_timer_stop(audio_power_timer_);
             esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
             codec_->EnableOutput(true);
         }
-        codec_->OutputData(task->pcm);
+        codec_->OutputData(*task.pcm);
+        AUDIO_TRACE(LatencyTracer::GetInstance().RecordDownlink(task.trace, LatencyTracer::Now()));
 
         /* Update the last output time */
         last_output_time_ = std::chrono::steady_clock::now();
@@ -301,9 +370,9 @@ void AudioService::AudioOutputTask() {
 
 #if CONFIG_USE_SERVER_AEC
         /* Record the timestamp for server AEC */
-        if (task->timestamp > 0) {
-            lock.lock();
-            timestamp_queue_.push_back(task->timestamp);
+        if (task.timestamp > 0) {
+            std::lock_guard<std::mutex> lock(timestamp_mutex_);
+            timestamp_queue_.push_back(task.timestamp);
         }
 #endif
     }
@@ -313,81 +382,262 @@ void AudioService::AudioOutputTask() {
 
 void AudioService::OpusCodecTask() {
     while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() {
-            return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
-                (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
-        });
         if (service_stopped_) {
             break;
         }
+        int decode_wait_ms = -1;
+        bool busy = DecodeFrame(decode_wait_ms);
+        busy = EncodeFrame() || busy;
+
+        if (!busy) {
+            /* The jitter buffer may hold packets back for a while, come back when it is time to release them */
+            TickType_t timeout = decode_wait_ms >= 0 ? pdMS_TO_TICKS(decode_wait_ms) + 1 : portMAX_DELAY;
+            xEventGroupWaitBits(event_group_, AS_EVENT_DECODE_NOT_EMPTY | AS_EVENT_PLAYBACK_NOT_FULL |
+                AS_EVENT_ENCODE_NOT_EMPTY | AS_EVENT_SEND_NOT_FULL, pdTRUE, pdFALSE, timeout);
+        }
+    }
 
-        /* Decode the audio from decode queue */
-        if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
-            auto packet = std::move(audio_decode_queue_.front());
-            audio_decode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
+    ESP_LOGW(TAG, "Opus codec task stopped");
+}
 
-            auto task = std::make_unique<AudioTask>();
-            task->type = kAudioTaskTypeDecodeToPlaybackQueue;
-            task->timestamp = packet->timestamp;
-
-            SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-            if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
-                // Resample if the sample rate is different
-                if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
-                    int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
-                    std::vector<int16_t> resampled(target_size);
-                    output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
-                    task->pcm = std::move(resampled);
-                }
+void AudioService::OpusEncodeTask() {
+    while (true) {
+        if (service_stopped_) {
+            break;
+        }
+        UpdateCodecPriorities();
+        if (!EncodeFrame()) {
+            xEventGroupWaitBits(event_group_, AS_EVENT_ENCODE_NOT_EMPTY | AS_EVENT_SEND_NOT_FULL, pdTRUE, pdFALSE, portMAX_DELAY);
+        }
+    }
 
-                lock.lock();
-                audio_playback_queue_.push_back(std::move(task));
-                audio_queue_cv_.notify_all();
-            } else {
-                ESP_LOGE(TAG, "Failed to decode audio");
-                lock.lock();
-            }
-            debug_statistics_.decode_count++;
-        }
-        
-        /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
-            auto task = std::move(audio_encode_queue_.front());
-            audio_encode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
+    ESP_LOGW(TAG, "Opus encode task stopped");
+}
 
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->frame_duration = OPUS_FRAME_DURATION_MS;
-            packet->sample_rate = 16000;
-            packet->timestamp = task->timestamp;
-            if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
-                ESP_LOGE(TAG, "Failed to encode audio");
-                continue;
-            }
+void AudioService::OpusDecodeTask() {
+    while (true) {
+        if (service_stopped_) {
+            break;
+        }
+        UpdateCodecPriorities();
+        int decode_wait_ms = -1;
+        if (!DecodeFrame(decode_wait_ms)) {
+            TickType_t timeout = decode_wait_ms >= 0 ? pdMS_TO_TICKS(decode_wait_ms) + 1 : portMAX_DELAY;
+            xEventGroupWaitBits(event_group_, AS_EVENT_DECODE_NOT_EMPTY | AS_EVENT_PLAYBACK_NOT_FULL, pdTRUE, pdFALSE, timeout);
+        }
+    }
 
-            if (task->type == kAudioTaskTypeEncodeToSendQueue) {
-                {
-                    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                    audio_send_queue_.push_back(std::move(packet));
-                }
-                if (callbacks_.on_send_queue_available) {
-                    callbacks_.on_send_queue_available();
-                }
-            } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
-                std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                audio_testing_queue_.push_back(std::move(packet));
+    ESP_LOGW(TAG, "Opus decode task stopped");
+}
+
+void AudioService::UpdateCodecPriorities() {
+    /*
+     * Uplink first while listening (also in realtime mode, so the user can barge in), downlink first while speaking.
+     * A full encode queue means the input task is about to block, the encoder goes first whatever the state.
+     * The state is read under the lock, so the task that applies last also decided last.
+     */
+    std::lock_guard<std::mutex> lock(codec_priority_mutex_);
+    bool uplink_first = IsAudioProcessorRunning() || audio_encode_queue_.Full();
+    if (uplink_first_.exchange(uplink_first) == uplink_first) {
+        return;
+    }
+    vTaskPrioritySet(opus_encode_task_handle_, uplink_first ? OPUS_CODEC_TASK_PRIORITY_BOOST : OPUS_CODEC_TASK_PRIORITY);
+    vTaskPrioritySet(opus_decode_task_handle_, uplink_first ? OPUS_CODEC_TASK_PRIORITY : OPUS_CODEC_TASK_PRIORITY_BOOST);
+}
+
+bool AudioService::DecodeFrame(int& decode_wait_ms) {
+    if (audio_playback_queue_.Full()) {
+        return false;
+    }
+
+    /* A sound that is due goes first, then the jitter buffer, where an empty payload conceals a lost packet */
+    int64_t start_us = esp_timer_get_time();
+    uint32_t decode_released;
+    {
+        std::lock_guard<std::mutex> lock(decode_queue_mutex_);
+        decode_released = jitter_buffer_.released();
+    }
+    if (!PlaySoundFrame(decode_released)) {
+        std::unique_ptr<AudioStreamPacket> packet;
+        auto result = PopPacketFromDecodeQueue(packet, decode_wait_ms);
+        if (result != kJitterBufferPacket && result != kJitterBufferLost) {
+            return false;
+        }
+        DecodeToPlaybackQueue(*packet);
+        AudioPacketPool::GetInstance().Release(std::move(packet));
+    }
+
+    /* A frame that takes longer than its own duration lets the speaker run dry */
+    if (esp_timer_get_time() - start_us > opus_decoder_->duration_ms() * 1000) {
+        debug_statistics_.decode_deadline_misses++;
+    }
+    uint32_t playback_queue_size = audio_playback_queue_.Size();
+    if (playback_queue_size > debug_statistics_.max_playback_queue_size) {
+        debug_statistics_.max_playback_queue_size = playback_queue_size;
+    }
+    return true;
+}
+
+bool AudioService::UpdateUplinkStall() {
+    bool full = audio_send_queue_.Full();
+    if (full && !uplink_stalled_) {
+        uplink_stalled_ = true;
+        uplink_stall_start_us_ = esp_timer_get_time();
+        debug_statistics_.uplink_stalls++;
+        ESP_LOGW(TAG, "Uplink stalled, %u packets waiting to be sent", (unsigned)audio_send_queue_.Size());
+    } else if (!full && uplink_stalled_) {
+        uplink_stalled_ = false;
+        debug_statistics_.uplink_stall_ms += (esp_timer_get_time() - uplink_stall_start_us_) / 1000;
+    }
+    return full;
+}
+
+bool AudioService::EncodeFrame() {
+    /* Encode the audio to send queue */
+    bool send_queue_full = UpdateUplinkStall();
+#if CONFIG_UPLINK_OVERFLOW_PAUSE_ENCODE
+    // Queued audio is kept, frames captured meanwhile are dropped by PushTaskToEncodeQueue
+    if (send_queue_full) {
+        return false;
+    }
+#else
+    (void)send_queue_full;
+#endif
+    AudioTask task;
+    if (!audio_encode_queue_.Pop(task)) {
+        return false;
+    }
+    if (task.type == kAudioTaskTypeEncodeToSendQueue &&
+        ShouldDropUplinkFrame(UPLINK_OVERFLOW_POLICY, audio_send_queue_.Size(), audio_send_queue_.limit(), task.voice)) {
+        debug_statistics_.overflow_drops++;
+        return true;
+    }
+
+    /* Frames queued before a new session frame duration are encoded as they are */
+    int frame_duration = task.pcm->size() * 1000 / 16000;
+    if (frame_duration != opus_encoder_->duration_ms()) {
+        SetEncodeFrameDuration(frame_duration);
+    }
+
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->frame_duration = frame_duration;
+    packet->sample_rate = 16000;
+    packet->timestamp = task.timestamp;
+    AUDIO_TRACE(packet->trace = task.trace);
+    AUDIO_TRACE(packet->trace.encode_start_us = LatencyTracer::Now());
+#if CONFIG_USE_ADAPTIVE_UPLINK
+    // Only the uplink controller looks at the encode time
+    int64_t encode_start_us = esp_timer_get_time();
+#endif
+    if (opus_encoder_->Encode(std::move(*task.pcm), packet->payload)) {
+        AUDIO_TRACE(packet->trace.encode_end_us = LatencyTracer::Now());
+        int64_t encode_end_us = esp_timer_get_time();
+        bool deadline_missed = encode_end_us > task.deadline_us;
+        if (deadline_missed) {
+            debug_statistics_.encode_deadline_misses++;
+        }
+        if (task.type == kAudioTaskTypeEncodeToSendQueue) {
+            audio_send_queue_.Push(std::move(packet));
+#if CONFIG_USE_ADAPTIVE_UPLINK
+            UplinkSample sample = {
+                .queued_frames = audio_send_queue_.Size(),
+                .encode_us = encode_end_us - encode_start_us,
+                .frame_us = frame_duration * 1000,
+                .deadline_missed = deadline_missed,
+                .max_frames_per_packet = uplink_max_frames_per_packet_,
+            };
+            if (uplink_controller_.Update(sample)) {
+                auto& settings = uplink_controller_.settings();
+                // Opus packets describe themselves, the server needs no notice of the new complexity
+                opus_encoder_->SetComplexity(settings.complexity);
+                uplink_congested_ = uplink_controller_.congested();
+                ESP_LOGI(TAG, "Uplink %s, complexity %d, encode load %lu%%", uplink_congested_ ? "congested" : "clear",
+                    settings.complexity, uplink_controller_.stats().encode_load_percent);
+            }
+            uplink_overloaded_ = uplink_controller_.overloaded();
+#endif
+            if (callbacks_.on_send_queue_available) {
+                callbacks_.on_send_queue_available();
             }
-            debug_statistics_.encode_count++;
-            lock.lock();
+        } else if (task.type == kAudioTaskTypeEncodeToTestingQueue) {
+            audio_testing_queue_.Push(std::move(packet));
         }
+        debug_statistics_.encode_count++;
+    } else {
+        ESP_LOGE(TAG, "Failed to encode audio");
     }
+    return true;
+}
 
-    ESP_LOGW(TAG, "Opus codec task stopped");
+void AudioService::DecodeToPlaybackQueue(AudioStreamPacket& packet, std::vector<int16_t>* capture) {
+    AudioTask task;
+    task.type = kAudioTaskTypeDecodeToPlaybackQueue;
+    task.timestamp = packet.timestamp;
+    task.pcm = pcm_frame_pool_.Acquire();
+    AUDIO_TRACE(task.trace = packet.trace);
+    AUDIO_TRACE(task.trace.decode_start_us = LatencyTracer::Now());
+
+    SetDecodeSampleRate(packet.sample_rate, packet.frame_duration);
+    if (opus_decoder_->Decode(std::move(packet.payload), *task.pcm)) {
+        AUDIO_TRACE(task.trace.decode_end_us = LatencyTracer::Now());
+        // Resample if the sample rate is different
+        if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
+            auto resampled = pcm_frame_pool_.Acquire();
+            resampled->resize(output_resampler_.GetOutputSamples(task.pcm->size()));
+            output_resampler_.Process(task.pcm->data(), task.pcm->size(), resampled->data());
+            task.pcm = std::move(resampled);
+        }
+        if (capture != nullptr) {
+            capture->insert(capture->end(), task.pcm->begin(), task.pcm->end());
+        }
+
+        bool was_empty = false;
+        audio_playback_queue_.Push(std::move(task), &was_empty);
+        if (was_empty) {
+            xEventGroupSetBits(event_group_, AS_EVENT_PLAYBACK_NOT_EMPTY);
+        }
+    } else {
+        ESP_LOGE(TAG, "Failed to decode audio");
+    }
+    debug_statistics_.decode_count++;
+}
+
+void AudioService::SetEncodeFrameDuration(int frame_duration) {
+    ESP_LOGI(TAG, "Encoding %d ms frames", frame_duration);
+    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, frame_duration);
+#if CONFIG_USE_ADAPTIVE_UPLINK
+    opus_encoder_->SetComplexity(uplink_controller_.settings().complexity);
+#else
+    opus_encoder_->SetComplexity(0);
+#endif
+}
+
+int AudioService::AdaptUplinkFrameDuration(int frame_duration_ms) {
+#if CONFIG_USE_ADAPTIVE_UPLINK
+    // Short frames cost two to three times the packets and CPU, the next session probes them again once clear
+    if (frame_duration_ms < OPUS_FRAME_DURATION_MS && (uplink_congested_ || uplink_overloaded_)) {
+        ESP_LOGW(TAG, "Uplink %s, using %d ms frames instead of %d ms", uplink_congested_ ? "congested" : "overloaded",
+            OPUS_FRAME_DURATION_MS, frame_duration_ms);
+        return OPUS_FRAME_DURATION_MS;
+    }
+#endif
+    return frame_duration_ms;
+}
+
+void AudioService::SetUplinkFrameDuration(int frame_duration_ms) {
+    if (frame_duration_ms == uplink_frame_duration_ms_) {
+        return;
+    }
+    if (IsAudioProcessorRunning()) {
+        ESP_LOGW(TAG, "Cannot change the frame duration while voice processing is on");
+        return;
+    }
+    ESP_LOGI(TAG, "Uplink frame duration: %d ms", frame_duration_ms);
+    uplink_frame_duration_ms_ = frame_duration_ms;
+    audio_send_queue_.SetLimit(MAX_SEND_QUEUE_DURATION_MS / frame_duration_ms);
+    if (audio_processor_initialized_) {
+        audio_processor_->SetFrameDuration(frame_duration_ms);
+    }
 }
 
 void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
@@ -398,64 +648,131 @@ void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
     opus_decoder_.reset();
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
 
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+    if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
+        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec_->output_sample_rate());
+        output_resampler_.Configure(opus_decoder_->sample_rate(), codec_->output_sample_rate());
     }
 }
 
-void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
-    auto task = std::make_unique<AudioTask>();
-    task->type = type;
-    task->pcm = std::move(pcm);
-    
-    /* Push the task to the encode queue */
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
+void AudioService::PushTaskToEncodeQueue(AudioTaskType type, const std::vector<int16_t>& pcm) {
+    /* Copy into a pooled frame, so the caller keeps its buffer (and its capacity) for the next frame */
+    auto frame = pcm_frame_pool_.Acquire();
+    frame->assign(pcm.begin(), pcm.end());
+    PushTaskToEncodeQueue(type, std::move(frame));
+}
+
+void AudioService::PushTaskToEncodeQueue(AudioTaskType type, PcmFrame&& pcm) {
+    AudioTask task;
+    task.type = type;
+#if CONFIG_USE_AUDIO_PROCESSOR
+    // The AFE runs its VAD only while device AEC is off
+    task.voice = voice_detected_ || device_aec_enabled_;
+#endif
+    task.pcm = std::move(pcm);
+    task.deadline_us = esp_timer_get_time() + (int64_t)task.pcm->size() * 1000000 / 16000;
 
     /* If the task is to send queue, we need to set the timestamp */
-    if (type == kAudioTaskTypeEncodeToSendQueue && !timestamp_queue_.empty()) {
-        if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
-            task->timestamp = timestamp_queue_.front();
-        } else {
-            ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+    if (type == kAudioTaskTypeEncodeToSendQueue) {
+        AUDIO_TRACE(task.trace.capture_us = LatencyTracer::GetInstance().CaptureTimeOf(task.pcm->size()));
+        AUDIO_TRACE(task.trace.processed_us = LatencyTracer::Now());
+        std::lock_guard<std::mutex> lock(timestamp_mutex_);
+        if (!timestamp_queue_.empty()) {
+            if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
+                task.timestamp = timestamp_queue_.front();
+            } else {
+                ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+            }
+            timestamp_queue_.pop_front();
         }
-        timestamp_queue_.pop_front();
     }
 
-    audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
-    audio_encode_queue_.push_back(std::move(task));
-    audio_queue_cv_.notify_all();
+    /* Never wait for the codec task: the caller feeds the wake word and the AFE, which must keep up with capture */
+    bool was_empty = false;
+    if (!PushOrDrop(audio_encode_queue_, std::move(task), debug_statistics_.encode_queue_drops, &was_empty)) {
+        return;
+    }
+    if (was_empty) {
+        xEventGroupSetBits(event_group_, AS_EVENT_ENCODE_NOT_EMPTY);
+    }
+    uint32_t encode_queue_size = audio_encode_queue_.Size();
+    if (encode_queue_size > debug_statistics_.max_encode_queue_size) {
+        debug_statistics_.max_encode_queue_size = encode_queue_size;
+    }
 }
 
 bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
-        if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
-        } else {
+    AUDIO_TRACE(packet->trace.receive_us = LatencyTracer::Now());
+    std::unique_lock<std::mutex> lock(decode_queue_mutex_);
+    if (packet->frame_duration > 0) {
+        decode_frame_duration_ms_ = packet->frame_duration;
+    }
+    while (jitter_buffer_.Size() >= (size_t)(MAX_DECODE_QUEUE_DURATION_MS / decode_frame_duration_ms_)) {
+        if (!wait) {
+            return false;
+        }
+        lock.unlock();
+        xEventGroupWaitBits(event_group_, AS_EVENT_DECODE_NOT_FULL, pdTRUE, pdFALSE, portMAX_DELAY);
+        if (service_stopped_) {
             return false;
         }
+        lock.lock();
+    }
+    bool accepted = jitter_buffer_.Put(std::move(packet));
+    lock.unlock();
+    if (accepted) {
+        // Also wakes the codec task when this packet fills a gap it is waiting on
+        xEventGroupSetBits(event_group_, AS_EVENT_DECODE_NOT_EMPTY);
     }
-    audio_decode_queue_.push_back(std::move(packet));
-    audio_queue_cv_.notify_all();
     return true;
 }
 
+JitterBufferResult AudioService::PopPacketFromDecodeQueue(std::unique_ptr<AudioStreamPacket>& packet, int& wait_ms) {
+    std::unique_lock<std::mutex> lock(decode_queue_mutex_);
+    bool was_full = jitter_buffer_.Size() >= (size_t)(MAX_DECODE_QUEUE_DURATION_MS / decode_frame_duration_ms_);
+    auto result = jitter_buffer_.Get(packet, wait_ms);
+    lock.unlock();
+    if (was_full && result == kJitterBufferPacket) {
+        xEventGroupSetBits(event_group_, AS_EVENT_DECODE_NOT_FULL);
+    }
+    return result;
+}
+
+void AudioService::DropStaleSendPackets() {
+#if !CONFIG_UPLINK_OVERFLOW_PAUSE_ENCODE
+    /* After a stall the server gets the latest audio instead of replaying the whole backlog */
+    size_t max_packets = std::max(CONFIG_UPLINK_MAX_BACKLOG_MS / uplink_frame_duration_ms_, 1);
+    size_t dropped = 0;
+    while (audio_send_queue_.Size() > max_packets) {
+        std::unique_ptr<AudioStreamPacket> packet;
+        bool was_full = false;
+        if (!audio_send_queue_.Pop(packet, &was_full)) {
+            break;
+        }
+        if (was_full) {
+            xEventGroupSetBits(event_group_, AS_EVENT_SEND_NOT_FULL);
+        }
+        dropped++;
+    }
+    if (dropped > 0) {
+        debug_statistics_.stale_packet_drops += dropped;
+        ESP_LOGW(TAG, "Dropped %u stale uplink packets", (unsigned)dropped);
+    }
+#endif
+}
+
 std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    if (audio_send_queue_.empty()) {
-        return nullptr;
+    std::unique_ptr<AudioStreamPacket> packet;
+    bool was_full = false;
+    audio_send_queue_.Pop(packet, &was_full);
+    if (was_full) {
+        xEventGroupSetBits(event_group_, AS_EVENT_SEND_NOT_FULL);
     }
-    auto packet = std::move(audio_send_queue_.front());
-    audio_send_queue_.pop_front();
-    audio_queue_cv_.notify_all();
     return packet;
 }
 
 void AudioService::EncodeWakeWord() {
     if (wake_word_) {
-        wake_word_->EncodeWakeWordData();
+        wake_word_->EncodeWakeWordData(uplink_frame_duration_ms_);
     }
 }
 
@@ -465,6 +782,8 @@ const std::string& AudioService::GetLastWakeWord() const {
 
 std::unique_ptr<AudioStreamPacket> AudioService::PopWakeWordPacket() {
     auto packet = std::make_unique<AudioStreamPacket>();
+    packet->sample_rate = 16000;
+    packet->frame_duration = uplink_frame_duration_ms_;
     if (wake_word_->GetWakeWordOpus(packet->payload)) {
         return packet;
     }
@@ -497,18 +816,23 @@ void AudioService::EnableVoiceProcessing(bool enable) {
     ESP_LOGD(TAG, "%s voice processing", enable ? "Enabling" : "Disabling");
     if (enable) {
         if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS);
+            audio_processor_->Initialize(codec_, uplink_frame_duration_ms_);
             audio_processor_initialized_ = true;
         }
 
         /* We should make sure no audio is playing */
         ResetDecoder();
+        AUDIO_TRACE(LatencyTracer::GetInstance().ResetCapture());
         audio_input_need_warmup_ = true;
         audio_processor_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
     } else {
         audio_processor_->Stop();
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
+        /* Frames held back for a coalesced packet are sent now that no more are coming */
+        if (callbacks_.on_send_queue_available && !audio_send_queue_.Empty()) {
+            callbacks_.on_send_queue_available();
+        }
     }
 }
 
@@ -518,17 +842,27 @@ void AudioService::EnableAudioTesting(bool enable) {
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
     } else {
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
-        /* Copy audio_testing_queue_ to audio_decode_queue_ */
-        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-        audio_decode_queue_ = std::move(audio_testing_queue_);
-        audio_queue_cv_.notify_all();
+        /*
+         * Move audio_testing_queue_ to the jitter buffer. This is the only consumer of the queue, the button
+         * and main tasks may both get here, decode_queue_mutex_ keeps their pops apart.
+         */
+        {
+            std::lock_guard<std::mutex> lock(decode_queue_mutex_);
+            jitter_buffer_.Reset();
+            std::unique_ptr<AudioStreamPacket> packet;
+            while (audio_testing_queue_.Pop(packet)) {
+                jitter_buffer_.Put(std::move(packet));
+            }
+        }
+        xEventGroupSetBits(event_group_, AS_EVENT_DECODE_NOT_EMPTY);
     }
 }
 
 void AudioService::EnableDeviceAec(bool enable) {
     ESP_LOGI(TAG, "%s device AEC", enable ? "Enabling" : "Disabling");
+    device_aec_enabled_ = enable;
     if (!audio_processor_initialized_) {
-        audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS);
+        audio_processor_->Initialize(codec_, uplink_frame_duration_ms_);
         audio_processor_initialized_ = true;
     }
 
@@ -546,111 +880,176 @@ void AudioService::PlaySound(const std::string_view& ogg) {
         codec_->EnableOutput(true);
     }
 
-    const uint8_t* buf = reinterpret_cast<const uint8_t*>(ogg.data());
-    size_t size = ogg.size();
-    size_t offset = 0;
-
-    auto find_page = [&](size_t start)->size_t {
-        for (size_t i = start; i + 4 <= size; ++i) {
-            if (buf[i] == 'O' && buf[i+1] == 'g' && buf[i+2] == 'g' && buf[i+3] == 'S') return i;
+    /* Only the view is queued, the codec task demuxes the asset in place as the playback queue drains */
+    uint32_t decode_position;
+    {
+        std::lock_guard<std::mutex> lock(decode_queue_mutex_);
+        decode_position = jitter_buffer_.accepted();
+    }
+    {
+        std::lock_guard<std::mutex> lock(sound_queue_mutex_);
+        if (sound_queue_.size() >= MAX_SOUNDS_IN_QUEUE) {
+            ESP_LOGW(TAG, "Sound queue is full, dropping sound");
+            return;
         }
-        return static_cast<size_t>(-1);
-    };
+        sound_queue_.push_back({ogg, decode_position});
+    }
+    xEventGroupSetBits(event_group_, AS_EVENT_DECODE_NOT_EMPTY);
+}
 
-    bool seen_head = false;
-    bool seen_tags = false;
-    int sample_rate = 16000; // 默认值
+void AudioService::StopSounds() {
+    std::lock_guard<std::mutex> lock(sound_queue_mutex_);
+    sound_queue_.clear();
+    // The demuxer belongs to the codec task, it closes the current sound on its next packet
+    sound_cancelled_ = true;
+}
 
-    while (true) {
-        size_t pos = find_page(offset);
-        if (pos == static_cast<size_t>(-1)) break;
-        offset = pos;
-        if (offset + 27 > size) break;
-
-        const uint8_t* page = buf + offset;
-        uint8_t page_segments = page[26];
-        size_t seg_table_off = offset + 27;
-        if (seg_table_off + page_segments > size) break;
-
-        size_t body_size = 0;
-        for (size_t i = 0; i < page_segments; ++i) body_size += page[27 + i];
-
-        size_t body_off = seg_table_off + page_segments;
-        if (body_off + body_size > size) break;
-
-        // Parse packets using lacing
-        size_t cur = body_off;
-        size_t seg_idx = 0;
-        while (seg_idx < page_segments) {
-            size_t pkt_len = 0;
-            size_t pkt_start = cur;
-            bool continued = false;
-            do {
-                uint8_t l = page[27 + seg_idx++];
-                pkt_len += l;
-                cur += l;
-                continued = (l == 255);
-            } while (continued && seg_idx < page_segments);
-
-            if (pkt_len == 0) continue;
-            const uint8_t* pkt_ptr = buf + pkt_start;
-
-            if (!seen_head) {
-                // 解析OpusHead包
-                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
-                    seen_head = true;
-                    
-                    // OpusHead结构：[0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip
-                    // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
-                    if (pkt_len >= 12) {
-                        uint8_t version = pkt_ptr[8];
-                        uint8_t channel_count = pkt_ptr[9];
-                        
-                        if (pkt_len >= 16) {
-                            // 读取输入采样率 (little-endian)
-                            sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) | 
-                                        (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
-                            ESP_LOGI(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d", 
-                                   version, channel_count, sample_rate);
-                        }
-                    }
-                }
-                continue;
+bool AudioService::PlaySoundFrame(uint32_t decode_released) {
+    std::unique_lock<std::mutex> lock(sound_queue_mutex_);
+    if (sound_cancelled_) {
+        sound_demuxer_.Close();
+        sound_cached_.reset();
+        std::vector<int16_t>().swap(sound_capture_);
+        sound_cancelled_ = false;
+    }
+
+    /* The sound being played stays at the front of the queue until its last frame */
+    while (!sound_queue_.empty()) {
+        auto& sound = sound_queue_.front().ogg;
+        if (!sound_demuxer_.IsOpen() && !sound_cached_) {
+            // Server audio queued before the sound plays first
+            if ((int32_t)(decode_released - sound_queue_.front().decode_position) < 0) {
+                return false;
             }
-            if (!seen_tags) {
-                // Expect OpusTags in second packet
-                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
-                    seen_tags = true;
+#if CONFIG_USE_SOUND_CACHE
+            sound_cached_ = sound_cache_.Lookup(sound);
+            sound_cached_offset_ = 0;
+            sound_capturing_ = !sound_cached_;
+#endif
+            if (!sound_cached_) {
+                sound_demuxer_.Open(sound);
+            }
+        }
+
+        if (sound_cached_) {
+            /* Cache hit, the PCM is already decoded and resampled */
+            if (sound_cached_offset_ < sound_cached_->samples) {
+                auto cached = sound_cached_;
+                size_t offset = sound_cached_offset_;
+                size_t samples = std::min<size_t>(codec_->output_sample_rate() * OPUS_FRAME_DURATION_MS / 1000,
+                    cached->samples - offset);
+                sound_cached_offset_ += samples;
+                lock.unlock();
+
+                AudioTask task;
+                task.type = kAudioTaskTypeDecodeToPlaybackQueue;
+                task.pcm = pcm_frame_pool_.Acquire();
+                task.pcm->assign(cached->pcm + offset, cached->pcm + offset + samples);
+                bool was_empty = false;
+                audio_playback_queue_.Push(std::move(task), &was_empty);
+                if (was_empty) {
+                    xEventGroupSetBits(event_group_, AS_EVENT_PLAYBACK_NOT_EMPTY);
                 }
-                continue;
+                return true;
             }
+            sound_cached_.reset();
+            sound_queue_.pop_front();
+            continue;
+        }
 
-            // Audio packet (Opus)
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->sample_rate = sample_rate;
-            packet->frame_duration = 60;
-            packet->payload.resize(pkt_len);
-            std::memcpy(packet->payload.data(), pkt_ptr, pkt_len);
-            PushPacketToDecodeQueue(std::move(packet), true);
+        std::string_view packet;
+        if (sound_demuxer_.Next(packet)) {
+            int sample_rate = sound_demuxer_.sample_rate();
+            lock.unlock();
+            // The decoder takes a vector, one reused packet instead of a packet per frame
+            sound_packet_.sample_rate = sample_rate;
+            sound_packet_.frame_duration = OpusPacketDurationMs(packet);
+            sound_packet_.payload.assign(packet.begin(), packet.end());
+            DecodeToPlaybackQueue(sound_packet_, sound_capturing_ ? &sound_capture_ : nullptr);
+#if CONFIG_USE_SOUND_CACHE
+            if (sound_capturing_ && sound_capture_.size() * sizeof(int16_t) > sound_cache_.max_entry_bytes()) {
+                // Too long to be worth caching
+                sound_capturing_ = false;
+                std::vector<int16_t>().swap(sound_capture_);
+            }
+#endif
+            return true;
         }
 
-        offset = body_off + body_size;
+#if CONFIG_USE_SOUND_CACHE
+        if (sound_capturing_) {
+            sound_cache_.Insert(sound, sound_capture_.data(), sound_capture_.size());
+            sound_capturing_ = false;
+            std::vector<int16_t>().swap(sound_capture_);
+        }
+#endif
+        sound_demuxer_.Close();
+        sound_queue_.pop_front();
     }
+    return false;
 }
 
 bool AudioService::IsIdle() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
+    {
+        std::lock_guard<std::mutex> lock(sound_queue_mutex_);
+        if (!sound_queue_.empty()) {
+            return false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(decode_queue_mutex_);
+    return audio_encode_queue_.Empty() && jitter_buffer_.Empty() && audio_playback_queue_.Empty() && audio_testing_queue_.Empty();
 }
 
 void AudioService::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    opus_decoder_->ResetState();
-    timestamp_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(decode_queue_mutex_);
+        opus_decoder_->ResetState();
+        auto& stats = jitter_buffer_.stats();
+        if (stats.received > 0) {
+            ESP_LOGI(TAG, "Jitter buffer: received %lu, late %lu, duplicates %lu, concealed %lu, skipped %lu, underruns %lu, "
+                "jitter %lu ms, target delay %lu ms, added latency %lu ms (max %lu ms)",
+                stats.received, stats.late, stats.duplicates, stats.concealed, stats.skipped, stats.underruns,
+                stats.jitter_ms, stats.target_delay_ms, stats.added_latency_ms, stats.max_added_latency_ms);
+        }
+        jitter_buffer_.Reset();
+    }
+    StopSounds();
+    {
+        std::lock_guard<std::mutex> lock(timestamp_mutex_);
+        timestamp_queue_.clear();
+    }
+    audio_playback_queue_.RequestFlush();
+    audio_testing_queue_.RequestFlush();
+    /* Let the consumers apply the flush and the producers re-check for free slots */
+    xEventGroupSetBits(event_group_, AS_EVENT_PLAYBACK_NOT_EMPTY | AS_EVENT_PLAYBACK_NOT_FULL | AS_EVENT_DECODE_NOT_FULL);
+}
+
+size_t AudioService::GetUplinkFramesPerPacket(size_t max_frames_per_packet) {
+#if CONFIG_USE_ADAPTIVE_UPLINK
+    uplink_max_frames_per_packet_ = max_frames_per_packet;
+    // Batching only pays off once frames are waiting anyway, a clear link sends each frame right away
+    return uplink_congested_ ? max_frames_per_packet : 1;
+#else
+    return max_frames_per_packet;
+#endif
+}
+
+void AudioService::PrintCodecStats() {
+    auto& stats = debug_statistics_;
+    ESP_LOGI(TAG, "codec: encoded %lu (deadline misses %lu, max queue %lu/%d), decoded %lu (deadline misses %lu, max playback queue %lu/%d)",
+        stats.encode_count, stats.encode_deadline_misses, stats.max_encode_queue_size, MAX_ENCODE_TASKS_IN_QUEUE,
+        stats.decode_count, stats.decode_deadline_misses, stats.max_playback_queue_size, MAX_PLAYBACK_TASKS_IN_QUEUE);
+#if CONFIG_USE_SPLIT_OPUS_CODEC_TASKS
+    ESP_LOGI(TAG, "codec: %s first", uplink_first_ ? "uplink" : "downlink");
+#endif
+    ESP_LOGI(TAG, "uplink: %lu stalls (%lu ms), dropped %lu frames behind the encoder, %lu by the overflow policy, %lu stale packets",
+        stats.uplink_stalls, stats.uplink_stall_ms, stats.encode_queue_drops, stats.overflow_drops, stats.stale_packet_drops);
+#if CONFIG_USE_ADAPTIVE_UPLINK
+    auto& uplink = uplink_controller_.stats();
+    ESP_LOGI(TAG, "uplink: complexity %d, queue depth %lu.%02lu, encode load %lu%%, congestion events %lu, complexity changes %lu",
+        uplink_controller_.settings().complexity, uplink.queue_depth_q4 >> 4, (uplink.queue_depth_q4 & 15) * 100 / 16,
+        uplink.encode_load_percent, uplink.congestion_events, uplink.complexity_changes);
+#endif
 }
 
 void AudioService::CheckAndUpdateAudioPowerState() {
@@ -3,9 +3,9 @@
 
 #include <memory>
 #include <deque>
-#include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -21,6 +21,16 @@
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
 #include "protocol.h"
+#include "spsc_queue.h"
+#include "pcm_frame_pool.h"
+#include "audio_packet_pool.h"
+#include "audio_frame.h"
+#include "jitter_buffer.h"
+#include "ogg_demuxer.h"
+#include "sound_cache.h"
+#include "latency_tracer.h"
+#include "uplink_controller.h"
+#include "uplink_overflow.h"
 
 
 /*
@@ -29,18 +39,40 @@
  * 2. (Server) -> {Decode Queue} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
  *
  * We use one task for MIC / Speaker / Processors, and one task for Opus Encoder / Opus Decoder.
+ * With CONFIG_USE_SPLIT_OPUS_CODEC_TASKS the encoder and the decoder get a task each, pinned to different cores,
+ * so a burst of downlink packets never holds back uplink frames. Uplink goes first while listening, downlink first
+ * while speaking.
  * 
  * Decode Queue and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
+ *
+ * Encode / Send / Playback / Testing queues have exactly one producer and one consumer, so they are
+ * lock-free SpscQueues. The Decode Queue is a jitter buffer fed by the protocol, so it keeps its own lock.
+ * PlaySound only queues a view of the Ogg asset, the Opus Decoder demuxes it in place. A sound starts once the
+ * packets that were in the Decode Queue before it have been played, like the packets it used to be queued as.
+ * Each queue signals its own event bits, a push or pop only wakes the task waiting on that queue.
  * 
  */
 
+// Default frame duration, also the longest one a session may use
 #define OPUS_FRAME_DURATION_MS 60
+// Shortest frame duration, used by sessions in the low latency mode
+#define OPUS_MIN_FRAME_DURATION_MS 20
 #define MAX_ENCODE_TASKS_IN_QUEUE 2
 #define MAX_PLAYBACK_TASKS_IN_QUEUE 2
-#define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
-#define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+// Queue depths are durations, the packet limits follow the frame duration of the session
+#define MAX_DECODE_QUEUE_DURATION_MS 2400
+#define MAX_SEND_QUEUE_DURATION_MS 2400
+#define MAX_PACKETS_IN_DURATION(duration_ms) ((duration_ms) / OPUS_MIN_FRAME_DURATION_MS)
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
 #define MAX_TIMESTAMPS_IN_QUEUE 3
+#define MAX_SOUNDS_IN_QUEUE 16
+// Frames held by the encode / playback queues, plus the ones being read, encoded, decoded, resampled and played
+#define PCM_FRAME_POOL_SIZE (MAX_ENCODE_TASKS_IN_QUEUE + MAX_PLAYBACK_TASKS_IN_QUEUE + 5)
+
+#define OPUS_CODEC_TASK_PRIORITY 2
+#define OPUS_CODEC_TASK_PRIORITY_BOOST 4
+#define OPUS_ENCODE_TASK_CORE 0
+#define OPUS_DECODE_TASK_CORE 1
 
 #define AUDIO_POWER_TIMEOUT_MS 15000
 #define AUDIO_POWER_CHECK_INTERVAL_MS 1000
@@ -50,10 +82,20 @@
 #define AS_EVENT_WAKE_WORD_RUNNING          (1 << 1)
 #define AS_EVENT_AUDIO_PROCESSOR_RUNNING    (1 << 2)
 #define AS_EVENT_PLAYBACK_NOT_EMPTY         (1 << 3)
+#define AS_EVENT_PLAYBACK_NOT_FULL          (1 << 4)
+#define AS_EVENT_ENCODE_NOT_EMPTY           (1 << 5)
+#define AS_EVENT_DECODE_NOT_EMPTY           (1 << 7)
+#define AS_EVENT_DECODE_NOT_FULL            (1 << 8)
+#define AS_EVENT_SEND_NOT_FULL              (1 << 9)
+#define AS_EVENT_QUEUE_ALL                  (AS_EVENT_PLAYBACK_NOT_EMPTY | AS_EVENT_PLAYBACK_NOT_FULL | \
+                                             AS_EVENT_ENCODE_NOT_EMPTY | \
+                                             AS_EVENT_DECODE_NOT_EMPTY | AS_EVENT_DECODE_NOT_FULL | \
+                                             AS_EVENT_SEND_NOT_FULL)
 
 struct AudioServiceCallbacks {
     std::function<void(void)> on_send_queue_available;
     std::function<void(const std::string&)> on_wake_word_detected;
+    std::function<void(void)> on_wake_word_speech;
     std::function<void(bool)> on_vad_change;
     std::function<void(void)> on_audio_testing_queue_full;
 };
@@ -66,9 +108,16 @@ enum AudioTaskType {
 };
 
 struct AudioTask {
-    AudioTaskType type;
-    std::vector<int16_t> pcm;
-    uint32_t timestamp;
+    AudioTaskType type = kAudioTaskTypeEncodeToSendQueue;
+    PcmFrame pcm;
+    uint32_t timestamp = 0;
+    // A frame is due for encoding before the next one is captured
+    int64_t deadline_us = 0;
+    // False for frames the VAD marked as silence, always true without a running VAD
+    bool voice = true;
+#if CONFIG_USE_AUDIO_LATENCY_TRACER
+    LatencyTrace trace;
+#endif
 };
 
 struct DebugStatistics {
@@ -76,6 +125,17 @@ struct DebugStatistics {
     uint32_t decode_count = 0;
     uint32_t encode_count = 0;
     uint32_t playback_count = 0;
+    uint32_t encode_deadline_misses = 0;
+    uint32_t decode_deadline_misses = 0;
+    uint32_t max_encode_queue_size = 0;
+    uint32_t max_playback_queue_size = 0;
+    // Uplink backpressure: frames dropped because the encoder fell behind, frames dropped by the
+    // overflow policy before encoding, and queued packets dropped as stale once the network came back
+    uint32_t encode_queue_drops = 0;
+    uint32_t overflow_drops = 0;
+    uint32_t stale_packet_drops = 0;
+    uint32_t uplink_stalls = 0;
+    uint32_t uplink_stall_ms = 0;
 };
 
 class AudioService {
@@ -103,9 +163,24 @@ public:
 
     bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
     std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
+    size_t GetSendQueueSize() const { return audio_send_queue_.Size(); }
+    // Called by the consumer of the send queue before sending, drops packets beyond the backlog limit
+    void DropStaleSendPackets();
+    const DebugStatistics& GetDebugStatistics() const { return debug_statistics_; }
+    // Takes effect while voice processing is off, the wake word audio is encoded with it as well
+    void SetUplinkFrameDuration(int frame_duration_ms);
+    int GetUplinkFrameDuration() const { return uplink_frame_duration_ms_; }
+    // Frame duration for the next session, short frames fall back to the default ones when the last session could not keep up
+    int AdaptUplinkFrameDuration(int frame_duration_ms);
+    // Frames to send per message, at most the number the server accepted
+    size_t GetUplinkFramesPerPacket(size_t max_frames_per_packet);
+    // Queues the sound and returns, playback is cancelled by StopSounds() or ResetDecoder()
     void PlaySound(const std::string_view& sound);
-    bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
+    void StopSounds();
+    SoundCacheStats GetSoundCacheStats() { return sound_cache_.GetStats(); }
+    bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples, bool mono = false);
     void ResetDecoder();
+    void PrintCodecStats();
 
 private:
     AudioCodec* codec_ = nullptr;
@@ -115,9 +190,9 @@ private:
     std::unique_ptr<AudioDebugger> audio_debugger_;
     std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
-    OpusResampler input_resampler_;
-    OpusResampler reference_resampler_;
+    AudioFrameResampler input_resampler_;
     OpusResampler output_resampler_;
+    PcmFramePool& pcm_frame_pool_ = PcmFramePool::GetInstance();
     DebugStatistics debug_statistics_;
 
     EventGroupHandle_t event_group_;
@@ -126,19 +201,52 @@ private:
     TaskHandle_t audio_input_task_handle_ = nullptr;
     TaskHandle_t audio_output_task_handle_ = nullptr;
     TaskHandle_t opus_codec_task_handle_ = nullptr;
-    std::mutex audio_queue_mutex_;
-    std::condition_variable audio_queue_cv_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    TaskHandle_t opus_encode_task_handle_ = nullptr;
+    TaskHandle_t opus_decode_task_handle_ = nullptr;
+    // Both codec tasks update the priorities, the mutex keeps the decision and the two vTaskPrioritySet together
+    std::mutex codec_priority_mutex_;
+    std::atomic<bool> uplink_first_ = false;
+    std::atomic<int> uplink_frame_duration_ms_ = OPUS_FRAME_DURATION_MS;
+#if CONFIG_USE_ADAPTIVE_UPLINK
+    UplinkController uplink_controller_{CONFIG_AUDIO_UPLINK_MAX_COMPLEXITY};
+    std::atomic<bool> uplink_congested_ = false;
+    std::atomic<bool> uplink_overloaded_ = false;
+    std::atomic<size_t> uplink_max_frames_per_packet_ = 1;
+#endif
+    std::mutex decode_queue_mutex_;
+    JitterBuffer jitter_buffer_;
+    // Frame duration of the last incoming packet, guarded by decode_queue_mutex_
+    int decode_frame_duration_ms_ = OPUS_FRAME_DURATION_MS;
+    struct QueuedSound {
+        std::string_view ogg;
+        // JitterBuffer::accepted() when the sound was queued, it plays after those packets
+        uint32_t decode_position;
+    };
+    std::mutex sound_queue_mutex_;
+    std::deque<QueuedSound> sound_queue_;
+    bool sound_cancelled_ = false;
+    OggDemuxer sound_demuxer_;
+    AudioStreamPacket sound_packet_;
+    SoundCache sound_cache_;
+    std::shared_ptr<const SoundCacheEntry> sound_cached_;
+    size_t sound_cached_offset_ = 0;
+    bool sound_capturing_ = false;
+    std::vector<int16_t> sound_capture_;
+    SpscQueue<std::unique_ptr<AudioStreamPacket>, MAX_PACKETS_IN_DURATION(MAX_SEND_QUEUE_DURATION_MS)> audio_send_queue_;
+    SpscQueue<std::unique_ptr<AudioStreamPacket>, AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS> audio_testing_queue_;
+    SpscQueue<AudioTask, MAX_ENCODE_TASKS_IN_QUEUE> audio_encode_queue_;
+    SpscQueue<AudioTask, MAX_PLAYBACK_TASKS_IN_QUEUE> audio_playback_queue_;
     // For server AEC
+    std::mutex timestamp_mutex_;
     std::deque<uint32_t> timestamp_queue_;
 
     bool wake_word_initialized_ = false;
     bool audio_processor_initialized_ = false;
     bool voice_detected_ = false;
+    bool device_aec_enabled_ = false;
+    // Owned by the encode task
+    bool uplink_stalled_ = false;
+    int64_t uplink_stall_start_us_ = 0;
     bool service_stopped_ = true;
     bool audio_input_need_warmup_ = false;
 
@@ -149,8 +257,19 @@ private:
     void AudioInputTask();
     void AudioOutputTask();
     void OpusCodecTask();
-    void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
+    void OpusEncodeTask();
+    void OpusDecodeTask();
+    bool EncodeFrame();
+    bool DecodeFrame(int& decode_wait_ms);
+    void UpdateCodecPriorities();
+    void PushTaskToEncodeQueue(AudioTaskType type, const std::vector<int16_t>& pcm);
+    void PushTaskToEncodeQueue(AudioTaskType type, PcmFrame&& pcm);
+    JitterBufferResult PopPacketFromDecodeQueue(std::unique_ptr<AudioStreamPacket>& packet, int& wait_ms);
+    bool PlaySoundFrame(uint32_t decode_released);
+    void DecodeToPlaybackQueue(AudioStreamPacket& packet, std::vector<int16_t>* capture = nullptr);
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
+    void SetEncodeFrameDuration(int frame_duration);
+    bool UpdateUplinkStall();
     void CheckAndUpdateAudioPowerState();
 };
 
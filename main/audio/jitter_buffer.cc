@@ -0,0 +1,156 @@
+#include "jitter_buffer.h"
+
+#include <esp_timer.h>
+#include <algorithm>
+
+// Frame duration assumed for packets that do not carry one
+#define JITTER_BUFFER_DEFAULT_FRAME_MS 60
+// Playout delay in multiples of the jitter estimate
+#define JITTER_BUFFER_DELAY_FACTOR 3
+// Sequences further back than this are a restarted stream, not a late packet
+#define JITTER_BUFFER_RESTART_DISTANCE 64
+
+static inline int64_t NowMs() {
+    return esp_timer_get_time() / 1000;
+}
+
+int JitterBuffer::FrameDuration(const AudioStreamPacket& packet) const {
+    return packet.frame_duration > 0 ? packet.frame_duration : JITTER_BUFFER_DEFAULT_FRAME_MS;
+}
+
+int JitterBuffer::TargetDelayMs() const {
+    int delay = JITTER_BUFFER_DELAY_FACTOR * (jitter_q4_ >> 4);
+    return std::clamp(delay, JITTER_BUFFER_MIN_DELAY_MS, JITTER_BUFFER_MAX_DELAY_MS);
+}
+
+void JitterBuffer::UpdateJitter(const AudioStreamPacket& packet, int64_t now_ms) {
+    if (has_transit_) {
+        // Change of the transit time, the media clock comes from the sequence distance, which survives a wrap
+        int32_t frames = (int32_t)(packet.sequence - last_transit_sequence_);
+        int64_t d = now_ms - last_arrival_ms_ - (int64_t)frames * FrameDuration(packet);
+        // Only late arrivals can starve playback, bursts of early packets are ignored
+        d = std::clamp<int64_t>(d, 0, JITTER_BUFFER_MAX_DELAY_MS);
+        jitter_q4_ += ((int32_t)(d << 4) - jitter_q4_) >> 4;
+    }
+    has_transit_ = true;
+    last_arrival_ms_ = now_ms;
+    last_transit_sequence_ = packet.sequence;
+    stats_.jitter_ms = jitter_q4_ >> 4;
+    stats_.target_delay_ms = TargetDelayMs();
+}
+
+bool JitterBuffer::Put(std::unique_ptr<AudioStreamPacket> packet) {
+    int64_t now = NowMs();
+    if (packet->sequence == 0) {
+        packet->sequence = last_sequence_ + 1;
+    }
+    uint32_t sequence = packet->sequence;
+    stats_.received++;
+
+    if (has_expected_) {
+        int32_t distance = (int32_t)(sequence - expected_sequence_);
+        if (distance < -JITTER_BUFFER_RESTART_DISTANCE) {
+            Reset();
+        } else if (distance < 0) {
+            stats_.late++;
+            return false;
+        }
+    }
+
+    // Find the insert position from the back, packets mostly arrive in order
+    auto it = packets_.end();
+    while (it != packets_.begin() && (int32_t)(std::prev(it)->packet->sequence - sequence) >= 0) {
+        --it;
+        if (it->packet->sequence == sequence) {
+            stats_.duplicates++;
+            return false;
+        }
+    }
+
+    bool underrun = drained_ms_ >= 0 && now - drained_ms_ <= JITTER_BUFFER_UNDERRUN_WINDOW_MS;
+    if (packets_.empty() && !playing_) {
+        utterance_first_arrival_ms_ = now;
+        if (!underrun) {
+            // A new utterance after a pause, the pause itself is not jitter
+            has_transit_ = false;
+        }
+    }
+    if (underrun) {
+        stats_.underruns++;
+    }
+    drained_ms_ = -1;
+    if (packets_.empty() || (int32_t)(sequence - last_sequence_) > 0) {
+        UpdateJitter(*packet, now);
+        last_sequence_ = sequence;
+    }
+    packets_.insert(it, Entry{std::move(packet), now});
+    accepted_++;
+    return true;
+}
+
+JitterBufferResult JitterBuffer::Get(std::unique_ptr<AudioStreamPacket>& packet, int& wait_ms) {
+    int64_t now = NowMs();
+    if (packets_.empty()) {
+        if (playing_) {
+            // Start over with a fresh playout delay when data comes back
+            playing_ = false;
+            drained_ms_ = now;
+        }
+        return kJitterBufferEmpty;
+    }
+
+    int target = TargetDelayMs();
+    auto& front = packets_.front();
+    if (!playing_) {
+        int buffered_ms = packets_.size() * FrameDuration(*front.packet);
+        int waited_ms = now - utterance_first_arrival_ms_;
+        if (buffered_ms < target && waited_ms < target) {
+            wait_ms = target - waited_ms;
+            return kJitterBufferWait;
+        }
+        playing_ = true;
+        stats_.added_latency_ms = waited_ms;
+        stats_.max_added_latency_ms = std::max(stats_.max_added_latency_ms, stats_.added_latency_ms);
+        if (!has_expected_) {
+            expected_sequence_ = front.packet->sequence;
+            has_expected_ = true;
+        }
+    }
+
+    int32_t gap = (int32_t)(front.packet->sequence - expected_sequence_);
+    if (gap > 0 && gap <= JITTER_BUFFER_MAX_CONCEAL_FRAMES) {
+        // Give the missing packet at least one frame to show up, the playback queue covers that wait
+        int frame_ms = FrameDuration(*front.packet);
+        int age_ms = now - front.arrival_ms;
+        int give_up_ms = std::max(target, frame_ms);
+        if (age_ms < give_up_ms) {
+            wait_ms = give_up_ms - age_ms;
+            return kJitterBufferWait;
+        }
+        packet = std::make_unique<AudioStreamPacket>();
+        packet->sample_rate = front.packet->sample_rate;
+        packet->frame_duration = front.packet->frame_duration;
+        packet->sequence = expected_sequence_++;
+        stats_.concealed++;
+        return kJitterBufferLost;
+    }
+    if (gap > 0) {
+        stats_.skipped += gap;
+    }
+
+    packet = std::move(front.packet);
+    packets_.pop_front();
+    released_++;
+    expected_sequence_ = packet->sequence + 1;
+    return kJitterBufferPacket;
+}
+
+void JitterBuffer::Reset() {
+    // The jitter estimate and the counters describe the network, they survive a reset
+    packets_.clear();
+    released_ = accepted_;
+    playing_ = false;
+    has_expected_ = false;
+    has_transit_ = false;
+    drained_ms_ = -1;
+}
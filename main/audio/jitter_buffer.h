@@ -0,0 +1,91 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <deque>
+#include <memory>
+#include <cstdint>
+
+#include "protocol.h"
+
+#define JITTER_BUFFER_MIN_DELAY_MS 0
+#define JITTER_BUFFER_MAX_DELAY_MS 600
+// Longer gaps are skipped instead of concealed
+#define JITTER_BUFFER_MAX_CONCEAL_FRAMES 3
+// A buffer that ran dry and refilled within this time counts as an underrun, not a new utterance
+#define JITTER_BUFFER_UNDERRUN_WINDOW_MS 1000
+
+struct JitterBufferStats {
+    uint32_t received = 0;
+    uint32_t late = 0;
+    uint32_t duplicates = 0;
+    uint32_t concealed = 0;
+    uint32_t skipped = 0;
+    uint32_t underruns = 0;
+    uint32_t jitter_ms = 0;
+    uint32_t target_delay_ms = 0;
+    // Playout delay added before the last utterance started, and the largest one so far
+    uint32_t added_latency_ms = 0;
+    uint32_t max_added_latency_ms = 0;
+};
+
+enum JitterBufferResult {
+    kJitterBufferEmpty,
+    kJitterBufferWait,
+    kJitterBufferPacket,
+    kJitterBufferLost,
+};
+
+/*
+ * Adaptive jitter buffer for incoming Opus packets, not thread-safe.
+ *
+ * Packets are kept ordered by sequence. Late and duplicate packets are dropped. Packets without
+ * a sequence (0) are appended in arrival order. The playout delay follows the measured late-arrival
+ * jitter: playback of an utterance starts once the buffer holds that much audio (or the first packet
+ * has waited that long), and a missing packet is given up on after the same delay.
+ * A lost packet is returned as an empty payload, which asks the Opus decoder for concealment (PLC).
+ */
+class JitterBuffer {
+public:
+    // Returns false if the packet was dropped
+    bool Put(std::unique_ptr<AudioStreamPacket> packet);
+    // On kJitterBufferWait, `wait_ms` tells when to call again
+    JitterBufferResult Get(std::unique_ptr<AudioStreamPacket>& packet, int& wait_ms);
+    void Reset();
+
+    inline size_t Size() const { return packets_.size(); }
+    // Packets accepted so far, and packets handed out by Get() or dropped by Reset(), audio queued
+    // elsewhere keeps its place behind the packets accepted before it with these
+    inline uint32_t accepted() const { return accepted_; }
+    inline uint32_t released() const { return released_; }
+    inline bool Empty() const { return packets_.empty(); }
+    inline const JitterBufferStats& stats() const { return stats_; }
+
+private:
+    struct Entry {
+        std::unique_ptr<AudioStreamPacket> packet;
+        int64_t arrival_ms;
+    };
+    std::deque<Entry> packets_;
+    JitterBufferStats stats_;
+    uint32_t accepted_ = 0;
+    uint32_t released_ = 0;
+
+    bool playing_ = false;
+    bool has_expected_ = false;
+    uint32_t expected_sequence_ = 0;
+    uint32_t last_sequence_ = 0;
+    int64_t drained_ms_ = -1;
+    int64_t utterance_first_arrival_ms_ = 0;
+
+    // RFC 3550 style estimate, in 1/16 ms
+    bool has_transit_ = false;
+    int64_t last_arrival_ms_ = 0;
+    uint32_t last_transit_sequence_ = 0;
+    int32_t jitter_q4_ = 0;
+
+    int FrameDuration(const AudioStreamPacket& packet) const;
+    int TargetDelayMs() const;
+    void UpdateJitter(const AudioStreamPacket& packet, int64_t now_ms);
+};
+
+#endif // JITTER_BUFFER_H
@@ -0,0 +1,164 @@
+#include "latency_tracer.h"
+
+#if CONFIG_USE_AUDIO_LATENCY_TRACER
+
+#include <esp_log.h>
+#include <cJSON.h>
+#include <algorithm>
+
+#define TAG "LatencyTracer"
+
+static const char* const kStageNames[kLatencyStageCount] = {
+    "process", "encode_queue", "encode", "send_queue", "uplink",
+    "decode_queue", "decode", "playback_queue", "downlink",
+};
+
+// 4 buckets per power of two, values below 4us get a bucket each
+static inline int BucketOf(uint32_t value) {
+    if (value < 4) {
+        return value;
+    }
+    int msb = 31 - __builtin_clz(value);
+    return (msb - 1) * 4 + ((value >> (msb - 2)) & 3);
+}
+
+static inline uint32_t BucketUpperBound(int bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+    int msb = bucket / 4 + 1;
+    uint64_t upper = ((uint64_t)(4 + bucket % 4 + 1) << (msb - 2)) - 1;
+    return upper > UINT32_MAX ? UINT32_MAX : (uint32_t)upper;
+}
+
+void LatencyTracer::MarkCaptured(size_t frames) {
+    std::lock_guard<std::mutex> lock(capture_mutex_);
+    captured_frames_ += frames;
+    capture_marks_[capture_mark_index_] = {captured_frames_, Now()};
+    capture_mark_index_ = (capture_mark_index_ + 1) % LATENCY_CAPTURE_MARKS;
+}
+
+uint32_t LatencyTracer::CaptureTimeOf(size_t processed_frames) {
+    std::lock_guard<std::mutex> lock(capture_mutex_);
+    processed_frames_ += processed_frames;
+    // The oldest captured block that contains the last processed sample
+    uint32_t time_us = 0;
+    uint64_t best = UINT64_MAX;
+    for (auto& mark : capture_marks_) {
+        if (mark.end_frame >= processed_frames_ && mark.end_frame < best) {
+            best = mark.end_frame;
+            time_us = mark.time_us;
+        }
+    }
+    return time_us;
+}
+
+void LatencyTracer::ResetCapture() {
+    std::lock_guard<std::mutex> lock(capture_mutex_);
+    for (auto& mark : capture_marks_) {
+        mark = {};
+    }
+    captured_frames_ = 0;
+    processed_frames_ = 0;
+}
+
+void LatencyTracer::Record(LatencyStage stage, uint32_t start_us, uint32_t end_us) {
+    if (start_us == 0 || end_us == 0) {
+        return;
+    }
+    uint32_t value = end_us - start_us;
+    auto& histogram = histograms_[stage];
+    histogram.count++;
+    histogram.buckets[BucketOf(value)]++;
+    if (value > histogram.max_us) {
+        histogram.max_us = value;
+    }
+}
+
+void LatencyTracer::RecordUplink(const LatencyTrace& trace, uint32_t send_us) {
+    std::lock_guard<std::mutex> lock(histogram_mutex_);
+    Record(kLatencyStageProcess, trace.capture_us, trace.processed_us);
+    Record(kLatencyStageEncodeQueue, trace.processed_us, trace.encode_start_us);
+    Record(kLatencyStageEncode, trace.encode_start_us, trace.encode_end_us);
+    Record(kLatencyStageSendQueue, trace.encode_end_us, send_us);
+    Record(kLatencyStageUplink, trace.capture_us, send_us);
+    if (frame_callback_) {
+        LatencyFrame frame = {kLatencyUplink, {}, 0,
+            {trace.capture_us, trace.processed_us, trace.encode_start_us, trace.encode_end_us, send_us}};
+        frame_callback_(frame);
+    }
+}
+
+void LatencyTracer::RecordDownlink(const LatencyTrace& trace, uint32_t play_us) {
+    std::lock_guard<std::mutex> lock(histogram_mutex_);
+    Record(kLatencyStageDecodeQueue, trace.receive_us, trace.decode_start_us);
+    Record(kLatencyStageDecode, trace.decode_start_us, trace.decode_end_us);
+    Record(kLatencyStagePlaybackQueue, trace.decode_end_us, play_us);
+    Record(kLatencyStageDownlink, trace.receive_us, play_us);
+    if (frame_callback_) {
+        LatencyFrame frame = {kLatencyDownlink, {}, trace.frame,
+            {trace.receive_us, trace.decode_start_us, trace.decode_end_us, play_us, 0}};
+        frame_callback_(frame);
+    }
+}
+
+void LatencyTracer::OnFrame(std::function<void(const LatencyFrame& frame)> callback) {
+    std::lock_guard<std::mutex> lock(histogram_mutex_);
+    frame_callback_ = callback;
+}
+
+uint32_t LatencyTracer::Percentile(const Histogram& histogram, uint32_t percent) {
+    if (histogram.count == 0) {
+        return 0;
+    }
+    uint64_t rank = ((uint64_t)histogram.count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram.buckets[i];
+        if (seen >= rank) {
+            return std::min(BucketUpperBound(i), histogram.max_us);
+        }
+    }
+    return histogram.max_us;
+}
+
+void LatencyTracer::GetStats(StageStats (&stats)[kLatencyStageCount]) {
+    // Only the few percentiles are taken under the lock, the histograms are too large to copy to a task stack
+    std::lock_guard<std::mutex> lock(histogram_mutex_);
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto& histogram = histograms_[i];
+        stats[i] = {histogram.count, Percentile(histogram, 50), Percentile(histogram, 95), Percentile(histogram, 99),
+            histogram.max_us};
+    }
+}
+
+std::string LatencyTracer::GetStatsJson() {
+    StageStats stats[kLatencyStageCount];
+    GetStats(stats);
+    auto root = cJSON_CreateObject();
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto stage = cJSON_CreateObject();
+        cJSON_AddNumberToObject(stage, "count", stats[i].count);
+        cJSON_AddNumberToObject(stage, "p50_us", stats[i].p50_us);
+        cJSON_AddNumberToObject(stage, "p95_us", stats[i].p95_us);
+        cJSON_AddNumberToObject(stage, "p99_us", stats[i].p99_us);
+        cJSON_AddNumberToObject(stage, "max_us", stats[i].max_us);
+        cJSON_AddItemToObject(root, kStageNames[i], stage);
+    }
+    auto json_str = cJSON_PrintUnformatted(root);
+    std::string json(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(root);
+    return json;
+}
+
+void LatencyTracer::PrintStats() {
+    StageStats stats[kLatencyStageCount];
+    GetStats(stats);
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        ESP_LOGI(TAG, "%-14s count %6lu  p50 %7lu us  p95 %7lu us  p99 %7lu us  max %7lu us", kStageNames[i],
+            stats[i].count, stats[i].p50_us, stats[i].p95_us, stats[i].p99_us, stats[i].max_us);
+    }
+}
+
+#endif // CONFIG_USE_AUDIO_LATENCY_TRACER
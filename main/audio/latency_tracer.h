@@ -0,0 +1,138 @@
+#ifndef LATENCY_TRACER_H
+#define LATENCY_TRACER_H
+
+#include <sdkconfig.h>
+
+/*
+ * Per-stage latency tracer of the audio pipeline, enabled by CONFIG_USE_AUDIO_LATENCY_TRACER.
+ *
+ * Frames carry a LatencyTrace with the monotonic time (esp_timer, in us) of each stage they went through.
+ * When a frame leaves the device (sent or written to I2S) the intervals go into log-scale histograms,
+ * which report p50 / p95 / p99 per stage over the serial log or the self.audio.get_latency_stats MCP tool.
+ * A frame sink (OnFrame) gets the stage times of every frame as well, the protocol recorder streams them
+ * so scripts/protocol_trace.py can merge them with the server's own trace.
+ *
+ * All calls are wrapped in AUDIO_TRACE(), so a disabled tracer leaves no code and no fields behind.
+ */
+#if CONFIG_USE_AUDIO_LATENCY_TRACER
+
+#include <string>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <esp_timer.h>
+
+#define AUDIO_TRACE(statement) statement
+
+struct LatencyTrace {
+    // Uplink
+    uint32_t capture_us = 0;
+    uint32_t processed_us = 0;
+    uint32_t encode_start_us = 0;
+    uint32_t encode_end_us = 0;
+    // Downlink
+    uint32_t frame = 0;         // frame number the protocol recorder gave the packet, 0 without it
+    uint32_t receive_us = 0;
+    uint32_t decode_start_us = 0;
+    uint32_t decode_end_us = 0;
+};
+
+enum LatencyStage {
+    kLatencyStageProcess,       // capture -> audio processor output
+    kLatencyStageEncodeQueue,   // processor output -> encode start
+    kLatencyStageEncode,        // encode start -> encode end
+    kLatencyStageSendQueue,     // encode end -> send
+    kLatencyStageUplink,        // capture -> send
+    kLatencyStageDecodeQueue,   // receive -> decode start (jitter buffer)
+    kLatencyStageDecode,        // decode start -> decode end
+    kLatencyStagePlaybackQueue, // decode end -> I2S write
+    kLatencyStageDownlink,      // receive -> I2S write
+    kLatencyStageCount
+};
+
+enum LatencyDirection : uint8_t {
+    kLatencyUplink = 0,
+    kLatencyDownlink = 1,
+};
+
+// Stage times of one frame that was sent or played, little endian as the protocol recorder sends it
+struct LatencyFrame {
+    uint8_t direction;
+    uint8_t reserved[3];
+    // Downlink only, the frame number from the trace
+    uint32_t frame;
+    // Uplink: capture, processed, encode start, encode end, send. Downlink: receive, decode start, decode end, play
+    uint32_t stages_us[5];
+} __attribute__((packed));
+
+#define LATENCY_HISTOGRAM_BUCKETS 124
+#define LATENCY_CAPTURE_MARKS 16
+
+class LatencyTracer {
+public:
+    static LatencyTracer& GetInstance() {
+        static LatencyTracer instance;
+        return instance;
+    }
+    LatencyTracer(const LatencyTracer&) = delete;
+    LatencyTracer& operator=(const LatencyTracer&) = delete;
+
+    static inline uint32_t Now() { return (uint32_t)esp_timer_get_time(); }
+
+    // The audio processor may hold samples back, so processed frames are matched to their capture time by sample count
+    void MarkCaptured(size_t frames);
+    uint32_t CaptureTimeOf(size_t processed_frames);
+    void ResetCapture();
+
+    // Uplink frames are recorded by the main task once sent, downlink frames by the output task once played
+    void RecordUplink(const LatencyTrace& trace, uint32_t send_us);
+    void RecordDownlink(const LatencyTrace& trace, uint32_t play_us);
+    // Called for every recorded frame with the tracer locked, so it must not block
+    void OnFrame(std::function<void(const LatencyFrame& frame)> callback);
+
+    std::string GetStatsJson();
+    void PrintStats();
+
+private:
+    LatencyTracer() = default;
+
+    struct Histogram {
+        uint32_t count;
+        uint32_t max_us;
+        uint32_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+    };
+    struct StageStats {
+        uint32_t count;
+        uint32_t p50_us;
+        uint32_t p95_us;
+        uint32_t p99_us;
+        uint32_t max_us;
+    };
+    // Recording and reporting run on different tasks
+    std::mutex histogram_mutex_;
+    Histogram histograms_[kLatencyStageCount] = {};
+    std::function<void(const LatencyFrame& frame)> frame_callback_;
+
+    struct CaptureMark {
+        uint64_t end_frame;
+        uint32_t time_us;
+    };
+    std::mutex capture_mutex_;
+    CaptureMark capture_marks_[LATENCY_CAPTURE_MARKS] = {};
+    size_t capture_mark_index_ = 0;
+    uint64_t captured_frames_ = 0;
+    uint64_t processed_frames_ = 0;
+
+    void Record(LatencyStage stage, uint32_t start_us, uint32_t end_us);
+    void GetStats(StageStats (&stats)[kLatencyStageCount]);
+    static uint32_t Percentile(const Histogram& histogram, uint32_t percent);
+};
+
+#else
+
+#define AUDIO_TRACE(statement)
+
+#endif // CONFIG_USE_AUDIO_LATENCY_TRACER
+
+#endif // LATENCY_TRACER_H
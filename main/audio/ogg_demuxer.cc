@@ -0,0 +1,130 @@
+#include "ogg_demuxer.h"
+
+#include <esp_log.h>
+#include <cstring>
+
+#define TAG "OggDemuxer"
+
+#define OGG_PAGE_HEADER_SIZE 27
+
+void OggDemuxer::Open(std::string_view data) {
+    data_ = data;
+    next_page_ = 0;
+    segment_table_ = nullptr;
+    segments_ = 0;
+    segment_index_ = 0;
+    body_offset_ = 0;
+    continued_packet_.clear();
+    continued_returned_ = false;
+    seen_head_ = false;
+    seen_tags_ = false;
+    sample_rate_ = 16000;
+}
+
+void OggDemuxer::Close() {
+    data_ = std::string_view();
+    // Give back the memory of a packet that spanned pages
+    continued_packet_ = std::vector<uint8_t>();
+}
+
+bool OggDemuxer::LoadPage() {
+    auto buf = reinterpret_cast<const uint8_t*>(data_.data());
+    size_t size = data_.size();
+
+    if (next_page_ + 4 <= size && std::memcmp(buf + next_page_, "OggS", 4) != 0) {
+        // Broken page, resync on the next capture pattern
+        auto pos = data_.find("OggS", next_page_);
+        ESP_LOGW(TAG, "Lost page sync at %u", (unsigned)next_page_);
+        next_page_ = pos == std::string_view::npos ? size : pos;
+    }
+    if (next_page_ + OGG_PAGE_HEADER_SIZE > size) {
+        return false;
+    }
+
+    const uint8_t* page = buf + next_page_;
+    size_t segments = page[26];
+    size_t body_offset = next_page_ + OGG_PAGE_HEADER_SIZE + segments;
+    if (body_offset > size) {
+        return false;
+    }
+    size_t body_size = 0;
+    for (size_t i = 0; i < segments; i++) {
+        body_size += page[OGG_PAGE_HEADER_SIZE + i];
+    }
+    if (body_offset + body_size > size) {
+        return false;
+    }
+
+    segment_table_ = page + OGG_PAGE_HEADER_SIZE;
+    segments_ = segments;
+    segment_index_ = 0;
+    body_offset_ = body_offset;
+    next_page_ = body_offset + body_size;
+    return true;
+}
+
+bool OggDemuxer::Next(std::string_view& packet) {
+    if (continued_returned_) {
+        continued_packet_.clear();
+        continued_returned_ = false;
+    }
+    while (IsOpen()) {
+        if (segment_index_ >= segments_ && !LoadPage()) {
+            return false;
+        }
+
+        // Lacing: a packet ends with the first segment shorter than 255 bytes
+        size_t start = body_offset_;
+        size_t length = 0;
+        bool complete = false;
+        while (segment_index_ < segments_) {
+            uint8_t lacing = segment_table_[segment_index_++];
+            length += lacing;
+            if (lacing < 255) {
+                complete = true;
+                break;
+            }
+        }
+        body_offset_ += length;
+
+        std::string_view view = data_.substr(start, length);
+        if (!complete) {
+            // Continues on the next page, this is the only case that copies
+            continued_packet_.insert(continued_packet_.end(), view.begin(), view.end());
+            continue;
+        }
+        if (!continued_packet_.empty()) {
+            continued_packet_.insert(continued_packet_.end(), view.begin(), view.end());
+            view = std::string_view(reinterpret_cast<const char*>(continued_packet_.data()), continued_packet_.size());
+            // Cleared on the next call, the view stays valid until then
+            continued_returned_ = true;
+        }
+        if (view.empty()) {
+            continue;
+        }
+
+        auto p = reinterpret_cast<const uint8_t*>(view.data());
+        if (!seen_head_) {
+            // OpusHead: [0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip, [12-15] input_sample_rate
+            if (view.size() >= 19 && std::memcmp(p, "OpusHead", 8) == 0) {
+                seen_head_ = true;
+                sample_rate_ = p[12] | (p[13] << 8) | (p[14] << 16) | (p[15] << 24);
+                ESP_LOGD(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d", p[8], p[9], sample_rate_);
+            }
+            continued_packet_.clear();
+            continued_returned_ = false;
+            continue;
+        }
+        if (!seen_tags_) {
+            if (view.size() >= 8 && std::memcmp(p, "OpusTags", 8) == 0) {
+                seen_tags_ = true;
+            }
+            continued_packet_.clear();
+            continued_returned_ = false;
+            continue;
+        }
+        packet = view;
+        return true;
+    }
+    return false;
+}
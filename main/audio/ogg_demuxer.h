@@ -0,0 +1,44 @@
+#ifndef OGG_DEMUXER_H
+#define OGG_DEMUXER_H
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Incremental Ogg/Opus demuxer over data that stays mapped (embedded assets in flash).
+ *
+ * Pages are walked one after another from the header sizes, the stream is only scanned for
+ * the "OggS" capture pattern again after a broken page. Packets are returned as views into
+ * the mapped data. Only a packet that continues on the next page is copied, into a buffer
+ * owned by the demuxer. OpusHead and OpusTags are consumed internally.
+ */
+class OggDemuxer {
+public:
+    void Open(std::string_view data);
+    void Close();
+
+    // Next audio packet, valid until the next call. Returns false at the end of the stream.
+    bool Next(std::string_view& packet);
+
+    inline bool IsOpen() const { return !data_.empty(); }
+    inline int sample_rate() const { return sample_rate_; }
+
+private:
+    std::string_view data_;
+    size_t next_page_ = 0;
+    const uint8_t* segment_table_ = nullptr;
+    size_t segments_ = 0;
+    size_t segment_index_ = 0;
+    size_t body_offset_ = 0;
+    std::vector<uint8_t> continued_packet_;
+    bool continued_returned_ = false;
+    bool seen_head_ = false;
+    bool seen_tags_ = false;
+    int sample_rate_ = 16000;
+
+    bool LoadPage();
+};
+
+#endif // OGG_DEMUXER_H
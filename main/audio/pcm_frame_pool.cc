@@ -0,0 +1,88 @@
+#include "pcm_frame_pool.h"
+#include <esp_log.h>
+
+#define TAG "PcmFramePool"
+
+PcmFrame::PcmFrame(PcmFrame&& other) noexcept
+    : pool_(other.pool_), buffer_(other.buffer_), capacity_(other.capacity_) {
+    other.pool_ = nullptr;
+    other.buffer_ = nullptr;
+}
+
+PcmFrame& PcmFrame::operator=(PcmFrame&& other) noexcept {
+    if (this != &other) {
+        Reset();
+        pool_ = other.pool_;
+        buffer_ = other.buffer_;
+        capacity_ = other.capacity_;
+        other.pool_ = nullptr;
+        other.buffer_ = nullptr;
+    }
+    return *this;
+}
+
+void PcmFrame::Reset() {
+    if (buffer_ != nullptr) {
+        pool_->Release(buffer_, capacity_);
+        pool_ = nullptr;
+        buffer_ = nullptr;
+    }
+}
+
+void PcmFramePool::Initialize(size_t frames, size_t frame_samples) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frame_samples_ = frame_samples;
+    buffers_.reserve(frames);
+    free_buffers_.reserve(frames);
+    while (buffers_.size() < frames) {
+        auto buffer = std::make_unique<std::vector<int16_t>>();
+        buffer->reserve(frame_samples_);
+        free_buffers_.push_back(buffer.get());
+        buffers_.push_back(std::move(buffer));
+    }
+    stats_.frames = buffers_.size();
+    ESP_LOGI(TAG, "Initialized %u frames of %u samples", (unsigned)buffers_.size(), (unsigned)frame_samples_);
+}
+
+PcmFrame PcmFramePool::Acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_buffers_.empty()) {
+        // Grow the pool instead of failing, the allocation counter shows it is undersized
+        auto buffer = std::make_unique<std::vector<int16_t>>();
+        buffer->reserve(frame_samples_);
+        free_buffers_.reserve(buffers_.size() + 1);
+        free_buffers_.push_back(buffer.get());
+        buffers_.push_back(std::move(buffer));
+        stats_.frames = buffers_.size();
+        stats_.heap_allocations++;
+        ESP_LOGW(TAG, "Pool exhausted, grown to %u frames", (unsigned)buffers_.size());
+    }
+    auto buffer = free_buffers_.back();
+    free_buffers_.pop_back();
+    buffer->clear();
+
+    stats_.acquired++;
+    stats_.in_use++;
+    if (stats_.in_use > stats_.peak_in_use) {
+        stats_.peak_in_use = stats_.in_use;
+    }
+    return PcmFrame(this, buffer);
+}
+
+void PcmFramePool::Release(std::vector<int16_t>* buffer, size_t acquired_capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The vector reallocated (grew past the frame size, or was moved out and re-reserved here)
+    if (buffer->capacity() != acquired_capacity) {
+        stats_.heap_allocations++;
+    }
+    if (buffer->capacity() < frame_samples_) {
+        buffer->reserve(frame_samples_);
+    }
+    free_buffers_.push_back(buffer);
+    stats_.in_use--;
+}
+
+PcmFramePoolStats PcmFramePool::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
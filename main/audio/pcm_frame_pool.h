@@ -0,0 +1,75 @@
+#ifndef PCM_FRAME_POOL_H
+#define PCM_FRAME_POOL_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+class PcmFramePool;
+
+/*
+ * RAII handle of a pooled PCM buffer. The buffer goes back to its pool when the handle is destroyed.
+ * The vector keeps its reserved capacity between uses, so resize() within a frame never allocates.
+ */
+class PcmFrame {
+public:
+    PcmFrame() = default;
+    ~PcmFrame() { Reset(); }
+    PcmFrame(PcmFrame&& other) noexcept;
+    PcmFrame& operator=(PcmFrame&& other) noexcept;
+    PcmFrame(const PcmFrame&) = delete;
+    PcmFrame& operator=(const PcmFrame&) = delete;
+
+    explicit operator bool() const { return buffer_ != nullptr; }
+    std::vector<int16_t>& operator*() const { return *buffer_; }
+    std::vector<int16_t>* operator->() const { return buffer_; }
+    void Reset();
+
+private:
+    friend class PcmFramePool;
+    PcmFrame(PcmFramePool* pool, std::vector<int16_t>* buffer)
+        : pool_(pool), buffer_(buffer), capacity_(buffer->capacity()) {}
+
+    PcmFramePool* pool_ = nullptr;
+    std::vector<int16_t>* buffer_ = nullptr;
+    size_t capacity_ = 0;
+};
+
+struct PcmFramePoolStats {
+    uint32_t frames = 0;
+    uint32_t in_use = 0;
+    uint32_t peak_in_use = 0;
+    uint32_t acquired = 0;
+    // Heap allocations made after Initialize(), stays constant when the pipeline is allocation free
+    uint32_t heap_allocations = 0;
+};
+
+class PcmFramePool {
+public:
+    static PcmFramePool& GetInstance() {
+        static PcmFramePool instance;
+        return instance;
+    }
+    PcmFramePool(const PcmFramePool&) = delete;
+    PcmFramePool& operator=(const PcmFramePool&) = delete;
+
+    void Initialize(size_t frames, size_t frame_samples);
+    PcmFrame Acquire();
+    PcmFramePoolStats GetStats();
+
+private:
+    friend class PcmFrame;
+    PcmFramePool() = default;
+
+    std::mutex mutex_;
+    size_t frame_samples_ = 0;
+    std::vector<std::unique_ptr<std::vector<int16_t>>> buffers_;
+    std::vector<std::vector<int16_t>*> free_buffers_;
+    PcmFramePoolStats stats_;
+
+    void Release(std::vector<int16_t>* buffer, size_t acquired_capacity);
+};
+
+#endif // PCM_FRAME_POOL_H
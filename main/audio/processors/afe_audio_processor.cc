@@ -16,6 +16,7 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms) {
 
     // Pre-allocate output buffer capacity
     output_buffer_.reserve(frame_samples_);
+    frame_buffer_.reserve(frame_samples_);
 
     int ref_num = codec_->input_reference() ? 1 : 0;
 
@@ -70,6 +71,14 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms) {
     }, "audio_communication", 4096, this, 3, NULL);
 }
 
+void AfeAudioProcessor::SetFrameDuration(int frame_duration_ms) {
+    frame_samples_ = frame_duration_ms * 16000 / 1000;
+    // Samples left over from the previous frame size belong to the last session
+    output_buffer_.clear();
+    output_buffer_.reserve(frame_samples_);
+    frame_buffer_.reserve(frame_samples_);
+}
+
 AfeAudioProcessor::~AfeAudioProcessor() {
     if (afe_data_ != nullptr) {
         afe_iface_->destroy(afe_data_);
@@ -84,7 +93,7 @@ size_t AfeAudioProcessor::GetFeedSize() {
     return afe_iface_->get_feed_chunksize(afe_data_);
 }
 
-void AfeAudioProcessor::Feed(std::vector<int16_t>&& data) {
+void AfeAudioProcessor::Feed(std::vector<int16_t>& data) {
     if (afe_data_ == nullptr) {
         return;
     }
@@ -106,7 +115,7 @@ bool AfeAudioProcessor::IsRunning() {
     return xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING;
 }
 
-void AfeAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+void AfeAudioProcessor::OnOutput(std::function<void(const std::vector<int16_t>& data)> callback) {
     output_callback_ = callback;
 }
 
@@ -152,15 +161,17 @@ void AfeAudioProcessor::AudioProcessorTask() {
             output_buffer_.insert(output_buffer_.end(), res->data, res->data + samples);
             
             // Output complete frames when buffer has enough data
+            // The output callback copies the frame into its own pooled buffer, so neither buffer
+            // loses its capacity here and no allocation happens per frame
             while (output_buffer_.size() >= frame_samples_) {
                 if (output_buffer_.size() == frame_samples_) {
-                    // If buffer size equals frame size, move the entire buffer
-                    output_callback_(std::move(output_buffer_));
+                    // If buffer size equals frame size, hand over the entire buffer
+                    output_callback_(output_buffer_);
                     output_buffer_.clear();
-                    output_buffer_.reserve(frame_samples_);
                 } else {
                     // If buffer size exceeds frame size, copy one frame and remove it
-                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
+                    frame_buffer_.assign(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
+                    output_callback_(frame_buffer_);
                     output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
                 }
             }
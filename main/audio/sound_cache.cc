@@ -0,0 +1,73 @@
+#include "sound_cache.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+
+#define TAG "SoundCache"
+
+SoundCacheEntry::~SoundCacheEntry() {
+    if (pcm != nullptr) {
+        heap_caps_free(pcm);
+    }
+}
+
+void SoundCache::Initialize(size_t capacity_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_bytes_ = capacity_bytes;
+    stats_.capacity_bytes = capacity_bytes;
+}
+
+std::shared_ptr<const SoundCacheEntry> SoundCache::Lookup(const std::string_view& sound) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if ((*it)->key == sound.data() && (*it)->key_size == sound.size()) {
+            entries_.splice(entries_.begin(), entries_, it);
+            stats_.hits++;
+            return entries_.front();
+        }
+    }
+    stats_.misses++;
+    return nullptr;
+}
+
+void SoundCache::Insert(const std::string_view& sound, const int16_t* pcm, size_t samples) {
+    size_t bytes = samples * sizeof(int16_t);
+    if (bytes == 0 || bytes > max_entry_bytes()) {
+        return;
+    }
+
+    auto entry = std::make_shared<SoundCacheEntry>();
+    entry->pcm = (int16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+    if (entry->pcm == nullptr) {
+        ESP_LOGW(TAG, "Failed to allocate %u bytes", (unsigned)bytes);
+        return;
+    }
+    memcpy(entry->pcm, pcm, bytes);
+    entry->key = sound.data();
+    entry->key_size = sound.size();
+    entry->samples = samples;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& cached : entries_) {
+        if (cached->key == entry->key && cached->key_size == entry->key_size) {
+            return;
+        }
+    }
+    while (!entries_.empty() && stats_.bytes + bytes > capacity_bytes_) {
+        stats_.bytes -= entries_.back()->samples * sizeof(int16_t);
+        entries_.pop_back();
+        stats_.evictions++;
+    }
+    entries_.push_front(std::move(entry));
+    stats_.bytes += bytes;
+    stats_.insertions++;
+    stats_.entries = entries_.size();
+    ESP_LOGI(TAG, "Cached %u bytes, %lu entries, %lu/%lu bytes, hits %lu, misses %lu, evictions %lu", (unsigned)bytes,
+        stats_.entries, stats_.bytes, stats_.capacity_bytes, stats_.hits, stats_.misses, stats_.evictions);
+}
+
+SoundCacheStats SoundCache::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
@@ -0,0 +1,57 @@
+#ifndef SOUND_CACHE_H
+#define SOUND_CACHE_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+/* Decoded (and resampled) PCM of one sound asset, the samples live in PSRAM */
+struct SoundCacheEntry {
+    const char* key = nullptr;
+    size_t key_size = 0;
+    int16_t* pcm = nullptr;
+    size_t samples = 0;
+
+    SoundCacheEntry() = default;
+    ~SoundCacheEntry();
+    SoundCacheEntry(const SoundCacheEntry&) = delete;
+    SoundCacheEntry& operator=(const SoundCacheEntry&) = delete;
+};
+
+struct SoundCacheStats {
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    uint32_t insertions = 0;
+    uint32_t evictions = 0;
+    uint32_t entries = 0;
+    uint32_t bytes = 0;
+    uint32_t capacity_bytes = 0;
+};
+
+/*
+ * LRU cache of decoded sound assets, keyed by the address of the embedded Ogg data.
+ * Entries are shared, so a sound that is evicted while playing stays valid until it finishes.
+ */
+class SoundCache {
+public:
+    void Initialize(size_t capacity_bytes);
+
+    // Largest PCM size worth caching, so that a single long sentence cannot flush all the short sounds
+    inline size_t max_entry_bytes() const { return capacity_bytes_ / 4; }
+
+    std::shared_ptr<const SoundCacheEntry> Lookup(const std::string_view& sound);
+    void Insert(const std::string_view& sound, const int16_t* pcm, size_t samples);
+    SoundCacheStats GetStats();
+
+private:
+    std::mutex mutex_;
+    size_t capacity_bytes_ = 0;
+    // Most recently used first
+    std::list<std::shared_ptr<const SoundCacheEntry>> entries_;
+    SoundCacheStats stats_;
+};
+
+#endif // SOUND_CACHE_H
@@ -0,0 +1,114 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/*
+ * Bounded, preallocated, lock-free single-producer / single-consumer queue.
+ *
+ * Push() must only be called from one task at a time, Pop() from one other task at a time.
+ * Head and tail are free-running 32-bit counters, the slot array is rounded up to a power
+ * of two so the counters can wrap, while the logical capacity stays exactly `Capacity`
+ * (or the lower limit set at runtime).
+ *
+ * Any task may call RequestFlush(). The flush is applied lazily by the consumer on its next
+ * Pop(), so the consumer stays the only writer of the head counter.
+ *
+ * Push() and Pop() report the empty -> non-empty and full -> non-full transitions, so the
+ * caller only needs to wake the other side when it may actually be waiting.
+ *
+ * SetLimit() lowers the logical capacity at runtime, for queues whose depth is a duration and whose
+ * items can get longer. Items above a lowered limit stay queued, the queue reports full until they drain.
+ */
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity > 0, "SpscQueue capacity must be greater than 0");
+
+    static constexpr size_t RoundUpPowerOfTwo(size_t value) {
+        size_t result = 1;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    static constexpr size_t kSlots = RoundUpPowerOfTwo(Capacity);
+    static constexpr uint32_t kMask = kSlots - 1;
+
+public:
+    static constexpr size_t capacity() { return Capacity; }
+    size_t limit() const { return limit_.load(std::memory_order_relaxed); }
+    void SetLimit(size_t limit) {
+        limit_.store(std::clamp<size_t>(limit, 1, Capacity), std::memory_order_relaxed);
+    }
+
+    // Producer side. Returns false if the queue is full, `item` is left untouched in that case.
+    bool Push(T&& item, bool* was_empty = nullptr) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load() >= limit()) {
+            return false;
+        }
+        slots_[tail & kMask] = std::move(item);
+        tail_.store(tail + 1);
+        if (was_empty != nullptr) {
+            // Checked after publishing, so a consumer that just saw the queue empty is never missed
+            *was_empty = (tail + 1 - head_.load()) == 1;
+        }
+        return true;
+    }
+
+    // Consumer side. Returns false if the queue is empty.
+    bool Pop(T& item, bool* was_full = nullptr) {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t old_head = head;
+        if (flush_pending_.exchange(false)) {
+            uint32_t target = flush_to_.load();
+            while (static_cast<int32_t>(target - head) > 0) {
+                slots_[head & kMask] = T();
+                head++;
+            }
+            head_.store(head);
+        }
+
+        bool popped = false;
+        if (head != tail_.load()) {
+            item = std::move(slots_[head & kMask]);
+            slots_[head & kMask] = T();
+            head_.store(head + 1);
+            popped = true;
+        }
+        if (was_full != nullptr) {
+            *was_full = tail_.load() - old_head >= limit();
+        }
+        return popped;
+    }
+
+    // Drop everything pushed so far. Safe to call from any task.
+    void RequestFlush() {
+        flush_to_.store(tail_.load());
+        flush_pending_.store(true);
+    }
+
+    size_t Size() const {
+        // Load head first: it never overtakes a tail loaded afterwards
+        uint32_t head = head_.load();
+        return tail_.load() - head;
+    }
+    bool Empty() const { return Size() == 0; }
+    bool Full() const { return Size() >= limit(); }
+
+private:
+    std::array<T, kSlots> slots_;
+    std::atomic<uint32_t> head_ = 0;
+    std::atomic<uint32_t> tail_ = 0;
+    std::atomic<uint32_t> flush_to_ = 0;
+    std::atomic<bool> flush_pending_ = false;
+    std::atomic<size_t> limit_ = Capacity;
+};
+
+#endif // SPSC_QUEUE_H
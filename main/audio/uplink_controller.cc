@@ -0,0 +1,59 @@
+#include "uplink_controller.h"
+
+#include <algorithm>
+
+UplinkController::UplinkController(int max_complexity) : max_complexity_(max_complexity) {
+}
+
+bool UplinkController::Update(const UplinkSample& sample) {
+    auto previous = settings_;
+
+    // Frames waiting for their batch to fill up are not a backlog
+    int32_t excess = (int32_t)sample.queued_frames - (int32_t)(settings_.frames_per_packet - 1);
+    excess = std::max(excess, 0);
+    queue_depth_q4_ += ((excess << 4) - queue_depth_q4_) >> 3;
+    stats_.queue_depth_q4 = queue_depth_q4_;
+
+    if (!congested_ && queue_depth_q4_ >= (UPLINK_CONGESTED_QUEUE_FRAMES << 4)) {
+        congested_ = true;
+        stats_.congestion_events++;
+    } else if (congested_ && queue_depth_q4_ <= (UPLINK_CLEAR_QUEUE_FRAMES << 4)) {
+        congested_ = false;
+    }
+    settings_.frames_per_packet = congested_ ? std::max<size_t>(sample.max_frames_per_packet, 1) : 1;
+
+    if (sample.frame_us > 0) {
+        int32_t load = (int32_t)std::min<int64_t>(sample.encode_us * 100 / sample.frame_us, 1000);
+        if (has_load_) {
+            load_percent_q4_ += ((load << 4) - load_percent_q4_) >> 3;
+        } else {
+            load_percent_q4_ = load << 4;
+            has_load_ = true;
+        }
+        stats_.encode_load_percent = load_percent_q4_ >> 4;
+    }
+
+    int load_percent = load_percent_q4_ >> 4;
+    if (sample.deadline_missed || load_percent > UPLINK_LOAD_LOWER_PERCENT) {
+        // A late frame costs more than any quality gain, step down right away
+        if (settings_.complexity > 0) {
+            settings_.complexity = std::max(settings_.complexity - 2, 0);
+            // Start over from the new load
+            has_load_ = false;
+        }
+        hold_frames_ = 0;
+    } else if (load_percent < UPLINK_LOAD_RAISE_PERCENT && settings_.complexity < max_complexity_) {
+        if (++hold_frames_ >= UPLINK_RAISE_HOLD_FRAMES) {
+            settings_.complexity++;
+            has_load_ = false;
+            hold_frames_ = 0;
+        }
+    } else {
+        hold_frames_ = 0;
+    }
+
+    if (settings_.complexity != previous.complexity) {
+        stats_.complexity_changes++;
+    }
+    return settings_.complexity != previous.complexity || settings_.frames_per_packet != previous.frames_per_packet;
+}
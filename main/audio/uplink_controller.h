@@ -0,0 +1,77 @@
+#ifndef UPLINK_CONTROLLER_H
+#define UPLINK_CONTROLLER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Frames in the send queue beyond the batch being filled that mark the link as congested, and as clear again
+#define UPLINK_CONGESTED_QUEUE_FRAMES 3
+#define UPLINK_CLEAR_QUEUE_FRAMES 1
+// Encode time in percent of the frame duration that allows a higher complexity, or forces a lower one
+#define UPLINK_LOAD_RAISE_PERCENT 30
+#define UPLINK_LOAD_LOWER_PERCENT 60
+// Frames between two complexity raises
+#define UPLINK_RAISE_HOLD_FRAMES 50
+
+struct UplinkSample {
+    // Send queue depth after the frame was queued
+    size_t queued_frames;
+    int64_t encode_us;
+    int64_t frame_us;
+    bool deadline_missed;
+    // Largest batch the server accepted
+    size_t max_frames_per_packet;
+};
+
+struct UplinkSettings {
+    int complexity = 0;
+    size_t frames_per_packet = 1;
+};
+
+struct UplinkControllerStats {
+    uint32_t queue_depth_q4 = 0;
+    uint32_t encode_load_percent = 0;
+    uint32_t congestion_events = 0;
+    uint32_t complexity_changes = 0;
+};
+
+/*
+ * Picks the uplink encoder settings from what the device can observe while listening, not thread-safe.
+ *
+ * The send queue only builds up when the connection cannot drain it, so its smoothed depth stands in for
+ * the available bandwidth. A congested link gets the largest batch the server accepted, which saves a
+ * message header per frame, and a clear link sends every frame on its own for the lowest latency.
+ * The encoder complexity follows the spare CPU: it is raised one step at a time while encoding takes a
+ * small part of the frame, and lowered at once when it takes too much or a frame misses its deadline.
+ * The frame duration is fixed for a session, a session that ends congested or overloaded makes the next
+ * one fall back from short frames to the default ones, see AudioService::AdaptUplinkFrameDuration().
+ */
+class UplinkController {
+public:
+    explicit UplinkController(int max_complexity);
+
+    // Returns true if the settings have changed
+    bool Update(const UplinkSample& sample);
+
+    inline const UplinkSettings& settings() const { return settings_; }
+    inline bool congested() const { return congested_; }
+    // Encoding takes too much of the frame even at the lowest complexity
+    inline bool overloaded() const {
+        return settings_.complexity == 0 && (load_percent_q4_ >> 4) > UPLINK_LOAD_LOWER_PERCENT;
+    }
+    inline const UplinkControllerStats& stats() const { return stats_; }
+
+private:
+    int max_complexity_;
+    UplinkSettings settings_;
+    UplinkControllerStats stats_;
+
+    bool congested_ = false;
+    bool has_load_ = false;
+    // Moving averages with a gain of 1/8, in 1/16 units
+    int32_t queue_depth_q4_ = 0;
+    int32_t load_percent_q4_ = 0;
+    int hold_frames_ = 0;
+};
+
+#endif // UPLINK_CONTROLLER_H
@@ -0,0 +1,48 @@
+#ifndef UPLINK_OVERFLOW_H
+#define UPLINK_OVERFLOW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// What the uplink gives up once the send queue backs up, see UPLINK_OVERFLOW_POLICY in Kconfig
+enum UplinkOverflowPolicy {
+    kUplinkOverflowDropNewest,
+    kUplinkOverflowDropSilenceFirst,
+    kUplinkOverflowPauseEncode,
+};
+
+#if CONFIG_UPLINK_OVERFLOW_DROP_SILENCE_FIRST
+#define UPLINK_OVERFLOW_POLICY kUplinkOverflowDropSilenceFirst
+#elif CONFIG_UPLINK_OVERFLOW_PAUSE_ENCODE
+#define UPLINK_OVERFLOW_POLICY kUplinkOverflowPauseEncode
+#else
+#define UPLINK_OVERFLOW_POLICY kUplinkOverflowDropNewest
+#endif
+
+// Whether the encode task drops a captured frame instead of encoding it, with `queued` of `limit` packets
+// waiting to be sent. The send queue belongs to its consumer, so the new frame is what goes, the old end
+// is trimmed by AudioService::DropStaleSendPackets() once the network is back.
+inline bool ShouldDropUplinkFrame(UplinkOverflowPolicy policy, size_t queued, size_t limit, bool voice) {
+    if (queued >= limit) {
+        return true;
+    }
+    // Past three quarters of the queue, the room left is kept for speech
+    if (policy == kUplinkOverflowDropSilenceFirst && !voice && queued * 4 >= limit * 3) {
+        return true;
+    }
+    return false;
+}
+
+// The input task's side of a queue: never waits for the consumer, an item that finds the queue full is
+// dropped and counted in `drops`. Returns true if the item was queued.
+template <typename Queue, typename Item>
+inline bool PushOrDrop(Queue& queue, Item&& item, uint32_t& drops, bool* was_empty = nullptr) {
+    if (!queue.Push(std::move(item), was_empty)) {
+        drops++;
+        return false;
+    }
+    return true;
+}
+
+#endif // UPLINK_OVERFLOW_H
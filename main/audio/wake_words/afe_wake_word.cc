@@ -71,6 +71,9 @@ bool AfeWakeWord::Initialize(AudioCodec* codec) {
     afe_config->aec_mode = AEC_MODE_SR_HIGH_PERF;
     afe_config->afe_perferred_core = 1;
     afe_config->afe_perferred_priority = 1;
+#if CONFIG_USE_AUDIO_CHANNEL_PRECONNECT
+    afe_config->vad_init = true;
+#endif
     afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
     
     afe_iface_ = esp_afe_handle_from_config(afe_config);
@@ -89,6 +92,10 @@ void AfeWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_
     wake_word_detected_callback_ = callback;
 }
 
+void AfeWakeWord::OnSpeechDetected(std::function<void()> callback) {
+    speech_detected_callback_ = callback;
+}
+
 void AfeWakeWord::Start() {
     xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
 }
@@ -131,6 +138,13 @@ void AfeWakeWord::AudioDetectionTask() {
         // Store the wake word data for voice recognition, like who is speaking
         StoreWakeWordData(res->data, res->data_size / sizeof(int16_t));
 
+        // The wake word may follow a speech onset
+        bool speaking = res->vad_state == VAD_SPEECH;
+        if (speaking && !is_speaking_ && speech_detected_callback_) {
+            speech_detected_callback_();
+        }
+        is_speaking_ = speaking;
+
         if (res->wakeup_state == WAKENET_DETECTED) {
             Stop();
             last_detected_wake_word_ = wake_words_[res->wakenet_model_index - 1];
@@ -151,7 +165,8 @@ void AfeWakeWord::StoreWakeWordData(const int16_t* data, size_t samples) {
     }
 }
 
-void AfeWakeWord::EncodeWakeWordData() {
+void AfeWakeWord::EncodeWakeWordData(int frame_duration_ms) {
+    wake_word_frame_duration_ms_ = frame_duration_ms;
     const size_t stack_size = 4096 * 7;
     wake_word_opus_.clear();
     if (wake_word_encode_task_stack_ == nullptr) {
@@ -167,7 +182,7 @@ void AfeWakeWord::EncodeWakeWordData() {
         auto this_ = (AfeWakeWord*)arg;
         {
             auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, this_->wake_word_frame_duration_ms_);
             encoder->SetComplexity(0); // 0 is the fastest
 
             int packets = 0;
@@ -1,6 +1,7 @@
 #include "custom_wake_word.h"
 #include "audio_service.h"
 #include "system_info.h"
+#include "audio_frame.h"
 
 #include <esp_log.h>
 #include "esp_mn_iface.h"
@@ -83,13 +84,11 @@ void CustomWakeWord::Feed(const std::vector<int16_t>& data) {
     esp_mn_state_t mn_state;
     // If input channels is 2, we need to fetch the left channel data
     if (codec_->input_channels() == 2) {
-        auto mono_data = std::vector<int16_t>(data.size() / 2);
-        for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-            mono_data[i] = data[j];
-        }
+        mono_data_.resize(data.size() / 2);
+        AudioFrameExtractChannel(data.data(), mono_data_.size(), 2, 0, mono_data_.data());
 
-        StoreWakeWordData(mono_data);
-        mn_state = multinet_->detect(multinet_model_data_, const_cast<int16_t*>(mono_data.data()));
+        StoreWakeWordData(mono_data_);
+        mn_state = multinet_->detect(multinet_model_data_, mono_data_.data());
     } else {
         StoreWakeWordData(data);
         mn_state = multinet_->detect(multinet_model_data_, const_cast<int16_t*>(data.data()));
@@ -133,7 +132,8 @@ void CustomWakeWord::StoreWakeWordData(const std::vector<int16_t>& data) {
     }
 }
 
-void CustomWakeWord::EncodeWakeWordData() {
+void CustomWakeWord::EncodeWakeWordData(int frame_duration_ms) {
+    wake_word_frame_duration_ms_ = frame_duration_ms;
     const size_t stack_size = 4096 * 7;
     wake_word_opus_.clear();
     if (wake_word_encode_task_stack_ == nullptr) {
@@ -149,7 +149,7 @@ void CustomWakeWord::EncodeWakeWordData() {
         auto this_ = (CustomWakeWord*)arg;
         {
             auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, this_->wake_word_frame_duration_ms_);
             encoder->SetComplexity(0); // 0 is the fastest
 
             int packets = 0;
@@ -0,0 +1,116 @@
+#include "ble_crc32.h"
+#include "sdkconfig.h"
+
+#if CONFIG_BLE_OTA_CRC32_ROM
+#include "esp_crc.h"
+#elif CONFIG_BLE_OTA_CRC32_TABLE
+#include <stdbool.h>
+#include <string.h>
+#endif
+
+#define BLE_CRC32_POLY  0xEDB88320U
+
+uint32_t ble_crc32_update_bitwise(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ (BLE_CRC32_POLY & ((crc & 1) ? 0xFFFFFFFF : 0));
+        }
+    }
+    return crc;
+}
+
+#if CONFIG_BLE_OTA_CRC32_TABLE
+// slice-by-8 查找表，首次使用时生成 (8KB)
+static uint32_t s_crc32_table[8][256];
+static bool s_crc32_table_ready = false;
+
+static void ble_crc32_init_table(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        s_crc32_table[0][i] = ble_crc32_update_bitwise(0, &(uint8_t){ i }, 1);
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = s_crc32_table[0][i];
+        for (int k = 1; k < 8; k++) {
+            crc = (crc >> 8) ^ s_crc32_table[0][crc & 0xFF];
+            s_crc32_table[k][i] = crc;
+        }
+    }
+    s_crc32_table_ready = true;
+}
+
+static uint32_t ble_crc32_update_table(uint32_t crc, const uint8_t *p, size_t len)
+{
+    if (!s_crc32_table_ready) {
+        ble_crc32_init_table();
+    }
+
+    // 芯片均为小端，每次处理 8 字节
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = s_crc32_table[7][lo & 0xFF] ^ s_crc32_table[6][(lo >> 8) & 0xFF] ^
+              s_crc32_table[5][(lo >> 16) & 0xFF] ^ s_crc32_table[4][lo >> 24] ^
+              s_crc32_table[3][hi & 0xFF] ^ s_crc32_table[2][(hi >> 8) & 0xFF] ^
+              s_crc32_table[1][(hi >> 16) & 0xFF] ^ s_crc32_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ s_crc32_table[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+#endif
+
+uint32_t ble_crc32_update(uint32_t crc, const void *data, size_t len)
+{
+#if CONFIG_BLE_OTA_CRC32_ROM
+    // ROM 实现在入口和出口各取反一次，两边再取反即得到寄存器值
+    return ~esp_crc32_le(~crc, (const uint8_t *)data, len);
+#elif CONFIG_BLE_OTA_CRC32_TABLE
+    return ble_crc32_update_table(crc, (const uint8_t *)data, len);
+#else
+    return ble_crc32_update_bitwise(crc, data, len);
+#endif
+}
+
+// GF(2) 上模多项式乘法，反射表示下 x^0 为最高位
+static uint32_t ble_crc32_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1U << 31;
+    uint32_t p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ BLE_CRC32_POLY : b >> 1;
+    }
+    return p;
+}
+
+uint32_t ble_crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+    // 寄存器值对数据是线性的: crc(A+B) = crc1 * x^(8*len2) + crc2 (mod P)
+    uint32_t power = 1U << 31;      // x^0
+    uint32_t square = 1U << 23;     // x^8
+    while (len2) {
+        if (len2 & 1) {
+            power = ble_crc32_multmodp(square, power);
+        }
+        len2 >>= 1;
+        if (len2) {
+            square = ble_crc32_multmodp(square, square);
+        }
+    }
+    return ble_crc32_multmodp(power, crc1) ^ crc2;
+}
@@ -0,0 +1,28 @@
+#ifndef BLE_CRC32_H
+#define BLE_CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// BLE OTA 使用的 CRC32：反射多项式 0xEDB88320，不做初值与结果取反，
+// 即 crc 直接是移位寄存器的值，新的数据包从 0 开始累加
+
+// 在 crc 的基础上累加 len 字节数据，后端由 CONFIG_BLE_OTA_CRC32_* 选择
+uint32_t ble_crc32_update(uint32_t crc, const void *data, size_t len);
+
+// 逐位实现，作为其他后端的对照基准
+uint32_t ble_crc32_update_bitwise(uint32_t crc, const void *data, size_t len);
+
+// 已知 A 段结束时的 crc1 和 B 段从 0 开始的 crc2，求 A+B 整段的 crc，
+// 两个累加值只需对数据计算一遍
+uint32_t ble_crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_CRC32_H
@@ -1,12 +1,15 @@
 #include "ble_ota.h"
 #include "ble_protocol.h"
+#include "ble_crc32.h"
+#include "ota_image_decoder.h"
 #include "esp_ble.h"
 #include "esp_log.h"
 #include "esp_ota_ops.h"
 #include "esp_app_format.h"
 #include "esp_partition.h"
 #include "esp_err.h"
-#include "esp_crc.h"
+#include "nvs.h"
+#include "spi_flash_mmap.h"
 #include "host/ble_hs.h"
 
 #include "freertos/FreeRTOS.h"
@@ -16,43 +19,44 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 
 static const char* TAG = "BLE_OTA";
 
-// OTA数据消息结构
+// 写入 Flash 的数据块
 typedef struct {
-    uint16_t conn_id;
-    uint16_t len;
-    uint8_t data[];
-} ble_ota_data_msg_t;
+    uint8_t *data;
+    uint32_t len;
+    uint32_t end_offset;    // 写完这一块后的文件位置
+    uint32_t end_crc32;     // 文件开头到 end_offset 的 CRC32
+} ble_ota_block_t;
+
+// 保存在 NVS 的续传记录：固件标识 + 已写入 Flash 的字节数及其 CRC32，只用于原始固件
+typedef struct {
+    uint8_t version[3];
+    uint8_t reserved;
+    uint32_t file_size;
+    uint32_t file_crc32;
+    uint32_t partition_address;
+    uint32_t offset;
+    uint32_t crc32;
+} ble_ota_checkpoint_t;
 
 // 任务配置
+#define BLE_OTA_WRITE_TIMEOUT_MS    5000
 #define BLE_OTA_TASK_STACK_SIZE     4096
 #define BLE_OTA_TASK_PRIORITY       3
-#define BLE_OTA_QUEUE_SIZE          10
-
-static uint32_t lr_crc_compute(uint8_t const * p_data, uint32_t size,uint32_t*p_crc)
-{
-    uint32_t crc;
-    if (p_crc == NULL) {
-        crc = 0XFFFFFFFF;
-    } else {
-        crc = *p_crc;
-    }
-
-    // ESP_LOGI(TAG, "CRC init: 0x%08X", crc);
-
-    for (uint32_t i = 0; i < size; i++)
-    {
-        crc = crc ^ p_data[i];
-        for (uint32_t j = 8; j > 0; j--)
-        {
-            crc = (crc >> 1) ^ (0xEDB88320U & ((crc & 1) ? 0xFFFFFFFF : 0));
-        }
-    }
-    return crc;
-}
-
+#define BLE_OTA_WINDOW_MAX          CONFIG_BLE_OTA_WINDOW_MAX
+// APP 最多有 BLE_OTA_WINDOW_MAX 个 4KB 数据包未确认，接收缓冲区需容纳这些包及其分包开销
+#define BLE_OTA_RX_BUFFER_SIZE      ((BLE_OTA_WINDOW_MAX + 1) * 4096)
+// 固件标识：version(3) + file_size(4) + file_crc32(4)，与发送文件信息的前 11 字节相同
+#define BLE_OTA_IMAGE_INFO_LEN      11
+// 连接断开后保留会话的时间，超时后释放内存，原始固件仍可从 NVS 记录的位置继续
+#define BLE_OTA_SUSPEND_TIMEOUT_MS  (5 * 60 * 1000)
+#define BLE_OTA_NVS_NAMESPACE       "ble_ota"
+#define BLE_OTA_NVS_KEY             "checkpoint"
+// 续传记录最多每 64KB 写一次 NVS，与 HTTP 升级相同
+#define BLE_OTA_RESUME_SAVE_INTERVAL (64 * 1024)
 
 // OTA状态管理
 typedef struct {
@@ -73,10 +77,32 @@ typedef struct {
     uint32_t total_written;
     uint32_t total_crc32;
     
-    // OTA操作
-    esp_ota_handle_t ota_handle;
+    // OTA操作：直接写分区，重启后可以从 NVS 记录的位置继续
     const esp_partition_t* ota_partition;
-    uint8_t* ota_buffer;
+    uint32_t flash_offset;          // 解码后写入分区的字节数，包括暂存在 flash_tail 中的部分
+    uint32_t erased_end;            // 分区已擦除到的位置
+    uint8_t flash_tail[16];         // Flash 加密时按 16 字节写入，不足 16 字节的尾部暂存在这里
+    uint8_t flash_tail_len;
+    uint8_t* ota_buffer;            // 正在接收的数据块，指向 ota_blocks 之一
+
+    // 异步写 Flash：接收第 N+1 块的同时写入前面的块
+    uint8_t window;                 // 与 APP 协商的未确认数据包数
+    uint8_t block_count;            // window + 1 个数据块轮流使用
+    uint8_t block_index;
+    uint8_t* ota_blocks[BLE_OTA_WINDOW_MAX + 1];
+    SemaphoreHandle_t free_blocks;
+    atomic_int pending_writes;
+    volatile esp_err_t write_error;
+    ota_image_decoder_t *decoder;   // 压缩/差分固件由写Flash任务解码后写入，从 NVS 续传的原始固件为 NULL
+
+    // 断点续传：查询续传位置时的结果，紧接着的发送文件信息据此继续
+    uint8_t resume_info[BLE_OTA_IMAGE_INFO_LEN];
+    uint16_t resume_conn_id;
+    uint32_t resume_offset;
+    uint32_t resume_crc32;
+    bool resume_from_nvs;
+    TickType_t suspended_at;
+    atomic_bool disconnected;       // 会话连接已断开，由 OTA 任务挂起会话
 
     bool success_finish;
 
@@ -86,10 +112,12 @@ typedef struct {
     // 互斥锁
     SemaphoreHandle_t mutex;
     
-    // 队列和任务
-    QueueHandle_t data_queue;
+    // 接收与处理任务
+    ble_route_handle_t route;
     TaskHandle_t task_handle;
     bool task_running;
+    QueueHandle_t write_queue;
+    TaskHandle_t writer_handle;
 } ble_ota_context_t;
 
 static ble_ota_context_t g_ota_ctx = {0};
@@ -97,15 +125,25 @@ static ble_ota_context_t g_ota_ctx = {0};
 // 函数声明
 static void ble_ota_event_handler(ble_evt_t *evt);
 static void ble_ota_task(void *arg);
+static void ble_ota_writer_task(void *arg);
+static void ble_ota_suspend(void);
+static bool ble_ota_wait_writes(void);
+static void ble_ota_free_blocks(void);
 static esp_err_t ble_ota_process_data(uint16_t conn_id, uint8_t *data, uint16_t len);
 static esp_err_t ble_ota_handle_send_file_info(uint16_t conn_id, uint8_t *data, uint16_t len);
 static esp_err_t ble_ota_handle_send_file_data(uint16_t conn_id, uint8_t *data, uint16_t len);
 static esp_err_t ble_ota_handle_send_packet_crc(uint16_t conn_id, uint8_t *data, uint16_t len);
+static esp_err_t ble_ota_handle_query_resume(uint16_t conn_id, uint8_t *data, uint16_t len);
 static bool ble_ota_check_version(const uint8_t *new_version);
 
 esp_err_t ble_ota_init(ble_ota_progress_callback_t progress_cb)
 {
     ESP_LOGI(TAG, "Initializing BLE OTA module");
+
+    esp_err_t err = ble_protocol_init();
+    if (err != ESP_OK) {
+        return err;
+    }
     
     memset(&g_ota_ctx, 0, sizeof(g_ota_ctx));
     g_ota_ctx.state = BLE_OTA_STATE_IDLE;
@@ -117,12 +155,13 @@ esp_err_t ble_ota_init(ble_ota_progress_callback_t progress_cb)
         return ESP_ERR_NO_MEM;
     }
     
-    // 创建数据队列
-    g_ota_ctx.data_queue = xQueueCreate(BLE_OTA_QUEUE_SIZE, sizeof(ble_ota_data_msg_t*));
-    if (g_ota_ctx.data_queue == NULL) {
-        ESP_LOGE(TAG, "Failed to create data queue");
+    // OTA 命令由 BLE 协议栈直接放入接收缓冲区
+    err = esp_ble_register_route(BLE_OTA_CMD_SEND_FILE_INFO, BLE_OTA_CMD_QUERY_RESUME,
+                                 BLE_OTA_RX_BUFFER_SIZE, &g_ota_ctx.route);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register OTA route");
         vSemaphoreDelete(g_ota_ctx.mutex);
-        return ESP_ERR_NO_MEM;
+        return err;
     }
     
     // 创建OTA处理任务
@@ -137,7 +176,22 @@ esp_err_t ble_ota_init(ble_ota_progress_callback_t progress_cb)
     
     if (ret != pdPASS) {
         ESP_LOGE(TAG, "Failed to create OTA task");
-        vQueueDelete(g_ota_ctx.data_queue);
+        esp_ble_unregister_route(g_ota_ctx.route);
+        vSemaphoreDelete(g_ota_ctx.mutex);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // 创建写Flash队列和任务
+    g_ota_ctx.write_queue = xQueueCreate(BLE_OTA_WINDOW_MAX + 1, sizeof(ble_ota_block_t));
+    if (g_ota_ctx.write_queue == NULL ||
+        xTaskCreate(ble_ota_writer_task, "ble_ota_writer", BLE_OTA_TASK_STACK_SIZE, NULL,
+                    BLE_OTA_TASK_PRIORITY, &g_ota_ctx.writer_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create OTA writer task");
+        if (g_ota_ctx.write_queue) {
+            vQueueDelete(g_ota_ctx.write_queue);
+        }
+        vTaskDelete(g_ota_ctx.task_handle);
+        esp_ble_unregister_route(g_ota_ctx.route);
         vSemaphoreDelete(g_ota_ctx.mutex);
         return ESP_ERR_NO_MEM;
     }
@@ -148,7 +202,9 @@ esp_err_t ble_ota_init(ble_ota_progress_callback_t progress_cb)
         ESP_LOGE(TAG, "Failed to register BLE callback: %s", esp_err_to_name(esp_ret));
         g_ota_ctx.task_running = false;
         vTaskDelete(g_ota_ctx.task_handle);
-        vQueueDelete(g_ota_ctx.data_queue);
+        vTaskDelete(g_ota_ctx.writer_handle);
+        vQueueDelete(g_ota_ctx.write_queue);
+        esp_ble_unregister_route(g_ota_ctx.route);
         vSemaphoreDelete(g_ota_ctx.mutex);
         return esp_ret;
     }
@@ -169,10 +225,6 @@ esp_err_t ble_ota_deinit(void)
     if (g_ota_ctx.task_running) {
         g_ota_ctx.task_running = false;
         
-        // 发送空消息通知任务退出
-        ble_ota_data_msg_t* exit_msg = NULL;
-        xQueueSend(g_ota_ctx.data_queue, &exit_msg, 0);
-        
         // 等待任务退出
         vTaskDelay(pdMS_TO_TICKS(100));
         
@@ -181,25 +233,27 @@ esp_err_t ble_ota_deinit(void)
             g_ota_ctx.task_handle = NULL;
         }
     }
-    
-    // 清理队列
-    if (g_ota_ctx.data_queue) {
-        // 清理队列中剩余的消息
-        ble_ota_data_msg_t* msg;
-        while (xQueueReceive(g_ota_ctx.data_queue, &msg, 0) == pdTRUE) {
-            if (msg) {
-                free(msg);
-            }
-        }
-        vQueueDelete(g_ota_ctx.data_queue);
-        g_ota_ctx.data_queue = NULL;
+
+    // 等待写Flash任务完成已提交的数据块后退出
+    ble_ota_wait_writes();
+    if (g_ota_ctx.writer_handle) {
+        vTaskDelete(g_ota_ctx.writer_handle);
+        g_ota_ctx.writer_handle = NULL;
+    }
+    if (g_ota_ctx.write_queue) {
+        vQueueDelete(g_ota_ctx.write_queue);
+        g_ota_ctx.write_queue = NULL;
     }
     
-    // 如果正在进行OTA操作，终止它
-    if (g_ota_ctx.state != BLE_OTA_STATE_IDLE && g_ota_ctx.ota_handle != 0) {
-        esp_ota_abort(g_ota_ctx.ota_handle);
+    // 任务已停止，释放接收缓冲区
+    if (g_ota_ctx.route) {
+        esp_ble_unregister_route(g_ota_ctx.route);
+        g_ota_ctx.route = NULL;
     }
     
+    ble_ota_free_blocks();
+    ota_image_decoder_destroy(g_ota_ctx.decoder);
+
     if (g_ota_ctx.mutex) {
         vSemaphoreDelete(g_ota_ctx.mutex);
     }
@@ -214,59 +268,351 @@ ble_ota_state_t ble_ota_get_state(void)
     return g_ota_ctx.state;
 }
 
-void ble_ota_reset_state(void)
+static uint32_t ble_ota_get_u32(const uint8_t *data)
+{
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void ble_ota_put_u32(uint8_t *data, uint32_t value)
+{
+    data[0] = value >> 0;
+    data[1] = value >> 8;
+    data[2] = value >> 16;
+    data[3] = value >> 24;
+}
+
+// info 为固件标识，与当前会话是同一个固件
+static bool ble_ota_same_image(const uint8_t *info)
+{
+    return memcmp(g_ota_ctx.version, info, 3) == 0 &&
+           g_ota_ctx.file_size == ble_ota_get_u32(info + 3) &&
+           g_ota_ctx.file_crc32 == ble_ota_get_u32(info + 7);
+}
+
+// 正在传输或断开后等待继续的会话
+static bool ble_ota_session_active(void)
+{
+    return g_ota_ctx.state == BLE_OTA_STATE_WAIT_FILE_DATA ||
+           g_ota_ctx.state == BLE_OTA_STATE_WAIT_PACKET_CRC ||
+           g_ota_ctx.state == BLE_OTA_STATE_SUSPENDED;
+}
+
+static void ble_ota_save_checkpoint(uint32_t offset, uint32_t crc32)
+{
+    ble_ota_checkpoint_t checkpoint = {
+        .file_size = g_ota_ctx.file_size,
+        .file_crc32 = g_ota_ctx.file_crc32,
+        .partition_address = g_ota_ctx.ota_partition->address,
+        .offset = offset,
+        .crc32 = crc32,
+    };
+    memcpy(checkpoint.version, g_ota_ctx.version, 3);
+
+    nvs_handle_t nvs;
+    if (nvs_open(BLE_OTA_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(nvs, BLE_OTA_NVS_KEY, &checkpoint, sizeof(checkpoint)) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+}
+
+static void ble_ota_clear_checkpoint(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(BLE_OTA_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_erase_key(nvs, BLE_OTA_NVS_KEY) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+}
+
+// NVS 中同一固件的续传记录，读回 Flash 校验后返回按扇区对齐的续传位置
+static bool ble_ota_verify_checkpoint(const uint8_t *info, uint32_t *offset, uint32_t *crc32)
 {
-    if (xSemaphoreTake(g_ota_ctx.mutex, pdMS_TO_TICKS(1000)) == pdTRUE) {
-        if (g_ota_ctx.ota_handle != 0) {
-            esp_ota_abort(g_ota_ctx.ota_handle);
-            g_ota_ctx.ota_handle = 0;
+    ble_ota_checkpoint_t checkpoint;
+    size_t size = sizeof(checkpoint);
+    nvs_handle_t nvs;
+    if (nvs_open(BLE_OTA_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    esp_err_t ret = nvs_get_blob(nvs, BLE_OTA_NVS_KEY, &checkpoint, &size);
+    nvs_close(nvs);
+    if (ret != ESP_OK || size != sizeof(checkpoint)) {
+        return false;
+    }
+
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL || checkpoint.partition_address != partition->address ||
+        memcmp(checkpoint.version, info, 3) != 0 ||
+        checkpoint.file_size != ble_ota_get_u32(info + 3) ||
+        checkpoint.file_crc32 != ble_ota_get_u32(info + 7) ||
+        checkpoint.offset == 0 || checkpoint.offset >= checkpoint.file_size) {
+        return false;
+    }
+
+    // 记录之后的扇区可能已写入一部分，从记录所在扇区的开头继续
+    uint32_t aligned = checkpoint.offset / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+    uint8_t *buffer = (uint8_t *)malloc(SPI_FLASH_SEC_SIZE);
+    if (buffer == NULL) {
+        return false;
+    }
+    uint32_t crc = 0;
+    uint32_t aligned_crc = 0;
+    for (uint32_t pos = 0; pos < checkpoint.offset && ret == ESP_OK; pos += SPI_FLASH_SEC_SIZE) {
+        if (pos == aligned) {
+            aligned_crc = crc;
         }
-        
-        g_ota_ctx.state = BLE_OTA_STATE_IDLE;
-        g_ota_ctx.conn_id = 0;
-        g_ota_ctx.file_size = 0;
-        g_ota_ctx.file_crc32 = 0;
-        g_ota_ctx.packet_length = 0;
-        g_ota_ctx.received_bytes = 0;
-        g_ota_ctx.expected_bytes = 0;
-        g_ota_ctx.packet_crc32 = 0;
-        g_ota_ctx.ota_partition = NULL;
-        g_ota_ctx.total_crc32 = 0;
-        g_ota_ctx.success_finish = false;
+        uint32_t n = checkpoint.offset - pos < SPI_FLASH_SEC_SIZE ? checkpoint.offset - pos : SPI_FLASH_SEC_SIZE;
+        ret = esp_partition_read(partition, pos, buffer, n);
+        crc = ble_crc32_update(crc, buffer, n);
+    }
+    if (aligned == checkpoint.offset) {
+        aligned_crc = crc;
+    }
+    free(buffer);
 
-        if (g_ota_ctx.ota_buffer) {
-            free(g_ota_ctx.ota_buffer);
-            g_ota_ctx.ota_buffer = NULL;
+    if (ret != ESP_OK || crc != checkpoint.crc32) {
+        ESP_LOGW(TAG, "OTA checkpoint does not match partition %s", partition->label);
+        return false;
+    }
+    *offset = aligned;
+    *crc32 = aligned_crc;
+    return aligned > 0;
+}
+
+// 等待已提交的数据块全部写入Flash
+static bool ble_ota_wait_writes(void)
+{
+    for (int i = 0; i < BLE_OTA_WRITE_TIMEOUT_MS / 10; i++) {
+        if (atomic_load(&g_ota_ctx.pending_writes) == 0) {
+            return true;
         }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    ESP_LOGE(TAG, "Timeout waiting for %d flash writes", atomic_load(&g_ota_ctx.pending_writes));
+    return false;
+}
 
-        xSemaphoreGive(g_ota_ctx.mutex);
+static esp_err_t ble_ota_alloc_blocks(uint8_t window)
+{
+    g_ota_ctx.window = window;
+    g_ota_ctx.block_count = window + 1;
+    g_ota_ctx.block_index = 0;
+    g_ota_ctx.write_error = ESP_OK;
+    for (int i = 0; i < g_ota_ctx.block_count; i++) {
+        g_ota_ctx.ota_blocks[i] = (uint8_t *)malloc(g_ota_ctx.packet_length);
+        if (g_ota_ctx.ota_blocks[i] == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    // 正在接收的数据块占用一个
+    g_ota_ctx.free_blocks = xSemaphoreCreateCounting(g_ota_ctx.block_count, g_ota_ctx.block_count - 1);
+    if (g_ota_ctx.free_blocks == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    g_ota_ctx.ota_buffer = g_ota_ctx.ota_blocks[0];
+    return ESP_OK;
+}
+
+// 只在没有未完成的写入时调用
+static void ble_ota_free_blocks(void)
+{
+    for (int i = 0; i < BLE_OTA_WINDOW_MAX + 1; i++) {
+        if (g_ota_ctx.ota_blocks[i]) {
+            free(g_ota_ctx.ota_blocks[i]);
+            g_ota_ctx.ota_blocks[i] = NULL;
+        }
+    }
+    if (g_ota_ctx.free_blocks) {
+        vSemaphoreDelete(g_ota_ctx.free_blocks);
+        g_ota_ctx.free_blocks = NULL;
+    }
+    g_ota_ctx.ota_buffer = NULL;
+    g_ota_ctx.block_count = 0;
+}
+
+// 校验通过的数据块交给写Flash任务，并切换到下一个空闲数据块
+static esp_err_t ble_ota_submit_block(void)
+{
+    if (g_ota_ctx.write_error != ESP_OK) {
+        return g_ota_ctx.write_error;
+    }
+
+    ble_ota_block_t block = {
+        .data = g_ota_ctx.ota_buffer,
+        .len = g_ota_ctx.received_bytes,
+        .end_offset = g_ota_ctx.total_written + g_ota_ctx.received_bytes,
+        .end_crc32 = g_ota_ctx.total_crc32,
+    };
+    atomic_fetch_add(&g_ota_ctx.pending_writes, 1);
+    xQueueSend(g_ota_ctx.write_queue, &block, portMAX_DELAY);
+
+    if (g_ota_ctx.total_written + g_ota_ctx.received_bytes >= g_ota_ctx.file_size) {
+        // 最后一块，不再需要新的数据块
+        return ESP_OK;
+    }
+
+    // 所有数据块都在等待写入时，由此限制 APP 的发送速度
+    if (xSemaphoreTake(g_ota_ctx.free_blocks, pdMS_TO_TICKS(BLE_OTA_WRITE_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Timeout waiting for a free OTA block");
+        return ESP_ERR_TIMEOUT;
+    }
+    g_ota_ctx.block_index = (g_ota_ctx.block_index + 1) % g_ota_ctx.block_count;
+    g_ota_ctx.ota_buffer = g_ota_ctx.ota_blocks[g_ota_ctx.block_index];
+    return g_ota_ctx.write_error;
+}
+
+static esp_err_t ble_ota_write_decoded(void *ctx, const uint8_t *data, size_t len)
+{
+    const esp_partition_t *partition = g_ota_ctx.ota_partition;
+    uint32_t end = g_ota_ctx.flash_offset + len;
+    if (end > partition->size) {
+        ESP_LOGE(TAG, "Image larger than partition %s", partition->label);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // 写到哪里擦到哪里，续传时不擦除已写入的扇区
+    esp_err_t ret;
+    if (end > g_ota_ctx.erased_end) {
+        uint32_t erase_end = (end + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+        ret = esp_partition_erase_range(partition, g_ota_ctx.erased_end, erase_end - g_ota_ctx.erased_end);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        g_ota_ctx.erased_end = erase_end;
+    }
+
+    // 加密分区按 16 字节写入，先补齐上次剩下的尾部，本次不足 16 字节的部分留到下次
+    uint32_t pos = g_ota_ctx.flash_offset - g_ota_ctx.flash_tail_len;
+    if (g_ota_ctx.flash_tail_len > 0) {
+        size_t n = 16 - g_ota_ctx.flash_tail_len < len ? 16 - g_ota_ctx.flash_tail_len : len;
+        memcpy(g_ota_ctx.flash_tail + g_ota_ctx.flash_tail_len, data, n);
+        g_ota_ctx.flash_tail_len += n;
+        data += n;
+        len -= n;
+        if (g_ota_ctx.flash_tail_len < 16) {
+            g_ota_ctx.flash_offset = end;
+            return ESP_OK;
+        }
+        ret = esp_partition_write(partition, pos, g_ota_ctx.flash_tail, 16);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        pos += 16;
+        g_ota_ctx.flash_tail_len = 0;
+    }
+    size_t aligned = len & ~15;
+    if (aligned > 0) {
+        ret = esp_partition_write(partition, pos, data, aligned);
+        if (ret != ESP_OK) {
+            return ret;
+        }
     }
+    memcpy(g_ota_ctx.flash_tail, data + aligned, len - aligned);
+    g_ota_ctx.flash_tail_len = len - aligned;
+    g_ota_ctx.flash_offset = end;
+    return ESP_OK;
+}
+
+// 固件结束后写入暂存的尾部，用 0xFF 补齐 16 字节
+static esp_err_t ble_ota_flush_tail(void)
+{
+    if (g_ota_ctx.flash_tail_len == 0) {
+        return ESP_OK;
+    }
+    memset(g_ota_ctx.flash_tail + g_ota_ctx.flash_tail_len, 0xFF, 16 - g_ota_ctx.flash_tail_len);
+    esp_err_t ret = esp_partition_write(g_ota_ctx.ota_partition, g_ota_ctx.flash_offset - g_ota_ctx.flash_tail_len,
+                                        g_ota_ctx.flash_tail, 16);
+    if (ret == ESP_OK) {
+        g_ota_ctx.flash_tail_len = 0;
+    }
+    return ret;
+}
+
+static void ble_ota_writer_task(void *arg)
+{
+    ble_ota_block_t block;
+
+    while (xQueueReceive(g_ota_ctx.write_queue, &block, portMAX_DELAY) == pdTRUE) {
+        // 出错后丢弃剩余数据块，等待重置
+        if (g_ota_ctx.write_error == ESP_OK) {
+            esp_err_t ret = g_ota_ctx.decoder != NULL ? ota_image_decoder_feed(g_ota_ctx.decoder, block.data, block.len)
+                                                      : ble_ota_write_decoded(NULL, block.data, block.len);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(ret));
+                g_ota_ctx.write_error = ret;
+            } else if ((g_ota_ctx.decoder == NULL || ota_image_decoder_get_type(g_ota_ctx.decoder) == OTA_IMAGE_TYPE_RAW) &&
+                       g_ota_ctx.flash_offset - g_ota_ctx.flash_tail_len == block.end_offset &&
+                       block.end_offset / BLE_OTA_RESUME_SAVE_INTERVAL != (block.end_offset - block.len) / BLE_OTA_RESUME_SAVE_INTERVAL) {
+                // 原始固件的文件位置就是 Flash 位置，数据全部落到 Flash 后，每越过 64KB 记录一次续传位置
+                ble_ota_save_checkpoint(block.end_offset, block.end_crc32);
+            }
+        }
+        xSemaphoreGive(g_ota_ctx.free_blocks);
+        atomic_fetch_sub(&g_ota_ctx.pending_writes, 1);
+    }
+    vTaskDelete(NULL);
+}
+
+void ble_ota_reset_state(void)
+{
+    // OTA 任务可能正持锁等待空闲数据块，最多 BLE_OTA_WRITE_TIMEOUT_MS
+    if (xSemaphoreTake(g_ota_ctx.mutex, pdMS_TO_TICKS(BLE_OTA_WRITE_TIMEOUT_MS + 1000)) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to take mutex, OTA state not reset");
+        return;
+    }
+    // 写Flash任务仍在使用分区和数据块，已写入的部分保留给 NVS 续传
+    ble_ota_wait_writes();
+    
+    g_ota_ctx.state = BLE_OTA_STATE_IDLE;
+    g_ota_ctx.conn_id = 0;
+    g_ota_ctx.file_size = 0;
+    g_ota_ctx.file_crc32 = 0;
+    g_ota_ctx.packet_length = 0;
+    g_ota_ctx.received_bytes = 0;
+    g_ota_ctx.expected_bytes = 0;
+    g_ota_ctx.packet_crc32 = 0;
+    g_ota_ctx.ota_partition = NULL;
+    g_ota_ctx.total_crc32 = 0;
+    g_ota_ctx.total_written = 0;
+    g_ota_ctx.flash_offset = 0;
+    g_ota_ctx.erased_end = 0;
+    g_ota_ctx.flash_tail_len = 0;
+    g_ota_ctx.resume_offset = 0;
+    g_ota_ctx.success_finish = false;
+
+    ble_ota_free_blocks();
+    ota_image_decoder_destroy(g_ota_ctx.decoder);
+    g_ota_ctx.decoder = NULL;
+
+    xSemaphoreGive(g_ota_ctx.mutex);
     
     ESP_LOGI(TAG, "OTA state reset to IDLE");
 }
 
 static void ble_ota_task(void *arg)
 {
-    ble_ota_data_msg_t* msg;
+    ble_route_packet_t* packet;
     
     ESP_LOGI(TAG, "BLE OTA task started");
     while(!g_ota_ctx.task_running){
         vTaskDelay(pdMS_TO_TICKS(1000));
     }
     while (g_ota_ctx.task_running) {
-        // 等待队列消息
-        if (xQueueReceive(g_ota_ctx.data_queue, &msg, pdMS_TO_TICKS(10000)) == pdTRUE) {
-            if (msg == NULL) {
-                // 收到退出信号
-                ESP_LOGI(TAG, "BLE OTA task received exit signal");
-                break;
-            }
-            
-            // 处理数据
-            ble_ota_process_data(msg->conn_id, msg->data, msg->len);
-            
-            // 释放消息内存
-            free(msg);
+        // 等待数据包，直接在接收缓冲区中处理
+        // 超时后检查断开和挂起超时
+        packet = esp_ble_route_receive(g_ota_ctx.route, 1000);
+        // 挂起后，断开前残留的数据包由 ble_ota_process_data 忽略
+        if (atomic_exchange(&g_ota_ctx.disconnected, false)) {
+            ble_ota_suspend();
+        }
+        if (packet != NULL) {
+            ble_ota_process_data(packet->conn_id, packet->data, packet->len);
+            esp_ble_route_return(g_ota_ctx.route, packet);
 
             if(g_ota_ctx.success_finish) {
                 // 处理成功完成的情况
@@ -275,6 +621,13 @@ static void ble_ota_task(void *arg)
                 break;
             }
         }
+
+        // 断开后长时间没有继续，释放会话占用的内存
+        if (g_ota_ctx.state == BLE_OTA_STATE_SUSPENDED &&
+            xTaskGetTickCount() - g_ota_ctx.suspended_at > pdMS_TO_TICKS(BLE_OTA_SUSPEND_TIMEOUT_MS)) {
+            ESP_LOGW(TAG, "Suspended OTA session expired");
+            ble_ota_reset_state();
+        }
     }
     
     ESP_LOGI(TAG, "BLE OTA task exited");
@@ -305,6 +658,14 @@ static esp_err_t ble_ota_process_data(uint16_t conn_id, uint8_t *data, uint16_t
         return ESP_OK;
     }
     
+    // 断开前收到的数据包，以及不属于当前会话连接的数据包，不影响会话
+    if ((cmd == BLE_OTA_CMD_SEND_FILE_DATA || cmd == BLE_OTA_CMD_SEND_PACKET_CRC) &&
+        (g_ota_ctx.state == BLE_OTA_STATE_SUSPENDED ||
+         (g_ota_ctx.state != BLE_OTA_STATE_IDLE && conn_id != g_ota_ctx.conn_id))) {
+        ESP_LOGW(TAG, "Ignoring OTA command 0x%02X from conn_id %d", cmd, conn_id);
+        return ESP_OK;
+    }
+
     ESP_LOGI(TAG, "Processing OTA command: 0x%02X, payload_len: %d", cmd, payload_len);
     
     switch (cmd) {
@@ -316,6 +677,9 @@ static esp_err_t ble_ota_process_data(uint16_t conn_id, uint8_t *data, uint16_t
             
         case BLE_OTA_CMD_SEND_PACKET_CRC:
             return ble_ota_handle_send_packet_crc(conn_id, (uint8_t*)payload, payload_len);
+
+        case BLE_OTA_CMD_QUERY_RESUME:
+            return ble_ota_handle_query_resume(conn_id, (uint8_t*)payload, payload_len);
             
         default:
             ESP_LOGE(TAG, "Unknown OTA command: 0x%02X", cmd);
@@ -323,6 +687,27 @@ static esp_err_t ble_ota_process_data(uint16_t conn_id, uint8_t *data, uint16_t
     }
 }
 
+// 丢弃未校验的数据包，保留已确认的进度、数据块和解码器，只在 OTA 任务中调用，不会与等待空闲数据块的提交冲突
+static void ble_ota_suspend(void)
+{
+    if (xSemaphoreTake(g_ota_ctx.mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    bool active = g_ota_ctx.state == BLE_OTA_STATE_WAIT_FILE_DATA || g_ota_ctx.state == BLE_OTA_STATE_WAIT_PACKET_CRC;
+    if (active) {
+        g_ota_ctx.received_bytes = 0;
+        g_ota_ctx.packet_crc32 = 0;
+        g_ota_ctx.state = BLE_OTA_STATE_SUSPENDED;
+        g_ota_ctx.suspended_at = xTaskGetTickCount();
+        ESP_LOGI(TAG, "OTA suspended at %lu/%lu bytes", g_ota_ctx.total_written, g_ota_ctx.file_size);
+    }
+    xSemaphoreGive(g_ota_ctx.mutex);
+
+    if (!active && g_ota_ctx.state != BLE_OTA_STATE_SUSPENDED) {
+        ble_ota_reset_state();
+    }
+}
+
 static void ble_ota_event_handler(ble_evt_t *evt)
 {
     if (evt == NULL) {
@@ -336,57 +721,10 @@ static void ble_ota_event_handler(ble_evt_t *evt)
             
         case BLE_EVT_DISCONNECTED:
             ESP_LOGI(TAG, "BLE disconnected, conn_id: %d", evt->params.disconnected.conn_id);
-            // 如果正在进行OTA且连接断开，重置状态
+            // 传输中断开时保留会话，APP 重新连接后查询续传位置继续
+            // OTA 任务可能正持锁等待写入 Flash，由它挂起会话，不阻塞蓝牙协议栈
             if (g_ota_ctx.conn_id == evt->params.disconnected.conn_id) {
-                ble_ota_reset_state();
-            }
-            break;
-            
-        case BLE_EVT_DATA_RECEIVED:
-            {
-                uint8_t *data = evt->params.data_received.p_data;
-                uint16_t len = evt->params.data_received.len;
-                uint16_t conn_id = evt->params.data_received.conn_id;
-                
-                // 检查最小包长度
-                if (len < 3) {
-                    ESP_LOGE(TAG, "Received data too short: %d", len);
-                    return;
-                }
-                
-                // 快速检查是否为OTA协议包
-                if (data[0] != BLE_OTA_HEADER_0 || data[1] != BLE_OTA_HEADER_1) {
-                    ESP_LOGD(TAG, "Not OTA protocol header, ignoring");
-                    return;
-                }
-                
-                // 检查是否为OTA命令
-                uint8_t cmd = data[2];
-                if (!ble_protocol_is_ota_cmd(cmd)) {
-                    ESP_LOGD(TAG, "Not an OTA command: 0x%02X", cmd);
-                    return;
-                }
-                
-                // 分配消息内存
-                ble_ota_data_msg_t* msg = (ble_ota_data_msg_t*)malloc(sizeof(ble_ota_data_msg_t) + len);
-                if (msg == NULL) {
-                    ESP_LOGE(TAG, "Failed to allocate memory for OTA message");
-                    return;
-                }
-                
-                // 填充消息
-                msg->conn_id = conn_id;
-                msg->len = len;
-                memcpy(msg->data, data, len);
-                
-                // 发送到队列
-                if (xQueueSend(g_ota_ctx.data_queue, &msg, 0) != pdTRUE) {
-                    ESP_LOGE(TAG, "Failed to send message to OTA queue");
-                    free(msg);
-                    return;
-                }
-                
-                ESP_LOGD(TAG, "OTA data queued for processing");
+                atomic_store(&g_ota_ctx.disconnected, true);
             }
             break;
             
@@ -405,7 +743,8 @@ static esp_err_t ble_ota_handle_send_file_info(uint16_t conn_id, uint8_t *data,
 {
     ESP_LOGI(TAG, "Handle send file info");
     
-    if (data == NULL || len != 11) { // 3 + 4 + 4 = 11 bytes
+    // 3 + 4 + 4 = 11 bytes，可选 1 byte 请求的未确认数据包数
+    if (data == NULL || (len != 11 && len != 12)) {
         ESP_LOGE(TAG, "Invalid file info data length: %d", len);
         uint8_t ack = BLE_OTA_ACK_ERROR;
         return ble_protocol_send_response(conn_id, BLE_OTA_CMD_SEND_FILE_INFO, &ack, 1);
@@ -416,6 +755,39 @@ static esp_err_t ble_ota_handle_send_file_info(uint16_t conn_id, uint8_t *data,
         uint8_t ack = BLE_OTA_ACK_ERROR;
         return ble_protocol_send_response(conn_id, BLE_OTA_CMD_SEND_FILE_INFO, &ack, 1);
     }
+
+    // 同一连接刚查询过同一固件的续传位置，从该位置继续
+    bool resume = g_ota_ctx.resume_offset > 0 && g_ota_ctx.resume_conn_id == conn_id &&
+                  memcmp(g_ota_ctx.resume_info, data, BLE_OTA_IMAGE_INFO_LEN) == 0;
+    uint32_t resume_offset = g_ota_ctx.resume_offset;
+    g_ota_ctx.resume_offset = 0;
+    if (resume && !g_ota_ctx.resume_from_nvs) {
+        // 内存中的会话在查询之后超时释放了，APP 需要重新查询
+        if (!ble_ota_session_active() || !ble_ota_same_image(data)) {
+            ESP_LOGE(TAG, "OTA session to resume no longer exists");
+            xSemaphoreGive(g_ota_ctx.mutex);
+            uint8_t ack = BLE_OTA_ACK_ERROR;
+            return ble_protocol_send_response(conn_id, BLE_OTA_CMD_SEND_FILE_INFO, &ack, 1);
+        }
+        // 数据块、解码器和窗口保持不变，从下一个数据包继续
+        g_ota_ctx.conn_id = conn_id;
+        g_ota_ctx.received_bytes = 0;
+        g_ota_ctx.packet_crc32 = 0;
+        g_ota_ctx.state = BLE_OTA_STATE_WAIT_FILE_DATA;
+        check_expected_bytes();
+        uint8_t window = g_ota_ctx.window;
+        xSemaphoreGive(g_ota_ctx.mutex);
+
+        ESP_LOGI(TAG, "Resuming OTA at %lu/%lu bytes", g_ota_ctx.total_written, g_ota_ctx.file_size);
+
+        uint8_t response[4];
+        response[0] = BLE_OTA_ACK_SUCCESS;
+        response[1] = g_ota_ctx.packet_length & 0xFF;
+        response[2] = (g_ota_ctx.packet_length >> 8) & 0xFF;
+        response[3] = window;
+        ble_gap_set_prefered_le_phy(conn_id,BLE_GAP_LE_PHY_2M_MASK,BLE_GAP_LE_PHY_2M_MASK,0);
+        return ble_protocol_send_response(conn_id, BLE_OTA_CMD_SEND_FILE_INFO, response, len == 12 ? 4 : 3);
+    }
     
     // 解析文件信息
     memcpy(g_ota_ctx.version, data, 3);
@@ -423,6 +795,12 @@ static esp_err_t ble_ota_handle_send_file_info(uint16_t conn_id, uint8_t *data,
     g_ota_ctx.file_crc32 = (data[7] << 0) | (data[8] << 8) | (data[9] << 16) | (data[10] << 24);
     g_ota_ctx.conn_id = conn_id;
     g_ota_ctx.received_bytes = 0;
+    // 旧版 APP 不带窗口参数，逐包等待确认，设备端仍然异步写入
+    bool negotiate_window = len == 12;
+    uint8_t window = 1;
+    if (negotiate_window && data[11] > 1) {
+        window = data[11] < BLE_OTA_WINDOW_MAX ? data[11] : BLE_OTA_WINDOW_MAX;
+    }
     
     ESP_LOGI(TAG, "File info - Version: %d.%d.%d, Size: %lu, CRC32: 0x%08lX", 
              g_ota_ctx.version[0], g_ota_ctx.version[1], g_ota_ctx.version[2],
@@ -448,44 +826,54 @@ static esp_err_t ble_ota_handle_send_file_info(uint16_t conn_id, uint8_t *data,
     }
 
     ESP_LOGI(TAG, "Starting partition %s", g_ota_ctx.ota_partition->label);
-
-    // 开始OTA
-    esp_err_t ret = esp_ota_begin(g_ota_ctx.ota_partition, OTA_WITH_SEQUENTIAL_WRITES, &g_ota_ctx.ota_handle);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to begin OTA: %s", esp_err_to_name(ret));
-        g_ota_ctx.state = BLE_OTA_STATE_ERROR;
-        xSemaphoreGive(g_ota_ctx.mutex);
-        uint8_t ack = BLE_OTA_ACK_ERROR;
-        return ble_protocol_send_response(conn_id, BLE_OTA_CMD_SEND_FILE_INFO, &ack, 1);
-    }
-
-    ESP_LOGI(TAG, "esp_ota_begin %s", g_ota_ctx.ota_partition->label);
     
     // 设置数据包长度 (64-4096字节范围内)
     g_ota_ctx.packet_length = 4096; // 默认1KB
 
-    g_ota_ctx.ota_buffer = (uint8_t *)malloc(g_ota_ctx.packet_length);
-    if (g_ota_ctx.ota_buffer == NULL) {
+    // 上一次升级未正常重置时，先释放旧的数据块
+    ble_ota_wait_writes();
+    ble_ota_free_blocks();
+    ota_image_decoder_destroy(g_ota_ctx.decoder);
+    g_ota_ctx.decoder = NULL;
+    if (resume) {
+        // 只有原始固件记录续传位置，已校验过的部分直接写入分区，不再经过解码器
+        g_ota_ctx.total_written = resume_offset;
+        g_ota_ctx.total_crc32 = g_ota_ctx.resume_crc32;
+        ESP_LOGI(TAG, "Resuming OTA from flash at %lu/%lu bytes", g_ota_ctx.total_written, g_ota_ctx.file_size);
+    } else {
+        g_ota_ctx.total_written = 0;
+        g_ota_ctx.total_crc32 = 0;
+        ble_ota_clear_checkpoint();
+        // 差分固件以当前运行的固件为基础
+        g_ota_ctx.decoder = ota_image_decoder_create(esp_ota_get_running_partition(), ble_ota_write_decoded, NULL);
+    }
+    g_ota_ctx.flash_offset = g_ota_ctx.total_written;
+    g_ota_ctx.erased_end = g_ota_ctx.total_written;
+    g_ota_ctx.flash_tail_len = 0;
+    if ((!resume && g_ota_ctx.decoder == NULL) || ble_ota_alloc_blocks(window) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to allocate OTA buffer");
+        ble_ota_free_blocks();
         g_ota_ctx.state = BLE_OTA_STATE_ERROR;
         xSemaphoreGive(g_ota_ctx.mutex);
         uint8_t ack = BLE_OTA_ACK_ERROR;
         return ble_protocol_send_response(conn_id, BLE_OTA_CMD_SEND_FILE_INFO, &ack, 1);
     }
-    memset(g_ota_ctx.ota_buffer, 0xFF, g_ota_ctx.packet_length);
     g_ota_ctx.state = BLE_OTA_STATE_WAIT_FILE_DATA;
     check_expected_bytes();
     g_ota_ctx.packet_crc32 = 0;
     xSemaphoreGive(g_ota_ctx.mutex);
+
+    ESP_LOGI(TAG, "OTA window: %d packets", window);
     
-    // 发送响应：ack + packet_length
-    uint8_t response[3];
+    // 发送响应：ack + packet_length (+ window)
+    uint8_t response[4];
     response[0] = BLE_OTA_ACK_SUCCESS;
     response[1] = g_ota_ctx.packet_length & 0xFF;
     response[2] = (g_ota_ctx.packet_length >> 8) & 0xFF;
+    response[3] = window;
     
     ble_gap_set_prefered_le_phy(conn_id,BLE_GAP_LE_PHY_2M_MASK,BLE_GAP_LE_PHY_2M_MASK,0);
-    return ble_protocol_send_response(conn_id, BLE_OTA_CMD_SEND_FILE_INFO, response, 3);
+    return ble_protocol_send_response(conn_id, BLE_OTA_CMD_SEND_FILE_INFO, response, negotiate_window ? 4 : 3);
 }
 
 static esp_err_t ble_ota_handle_send_file_data(uint16_t conn_id, uint8_t *data, uint16_t len)
@@ -527,26 +915,22 @@ static esp_err_t ble_ota_handle_send_file_data(uint16_t conn_id, uint8_t *data,
     }
 
     // 更新CRC32
-    g_ota_ctx.packet_crc32 = lr_crc_compute(data, len,&g_ota_ctx.packet_crc32);
-    g_ota_ctx.total_crc32 = lr_crc_compute(data, len,&g_ota_ctx.total_crc32);
+    g_ota_ctx.packet_crc32 = ble_crc32_update(g_ota_ctx.packet_crc32, data, len);
     g_ota_ctx.received_bytes += len;
     
     ESP_LOGD(TAG, "Received %d bytes, total: %lu/%lu", len, g_ota_ctx.received_bytes, g_ota_ctx.expected_bytes);
     
     // 检查是否接收完一个数据包
     if (g_ota_ctx.received_bytes >= g_ota_ctx.expected_bytes) {
-
-        // 写入OTA数据
-        esp_err_t ret = esp_ota_write(g_ota_ctx.ota_handle, g_ota_ctx.ota_buffer , g_ota_ctx.received_bytes);
-        if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(ret));
+        // 之前的数据块写入失败
+        if (g_ota_ctx.write_error != ESP_OK) {
             g_ota_ctx.state = BLE_OTA_STATE_ERROR;
             xSemaphoreGive(g_ota_ctx.mutex);
             uint8_t ack = BLE_OTA_ACK_ERROR;
             ble_ota_reset_state();
             return ble_protocol_send_response(conn_id, BLE_OTA_CMD_SEND_FILE_DATA, &ack, 1);
         }
-        memset(g_ota_ctx.ota_buffer, 0xFF, g_ota_ctx.packet_length);
+        // 校验通过后才写入Flash
         ESP_LOGI(TAG, "Packet complete, waiting for CRC");
         g_ota_ctx.state = BLE_OTA_STATE_WAIT_PACKET_CRC;
 
@@ -596,16 +980,26 @@ static esp_err_t ble_ota_handle_send_packet_crc(uint16_t conn_id, uint8_t *data,
     ack[4] = g_ota_ctx.packet_crc32>>24;
 
     if (g_ota_ctx.packet_crc32 == received_crc) {
+        // 整包数据只计算一遍 CRC，校验通过后再合并到文件总 CRC，断开时未确认的数据包不计入
+        g_ota_ctx.total_crc32 = ble_crc32_combine(g_ota_ctx.total_crc32, g_ota_ctx.packet_crc32, g_ota_ctx.received_bytes);
         g_ota_ctx.packet_crc32 = 0;
         ESP_LOGI(TAG, "Packet CRC check passed");
 
         ack[0] = BLE_OTA_ACK_SUCCESS;
 
+        // 交给写Flash任务，没有空闲数据块时在这里等待
+        esp_err_t ret = ble_ota_submit_block();
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(ret));
+            ack[0] = BLE_OTA_ACK_ERROR;
+            g_ota_ctx.state = BLE_OTA_STATE_ERROR;
+        }
+
         // 检查是否完成整个文件的传输
         // 这里需要使用其他方法检查写入的总字节数
         g_ota_ctx.total_written += g_ota_ctx.received_bytes;
 
-        if (g_ota_ctx.total_written >= g_ota_ctx.file_size) {
+        if (ack[0] == BLE_OTA_ACK_SUCCESS && g_ota_ctx.total_written >= g_ota_ctx.file_size) {
             ESP_LOGI(TAG, "File transfer complete, finalizing OTA");
             g_ota_ctx.state = BLE_OTA_STATE_UPGRADING;
             
@@ -613,9 +1007,18 @@ static esp_err_t ble_ota_handle_send_packet_crc(uint16_t conn_id, uint8_t *data,
             g_ota_ctx.total_written = 0;
             g_ota_ctx.state = BLE_OTA_STATE_UPGRADING;
             
-            // 完成OTA
-            esp_err_t ret = esp_ota_end(g_ota_ctx.ota_handle);
-            if (ret == ESP_OK) {
+            // 等待剩余数据块写入Flash
+            if (!ble_ota_wait_writes() || g_ota_ctx.write_error != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(g_ota_ctx.write_error));
+                ack[0] = BLE_OTA_ACK_ERROR;
+            } else if (g_ota_ctx.decoder != NULL && ota_image_decoder_finish(g_ota_ctx.decoder) != ESP_OK) {
+                // 从 NVS 续传的原始固件没有解码器
+                ack[0] = BLE_OTA_ACK_ERROR;
+            } else if ((ret = ble_ota_flush_tail()) != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(ret));
+                ack[0] = BLE_OTA_ACK_ERROR;
+            } else {
+                // 完成OTA，设置启动分区前会校验整个固件
                 ret = esp_ota_set_boot_partition(g_ota_ctx.ota_partition);
                 if (ret == ESP_OK) {
                     g_ota_ctx.success_finish = true;
@@ -624,12 +1027,10 @@ static esp_err_t ble_ota_handle_send_packet_crc(uint16_t conn_id, uint8_t *data,
                     ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(ret));
                     ack[0] = BLE_OTA_ACK_ERROR;
                 }
-            } else {
-                ESP_LOGE(TAG, "Failed to end OTA: %s", esp_err_to_name(ret));
-                ack[0] = BLE_OTA_ACK_ERROR;
             }
-            g_ota_ctx.ota_handle = 0;
-        } else {
+            // 固件已完整写入，无论成败都不再续传
+            ble_ota_clear_checkpoint();
+        } else if (ack[0] == BLE_OTA_ACK_SUCCESS) {
             // 重置数据包状态，准备接收下一个数据包或完成升级
             g_ota_ctx.received_bytes = 0;
             check_expected_bytes();
@@ -640,14 +1041,60 @@ static esp_err_t ble_ota_handle_send_packet_crc(uint16_t conn_id, uint8_t *data,
         ack[0] = BLE_OTA_ACK_ERROR;
         g_ota_ctx.state = BLE_OTA_STATE_ERROR;
     }
+    xSemaphoreGive(g_ota_ctx.mutex);
+    // 重置需要重新获取互斥锁
     if(ack[0] == BLE_OTA_ACK_ERROR){
         ble_ota_reset_state();
     }
-    xSemaphoreGive(g_ota_ctx.mutex);
 
     return ble_protocol_send_response(conn_id, BLE_OTA_CMD_SEND_PACKET_CRC, ack, 5);
 }
 
+static esp_err_t ble_ota_handle_query_resume(uint16_t conn_id, uint8_t *data, uint16_t len)
+{
+    ESP_LOGI(TAG, "Handle query resume");
+
+    // 固件标识：3 + 4 + 4 = 11 bytes
+    if (data == NULL || len != BLE_OTA_IMAGE_INFO_LEN) {
+        ESP_LOGE(TAG, "Invalid resume query length: %d", len);
+        uint8_t ack = BLE_OTA_ACK_ERROR;
+        return ble_protocol_send_response(conn_id, BLE_OTA_CMD_QUERY_RESUME, &ack, 1);
+    }
+
+    if (xSemaphoreTake(g_ota_ctx.mutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to take mutex");
+        uint8_t ack = BLE_OTA_ACK_ERROR;
+        return ble_protocol_send_response(conn_id, BLE_OTA_CMD_QUERY_RESUME, &ack, 1);
+    }
+
+    // 优先继续内存中的会话，其次是重启前写入 Flash 的原始固件
+    uint32_t offset = 0;
+    uint32_t crc32 = 0;
+    bool from_nvs = false;
+    if (ble_ota_session_active() && ble_ota_same_image(data)) {
+        offset = g_ota_ctx.total_written;
+        crc32 = g_ota_ctx.total_crc32;
+    } else if (ble_ota_verify_checkpoint(data, &offset, &crc32)) {
+        from_nvs = true;
+    }
+
+    memcpy(g_ota_ctx.resume_info, data, BLE_OTA_IMAGE_INFO_LEN);
+    g_ota_ctx.resume_conn_id = conn_id;
+    g_ota_ctx.resume_offset = offset;
+    g_ota_ctx.resume_crc32 = crc32;
+    g_ota_ctx.resume_from_nvs = from_nvs;
+    xSemaphoreGive(g_ota_ctx.mutex);
+
+    ESP_LOGI(TAG, "Resume offset: %lu, CRC32: 0x%08lX%s", offset, crc32, from_nvs ? " (flash)" : "");
+
+    // 发送响应：ack + offset + crc32，offset 为 0 时从头开始
+    uint8_t response[9];
+    response[0] = BLE_OTA_ACK_SUCCESS;
+    ble_ota_put_u32(response + 1, offset);
+    ble_ota_put_u32(response + 5, crc32);
+    return ble_protocol_send_response(conn_id, BLE_OTA_CMD_QUERY_RESUME, response, sizeof(response));
+}
+
 static bool ble_ota_check_version(const uint8_t *new_version)
 {
     // 获取当前版本
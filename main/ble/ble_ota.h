@@ -20,6 +20,7 @@ extern "C" {
 #define BLE_OTA_CMD_SEND_FILE_INFO      BLE_PROTOCOL_CMD_SEND_FILE_INFO
 #define BLE_OTA_CMD_SEND_FILE_DATA      BLE_PROTOCOL_CMD_SEND_FILE_DATA
 #define BLE_OTA_CMD_SEND_PACKET_CRC     BLE_PROTOCOL_CMD_SEND_PACKET_CRC
+#define BLE_OTA_CMD_QUERY_RESUME        BLE_PROTOCOL_CMD_QUERY_RESUME
 
 // ACK 响应定义
 #define BLE_OTA_ACK_SUCCESS             BLE_PROTOCOL_ACK_SUCCESS
@@ -37,7 +38,8 @@ typedef enum {
     BLE_OTA_STATE_WAIT_FILE_DATA,
     BLE_OTA_STATE_WAIT_PACKET_CRC,
     BLE_OTA_STATE_UPGRADING,
-    BLE_OTA_STATE_ERROR
+    BLE_OTA_STATE_ERROR,
+    BLE_OTA_STATE_SUSPENDED         // 连接断开，等待 APP 重新连接后继续
 } ble_ota_state_t;
 
 // OTA进度回调函数类型
@@ -1,10 +1,68 @@
 #include "ble_protocol.h"
 #include "esp_ble.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include <string.h>
 
 static const char* TAG = "BLE_PROTOCOL";
 
+// 单个通知最多携带 512 字节（ATT 属性值上限）
+#define BLE_PROTOCOL_MAX_PACKET_LEN     512
+
+static SemaphoreHandle_t s_tx_mutex = NULL;     // 一条消息的分段必须连续发送
+static SemaphoreHandle_t s_tx_done = NULL;      // 收到 BLE_EVT_DATA_SENT
+
+static void ble_protocol_event_handler(ble_evt_t *evt)
+{
+    switch (evt->evt_id) {
+        case BLE_EVT_DATA_SENT:
+            xSemaphoreGive(s_tx_done);
+            break;
+
+        case BLE_EVT_DISCONNECTED:
+            xSemaphoreGive(s_tx_done);
+            break;
+
+        default:
+            break;
+    }
+}
+
+esp_err_t ble_protocol_init(void)
+{
+    if (s_tx_mutex != NULL) {
+        return ESP_OK;
+    }
+
+    s_tx_done = xSemaphoreCreateBinary();
+    s_tx_mutex = xSemaphoreCreateMutex();
+    if (s_tx_done == NULL || s_tx_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create TX semaphores");
+        if (s_tx_done) {
+            vSemaphoreDelete(s_tx_done);
+            s_tx_done = NULL;
+        }
+        if (s_tx_mutex) {
+            vSemaphoreDelete(s_tx_mutex);
+            s_tx_mutex = NULL;
+        }
+        return ESP_ERR_NO_MEM;
+    }
+
+    int ret = esp_ble_register_evt_callback(ble_protocol_event_handler);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register BLE callback: %d", ret);
+        vSemaphoreDelete(s_tx_done);
+        vSemaphoreDelete(s_tx_mutex);
+        s_tx_done = NULL;
+        s_tx_mutex = NULL;
+        return ret;
+    }
+    return ESP_OK;
+}
+
 bool ble_protocol_parse_packet(const uint8_t *data, size_t len, uint8_t *cmd, const uint8_t **payload, size_t *payload_len)
 {
     if (data == NULL || cmd == NULL || payload == NULL || payload_len == NULL) {
@@ -60,29 +118,136 @@ size_t ble_protocol_build_packet(uint8_t cmd, const uint8_t *payload, size_t pay
     return total_len;
 }
 
+uint16_t ble_protocol_get_max_payload(uint16_t conn_id)
+{
+    // ATT 通知头占 3 字节
+    uint16_t mtu = esp_ble_get_mtu(conn_id);
+    uint16_t max_packet = mtu > 3 ? mtu - 3 : 0;
+    if (max_packet > BLE_PROTOCOL_MAX_PACKET_LEN) {
+        max_packet = BLE_PROTOCOL_MAX_PACKET_LEN;
+    }
+    return max_packet > BLE_PROTOCOL_MIN_PACKET_LEN ? max_packet - BLE_PROTOCOL_MIN_PACKET_LEN : 0;
+}
+
+bool ble_protocol_sar_enabled(uint16_t conn_id)
+{
+    return esp_ble_route_sar_enabled(conn_id);
+}
+
+// 分段序号 0 只用于首段，255 之后回到 1
+static uint8_t ble_protocol_next_seq(uint8_t seq)
+{
+    return seq == 255 ? 1 : seq + 1;
+}
+
+// 协议栈缓冲区用尽时等待发送完成事件再重试，不在每个数据包之间固定延时
+static esp_err_t ble_protocol_notify(uint16_t conn_id, uint16_t handle, uint8_t *packet, uint16_t len)
+{
+    TickType_t start = xTaskGetTickCount();
+    while (true) {
+        int ret = esp_ble_notify_data(conn_id, handle, packet, len);
+        if (ret == 0) {
+            return ESP_OK;
+        }
+        if (ret != ESP_ERR_NO_MEM) {
+            ESP_LOGE(TAG, "Failed to send response: %d", ret);
+            return ESP_FAIL;
+        }
+        if (xTaskGetTickCount() - start >= pdMS_TO_TICKS(BLE_PROTOCOL_TIMEOUT_MS)) {
+            ESP_LOGE(TAG, "Timeout waiting for BLE TX buffers");
+            return ESP_ERR_TIMEOUT;
+        }
+        if (s_tx_done != NULL) {
+            // 丢弃之前的事件，只等接下来释放的缓冲区
+            xSemaphoreTake(s_tx_done, 0);
+            xSemaphoreTake(s_tx_done, pdMS_TO_TICKS(BLE_PROTOCOL_TX_RETRY_MS));
+        } else {
+            vTaskDelay(pdMS_TO_TICKS(BLE_PROTOCOL_TX_RETRY_MS));
+        }
+    }
+}
+
+static esp_err_t ble_protocol_send_segments(uint16_t conn_id, uint16_t handle, uint8_t cmd, const uint8_t *payload,
+                                            uint16_t payload_len, uint8_t *packet, uint16_t max_packet)
+{
+    uint16_t offset = 0;
+    uint8_t seq = 0;
+    int segments = 0;
+    do {
+        uint16_t header_len = segments == 0 ? BLE_PROTOCOL_SAR_FIRST_HEADER_LEN : BLE_PROTOCOL_SAR_HEADER_LEN;
+        uint16_t n = payload_len - offset;
+        if (n > max_packet - header_len) {
+            n = max_packet - header_len;
+        }
+        packet[0] = BLE_PROTOCOL_HEADER_0;
+        packet[1] = BLE_PROTOCOL_SAR_HEADER_1;
+        packet[2] = cmd;
+        packet[3] = seq;
+        if (segments == 0) {
+            packet[4] = payload_len & 0xFF;
+            packet[5] = (payload_len >> 8) & 0xFF;
+        }
+        memcpy(&packet[header_len], payload + offset, n);
+
+        esp_err_t ret = ble_protocol_notify(conn_id, handle, packet, header_len + n);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        offset += n;
+        seq = ble_protocol_next_seq(seq);
+        segments++;
+    } while (offset < payload_len);
+
+    ESP_LOGD(TAG, "Response sent: cmd=0x%02X, len=%d, %d segments", cmd, payload_len, segments);
+    return ESP_OK;
+}
+
 esp_err_t ble_protocol_send_response(uint16_t conn_id, uint8_t cmd, const uint8_t *payload, uint16_t payload_len)
 {
-    uint8_t packet_buffer[BLE_PROTOCOL_MIN_PACKET_LEN + BLE_PROTOCOL_MAX_PAYLOAD_LEN];
-    
-    size_t packet_len = ble_protocol_build_packet(cmd, payload, payload_len, packet_buffer, sizeof(packet_buffer));
-    if (packet_len == 0) {
-        ESP_LOGE(TAG, "Failed to build response packet");
+    uint8_t packet_buffer[BLE_PROTOCOL_MAX_PACKET_LEN];
+
+    if ((payload == NULL && payload_len > 0) || payload_len > BLE_PROTOCOL_MAX_MESSAGE_LEN) {
+        ESP_LOGE(TAG, "Invalid response payload: %d bytes", payload_len);
         return ESP_ERR_INVALID_ARG;
     }
-    
+
     uint16_t notify_handle = esp_ble_get_notify_handle();
     if (notify_handle == 0) {
         ESP_LOGE(TAG, "Invalid notify handle");
         return ESP_ERR_INVALID_STATE;
     }
-    
-    esp_err_t ret = esp_ble_notify_data(conn_id, notify_handle, packet_buffer, packet_len);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to send response: %s", esp_err_to_name(ret));
+
+    uint16_t max_packet = ble_protocol_get_max_payload(conn_id) + BLE_PROTOCOL_MIN_PACKET_LEN;
+    if (max_packet <= BLE_PROTOCOL_SAR_FIRST_HEADER_LEN) {
+        ESP_LOGE(TAG, "Invalid MTU for conn_id %d", conn_id);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (s_tx_mutex != NULL) {
+        xSemaphoreTake(s_tx_mutex, portMAX_DELAY);
+    }
+    esp_err_t ret;
+    if (BLE_PROTOCOL_MIN_PACKET_LEN + payload_len <= max_packet) {
+        packet_buffer[0] = BLE_PROTOCOL_HEADER_0;
+        packet_buffer[1] = BLE_PROTOCOL_HEADER_1;
+        packet_buffer[2] = cmd;
+        if (payload_len > 0) {
+            memcpy(&packet_buffer[3], payload, payload_len);
+        }
+        ret = ble_protocol_notify(conn_id, notify_handle, packet_buffer, BLE_PROTOCOL_MIN_PACKET_LEN + payload_len);
+        if (ret == ESP_OK) {
+            ESP_LOGD(TAG, "Response sent: cmd=0x%02X, len=%d", cmd, payload_len);
+        }
+    } else if (!ble_protocol_sar_enabled(conn_id)) {
+        // 不支持分段的 APP 只能接收一个通知以内的数据包
+        ESP_LOGE(TAG, "Response 0x%02X too large for MTU: %d > %d", cmd, payload_len, max_packet - BLE_PROTOCOL_MIN_PACKET_LEN);
+        ret = ESP_ERR_INVALID_SIZE;
     } else {
-        ESP_LOGD(TAG, "Response sent: cmd=0x%02X, len=%d", cmd, packet_len);
+        ret = ble_protocol_send_segments(conn_id, notify_handle, cmd, payload, payload_len, packet_buffer, max_packet);
+    }
+    if (s_tx_mutex != NULL) {
+        xSemaphoreGive(s_tx_mutex);
     }
-    
     return ret;
 }
 
@@ -102,5 +267,5 @@ bool ble_protocol_is_wifi_cmd(uint8_t cmd)
 
 bool ble_protocol_is_ota_cmd(uint8_t cmd)
 {
-    return (cmd >= BLE_PROTOCOL_CMD_SEND_FILE_INFO && cmd <= BLE_PROTOCOL_CMD_SEND_PACKET_CRC);
+    return (cmd >= BLE_PROTOCOL_CMD_SEND_FILE_INFO && cmd <= BLE_PROTOCOL_CMD_QUERY_RESUME);
 }
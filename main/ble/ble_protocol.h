@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "esp_err.h"
 
 #ifdef __cplusplus
@@ -12,16 +13,19 @@ extern "C" {
 // BLE协议公共定义
 #define BLE_PROTOCOL_HEADER_0           0x58
 #define BLE_PROTOCOL_HEADER_1           0x5A
+// 分段帧：header(2) + cmd(1) + seq(1) [+ 首段 total_len(2)] + data
+#define BLE_PROTOCOL_SAR_HEADER_1       0x5B
 
 // WiFi配置协议命令 (0x00-0x02)
 #define BLE_PROTOCOL_CMD_GET_WIFI_CONFIG     0x00
 #define BLE_PROTOCOL_CMD_SET_WIFI_CONFIG     0x01
 #define BLE_PROTOCOL_CMD_GET_WIFI_SCAN       0x02
 
-// OTA协议命令 (0x03-0x05)
+// OTA协议命令 (0x03-0x06)
 #define BLE_PROTOCOL_CMD_SEND_FILE_INFO      0x03
 #define BLE_PROTOCOL_CMD_SEND_FILE_DATA      0x04
 #define BLE_PROTOCOL_CMD_SEND_PACKET_CRC     0x05
+#define BLE_PROTOCOL_CMD_QUERY_RESUME        0x06
 
 // 公共响应状态
 #define BLE_PROTOCOL_ACK_SUCCESS             0x00
@@ -43,6 +47,11 @@ extern "C" {
 // 数据包长度限制
 #define BLE_PROTOCOL_MIN_PACKET_LEN          3       // header(2) + cmd(1)
 #define BLE_PROTOCOL_MAX_PAYLOAD_LEN         251     // 根据BLE MTU限制
+#define BLE_PROTOCOL_SAR_HEADER_LEN          4       // header(2) + cmd(1) + seq(1)
+#define BLE_PROTOCOL_SAR_FIRST_HEADER_LEN    6       // 首段多 total_len(2)
+#define BLE_PROTOCOL_MAX_MESSAGE_LEN         4096    // 分段消息重组后的最大载荷
+#define BLE_PROTOCOL_TX_RETRY_MS             10      // 协议栈缓冲区不足时的重试间隔
+#define BLE_PROTOCOL_CONN_NONE               0xFFFF
 
 // 协议数据包结构
 typedef struct {
@@ -54,15 +63,24 @@ typedef struct {
 // 协议处理函数类型定义
 typedef int (*ble_protocol_handler_t)(uint16_t conn_id, const uint8_t *payload, uint16_t payload_len);
 
+// 初始化发送锁与发送完成事件，可重复调用
+esp_err_t ble_protocol_init(void);
+
 // 协议解析函数
 bool ble_protocol_parse_packet(const uint8_t *data, size_t len, uint8_t *cmd, const uint8_t **payload, size_t *payload_len);
 
 // 协议构建函数
 size_t ble_protocol_build_packet(uint8_t cmd, const uint8_t *payload, size_t payload_len, uint8_t *packet, size_t max_len);
 
-// 协议发送函数
+// 协议发送函数，超过一个通知的载荷在 APP 支持分段时自动分段，否则返回 ESP_ERR_INVALID_SIZE
 esp_err_t ble_protocol_send_response(uint16_t conn_id, uint8_t cmd, const uint8_t *payload, uint16_t payload_len);
 
+// 当前 MTU 下单个数据包能携带的最大载荷
+uint16_t ble_protocol_get_max_payload(uint16_t conn_id);
+
+// APP 在本次连接中发送过分段帧，说明它也能接收分段帧
+bool ble_protocol_sar_enabled(uint16_t conn_id);
+
 // 协议验证函数
 bool ble_protocol_validate_packet(const uint8_t *data, size_t len);
 
@@ -0,0 +1,276 @@
+#include "ble_route.h"
+
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "ble_protocol.h"
+
+static const char* TAG = "ble_route";
+
+// 命令路由：协议数据包按命令字交给接收者的环形缓冲区，分段消息在环形缓冲区中原地重组
+
+// 环形缓冲区满时在协议栈任务中最多等待的时间
+#define BLE_ROUTE_SEND_WAIT_MS 10
+
+static struct ble_route m_routes[BLE_ROUTE_MAX];
+// 协议栈任务分发数据包时持有，注销路由不会删除正在写入的环形缓冲区
+static SemaphoreHandle_t m_route_mutex;
+static uint16_t m_sar_conn_id = BLE_PROTOCOL_CONN_NONE;
+
+static struct ble_route *ble_route_find(uint8_t cmd)
+{
+    for (int i = 0; i < BLE_ROUTE_MAX; i++) {
+        if (m_routes[i].used && cmd >= m_routes[i].cmd_min && cmd <= m_routes[i].cmd_max) {
+            return &m_routes[i];
+        }
+    }
+    return NULL;
+}
+
+static ble_route_packet_t *ble_route_acquire(struct ble_route *route, uint16_t conn_id, uint8_t cmd, uint16_t payload_len)
+{
+    ble_route_packet_t *packet = NULL;
+    size_t size = sizeof(ble_route_packet_t) + BLE_PROTOCOL_MIN_PACKET_LEN + payload_len;
+    if (xRingbufferSendAcquire(route->ring, (void **)&packet, size, pdMS_TO_TICKS(BLE_ROUTE_SEND_WAIT_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "Route 0x%02X-0x%02X full, dropping cmd 0x%02X (%d bytes)", route->cmd_min, route->cmd_max, cmd, payload_len);
+        route->dropped++;
+        return NULL;
+    }
+    packet->conn_id = conn_id;
+    packet->len = BLE_PROTOCOL_MIN_PACKET_LEN + payload_len;
+    packet->data[0] = BLE_PROTOCOL_HEADER_0;
+    packet->data[1] = BLE_PROTOCOL_HEADER_1;
+    packet->data[2] = cmd;
+    return packet;
+}
+
+static void ble_route_complete(struct ble_route *route, ble_route_packet_t *packet)
+{
+    route->packets++;
+    route->bytes += packet->len - BLE_PROTOCOL_MIN_PACKET_LEN;
+    xRingbufferSendComplete(route->ring, packet);
+}
+
+// 丢弃未收完的分段消息：已占用的位置标记为空包后提交，接收时跳过
+static void ble_route_abort(struct ble_route *route)
+{
+    if (route->pending == NULL) {
+        return;
+    }
+    ESP_LOGW(TAG, "Segmented message 0x%02X dropped at %d/%d", route->pending->data[2], route->received, route->total_len);
+    route->pending->len = 0;
+    xRingbufferSendComplete(route->ring, route->pending);
+    route->pending = NULL;
+    route->dropped++;
+}
+
+static void ble_route_feed_segment(struct ble_route *route, uint16_t conn_id, struct os_mbuf *om,
+                                   const uint8_t *header, uint16_t len)
+{
+    uint8_t cmd = header[2];
+    uint8_t seq = header[3];
+    uint16_t header_len = BLE_PROTOCOL_SAR_HEADER_LEN;
+
+    if (seq == 0) {
+        // 新的首段打断未收完的消息
+        ble_route_abort(route);
+        if (len < BLE_PROTOCOL_SAR_FIRST_HEADER_LEN) {
+            ESP_LOGE(TAG, "First segment too short: %d bytes", len);
+            route->dropped++;
+            return;
+        }
+        uint16_t total_len = header[4] | (header[5] << 8);
+        if (total_len > BLE_PROTOCOL_MAX_MESSAGE_LEN) {
+            ESP_LOGE(TAG, "Segmented message too large: %d bytes", total_len);
+            route->dropped++;
+            return;
+        }
+        // APP 发送分段帧，回复也可以分段
+        m_sar_conn_id = conn_id;
+        route->pending = ble_route_acquire(route, conn_id, cmd, total_len);
+        if (route->pending == NULL) {
+            return;
+        }
+        route->total_len = total_len;
+        route->received = 0;
+        header_len = BLE_PROTOCOL_SAR_FIRST_HEADER_LEN;
+    } else if (route->pending == NULL || seq != route->next_seq
+               || cmd != route->pending->data[2] || conn_id != route->pending->conn_id) {
+        ESP_LOGE(TAG, "Unexpected segment %d of 0x%02X, expected %d", seq, cmd, route->pending ? route->next_seq : 0);
+        ble_route_abort(route);
+        return;
+    }
+
+    uint16_t n = len - header_len;
+    if (route->received + n > route->total_len) {
+        ESP_LOGE(TAG, "Segmented message 0x%02X overflow: %d + %d > %d", cmd, route->received, n, route->total_len);
+        ble_route_abort(route);
+        return;
+    }
+    os_mbuf_copydata(om, header_len, n, &route->pending->data[BLE_PROTOCOL_MIN_PACKET_LEN + route->received]);
+    route->received += n;
+    // 分段序号 0 只用于首段，255 之后回到 1
+    route->next_seq = seq == 255 ? 1 : seq + 1;
+    if (route->received == route->total_len) {
+        ble_route_complete(route, route->pending);
+        route->pending = NULL;
+    }
+}
+
+bool ble_route_dispatch(uint16_t conn_id, struct os_mbuf *om)
+{
+    uint16_t len = OS_MBUF_PKTLEN(om);
+    uint8_t header[BLE_PROTOCOL_SAR_FIRST_HEADER_LEN];
+    if (len < BLE_PROTOCOL_MIN_PACKET_LEN
+        || os_mbuf_copydata(om, 0, len < sizeof(header) ? len : sizeof(header), header) != 0) {
+        return false;
+    }
+    if (header[0] != BLE_PROTOCOL_HEADER_0
+        || (header[1] != BLE_PROTOCOL_HEADER_1 && header[1] != BLE_PROTOCOL_SAR_HEADER_1)) {
+        return false;
+    }
+    if (m_route_mutex == NULL) {
+        return false;
+    }
+    xSemaphoreTake(m_route_mutex, portMAX_DELAY);
+    struct ble_route *route = ble_route_find(header[2]);
+    if (route == NULL) {
+        xSemaphoreGive(m_route_mutex);
+        return false;
+    }
+
+    if (header[1] == BLE_PROTOCOL_SAR_HEADER_1) {
+        if (len < BLE_PROTOCOL_SAR_HEADER_LEN) {
+            route->dropped++;
+        } else {
+            ble_route_feed_segment(route, conn_id, om, header, len);
+        }
+        xSemaphoreGive(m_route_mutex);
+        return true;
+    }
+
+    // 普通数据包打断未收完的分段消息
+    ble_route_abort(route);
+    uint16_t payload_len = len - BLE_PROTOCOL_MIN_PACKET_LEN;
+    ble_route_packet_t *packet = ble_route_acquire(route, conn_id, header[2], payload_len);
+    if (packet != NULL) {
+        os_mbuf_copydata(om, BLE_PROTOCOL_MIN_PACKET_LEN, payload_len, &packet->data[BLE_PROTOCOL_MIN_PACKET_LEN]);
+        ble_route_complete(route, packet);
+    }
+    xSemaphoreGive(m_route_mutex);
+    return true;
+}
+
+void ble_route_disconnected(uint16_t conn_id)
+{
+    if (m_sar_conn_id == conn_id) {
+        m_sar_conn_id = BLE_PROTOCOL_CONN_NONE;
+    }
+    if (m_route_mutex == NULL) {
+        return;
+    }
+    xSemaphoreTake(m_route_mutex, portMAX_DELAY);
+    for (int i = 0; i < BLE_ROUTE_MAX; i++) {
+        struct ble_route *route = &m_routes[i];
+        if (!route->used) {
+            continue;
+        }
+        if (route->pending != NULL && route->pending->conn_id == conn_id) {
+            ble_route_abort(route);
+        }
+        ESP_LOGI(TAG, "Route 0x%02X-0x%02X: %lu packets, %lu bytes, %lu dropped",
+                 route->cmd_min, route->cmd_max, route->packets, route->bytes, route->dropped);
+    }
+    xSemaphoreGive(m_route_mutex);
+}
+
+int esp_ble_register_route(uint8_t cmd_min, uint8_t cmd_max, size_t buffer_size, ble_route_handle_t *route)
+{
+    if (route == NULL || cmd_min > cmd_max) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // 路由在初始化蓝牙之前注册
+    if (m_route_mutex == NULL) {
+        m_route_mutex = xSemaphoreCreateMutex();
+        if (m_route_mutex == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    xSemaphoreTake(m_route_mutex, portMAX_DELAY);
+    struct ble_route *slot = NULL;
+    for (int i = 0; i < BLE_ROUTE_MAX; i++) {
+        if (m_routes[i].used && cmd_min <= m_routes[i].cmd_max && cmd_max >= m_routes[i].cmd_min) {
+            ESP_LOGE(TAG, "Route 0x%02X-0x%02X overlaps 0x%02X-0x%02X", cmd_min, cmd_max, m_routes[i].cmd_min, m_routes[i].cmd_max);
+            xSemaphoreGive(m_route_mutex);
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (!m_routes[i].used && slot == NULL) {
+            slot = &m_routes[i];
+        }
+    }
+    if (slot == NULL) {
+        ESP_LOGE(TAG, "No more route slots available");
+        xSemaphoreGive(m_route_mutex);
+        return ESP_ERR_NO_MEM;
+    }
+    memset(slot, 0, sizeof(*slot));
+    slot->ring = xRingbufferCreate(buffer_size, RINGBUF_TYPE_NOSPLIT);
+    if (slot->ring == NULL) {
+        ESP_LOGE(TAG, "Failed to create %d bytes ring buffer for route 0x%02X-0x%02X", buffer_size, cmd_min, cmd_max);
+        xSemaphoreGive(m_route_mutex);
+        return ESP_ERR_NO_MEM;
+    }
+    slot->cmd_min = cmd_min;
+    slot->cmd_max = cmd_max;
+    slot->used = true;
+    *route = slot;
+    xSemaphoreGive(m_route_mutex);
+    ESP_LOGI(TAG, "Registered route 0x%02X-0x%02X, %d bytes", cmd_min, cmd_max, buffer_size);
+    return ESP_OK;
+}
+
+// 调用前需停止接收任务，协议栈任务可能正在分发数据包，持锁后再删除环形缓冲区
+int esp_ble_unregister_route(ble_route_handle_t route)
+{
+    if (route == NULL || m_route_mutex == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(m_route_mutex, portMAX_DELAY);
+    if (!route->used) {
+        xSemaphoreGive(m_route_mutex);
+        return ESP_ERR_INVALID_ARG;
+    }
+    route->used = false;
+    ble_route_abort(route);
+    vRingbufferDelete(route->ring);
+    route->ring = NULL;
+    xSemaphoreGive(m_route_mutex);
+    return ESP_OK;
+}
+
+ble_route_packet_t *esp_ble_route_receive(ble_route_handle_t route, uint32_t timeout_ms)
+{
+    while (true) {
+        size_t size;
+        ble_route_packet_t *packet = (ble_route_packet_t *)xRingbufferReceive(route->ring, &size, pdMS_TO_TICKS(timeout_ms));
+        if (packet == NULL || packet->len > 0) {
+            return packet;
+        }
+        // 被丢弃的分段消息
+        vRingbufferReturnItem(route->ring, packet);
+    }
+}
+
+void esp_ble_route_return(ble_route_handle_t route, ble_route_packet_t *packet)
+{
+    vRingbufferReturnItem(route->ring, packet);
+}
+
+bool esp_ble_route_sar_enabled(uint16_t conn_id)
+{
+    return m_sar_conn_id == conn_id;
+}
@@ -0,0 +1,47 @@
+#ifndef BLE_ROUTE_H
+#define BLE_ROUTE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include "os/os_mbuf.h"
+
+#include "esp_ble.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// esp_ble.c 内部使用，路由的注册与接收接口见 esp_ble.h
+
+struct ble_route{
+    bool used;
+    uint8_t cmd_min;
+    uint8_t cmd_max;
+    RingbufHandle_t ring;
+
+    // 正在重组的分段消息，已在环形缓冲区中占好位置
+    ble_route_packet_t *pending;
+    uint16_t total_len;
+    uint16_t received;
+    uint8_t next_seq;
+
+    // 统计，断开连接时打印
+    uint32_t packets;
+    uint32_t bytes;
+    uint32_t dropped;
+};
+
+// 在协议栈任务中调用：只解析一次包头，按命令字把载荷从 mbuf 复制到接收者的环形缓冲区，
+// 分段消息原地重组，没有接收者时返回 false
+bool ble_route_dispatch(uint16_t conn_id, struct os_mbuf *om);
+// 丢弃该连接未收完的分段消息并打印各路由的统计
+void ble_route_disconnected(uint16_t conn_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLE_ROUTE_H
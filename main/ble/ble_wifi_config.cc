@@ -7,7 +7,6 @@
 #include "host/ble_hs.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
 #include <string.h>
 #include <cJSON.h>
 #include <functional>
@@ -21,13 +20,8 @@ extern "C" {
 
 #define TAG "BleWifiConfig"
 
-// 队列数据结构
-typedef struct {
-    uint16_t conn_id;
-    uint16_t handle;
-    uint8_t data[256];  // 最大数据长度
-    size_t data_len;
-} ble_data_queue_item_t;
+// WiFi 配置命令的接收缓冲区，由 BLE 协议栈直接写入
+#define BLE_WIFI_CONFIG_RX_BUFFER_SIZE 1024
 
 // 全局变量
 static bool g_ble_initialized = false;
@@ -35,8 +29,8 @@ static bool g_ble_advertising = false;
 static uint16_t g_conn_handle = 0xFFFF;
 static std::function<void(const std::string&, const std::string&)> g_wifi_config_callback;
 
-// 队列和线程相关变量
-static QueueHandle_t g_ble_data_queue = NULL;
+// 接收缓冲区和线程相关变量
+static ble_route_handle_t g_ble_route = NULL;
 static TaskHandle_t g_ble_process_task = NULL;
 static bool g_process_task_running = false;
 
@@ -52,31 +46,31 @@ static int handle_get_scan_list_cmd(uint8_t *response, size_t max_len);
 static bool parse_protocol_packet(const uint8_t *data, size_t len, uint8_t *cmd, const uint8_t **payload, size_t *payload_len);
 // 数据处理线程函数
 static void ble_data_process_task(void* pvParameters) {
-    ble_data_queue_item_t queue_item;
-    
     ESP_LOGI(TAG, "BLE data process task started");
     
     while (g_process_task_running) {
-        // 从队列中获取数据，等待最多100ms
-        if (xQueueReceive(g_ble_data_queue, &queue_item, pdMS_TO_TICKS(100)) == pdTRUE) {
-            ESP_LOGI(TAG, "Processing BLE data: conn_id=%d, handle=%d, len=%d", 
-                     queue_item.conn_id, queue_item.handle, queue_item.data_len);
+        // 从接收缓冲区中获取数据，等待最多100ms
+        ble_route_packet_t *packet = esp_ble_route_receive(g_ble_route, 100);
+        if (packet != NULL) {
+            ESP_LOGI(TAG, "Processing BLE data: conn_id=%d, len=%d", packet->conn_id, packet->len);
             
             // 解析协议数据包
             uint8_t cmd;
             const uint8_t *payload;
             size_t payload_len;
+            uint16_t conn_id = packet->conn_id;
             
-            // if (!parse_protocol_packet(queue_item.data, queue_item.data_len, &cmd, &payload, &payload_len)) {
-            //     ESP_LOGE(TAG, "Failed to parse protocol packet");
-            //     continue;
-            // }
-            
-            // // 只处理WiFi配置相关的命令
-            // if (!ble_protocol_is_wifi_cmd(cmd)) {
-            //     ESP_LOGD(TAG, "Not a WiFi config command: 0x%02X", cmd);
-            //     continue;
-            // }
+            // 只处理作为从机的配网连接
+            if (g_conn_handle != BLE_HS_CONN_HANDLE_NONE && conn_id != g_conn_handle) {
+                esp_ble_route_return(g_ble_route, packet);
+                continue;
+            }
+
+            if (!parse_protocol_packet(packet->data, packet->len, &cmd, &payload, &payload_len)) {
+                ESP_LOGE(TAG, "Failed to parse protocol packet");
+                esp_ble_route_return(g_ble_route, packet);
+                continue;
+            }
             
             // 处理命令
             size_t response_len = 0;
@@ -95,14 +89,16 @@ static void ble_data_process_task(void* pvParameters) {
                     
                 default:
                     ESP_LOGW(TAG, "Unknown command: 0x%02X", cmd);
-                    continue;
+                    break;
             }
+            // 载荷已处理完，归还接收缓冲区
+            esp_ble_route_return(g_ble_route, packet);
             
             // 发送响应
-            if (response_len > 0 && queue_item.conn_id != 0xFFFF) {
-                esp_ble_notify_data(queue_item.conn_id, 
-                                   esp_ble_get_notify_handle(), 
-                                   g_response_buffer, response_len);
+            if (response_len >= BLE_PROTOCOL_MIN_PACKET_LEN && conn_id != 0xFFFF) {
+                ble_protocol_send_response(conn_id, g_response_buffer[2],
+                                           g_response_buffer + BLE_PROTOCOL_MIN_PACKET_LEN,
+                                           response_len - BLE_PROTOCOL_MIN_PACKET_LEN);
             }
         }
     }
@@ -222,19 +218,19 @@ static int handle_get_scan_list_cmd(uint8_t *response, size_t max_len) {
     // 获取当前扫描结果
     std::vector<wifi_ap_record_t> local_scan_results = WifiConfigurationAp::GetInstance().GetAccessPoints();
 
-    // 构建响应载荷
-    uint16_t len_limit = 200; // 设置一个安全的MTU限制，避免超过BLE MTU
-    uint8_t arr[len_limit];
-    uint16_t offset = 0;
+    // APP 支持分段时一次发送全部结果，否则每个数据包不超过当前 MTU
+    size_t len_limit = ble_protocol_sar_enabled(g_conn_handle) ? BLE_PROTOCOL_MAX_MESSAGE_LEN
+                                                                : ble_protocol_get_max_payload(g_conn_handle);
+    std::vector<uint8_t> arr(len_limit);
+    size_t offset = 0;
     size_t response_len = 0;
     
-    int i = 0;
+    size_t i = 0;
     do {
-        memset(arr, 0, sizeof(arr));
         arr[0] = 0;
         offset = 1;
         
-        while (i < local_scan_results.size()) {
+        while (i < local_scan_results.size() && arr[0] < 255) {
             const char* ssid_str = (const char*)local_scan_results[i].ssid;
             uint8_t ssid_len = strlen(ssid_str);
             
@@ -250,15 +246,9 @@ static int handle_get_scan_list_cmd(uint8_t *response, size_t max_len) {
             i++;
         }
 
-        if (arr[0] > 0) {
-            response_len = build_response_packet(BLE_WIFI_CONFIG_CMD_GET_SCAN, 
-                                               arr, offset, 
-                                               response, max_len);
-            if (response_len > 0 && g_conn_handle != 0xFFFF) {
-                esp_ble_notify_data(g_conn_handle, esp_ble_get_notify_handle(), response, response_len);
-            }
-
-            vTaskDelay(pdMS_TO_TICKS(10)); // 小延迟避免发送过快
+        if (arr[0] > 0 && g_conn_handle != 0xFFFF) {
+            // 协议栈缓冲区不足时在发送函数内等待，不需要额外延时
+            ble_protocol_send_response(g_conn_handle, BLE_WIFI_CONFIG_CMD_GET_SCAN, arr.data(), offset);
         } else {
             break;
         }
@@ -303,49 +293,6 @@ static void ble_wifi_config_event_handler(ble_evt_t *evt) {
             g_ble_advertising = true;
             break;
             
-        case BLE_EVT_DATA_RECEIVED: {
-            ESP_LOGI(TAG, "BLE data received, conn_id=%d, handle=%d, len=%d", 
-                     evt->params.data_received.conn_id,
-                     evt->params.data_received.handle,
-                     evt->params.data_received.len);
-
-            // 检查数据长度是否超过队列项的最大大小
-            if (evt->params.data_received.len > sizeof(((ble_data_queue_item_t*)0)->data)) {
-                ESP_LOGE(TAG, "Received data too large: %d bytes", evt->params.data_received.len);
-                break;
-            }
-
-            uint8_t cmd;
-            const uint8_t *payload;
-            size_t payload_len;
-
-            if (!parse_protocol_packet(evt->params.data_received.p_data, evt->params.data_received.len, &cmd, &payload, &payload_len)) {
-                // ESP_LOGE(TAG, "Failed to parse protocol packet");
-                break;
-            }
-            
-            // 只处理WiFi配置相关的命令
-            if (!ble_protocol_is_wifi_cmd(cmd)) {
-                // ESP_LOGD(TAG, "Not a WiFi config command: 0x%02X", cmd);
-                break;
-            }
-            // 创建队列项
-            ble_data_queue_item_t queue_item;
-            queue_item.conn_id = evt->params.data_received.conn_id;
-            queue_item.handle = evt->params.data_received.handle;
-            queue_item.data_len = evt->params.data_received.len;
-            memcpy(queue_item.data, evt->params.data_received.p_data, evt->params.data_received.len);
-
-            // 将数据放入队列
-            if (g_ble_data_queue && xQueueSend(g_ble_data_queue, &queue_item, pdMS_TO_TICKS(10)) != pdTRUE) {
-                ESP_LOGW(TAG, "Failed to queue BLE data, queue might be full");
-            } else {
-                ESP_LOGD(TAG, "BLE data queued successfully");
-            }
-            
-            break;
-        }
-        
         case BLE_EVT_DATA_SENT:
             ESP_LOGD(TAG, "BLE data sent, conn_id=%d, handle=%d", 
                      evt->params.data_sent.conn_id,
@@ -367,10 +314,10 @@ int ble_wifi_config_init(void) {
         return 0;
     }
     
-    // 创建数据处理队列
-    g_ble_data_queue = xQueueCreate(4, sizeof(ble_data_queue_item_t));
-    if (g_ble_data_queue == NULL) {
-        ESP_LOGE(TAG, "Failed to create BLE data queue");
+    // WiFi 配置命令由 BLE 协议栈直接放入接收缓冲区
+    if (esp_ble_register_route(BLE_WIFI_CONFIG_CMD_GET_WIFI, BLE_WIFI_CONFIG_CMD_GET_SCAN,
+                               BLE_WIFI_CONFIG_RX_BUFFER_SIZE, &g_ble_route) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register BLE data route");
         return -1;
     }
     
@@ -387,8 +334,8 @@ int ble_wifi_config_init(void) {
     
     if (task_ret != pdPASS) {
         ESP_LOGE(TAG, "Failed to create BLE data process task");
-        vQueueDelete(g_ble_data_queue);
-        g_ble_data_queue = NULL;
+        esp_ble_unregister_route(g_ble_route);
+        g_ble_route = NULL;
         g_process_task_running = false;
         return -1;
     }
@@ -403,9 +350,9 @@ int ble_wifi_config_init(void) {
             vTaskDelete(g_ble_process_task);
             g_ble_process_task = NULL;
         }
-        if (g_ble_data_queue) {
-            vQueueDelete(g_ble_data_queue);
-            g_ble_data_queue = NULL;
+        if (g_ble_route) {
+            esp_ble_unregister_route(g_ble_route);
+            g_ble_route = NULL;
         }
         return ret;
     }
@@ -419,13 +366,18 @@ int ble_wifi_config_init(void) {
             vTaskDelete(g_ble_process_task);
             g_ble_process_task = NULL;
         }
-        if (g_ble_data_queue) {
-            vQueueDelete(g_ble_data_queue);
-            g_ble_data_queue = NULL;
+        if (g_ble_route) {
+            esp_ble_unregister_route(g_ble_route);
+            g_ble_route = NULL;
         }
         return ret;
     }
 
+    // 发送失败不影响配网，只是不能按发送完成事件控制速度
+    if (ble_protocol_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to initialize BLE protocol TX pacing");
+    }
+
     g_ble_initialized = true;
     ESP_LOGI(TAG, "BLE WiFi config initialized");
     return 0;
@@ -537,10 +489,10 @@ void ble_wifi_config_deinit(void) {
         g_ble_process_task = NULL;
     }
     
-    // 清理队列
-    if (g_ble_data_queue) {
-        vQueueDelete(g_ble_data_queue);
-        g_ble_data_queue = NULL;
+    // 清理接收缓冲区
+    if (g_ble_route) {
+        esp_ble_unregister_route(g_ble_route);
+        g_ble_route = NULL;
     }
     
     g_ble_initialized = false;
@@ -22,11 +22,15 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include "esp_timer.h"
 
 #include "modlog/modlog.h"
 
+#include "ble_protocol.h"
+#include "ble_route.h"
+
 static const char* TAG = "esp_ble";
 
 #ifdef USR_DEBUG_ENABLED
@@ -183,6 +187,12 @@ static int gatt_svc_access(uint16_t conn_handle, uint16_t attr_handle,
         }
         
         if (attr_handle == gatt_svr_write_chr_val_handle) {
+            if (ctxt->om != NULL && ble_route_dispatch(conn_handle, ctxt->om)) {
+                // 已按命令字交给接收者
+                rc = 0;
+                break;
+            }
+
             bool has_callback = false;
             for (int i = 0; i < BLE_EVT_CALLBACK_MAX; i++) {
                 if (g_ble_event_callbacks[i] != NULL) {
@@ -642,18 +652,20 @@ int esp_ble_notify_data(uint16_t conn_id, uint16_t handle, uint8_t *p_data, uint
     struct os_mbuf *om;
     om = ble_hs_mbuf_from_flat(p_data, len);
     if (om == NULL) {
-        ESP_LOGE(TAG, "esp_ble_notify_data om alloc Error");
+        // 缓冲区用尽由调用方等待后重试
+        ESP_LOGD(TAG, "esp_ble_notify_data om alloc Error");
         return ESP_ERR_NO_MEM;
     }
 
     ret = ble_gatts_notify_custom(conn_id, handle, om);
     if (ret != 0) {
-        ESP_LOGE(TAG, "esp_ble_notify_data failed: %d", ret);
         if(ret == BLE_HS_ENOMEM){
+            ESP_LOGD(TAG, "esp_ble_notify_data no buffer");
             return ESP_ERR_NO_MEM;
         }
+        ESP_LOGE(TAG, "esp_ble_notify_data failed: %d", ret);
     }else{
-        ESP_LOG_BUFFER_HEX(TAG, p_data, len);
+        ESP_LOG_BUFFER_HEX_LEVEL(TAG, p_data, len, ESP_LOG_DEBUG);
     }
     return ret;
 }
@@ -807,6 +819,7 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
 
     case BLE_GAP_EVENT_DISCONNECT:
         ESP_LOGI(TAG,"BLE_GAP_EVENT_DISCONNECT:%x,%d",event->disconnect.reason,event->disconnect.conn.conn_handle);
+        ble_route_disconnected(event->disconnect.conn.conn_handle);
         
         // 通知应用层断开连接事件
         for (int i = 0; i < BLE_EVT_CALLBACK_MAX; i++) {
@@ -863,7 +876,18 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
     break;
     
     case BLE_GAP_EVENT_NOTIFY_TX:
-        //ble_mngt_dev_tx_fininh_evt(event->notify_tx.conn_handle,event->notify_tx.status==0?true:false,false);
+        // 通知已交给控制器，发送方据此继续发送下一个分段
+        for (int i = 0; i < BLE_EVT_CALLBACK_MAX; i++) {
+            if (g_ble_event_callbacks[i] != NULL) {
+                ble_evt_t evt;
+                evt.evt_id = BLE_EVT_DATA_SENT;
+                evt.params.data_sent.conn_id = event->notify_tx.conn_handle;
+                evt.params.data_sent.handle = event->notify_tx.attr_handle;
+                evt.params.data_sent.p_data = NULL;
+                evt.params.data_sent.len = 0;
+                g_ble_event_callbacks[i](&evt);
+            }
+        }
     break;
 
     case BLE_GAP_EVENT_NOTIFY_RX:
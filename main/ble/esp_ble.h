@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -96,6 +97,27 @@ typedef void (*ble_evt_callback_t)(ble_evt_t *evt);
 int esp_ble_register_evt_callback(ble_evt_callback_t callback);
 int esp_ble_unregister_evt_callback(ble_evt_callback_t callback);
 
+// 按命令字路由收到的协议数据包（格式见 ble_protocol.h）。
+// 接收者登记一段命令范围和一个预分配的环形缓冲区，包头只解析一次，数据从协议栈 mbuf 直接复制到环形缓冲区，
+// 分段消息在环形缓冲区中原地重组。已路由的数据包不再产生 BLE_EVT_DATA_RECEIVED 事件
+#define BLE_ROUTE_MAX 4
+
+typedef struct{
+    uint16_t conn_id;
+    uint16_t len;       // data 长度
+    uint8_t data[];     // header(2) + cmd(1) + payload，分段消息重组为普通数据包
+}ble_route_packet_t;
+
+typedef struct ble_route *ble_route_handle_t;
+
+int esp_ble_register_route(uint8_t cmd_min, uint8_t cmd_max, size_t buffer_size, ble_route_handle_t *route);
+int esp_ble_unregister_route(ble_route_handle_t route);
+// 等待下一个数据包，处理完后用 esp_ble_route_return 归还
+ble_route_packet_t *esp_ble_route_receive(ble_route_handle_t route, uint32_t timeout_ms);
+void esp_ble_route_return(ble_route_handle_t route, ble_route_packet_t *packet);
+// APP 在本次连接中发送过分段帧，说明它也能接收分段帧
+bool esp_ble_route_sar_enabled(uint16_t conn_id);
+
 int esp_ble_init(void);
 
 #ifdef __cplusplus
@@ -0,0 +1,396 @@
+#include "firmware_downloader.h"
+#include "board.h"
+#include "settings.h"
+#include "ota_image_decoder.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_ota_ops.h>
+#include <esp_timer.h>
+#include <spi_flash_mmap.h>
+#include <freertos/task.h>
+
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#define TAG "FirmwareDownloader"
+
+#define PSRAM_BLOCK_COUNT 4
+#define PSRAM_BLOCK_SIZE (64 * 1024)
+#define INTERNAL_BLOCK_COUNT 2
+#define INTERNAL_BLOCK_SIZE (8 * 1024)
+#define READ_BUFFER_SIZE 4096
+#define MAX_RETRIES 5
+// Record the committed offset in NVS at most this often
+#define RESUME_SAVE_INTERVAL (64 * 1024)
+#define WRITER_DONE_EVENT BIT0
+
+
+FirmwareDownloader::FirmwareDownloader(const esp_partition_t* partition) : partition_(partition) {
+    event_group_ = xEventGroupCreate();
+}
+
+FirmwareDownloader::~FirmwareDownloader() {
+    for (auto block : blocks_) {
+        heap_caps_free(block);
+    }
+    if (free_queue_ != nullptr) {
+        vQueueDelete(free_queue_);
+    }
+    if (write_queue_ != nullptr) {
+        vQueueDelete(write_queue_);
+    }
+    vEventGroupDelete(event_group_);
+}
+
+bool FirmwareDownloader::AllocateBlocks() {
+    bool psram = heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0;
+    int count = psram ? PSRAM_BLOCK_COUNT : INTERNAL_BLOCK_COUNT;
+    block_size_ = psram ? PSRAM_BLOCK_SIZE : INTERNAL_BLOCK_SIZE;
+
+    free_queue_ = xQueueCreate(count, sizeof(uint8_t*));
+    write_queue_ = xQueueCreate(count + 1, sizeof(Block));
+    if (free_queue_ == nullptr || write_queue_ == nullptr) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        auto block = (uint8_t*)heap_caps_malloc(block_size_, psram ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (block == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u byte download block", block_size_);
+            return false;
+        }
+        blocks_.push_back(block);
+        xQueueSend(free_queue_, &block, 0);
+    }
+    ESP_LOGI(TAG, "Download buffer: %d x %u bytes in %s", count, block_size_, psram ? "PSRAM" : "internal RAM");
+    return true;
+}
+
+void FirmwareDownloader::LoadResumeState(const std::string& url) {
+    Settings settings("ota_resume", false);
+    url_ = url;
+    if (settings.GetString("url") != url) {
+        return;
+    }
+    etag_ = settings.GetString("etag");
+    image_size_ = settings.GetInt("size");
+    committed_offset_ = settings.GetInt("offset");
+}
+
+void FirmwareDownloader::SaveResumeState() {
+    Settings settings("ota_resume", true);
+    settings.SetString("url", url_);
+    settings.SetString("etag", etag_);
+    settings.SetInt("size", image_size_);
+    settings.SetInt("offset", committed_offset_);
+}
+
+void FirmwareDownloader::ClearResumeState() {
+    Settings settings("ota_resume", true);
+    settings.EraseAll();
+    etag_.clear();
+    image_size_ = 0;
+    committed_offset_ = 0;
+}
+
+std::unique_ptr<Http> FirmwareDownloader::OpenAt(size_t offset) {
+    auto http = Board::GetInstance().GetNetwork()->CreateHttp(0);
+    if (offset > 0) {
+        http->SetHeader("Range", "bytes=" + std::to_string(offset) + "-");
+    }
+    if (!http->Open("GET", url_)) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection");
+        return nullptr;
+    }
+
+    size_t image_size = 0;
+    size_t skip = 0;
+    auto status_code = http->GetStatusCode();
+    if (status_code == 206) {
+        // Content-Range: bytes <start>-<end>/<total>
+        auto content_range = http->GetResponseHeader("Content-Range");
+        auto slash = content_range.rfind('/');
+        if (slash != std::string::npos) {
+            image_size = strtoul(content_range.c_str() + slash + 1, nullptr, 10);
+        }
+        if (image_size == 0) {
+            image_size = offset + http->GetBodyLength();
+        }
+    } else if (status_code == 200) {
+        // The server ignored the Range header, read past what we already have
+        image_size = http->GetBodyLength();
+        skip = offset;
+    } else {
+        ESP_LOGE(TAG, "Failed to get firmware, status code: %d", status_code);
+        return nullptr;
+    }
+
+    auto etag = http->GetResponseHeader("ETag");
+    if (image_size == 0 || image_size > partition_->size) {
+        ESP_LOGE(TAG, "Invalid firmware size: %u", image_size);
+        return nullptr;
+    }
+    if (image_size_ != 0 && (image_size != image_size_ || (!etag_.empty() && etag != etag_))) {
+        ESP_LOGW(TAG, "Firmware changed on the server (size %u -> %u)", image_size_, image_size);
+        image_changed_ = true;
+        return nullptr;
+    }
+    if (image_size_ == 0) {
+        image_size_ = image_size;
+        etag_ = etag;
+    }
+
+    char buffer[512];
+    while (skip > 0) {
+        int ret = http->Read(buffer, std::min(skip, sizeof(buffer)));
+        if (ret <= 0) {
+            return nullptr;
+        }
+        skip -= ret;
+    }
+    return http;
+}
+
+bool FirmwareDownloader::CheckImageHeader(const uint8_t* data, size_t size) {
+    if (data[0] != ESP_IMAGE_HEADER_MAGIC) {
+        ESP_LOGE(TAG, "Invalid image magic: 0x%02x", data[0]);
+        return false;
+    }
+    esp_app_desc_t app_desc;
+    memcpy(&app_desc, data + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
+    return !check_app_ || check_app_(app_desc);
+}
+
+esp_err_t FirmwareDownloader::Output(const uint8_t* data, size_t size) {
+    const size_t header_size = sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t);
+    while (size > 0) {
+        if (block_.data == nullptr) {
+            xQueueReceive(free_queue_, &block_.data, portMAX_DELAY);
+            block_.offset = output_offset_;
+            block_.size = 0;
+        }
+        size_t n = std::min(size, block_size_ - block_.size);
+        memcpy(block_.data + block_.size, data, n);
+        block_.size += n;
+        output_offset_ += n;
+        data += n;
+        size -= n;
+
+        // Blocks are larger than the header, so it is all in the first one
+        if (!header_checked_ && output_offset_ >= header_size) {
+            if (!CheckImageHeader(block_.data, block_.size)) {
+                rejected_ = true;
+                return ESP_ERR_INVALID_VERSION;
+            }
+            header_checked_ = true;
+        }
+        if (block_.size == block_size_) {
+            Flush();
+        }
+    }
+    return ESP_OK;
+}
+
+void FirmwareDownloader::Flush() {
+    if (block_.data == nullptr) {
+        return;
+    }
+    if (block_.size > 0) {
+        xQueueSend(write_queue_, &block_, portMAX_DELAY);
+    } else {
+        xQueueSend(free_queue_, &block_.data, portMAX_DELAY);
+    }
+    block_.data = nullptr;
+}
+
+bool FirmwareDownloader::WaitForWrites() {
+    Block exit_block = {};
+    xQueueSend(write_queue_, &exit_block, portMAX_DELAY);
+    xEventGroupWaitBits(event_group_, WRITER_DONE_EVENT, pdTRUE, pdTRUE, portMAX_DELAY);
+    return write_error_ == ESP_OK;
+}
+
+void FirmwareDownloader::WriterTask() {
+    Block block;
+    while (xQueueReceive(write_queue_, &block, portMAX_DELAY) == pdTRUE && block.data != nullptr) {
+        // After an error the remaining blocks are only returned
+        if (write_error_ == ESP_OK) {
+            // Encrypted partitions are written in 16 byte units, pad the last block
+            size_t write_size = (block.size + 15) & ~15;
+            memset(block.data + block.size, 0xFF, write_size - block.size);
+            size_t erase_size = (write_size + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1);
+            esp_err_t err = esp_partition_erase_range(partition_, block.offset, erase_size);
+            if (err == ESP_OK) {
+                err = esp_partition_write(partition_, block.offset, block.data, write_size);
+            }
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write flash at 0x%x: %s", block.offset, esp_err_to_name(err));
+                write_error_ = err;
+            } else if (block.size == block_size_) {
+                // A partial block is the end of the image, which is verified right after
+                committed_offset_ = block.offset + block.size;
+                if (resumable_ && committed_offset_ % RESUME_SAVE_INTERVAL == 0) {
+                    SaveResumeState();
+                }
+            }
+        }
+        xQueueSend(free_queue_, &block.data, portMAX_DELAY);
+    }
+    xEventGroupSetBits(event_group_, WRITER_DONE_EVENT);
+}
+
+bool FirmwareDownloader::Download(const std::string& url, CheckAppCallback check_app, ProgressCallback progress_callback) {
+    if (!AllocateBlocks()) {
+        return false;
+    }
+
+    LoadResumeState(url);
+    check_app_ = check_app;
+    size_t offset = committed_offset_;
+    std::unique_ptr<Http> http;
+    if (offset > 0) {
+        ESP_LOGI(TAG, "Resuming download at %u/%u", offset, image_size_);
+        http = OpenAt(offset);
+        if (image_changed_) {
+            ESP_LOGW(TAG, "Cannot resume, downloading the whole image");
+            ClearResumeState();
+            offset = 0;
+            image_changed_ = false;
+        }
+    }
+
+    xEventGroupClearBits(event_group_, WRITER_DONE_EVENT);
+    xTaskCreate([](void* arg) {
+        auto downloader = (FirmwareDownloader*)arg;
+        downloader->WriterTask();
+        vTaskDelete(NULL);
+    }, "ota_writer", 4096, this, 3, nullptr);
+
+    // Only raw images are saved for resuming, so a resumed download is written as it is
+    std::unique_ptr<ota_image_decoder_t, decltype(&ota_image_decoder_destroy)> decoder(nullptr, ota_image_decoder_destroy);
+    if (offset == 0) {
+        decoder.reset(ota_image_decoder_create(esp_ota_get_running_partition(), [](void* ctx, const uint8_t* data, size_t len) {
+            return ((FirmwareDownloader*)ctx)->Output(data, len);
+        }, this));
+        if (!decoder) {
+            ESP_LOGE(TAG, "Failed to create image decoder");
+            WaitForWrites();
+            return false;
+        }
+    }
+    resumable_ = offset > 0;
+    output_offset_ = offset;
+    header_checked_ = offset > 0;
+
+    std::vector<uint8_t> buffer(READ_BUFFER_SIZE);
+    bool rejected = false;
+    bool completed = false;
+    int retries = 0;
+    size_t recent_read = 0;
+    auto last_calc_time = esp_timer_get_time();
+
+    while (write_error_ == ESP_OK) {
+        if (!http) {
+            if (retries > MAX_RETRIES) {
+                ESP_LOGE(TAG, "Download failed at %u/%u, giving up", offset, image_size_);
+                break;
+            }
+            if (retries > 0) {
+                ESP_LOGW(TAG, "Reconnecting at %u/%u (%d/%d)", offset, image_size_, retries, MAX_RETRIES);
+                vTaskDelay(pdMS_TO_TICKS(1000 * retries));
+            }
+            retries++;
+            http = OpenAt(offset);
+            if (!http) {
+                if (image_changed_) {
+                    // The image was replaced in the middle of the download
+                    rejected = true;
+                    break;
+                }
+                continue;
+            }
+            if (offset == 0) {
+                SaveResumeState();
+            }
+        }
+
+        int ret = http->Read((char*)buffer.data(), buffer.size());
+        if (ret < 0 || (ret == 0 && offset < image_size_)) {
+            ESP_LOGW(TAG, "Connection lost at %u/%u: %d", offset, image_size_, ret);
+            http->Close();
+            http.reset();
+            continue;
+        }
+        retries = 0;
+        offset += ret;
+
+        esp_err_t err = decoder ? ota_image_decoder_feed(decoder.get(), buffer.data(), ret) : Output(buffer.data(), ret);
+        if (err != ESP_OK) {
+            if (!rejected_) {
+                ESP_LOGE(TAG, "Failed to decode firmware: %s", esp_err_to_name(err));
+            }
+            rejected = true;
+            break;
+        }
+        if (decoder && !resumable_ && ota_image_decoder_get_type(decoder.get()) == OTA_IMAGE_TYPE_RAW) {
+            resumable_ = true;
+        }
+
+        // Calculate speed and progress every second
+        recent_read += ret;
+        completed = offset >= image_size_;
+        if (esp_timer_get_time() - last_calc_time >= 1000000 || completed) {
+            size_t progress = offset * 100 / image_size_;
+            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s, Flash: %u", progress, offset, image_size_, recent_read, committed_offset_.load());
+            if (progress_callback) {
+                progress_callback(progress, recent_read);
+            }
+            last_calc_time = esp_timer_get_time();
+            recent_read = 0;
+        }
+
+        if (completed) {
+            break;
+        }
+    }
+    if (http) {
+        http->Close();
+    }
+    if (completed) {
+        Flush();
+    } else if (block_.data != nullptr) {
+        xQueueSend(free_queue_, &block_.data, portMAX_DELAY);
+        block_.data = nullptr;
+    }
+
+    if (!WaitForWrites()) {
+        ESP_LOGE(TAG, "Failed to write firmware: %s", esp_err_to_name(write_error_.load()));
+        return false;
+    }
+    if (rejected) {
+        ClearResumeState();
+        return false;
+    }
+    if (!completed) {
+        // Keep the resume state, the next attempt continues from the last committed block
+        return false;
+    }
+
+    ClearResumeState();
+    if (decoder && ota_image_decoder_finish(decoder.get()) != ESP_OK) {
+        return false;
+    }
+
+    // Verifies the whole image before switching to it
+    esp_err_t err = esp_ota_set_boot_partition(partition_);
+    if (err != ESP_OK) {
+        if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
+            ESP_LOGE(TAG, "Image validation failed, image is corrupted");
+        } else {
+            ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(err));
+        }
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,85 @@
+#ifndef FIRMWARE_DOWNLOADER_H
+#define FIRMWARE_DOWNLOADER_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <esp_err.h>
+#include <esp_partition.h>
+#include <esp_app_format.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+
+class Http;
+
+/*
+ * Downloads a firmware image straight into an OTA partition.
+ *
+ * The network reader fills large blocks (PSRAM when available) and a writer task erases and
+ * programs them, so flash writes overlap with the next reads. Every block that reaches flash is
+ * recorded in NVS, and a dropped connection, or a reboot, resumes from there with an HTTP Range
+ * request instead of starting the image over.
+ *
+ * Compressed and delta images (see ota_image_decoder.h) are decoded on the fly. Their decoder state
+ * only lives in RAM, so they resume after a dropped connection but restart after a reboot.
+ */
+class FirmwareDownloader {
+public:
+    // Return false to reject the image, e.g. when it is the running version
+    using CheckAppCallback = std::function<bool(const esp_app_desc_t& app_desc)>;
+    using ProgressCallback = std::function<void(int progress, size_t speed)>;
+
+    FirmwareDownloader(const esp_partition_t* partition);
+    ~FirmwareDownloader();
+
+    // Download url and make the partition bootable
+    bool Download(const std::string& url, CheckAppCallback check_app, ProgressCallback progress_callback);
+
+private:
+    struct Block {
+        uint8_t* data;
+        size_t offset;
+        size_t size;
+    };
+
+    const esp_partition_t* partition_;
+    std::vector<uint8_t*> blocks_;
+    size_t block_size_ = 0;
+    QueueHandle_t free_queue_ = nullptr;
+    QueueHandle_t write_queue_ = nullptr;
+    EventGroupHandle_t event_group_ = nullptr;
+    std::atomic<size_t> committed_offset_ = 0;
+    std::atomic<esp_err_t> write_error_ = ESP_OK;
+
+    // Decoded image being cut into blocks
+    CheckAppCallback check_app_;
+    Block block_ = {};
+    size_t output_offset_ = 0;
+    bool header_checked_ = false;
+    bool rejected_ = false;
+    // Raw images can resume from NVS, their download offset is their flash offset
+    std::atomic<bool> resumable_ = false;
+
+    // Resume state, saved in NVS
+    std::string url_;
+    std::string etag_;
+    size_t image_size_ = 0;
+    bool image_changed_ = false;
+
+    bool AllocateBlocks();
+    void LoadResumeState(const std::string& url);
+    void SaveResumeState();
+    void ClearResumeState();
+    std::unique_ptr<Http> OpenAt(size_t offset);
+    bool CheckImageHeader(const uint8_t* data, size_t size);
+    esp_err_t Output(const uint8_t* data, size_t size);
+    void Flush();
+    bool WaitForWrites();
+    void WriterTask();
+};
+
+#endif // FIRMWARE_DOWNLOADER_H
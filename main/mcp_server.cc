@@ -13,6 +13,7 @@
 #include "application.h"
 #include "display.h"
 #include "board.h"
+#include "latency_tracer.h"
 
 #define TAG "MCP"
 
@@ -103,6 +104,17 @@ void McpServer::AddCommonTools() {
             });
     }
 
+#if CONFIG_USE_AUDIO_LATENCY_TRACER
+    AddTool("self.audio.get_latency_stats",
+        "Get the latency of each audio pipeline stage (p50 / p95 / p99 / max in microseconds). For debugging only.",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& tracer = LatencyTracer::GetInstance();
+            tracer.PrintStats();
+            return tracer.GetStatsJson();
+        });
+#endif
+
     // Restore the original tools list to the end of the tools list
     tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
 }
@@ -0,0 +1,343 @@
+#include "ota_image_decoder.h"
+
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <mbedtls/sha256.h>
+#include "sdkconfig.h"
+#if CONFIG_USE_COMPRESSED_OTA
+#include "rom/miniz.h"
+#endif
+
+#define TAG "OtaImageDecoder"
+
+#define OTA_IMAGE_VERSION           1
+#define OTA_IMAGE_COMPRESSED        1
+#define OTA_IMAGE_DELTA             2
+
+#define OTA_PATCH_ADD               0
+#define OTA_PATCH_INSERT            1
+#define OTA_PATCH_RECORD_SIZE       9
+#define OTA_SOURCE_BUFFER_SIZE      1024
+
+struct ota_image_decoder {
+    const esp_partition_t *source;
+    ota_image_write_cb_t write_cb;
+    void *ctx;
+    ota_image_type_t type;
+
+    // |magic(4)|version(1)|type(1)|reserved(2)|image_size(4)|source_size(4)|image_sha256(32)|source_sha256(32)|
+    uint8_t header[OTA_IMAGE_HEADER_SIZE];
+    size_t header_len;
+    uint32_t image_size;
+    uint32_t source_size;
+    size_t output_size;
+    mbedtls_sha256_context sha256;
+
+#if CONFIG_USE_COMPRESSED_OTA
+    tinfl_decompressor *inflator;
+    uint8_t *dict;
+    size_t dict_ofs;
+    bool inflate_done;
+#endif
+
+    // Patch record being applied
+    uint8_t record[OTA_PATCH_RECORD_SIZE];
+    size_t record_len;
+    uint8_t op;
+    uint32_t remaining;
+    uint32_t source_offset;
+    uint8_t source_buffer[OTA_SOURCE_BUFFER_SIZE];
+};
+
+ota_image_decoder_t *ota_image_decoder_create(const esp_partition_t *source, ota_image_write_cb_t write_cb, void *ctx)
+{
+    ota_image_decoder_t *decoder = calloc(1, sizeof(ota_image_decoder_t));
+    if (decoder == NULL) {
+        return NULL;
+    }
+    decoder->source = source;
+    decoder->write_cb = write_cb;
+    decoder->ctx = ctx;
+    mbedtls_sha256_init(&decoder->sha256);
+    return decoder;
+}
+
+void ota_image_decoder_destroy(ota_image_decoder_t *decoder)
+{
+    if (decoder == NULL) {
+        return;
+    }
+#if CONFIG_USE_COMPRESSED_OTA
+    heap_caps_free(decoder->inflator);
+    heap_caps_free(decoder->dict);
+#endif
+    mbedtls_sha256_free(&decoder->sha256);
+    free(decoder);
+}
+
+ota_image_type_t ota_image_decoder_get_type(const ota_image_decoder_t *decoder)
+{
+    return decoder->type;
+}
+
+size_t ota_image_decoder_get_image_size(const ota_image_decoder_t *decoder)
+{
+    return decoder->image_size;
+}
+
+#if CONFIG_USE_COMPRESSED_OTA
+static uint32_t read_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Delta images only apply to the firmware they were made from
+static esp_err_t ota_image_check_source(ota_image_decoder_t *decoder, const uint8_t *expected_sha256)
+{
+    if (decoder->source == NULL || decoder->source_size > decoder->source->size) {
+        ESP_LOGE(TAG, "Invalid delta source");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    mbedtls_sha256_context sha256;
+    uint8_t digest[32];
+    esp_err_t ret = ESP_OK;
+    mbedtls_sha256_init(&sha256);
+    mbedtls_sha256_starts(&sha256, 0);
+    for (uint32_t offset = 0; offset < decoder->source_size; offset += OTA_SOURCE_BUFFER_SIZE) {
+        size_t n = decoder->source_size - offset;
+        if (n > OTA_SOURCE_BUFFER_SIZE) {
+            n = OTA_SOURCE_BUFFER_SIZE;
+        }
+        ret = esp_partition_read(decoder->source, offset, decoder->source_buffer, n);
+        if (ret != ESP_OK) {
+            break;
+        }
+        mbedtls_sha256_update(&sha256, decoder->source_buffer, n);
+    }
+    mbedtls_sha256_finish(&sha256, digest);
+    mbedtls_sha256_free(&sha256);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read delta source: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    if (memcmp(digest, expected_sha256, sizeof(digest)) != 0) {
+        ESP_LOGE(TAG, "Delta image was made for another firmware");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t ota_image_parse_header(ota_image_decoder_t *decoder)
+{
+    const uint8_t *header = decoder->header;
+    if (header[4] != OTA_IMAGE_VERSION || (header[5] != OTA_IMAGE_COMPRESSED && header[5] != OTA_IMAGE_DELTA)) {
+        ESP_LOGE(TAG, "Unsupported image version %d, type %d", header[4], header[5]);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    decoder->image_size = read_le32(header + 8);
+    decoder->source_size = read_le32(header + 12);
+
+    if (header[5] == OTA_IMAGE_DELTA) {
+        esp_err_t ret = ota_image_check_source(decoder, header + 48);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+
+    decoder->inflator = heap_caps_malloc_prefer(sizeof(tinfl_decompressor), 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT);
+    decoder->dict = heap_caps_malloc_prefer(TINFL_LZ_DICT_SIZE, 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT);
+    if (decoder->inflator == NULL || decoder->dict == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate inflate buffers");
+        return ESP_ERR_NO_MEM;
+    }
+    tinfl_init(decoder->inflator);
+    mbedtls_sha256_starts(&decoder->sha256, 0);
+
+    decoder->type = header[5] == OTA_IMAGE_DELTA ? OTA_IMAGE_TYPE_DELTA : OTA_IMAGE_TYPE_COMPRESSED;
+    ESP_LOGI(TAG, "%s image, %lu bytes after decoding", decoder->type == OTA_IMAGE_TYPE_DELTA ? "Delta" : "Compressed",
+             decoder->image_size);
+    return ESP_OK;
+}
+
+static esp_err_t ota_image_emit(ota_image_decoder_t *decoder, const uint8_t *data, size_t len)
+{
+    if (decoder->output_size + len > decoder->image_size) {
+        ESP_LOGE(TAG, "Decoded data exceeds image size %lu", decoder->image_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    mbedtls_sha256_update(&decoder->sha256, data, len);
+    decoder->output_size += len;
+    return decoder->write_cb(decoder->ctx, data, len);
+}
+
+static esp_err_t ota_image_apply_patch(ota_image_decoder_t *decoder, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        if (decoder->remaining == 0) {
+            size_t n = OTA_PATCH_RECORD_SIZE - decoder->record_len;
+            if (n > len) {
+                n = len;
+            }
+            memcpy(decoder->record + decoder->record_len, data, n);
+            decoder->record_len += n;
+            data += n;
+            len -= n;
+            if (decoder->record_len < OTA_PATCH_RECORD_SIZE) {
+                break;
+            }
+            decoder->record_len = 0;
+            decoder->op = decoder->record[0];
+            decoder->remaining = read_le32(decoder->record + 1);
+            decoder->source_offset = read_le32(decoder->record + 5);
+            if (decoder->op != OTA_PATCH_ADD && decoder->op != OTA_PATCH_INSERT) {
+                ESP_LOGE(TAG, "Invalid patch record %d", decoder->op);
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            if (decoder->op == OTA_PATCH_ADD &&
+                (uint64_t)decoder->source_offset + decoder->remaining > decoder->source_size) {
+                ESP_LOGE(TAG, "Patch reads past the source: %lu + %lu", decoder->source_offset, decoder->remaining);
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            continue;
+        }
+
+        size_t n = len < decoder->remaining ? len : decoder->remaining;
+        esp_err_t ret;
+        if (decoder->op == OTA_PATCH_INSERT) {
+            ret = ota_image_emit(decoder, data, n);
+        } else {
+            if (n > OTA_SOURCE_BUFFER_SIZE) {
+                n = OTA_SOURCE_BUFFER_SIZE;
+            }
+            ret = esp_partition_read(decoder->source, decoder->source_offset, decoder->source_buffer, n);
+            if (ret == ESP_OK) {
+                for (size_t i = 0; i < n; i++) {
+                    decoder->source_buffer[i] += data[i];
+                }
+                ret = ota_image_emit(decoder, decoder->source_buffer, n);
+            }
+            decoder->source_offset += n;
+        }
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        data += n;
+        len -= n;
+        decoder->remaining -= n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t ota_image_inflate(ota_image_decoder_t *decoder, const uint8_t *data, size_t len)
+{
+    if (decoder->inflate_done) {
+        ESP_LOGE(TAG, "Data after the end of the image");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    while (true) {
+        size_t in_bytes = len;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - decoder->dict_ofs;
+        tinfl_status status = tinfl_decompress(decoder->inflator, data, &in_bytes,
+                                               decoder->dict, decoder->dict + decoder->dict_ofs, &out_bytes,
+                                               TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+        data += in_bytes;
+        len -= in_bytes;
+
+        if (out_bytes > 0) {
+            const uint8_t *out = decoder->dict + decoder->dict_ofs;
+            esp_err_t ret = decoder->type == OTA_IMAGE_TYPE_DELTA ?
+                ota_image_apply_patch(decoder, out, out_bytes) : ota_image_emit(decoder, out, out_bytes);
+            if (ret != ESP_OK) {
+                return ret;
+            }
+            decoder->dict_ofs = (decoder->dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+        }
+
+        if (status < TINFL_STATUS_DONE) {
+            ESP_LOGE(TAG, "Corrupted image stream: %d", status);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        if (status == TINFL_STATUS_DONE) {
+            decoder->inflate_done = true;
+            return len == 0 ? ESP_OK : ESP_ERR_INVALID_SIZE;
+        }
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT && len == 0) {
+            return ESP_OK;
+        }
+    }
+}
+#endif // CONFIG_USE_COMPRESSED_OTA
+
+esp_err_t ota_image_decoder_feed(ota_image_decoder_t *decoder, const uint8_t *data, size_t len)
+{
+    esp_err_t ret;
+
+    // The first 4 bytes tell raw images from encoded ones, encoded ones then need the whole header
+    while (len > 0 && decoder->type == OTA_IMAGE_TYPE_UNKNOWN) {
+        size_t want = decoder->header_len < 4 ? 4 : OTA_IMAGE_HEADER_SIZE;
+        size_t n = want - decoder->header_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(decoder->header + decoder->header_len, data, n);
+        decoder->header_len += n;
+        data += n;
+        len -= n;
+
+        if (decoder->header_len == 4 && memcmp(decoder->header, OTA_IMAGE_MAGIC, 4) != 0) {
+            decoder->type = OTA_IMAGE_TYPE_RAW;
+            ret = decoder->write_cb(decoder->ctx, decoder->header, 4);
+            if (ret != ESP_OK) {
+                return ret;
+            }
+        } else if (decoder->header_len == OTA_IMAGE_HEADER_SIZE) {
+#if CONFIG_USE_COMPRESSED_OTA
+            ret = ota_image_parse_header(decoder);
+            if (ret != ESP_OK) {
+                return ret;
+            }
+#else
+            ESP_LOGE(TAG, "Compressed and delta images are not enabled");
+            return ESP_ERR_NOT_SUPPORTED;
+#endif
+        }
+    }
+    if (len == 0) {
+        return ESP_OK;
+    }
+
+#if CONFIG_USE_COMPRESSED_OTA
+    if (decoder->type != OTA_IMAGE_TYPE_RAW) {
+        return ota_image_inflate(decoder, data, len);
+    }
+#endif
+    return decoder->write_cb(decoder->ctx, data, len);
+}
+
+esp_err_t ota_image_decoder_finish(ota_image_decoder_t *decoder)
+{
+    if (decoder->type == OTA_IMAGE_TYPE_RAW) {
+        // Raw images carry their own hash, checked by esp_image_verify
+        return ESP_OK;
+    }
+#if CONFIG_USE_COMPRESSED_OTA
+    if (decoder->type != OTA_IMAGE_TYPE_UNKNOWN && decoder->inflate_done &&
+        decoder->output_size == decoder->image_size && decoder->remaining == 0 && decoder->record_len == 0) {
+        uint8_t digest[32];
+        mbedtls_sha256_finish(&decoder->sha256, digest);
+        if (memcmp(digest, decoder->header + 16, sizeof(digest)) != 0) {
+            ESP_LOGE(TAG, "Decoded image hash mismatch");
+            return ESP_ERR_INVALID_CRC;
+        }
+        return ESP_OK;
+    }
+#endif
+    ESP_LOGE(TAG, "Incomplete image: %u/%lu bytes decoded", decoder->output_size, decoder->image_size);
+    return ESP_ERR_INVALID_SIZE;
+}
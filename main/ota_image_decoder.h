@@ -0,0 +1,60 @@
+#ifndef OTA_IMAGE_DECODER_H
+#define OTA_IMAGE_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include <esp_partition.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Streaming decoder for OTA images, shared by the HTTP and BLE upgrades.
+ *
+ * An image is either a raw app image, passed through unchanged, or an encoded image produced by
+ * scripts/ota_image_tool.py: an 80 byte header followed by a zlib stream of
+ *   - the raw app image (OTA_IMAGE_TYPE_COMPRESSED), or
+ *   - a patch against the running app (OTA_IMAGE_TYPE_DELTA), a sequence of records
+ *     |op(1)|length(4)|source_offset(4)| followed by length bytes. ADD outputs the sum of the
+ *     bytes and the running app at source_offset, INSERT outputs the bytes as they are.
+ *
+ * The decoded image is checked against the SHA-256 in the header by ota_image_decoder_finish().
+ */
+
+#define OTA_IMAGE_MAGIC             "OTAZ"
+#define OTA_IMAGE_HEADER_SIZE       80
+
+typedef enum {
+    OTA_IMAGE_TYPE_UNKNOWN = 0,
+    OTA_IMAGE_TYPE_RAW,
+    OTA_IMAGE_TYPE_COMPRESSED,
+    OTA_IMAGE_TYPE_DELTA,
+} ota_image_type_t;
+
+typedef esp_err_t (*ota_image_write_cb_t)(void *ctx, const uint8_t *data, size_t len);
+
+typedef struct ota_image_decoder ota_image_decoder_t;
+
+// source is the partition delta images are applied to, usually the running one
+ota_image_decoder_t *ota_image_decoder_create(const esp_partition_t *source, ota_image_write_cb_t write_cb, void *ctx);
+void ota_image_decoder_destroy(ota_image_decoder_t *decoder);
+
+// Feed the next bytes of the transferred file, decoded bytes are passed to write_cb
+esp_err_t ota_image_decoder_feed(ota_image_decoder_t *decoder, const uint8_t *data, size_t len);
+
+// Check that the whole image was decoded and matches its hash
+esp_err_t ota_image_decoder_finish(ota_image_decoder_t *decoder);
+
+// Known once the first 4 bytes were fed
+ota_image_type_t ota_image_decoder_get_type(const ota_image_decoder_t *decoder);
+
+// Size of the decoded image, 0 for raw images
+size_t ota_image_decoder_get_image_size(const ota_image_decoder_t *decoder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_IMAGE_DECODER_H
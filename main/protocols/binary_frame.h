@@ -0,0 +1,65 @@
+#ifndef BINARY_FRAME_H
+#define BINARY_FRAME_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <arpa/inet.h>
+
+#include "protocol.h"
+
+struct BinaryFrame {
+    uint16_t type;
+    uint32_t timestamp;
+    const uint8_t* payload;
+    size_t payload_size;
+};
+
+/*
+ * Walks the frames of one binary WebSocket message: a single Opus frame (version 1), or one or more
+ * BinaryProtocol2 / BinaryProtocol3 frames back to back. Headers are read without touching the receive
+ * buffer, and every size is checked against the message before `on_frame` sees a view of the payload.
+ *
+ * Returns the number of bytes consumed by complete frames, anything less than `len` is a malformed tail.
+ */
+template <typename OnFrame>
+size_t ParseBinaryFrames(int version, const uint8_t* data, size_t len, OnFrame&& on_frame) {
+    size_t offset = 0;
+    while (offset < len) {
+        BinaryFrame frame = {};
+        size_t header_size;
+        if (version == 2) {
+            header_size = sizeof(BinaryProtocol2);
+            if (len - offset < header_size) {
+                break;
+            }
+            BinaryProtocol2 bp2;
+            memcpy(&bp2, data + offset, header_size);
+            frame.type = ntohs(bp2.type);
+            frame.timestamp = ntohl(bp2.timestamp);
+            frame.payload_size = ntohl(bp2.payload_size);
+        } else if (version == 3) {
+            header_size = sizeof(BinaryProtocol3);
+            if (len - offset < header_size) {
+                break;
+            }
+            BinaryProtocol3 bp3;
+            memcpy(&bp3, data + offset, header_size);
+            frame.type = bp3.type;
+            frame.payload_size = ntohs(bp3.payload_size);
+        } else {
+            header_size = 0;
+            frame.payload_size = len;
+        }
+        if (frame.payload_size > len - offset - header_size) {
+            break;
+        }
+
+        frame.payload = data + offset + header_size;
+        offset += header_size + frame.payload_size;
+        on_frame(frame);
+    }
+    return offset;
+}
+
+#endif // BINARY_FRAME_H
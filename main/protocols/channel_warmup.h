@@ -0,0 +1,96 @@
+#ifndef CHANNEL_WARMUP_H
+#define CHANNEL_WARMUP_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+/*
+ * Bookkeeping for audio channels opened ahead of the wake word.
+ *
+ * Every speculative open is an attempt with a number of its own. The attempt owns the channel from Begin()
+ * until a session claims it or the channel goes away, and network errors in that time are its errors: nobody
+ * asked for the channel yet, so they are not shown. Closing names the attempt it was meant for, a late close
+ * of an earlier channel leaves the next attempt alone. One attempt runs at a time, and the next one waits two
+ * TTLs after the last, so a chatty room does not keep the radio busy.
+ *
+ * Used from the warm-up task, the main loop, the clock timer and the protocol callbacks.
+ */
+class ChannelWarmup {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit ChannelWarmup(Clock::duration ttl) : ttl_(ttl) {}
+
+    // The number of the new attempt, 0 while the channel is owned by one or the last one started too recently
+    uint32_t Begin(Clock::time_point now) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (owner_ != 0 || (last_attempt_ != 0 && now - started_ < ttl_ * 2)) {
+            return 0;
+        }
+        last_attempt_ = last_attempt_ + 1 == 0 ? 1 : last_attempt_ + 1;
+        owner_ = last_attempt_;
+        started_ = now;
+        warm_ = false;
+        return owner_;
+    }
+
+    // The open of an attempt returned, a channel that did not open belongs to nobody
+    void Finish(uint32_t attempt, bool opened, Clock::time_point now) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (attempt == 0 || attempt != owner_) {
+            return;
+        }
+        if (!opened) {
+            owner_ = 0;
+            return;
+        }
+        warm_ = true;
+        opened_ = now;
+        handshake_ms_ = std::chrono::duration_cast<std::chrono::milliseconds>(now - started_).count();
+    }
+
+    // The attempt owning the channel, 0 once a session has it or when there is none
+    uint32_t owner() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return owner_;
+    }
+
+    // A session takes the channel over, returns the milliseconds of handshake a warm channel saves it, -1 otherwise
+    int Claim() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int saved_ms = warm_ ? handshake_ms_ : -1;
+        owner_ = 0;
+        warm_ = false;
+        return saved_ms;
+    }
+
+    // The attempt whose warm channel has gone unused for longer than the TTL, 0 if none
+    uint32_t Expired(Clock::time_point now) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return warm_ && now - opened_ > ttl_ ? owner_ : 0;
+    }
+
+    // The channel of an attempt closed or is about to, false when the attempt no longer owns it
+    bool Drop(uint32_t attempt) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (attempt == 0 || attempt != owner_) {
+            return false;
+        }
+        owner_ = 0;
+        warm_ = false;
+        return true;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    const Clock::duration ttl_;
+    uint32_t last_attempt_ = 0;
+    uint32_t owner_ = 0;
+    bool warm_ = false;
+    int handshake_ms_ = 0;
+    Clock::time_point started_;
+    Clock::time_point opened_;
+};
+
+#endif // CHANNEL_WARMUP_H
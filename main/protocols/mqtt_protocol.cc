@@ -2,6 +2,7 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "audio_packet_pool.h"
 
 #include <esp_log.h>
 #include <cstring>
@@ -12,6 +13,7 @@
 
 MqttProtocol::MqttProtocol() {
     event_group_handle_ = xEventGroupCreate();
+    mbedtls_aes_init(&aes_ctx_);
 
     // Initialize reconnect timer
     esp_timer_create_args_t reconnect_timer_args = {
@@ -39,6 +41,7 @@ MqttProtocol::~MqttProtocol() {
     if (event_group_handle_ != nullptr) {
         vEventGroupDelete(event_group_handle_);
     }
+    mbedtls_aes_free(&aes_ctx_);
 }
 
 bool MqttProtocol::Start() {
@@ -103,8 +106,9 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
             ParseServerHello(root);
         } else if (strcmp(type->valuestring, "goodbye") == 0) {
             auto session_id = cJSON_GetObjectItem(root, "session_id");
-            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
+            const char* id = cJSON_IsString(session_id) ? session_id->valuestring : nullptr;
+            ESP_LOGI(TAG, "Received goodbye message, session_id: %s", id ? id : "null");
+            if (id == nullptr || session_id_ == id) {
                 Application::GetInstance().Schedule([this]() {
                     CloseAudioChannel();
                 });
@@ -148,30 +152,49 @@ bool MqttProtocol::SendText(const std::string& text) {
     return true;
 }
 
-bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+bool MqttProtocol::SendAudioFrames(const std::unique_ptr<AudioStreamPacket>* packets, size_t count) {
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ == nullptr) {
         return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
-
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
-        ESP_LOGE(TAG, "Failed to encrypt audio data");
-        return false;
+    /*
+     * Every frame keeps its own header (which is also its nonce) and is encrypted on its own,
+     * coalesced frames are written back to back into the reused buffer, one datagram per audio_frames_per_packet_ frames
+     */
+    for (size_t i = 0; i < count; i += audio_frames_per_packet_) {
+        send_buffer_.clear();
+        for (size_t j = i; j < count && j < i + audio_frames_per_packet_; j++) {
+            auto& packet = *packets[j];
+            size_t offset = send_buffer_.size();
+            send_buffer_.resize(offset + aes_nonce_.size() + packet.payload.size());
+            auto header = (uint8_t*)&send_buffer_[offset];
+
+            // Coalesced frames put the header at any offset, so its fields are filled in byte-wise
+            uint8_t nonce[16];
+            memcpy(nonce, aes_nonce_.data(), sizeof(nonce));
+            uint16_t payload_size = htons(packet.payload.size());
+            uint32_t timestamp = htonl(packet.timestamp);
+            uint32_t sequence = htonl(++local_sequence_);
+            memcpy(&nonce[2], &payload_size, sizeof(payload_size));
+            memcpy(&nonce[8], &timestamp, sizeof(timestamp));
+            memcpy(&nonce[12], &sequence, sizeof(sequence));
+            memcpy(header, nonce, sizeof(nonce));
+
+            // The counter is advanced by mbedtls, so it works on the local copy of the header
+            size_t nc_off = 0;
+            uint8_t stream_block[16] = {0};
+            if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet.payload.size(), &nc_off, nonce, stream_block,
+                packet.payload.data(), header + aes_nonce_.size()) != 0) {
+                ESP_LOGE(TAG, "Failed to encrypt audio data");
+                return false;
+            }
+        }
+        if (udp_->Send(send_buffer_) <= 0) {
+            return false;
+        }
     }
-
-    return udp_->Send(encrypted) > 0;
+    return true;
 }
 
 void MqttProtocol::CloseAudioChannel() {
@@ -225,7 +248,7 @@ bool MqttProtocol::OpenAudioChannel() {
          * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
          * |payload payload_len|
          */
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < aes_nonce_.size()) {
             ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
             return;
         }
@@ -235,23 +258,28 @@ bool MqttProtocol::OpenAudioChannel() {
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
+        // Reordered packets within the window are passed on, the jitter buffer of the audio service sorts them out
+        uint32_t highest = replay_window_.highest();
+        if (!replay_window_.Accept(sequence)) {
+            ESP_LOGD(TAG, "Dropped replayed or stale audio packet with sequence: %lu, highest: %lu", sequence, highest);
             return;
         }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
+        if (sequence != highest + 1) {
+            ESP_LOGD(TAG, "Received audio packet with sequence: %lu, expected: %lu", sequence, highest + 1);
         }
 
+        // The counter is advanced by mbedtls, so it works on a copy of the header
+        uint8_t nonce[16];
+        memcpy(nonce, data.data(), sizeof(nonce));
         size_t decrypted_size = data.size() - aes_nonce_.size();
         size_t nc_off = 0;
         uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        auto packet = std::make_unique<AudioStreamPacket>();
+        auto encrypted = (const uint8_t*)data.data() + aes_nonce_.size();
+        auto packet = AudioPacketPool::GetInstance().Acquire();
         packet->sample_rate = server_sample_rate_;
         packet->frame_duration = server_frame_duration_;
         packet->timestamp = timestamp;
+        packet->sequence = sequence;
         packet->payload.resize(decrypted_size);
         int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
         if (ret != 0) {
@@ -261,7 +289,6 @@ bool MqttProtocol::OpenAudioChannel() {
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -289,7 +316,8 @@ std::string MqttProtocol::GetHelloMessage() {
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", frame_duration_);
+    AddAudioBatchParams(audio_params);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -300,8 +328,8 @@ std::string MqttProtocol::GetHelloMessage() {
 
 void MqttProtocol::ParseServerHello(const cJSON* root) {
     auto transport = cJSON_GetObjectItem(root, "transport");
-    if (transport == nullptr || strcmp(transport->valuestring, "udp") != 0) {
-        ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
+    if (!cJSON_IsString(transport) || strcmp(transport->valuestring, "udp") != 0) {
+        ESP_LOGE(TAG, "Unsupported transport: %s", cJSON_IsString(transport) ? transport->valuestring : "null");
         return;
     }
 
@@ -323,24 +351,31 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
             server_frame_duration_ = frame_duration->valueint;
         }
     }
+    ParseAudioBatchParams(audio_params);
 
     auto udp = cJSON_GetObjectItem(root, "udp");
     if (!cJSON_IsObject(udp)) {
         ESP_LOGE(TAG, "UDP is not specified");
         return;
     }
-    udp_server_ = cJSON_GetObjectItem(udp, "server")->valuestring;
-    udp_port_ = cJSON_GetObjectItem(udp, "port")->valueint;
-    auto key = cJSON_GetObjectItem(udp, "key")->valuestring;
-    auto nonce = cJSON_GetObjectItem(udp, "nonce")->valuestring;
+    auto server = cJSON_GetObjectItem(udp, "server");
+    auto port = cJSON_GetObjectItem(udp, "port");
+    auto key = cJSON_GetObjectItem(udp, "key");
+    auto nonce = cJSON_GetObjectItem(udp, "nonce");
+    if (!cJSON_IsString(server) || !cJSON_IsNumber(port) || !cJSON_IsString(key) || !cJSON_IsString(nonce)) {
+        ESP_LOGE(TAG, "UDP server, port, key or nonce is missing");
+        return;
+    }
+    udp_server_ = server->valuestring;
+    udp_port_ = port->valueint;
 
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
-    aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
+    aes_nonce_ = DecodeHexString(nonce->valuestring);
+    // The context lives as long as the protocol, a new session only loads its key
+    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key->valuestring).c_str(), 128);
     local_sequence_ = 0;
-    remote_sequence_ = 0;
+    replay_window_.Reset();
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
@@ -3,6 +3,7 @@
 
 
 #include "protocol.h"
+#include "replay_window.h"
 #include <mqtt.h>
 #include <udp.h>
 #include <cJSON.h>
@@ -27,7 +28,6 @@ public:
     ~MqttProtocol();
 
     bool Start() override;
-    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -42,10 +42,12 @@ private:
     std::unique_ptr<Udp> udp_;
     mbedtls_aes_context aes_ctx_;
     std::string aes_nonce_;
+    // Reused for every outgoing datagram
+    std::string send_buffer_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
-    uint32_t remote_sequence_;
+    ReplayWindow replay_window_;
     esp_timer_handle_t reconnect_timer_;
 
     bool StartMqttClient(bool report_error=false);
@@ -53,6 +55,7 @@ private:
     std::string DecodeHexString(const std::string& hex_string);
 
     bool SendText(const std::string& text) override;
+    bool SendAudioFrames(const std::unique_ptr<AudioStreamPacket>* packets, size_t count) override;
     std::string GetHelloMessage();
 };
 
@@ -1,6 +1,7 @@
 #include "protocol.h"
 
 #include <esp_log.h>
+#include <algorithm>
 
 #define TAG "Protocol"
 
@@ -32,6 +33,24 @@ void Protocol::OnDisconnected(std::function<void()> callback) {
     on_disconnected_ = callback;
 }
 
+void Protocol::AddAudioBatchParams(cJSON* audio_params) {
+#if CONFIG_AUDIO_MAX_FRAMES_PER_PACKET > 1
+    cJSON_AddNumberToObject(audio_params, "max_frames_per_packet", CONFIG_AUDIO_MAX_FRAMES_PER_PACKET);
+#endif
+}
+
+void Protocol::ParseAudioBatchParams(const cJSON* audio_params) {
+    // Servers that do not know about coalescing leave it out, one frame per packet
+    audio_frames_per_packet_ = 1;
+#if CONFIG_AUDIO_MAX_FRAMES_PER_PACKET > 1
+    auto frames_per_packet = cJSON_GetObjectItem(audio_params, "frames_per_packet");
+    if (cJSON_IsNumber(frames_per_packet) && frames_per_packet->valueint > 1) {
+        audio_frames_per_packet_ = std::min(frames_per_packet->valueint, CONFIG_AUDIO_MAX_FRAMES_PER_PACKET);
+        ESP_LOGI(TAG, "Sending %u audio frames per packet", (unsigned)audio_frames_per_packet_);
+    }
+#endif
+}
+
 void Protocol::SetError(const std::string& message) {
     error_occurred_ = true;
     if (on_network_error_ != nullptr) {
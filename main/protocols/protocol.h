@@ -6,12 +6,20 @@
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <memory>
+
+#include "latency_tracer.h"
 
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
+    // Transport sequence number, 0 if the transport has none
+    uint32_t sequence = 0;
     std::vector<uint8_t> payload;
+#if CONFIG_USE_AUDIO_LATENCY_TRACER
+    LatencyTrace trace;
+#endif
 };
 
 struct BinaryProtocol2 {
@@ -42,6 +50,9 @@ enum ListeningMode {
 };
 
 class Protocol {
+    // Records and forwards the messages of the protocol it wraps
+    friend class RecordingProtocol;
+
 public:
     virtual ~Protocol() = default;
 
@@ -54,6 +65,17 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    // Uplink frame duration announced in the hello message, set before the audio channel is opened
+    inline int frame_duration() const {
+        return frame_duration_;
+    }
+    inline void SetFrameDuration(int frame_duration) {
+        frame_duration_ = frame_duration;
+    }
+    // Opus frames per WebSocket message / UDP datagram, negotiated in the hello message
+    inline size_t audio_frames_per_packet() const {
+        return audio_frames_per_packet_;
+    }
 
     void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
@@ -67,7 +89,9 @@ public:
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
-    virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
+    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) { return SendAudioFrames(&packet, 1); }
+    // Coalesces up to audio_frames_per_packet() packets into one message
+    bool SendAudio(const std::vector<std::unique_ptr<AudioStreamPacket>>& packets) { return SendAudioFrames(packets.data(), packets.size()); }
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
@@ -85,11 +109,16 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int frame_duration_ = 60;
+    size_t audio_frames_per_packet_ = 1;
     bool error_occurred_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
 
     virtual bool SendText(const std::string& text) = 0;
+    virtual bool SendAudioFrames(const std::unique_ptr<AudioStreamPacket>* packets, size_t count) = 0;
+    void AddAudioBatchParams(cJSON* audio_params);
+    void ParseAudioBatchParams(const cJSON* audio_params);
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
 };
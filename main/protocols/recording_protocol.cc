@@ -0,0 +1,186 @@
+#include "recording_protocol.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#define TAG "RecordingProtocol"
+
+// Larger records would not fit in one datagram, their payload is cut
+#define PROTOCOL_TRACE_MAX_RECORD_SIZE 1400
+
+RecordingProtocol::RecordingProtocol(std::unique_ptr<Protocol> protocol) : protocol_(std::move(protocol)) {
+    start_time_us_ = esp_timer_get_time();
+
+    udp_sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udp_sockfd_ >= 0) {
+        std::string server_addr = CONFIG_PROTOCOL_RECORDER_UDP_SERVER;
+        size_t colon_pos = server_addr.find(':');
+        if (colon_pos != std::string::npos) {
+            memset(&udp_server_addr_, 0, sizeof(udp_server_addr_));
+            udp_server_addr_.sin_family = AF_INET;
+            udp_server_addr_.sin_port = htons(std::stoi(server_addr.substr(colon_pos + 1)));
+            inet_pton(AF_INET, server_addr.substr(0, colon_pos).c_str(), &udp_server_addr_.sin_addr);
+            ESP_LOGI(TAG, "Recording protocol trace to %s", CONFIG_PROTOCOL_RECORDER_UDP_SERVER);
+        } else {
+            ESP_LOGW(TAG, "Invalid server address: %s, should be IP:PORT", CONFIG_PROTOCOL_RECORDER_UDP_SERVER);
+            close(udp_sockfd_);
+            udp_sockfd_ = -1;
+        }
+    } else {
+        ESP_LOGW(TAG, "Failed to create UDP socket: %d", errno);
+    }
+
+    /* The wrapped protocol reports to the recorder, which records and passes everything on */
+    protocol_->OnIncomingJson([this](const cJSON* root) {
+        auto json = cJSON_PrintUnformatted(root);
+        if (json != nullptr) {
+            Record(kTraceIncomingText, json, strlen(json));
+            cJSON_free(json);
+        }
+        if (on_incoming_json_ != nullptr) {
+            on_incoming_json_(root);
+        }
+    });
+    protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
+        // MQTT/UDP frames keep the server's sequence, WebSocket ones are counted
+        AUDIO_TRACE(packet->trace.frame = packet->sequence != 0 ? packet->sequence : ++downlink_frames_);
+        Record(kTraceIncomingAudio, packet->payload.data(), packet->payload.size(), packet->timestamp, packet->sequence);
+        if (on_incoming_audio_ != nullptr) {
+            on_incoming_audio_(std::move(packet));
+        }
+    });
+    protocol_->OnAudioChannelOpened([this]() {
+        CopyAudioParams();
+        if (on_audio_channel_opened_ != nullptr) {
+            on_audio_channel_opened_();
+        }
+    });
+    protocol_->OnAudioChannelClosed([this]() {
+        Record(kTraceAudioChannelClosed);
+        if (on_audio_channel_closed_ != nullptr) {
+            on_audio_channel_closed_();
+        }
+    });
+    protocol_->OnNetworkError([this](const std::string& message) {
+        Record(kTraceNetworkError, message);
+        if (on_network_error_ != nullptr) {
+            on_network_error_(message);
+        }
+    });
+    protocol_->OnConnected([this]() {
+        Record(kTraceConnected);
+        if (on_connected_ != nullptr) {
+            on_connected_();
+        }
+    });
+    protocol_->OnDisconnected([this]() {
+        Record(kTraceDisconnected);
+        if (on_disconnected_ != nullptr) {
+            on_disconnected_();
+        }
+    });
+
+#if CONFIG_USE_AUDIO_LATENCY_TRACER
+    /* Stage times of every frame sent or played, the main task records uplink frames in the order they were sent */
+    LatencyTracer::GetInstance().OnFrame([this](const LatencyFrame& frame) {
+        uint32_t number = frame.direction == kLatencyUplink ? ++uplink_frames_ : frame.frame;
+        Record(kTraceLatency, &frame, sizeof(frame), 0, number);
+    });
+#endif
+}
+
+RecordingProtocol::~RecordingProtocol() {
+    AUDIO_TRACE(LatencyTracer::GetInstance().OnFrame(nullptr));
+    protocol_.reset();
+    if (udp_sockfd_ >= 0) {
+        close(udp_sockfd_);
+    }
+}
+
+void RecordingProtocol::Record(ProtocolTraceRecordType type, const void* payload, size_t size, uint32_t timestamp, uint32_t sequence) {
+    if (udp_sockfd_ < 0) {
+        return;
+    }
+    size = std::min(size, PROTOCOL_TRACE_MAX_RECORD_SIZE - sizeof(ProtocolTraceRecord));
+    // Records come from the main task and the network tasks, each builds its own datagram
+    std::vector<uint8_t> datagram(sizeof(ProtocolTraceRecord) + size);
+    auto record = (ProtocolTraceRecord*)datagram.data();
+    record->index = record_index_++;
+    record->time_ms = (esp_timer_get_time() - start_time_us_) / 1000;
+    record->type = type;
+    record->reserved = 0;
+    record->reserved2 = 0;
+    record->timestamp = timestamp;
+    record->sequence = sequence;
+    record->size = size;
+    if (size > 0) {
+        memcpy(record->payload, payload, size);
+    }
+    if (sendto(udp_sockfd_, datagram.data(), datagram.size(), MSG_DONTWAIT,
+            (struct sockaddr*)&udp_server_addr_, sizeof(udp_server_addr_)) < 0) {
+        ESP_LOGD(TAG, "Failed to send trace record: %d", errno);
+    }
+}
+
+void RecordingProtocol::Record(ProtocolTraceRecordType type, const std::string& payload) {
+    Record(type, payload.data(), payload.size());
+}
+
+void RecordingProtocol::CopyAudioParams() {
+    // A new session numbers its frames from 1 again
+    uplink_frames_ = 0;
+    downlink_frames_ = 0;
+
+    /* Callers read the negotiated parameters from the recorder, not from the wrapped protocol */
+    server_sample_rate_ = protocol_->server_sample_rate();
+    server_frame_duration_ = protocol_->server_frame_duration();
+    session_id_ = protocol_->session_id();
+    audio_frames_per_packet_ = protocol_->audio_frames_per_packet();
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "session_id", session_id_.c_str());
+    cJSON_AddNumberToObject(root, "sample_rate", server_sample_rate_);
+    cJSON_AddNumberToObject(root, "frame_duration", server_frame_duration_);
+    cJSON_AddNumberToObject(root, "frames_per_packet", audio_frames_per_packet_);
+    auto json = cJSON_PrintUnformatted(root);
+    Record(kTraceAudioChannelOpened, json, strlen(json));
+    cJSON_free(json);
+    cJSON_Delete(root);
+}
+
+bool RecordingProtocol::Start() {
+    return protocol_->Start();
+}
+
+bool RecordingProtocol::OpenAudioChannel() {
+    Record(kTraceOpenAudioChannel);
+    protocol_->SetFrameDuration(frame_duration_);
+    return protocol_->OpenAudioChannel();
+}
+
+void RecordingProtocol::CloseAudioChannel() {
+    protocol_->CloseAudioChannel();
+}
+
+bool RecordingProtocol::IsAudioChannelOpened() const {
+    return protocol_->IsAudioChannelOpened();
+}
+
+bool RecordingProtocol::SendText(const std::string& text) {
+    Record(kTraceOutgoingText, text);
+    return protocol_->SendText(text);
+}
+
+bool RecordingProtocol::SendAudioFrames(const std::unique_ptr<AudioStreamPacket>* packets, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        Record(kTraceOutgoingAudio, packets[i]->payload.data(), packets[i]->payload.size(), packets[i]->timestamp, packets[i]->sequence);
+    }
+    return protocol_->SendAudioFrames(packets, count);
+}
@@ -0,0 +1,81 @@
+#ifndef RECORDING_PROTOCOL_H
+#define RECORDING_PROTOCOL_H
+
+#include "protocol.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <netinet/in.h>
+
+enum ProtocolTraceRecordType : uint8_t {
+    kTraceOutgoingText = 0,
+    kTraceOutgoingAudio = 1,
+    kTraceIncomingText = 2,
+    kTraceIncomingAudio = 3,
+    kTraceOpenAudioChannel = 4,
+    // Payload: the negotiated audio parameters as JSON
+    kTraceAudioChannelOpened = 5,
+    kTraceAudioChannelClosed = 6,
+    kTraceNetworkError = 7,
+    kTraceConnected = 8,
+    kTraceDisconnected = 9,
+    // CONFIG_USE_AUDIO_LATENCY_TRACER only. Payload: a LatencyFrame, sequence: the frame number in the session
+    kTraceLatency = 10,
+};
+
+// Little endian, followed by `size` bytes of payload. A trace file is the records back to back.
+struct ProtocolTraceRecord {
+    // Counts every record, a gap means records were lost on the way to the trace server
+    uint32_t index;
+    // Milliseconds since the recorder started
+    uint32_t time_ms;
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t reserved2;
+    // Audio only, 0 otherwise
+    uint32_t timestamp;
+    uint32_t sequence;
+    uint32_t size;
+    uint8_t payload[];
+} __attribute__((packed));
+
+/*
+ * Protocol decorator that records every message and channel event of the wrapped protocol.
+ *
+ * Each record is sent as one UDP datagram to CONFIG_PROTOCOL_RECORDER_UDP_SERVER, where
+ * scripts/protocol_trace.py appends it to a trace file. The same script reports session timings
+ * and packet loss from a trace, and replays it to a device as a WebSocket server.
+ * Recording never blocks the wrapped protocol, a record that cannot be sent is dropped.
+ * With the latency tracer enabled the stage times of every frame are recorded too, numbered so that
+ * protocol_trace.py can match them with the frames of a server trace.
+ */
+class RecordingProtocol : public Protocol {
+public:
+    explicit RecordingProtocol(std::unique_ptr<Protocol> protocol);
+    ~RecordingProtocol();
+
+    bool Start() override;
+    bool OpenAudioChannel() override;
+    void CloseAudioChannel() override;
+    bool IsAudioChannelOpened() const override;
+
+private:
+    std::unique_ptr<Protocol> protocol_;
+    int udp_sockfd_ = -1;
+    struct sockaddr_in udp_server_addr_;
+    std::atomic<uint32_t> record_index_ = 0;
+    // Frames of the current session, numbered from 1 as the server counts them
+    std::atomic<uint32_t> uplink_frames_ = 0;
+    std::atomic<uint32_t> downlink_frames_ = 0;
+    int64_t start_time_us_ = 0;
+
+    bool SendText(const std::string& text) override;
+    bool SendAudioFrames(const std::unique_ptr<AudioStreamPacket>* packets, size_t count) override;
+    void Record(ProtocolTraceRecordType type, const void* payload, size_t size, uint32_t timestamp = 0, uint32_t sequence = 0);
+    void Record(ProtocolTraceRecordType type, const std::string& payload = std::string());
+    void CopyAudioParams();
+};
+
+#endif // RECORDING_PROTOCOL_H
@@ -0,0 +1,50 @@
+#ifndef REPLAY_WINDOW_H
+#define REPLAY_WINDOW_H
+
+#include <cstdint>
+
+/*
+ * Anti-replay window over packet sequence numbers, as in DTLS / SRTP (RFC 6347 4.1.2.6).
+ *
+ * Bit i of the bitmap records whether sequence (highest - i) has been seen. A newer sequence slides
+ * the window forward, an older one is accepted once as long as it is less than 64 behind the newest,
+ * so reordered datagrams get through while duplicates and replays do not. Sequences compare in serial
+ * number arithmetic (RFC 1982), so the window keeps sliding across the 32-bit wrap.
+ */
+class ReplayWindow {
+public:
+    static constexpr uint32_t kSize = 64;
+
+    void Reset() {
+        highest_ = 0;
+        bitmap_ = 0;
+    }
+
+    inline uint32_t highest() const { return highest_; }
+
+    // Returns false for a duplicate or a sequence that fell out of the window, otherwise marks it as seen
+    bool Accept(uint32_t sequence) {
+        if (bitmap_ == 0 || (int32_t)(sequence - highest_) > 0) {
+            uint32_t shift = bitmap_ == 0 ? kSize : sequence - highest_;
+            bitmap_ = shift >= kSize ? 1 : (bitmap_ << shift) | 1;
+            highest_ = sequence;
+            return true;
+        }
+        uint32_t offset = highest_ - sequence;
+        if (offset >= kSize) {
+            return false;
+        }
+        uint64_t mask = 1ULL << offset;
+        if (bitmap_ & mask) {
+            return false;
+        }
+        bitmap_ |= mask;
+        return true;
+    }
+
+private:
+    uint32_t highest_ = 0;
+    uint64_t bitmap_ = 0;
+};
+
+#endif // REPLAY_WINDOW_H
@@ -3,6 +3,8 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "audio_packet_pool.h"
+#include "binary_frame.h"
 
 #include <cstring>
 #include <cJSON.h>
@@ -25,35 +27,68 @@ bool WebsocketProtocol::Start() {
     return true;
 }
 
-bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+bool WebsocketProtocol::SendAudioFrames(const std::unique_ptr<AudioStreamPacket>* packets, size_t count) {
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
-    if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
-        bp2->version = htons(version_);
-        bp2->type = 0;
-        bp2->reserved = 0;
-        bp2->timestamp = htonl(packet->timestamp);
-        bp2->payload_size = htonl(packet->payload.size());
-        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
-        bp3->type = 0;
-        bp3->reserved = 0;
-        bp3->payload_size = htons(packet->payload.size());
-        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+    if (version_ != 2 && version_ != 3) {
+        // Version 1 has no framing, every Opus packet is a message of its own
+        for (size_t i = 0; i < count; i++) {
+            if (!websocket_->Send(packets[i]->payload.data(), packets[i]->payload.size(), true)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* Frames are serialized back to back into the reused buffer, one message per audio_frames_per_packet_ frames */
+    for (size_t i = 0; i < count; i += audio_frames_per_packet_) {
+        send_buffer_.clear();
+        for (size_t j = i; j < count && j < i + audio_frames_per_packet_; j++) {
+            auto& packet = *packets[j];
+            size_t offset = send_buffer_.size();
+            if (version_ == 2) {
+                send_buffer_.resize(offset + sizeof(BinaryProtocol2) + packet.payload.size());
+                auto bp2 = (BinaryProtocol2*)&send_buffer_[offset];
+                bp2->version = htons(version_);
+                bp2->type = 0;
+                bp2->reserved = 0;
+                bp2->timestamp = htonl(packet.timestamp);
+                bp2->payload_size = htonl(packet.payload.size());
+                memcpy(bp2->payload, packet.payload.data(), packet.payload.size());
+            } else {
+                send_buffer_.resize(offset + sizeof(BinaryProtocol3) + packet.payload.size());
+                auto bp3 = (BinaryProtocol3*)&send_buffer_[offset];
+                bp3->type = 0;
+                bp3->reserved = 0;
+                bp3->payload_size = htons(packet.payload.size());
+                memcpy(bp3->payload, packet.payload.data(), packet.payload.size());
+            }
+        }
+        if (!websocket_->Send(send_buffer_.data(), send_buffer_.size(), true)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void WebsocketProtocol::ParseBinaryMessage(const uint8_t* data, size_t len) {
+    auto& pool = AudioPacketPool::GetInstance();
+    size_t consumed = ParseBinaryFrames(version_, data, len, [this, &pool](const BinaryFrame& frame) {
+        if (frame.type != 0) {
+            ESP_LOGW(TAG, "Skipping binary frame of type %u", frame.type);
+            return;
+        }
+        auto packet = pool.Acquire();
+        packet->sample_rate = server_sample_rate_;
+        packet->frame_duration = server_frame_duration_;
+        packet->timestamp = frame.timestamp;
+        packet->payload.assign(frame.payload, frame.payload + frame.payload_size);
+        on_incoming_audio_(std::move(packet));
+    });
+    if (consumed != len) {
+        ESP_LOGE(TAG, "Malformed binary message, %u of %u bytes left", (unsigned)(len - consumed), (unsigned)len);
     }
 }
 
@@ -111,38 +146,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
             if (on_incoming_audio_ != nullptr) {
-                if (version_ == 2) {
-                    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
-                    bp2->version = ntohs(bp2->version);
-                    bp2->type = ntohs(bp2->type);
-                    bp2->timestamp = ntohl(bp2->timestamp);
-                    bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
-                } else if (version_ == 3) {
-                    BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
-                    bp3->type = bp3->type;
-                    bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
-                } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    }));
-                }
+                ParseBinaryMessage((const uint8_t*)data, len);
             }
         } else {
             // Parse JSON data
@@ -215,7 +219,10 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", frame_duration_);
+    if (version_ == 2 || version_ == 3) {
+        AddAudioBatchParams(audio_params);
+    }
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -226,8 +233,8 @@ std::string WebsocketProtocol::GetHelloMessage() {
 
 void WebsocketProtocol::ParseServerHello(const cJSON* root) {
     auto transport = cJSON_GetObjectItem(root, "transport");
-    if (transport == nullptr || strcmp(transport->valuestring, "websocket") != 0) {
-        ESP_LOGE(TAG, "Unsupported transport: %s", transport->valuestring);
+    if (!cJSON_IsString(transport) || strcmp(transport->valuestring, "websocket") != 0) {
+        ESP_LOGE(TAG, "Unsupported transport: %s", cJSON_IsString(transport) ? transport->valuestring : "null");
         return;
     }
 
@@ -248,6 +255,8 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
             server_frame_duration_ = frame_duration->valueint;
         }
     }
+    // Only offered with version 2 and 3, version 1 frames carry no size and always go one per message
+    ParseAudioBatchParams(audio_params);
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
@@ -16,7 +16,6 @@ public:
     ~WebsocketProtocol();
 
     bool Start() override;
-    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -25,9 +24,13 @@ private:
     EventGroupHandle_t event_group_handle_;
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
+    // Reused for every outgoing audio message
+    std::string send_buffer_;
 
     void ParseServerHello(const cJSON* root);
+    void ParseBinaryMessage(const uint8_t* data, size_t len);
     bool SendText(const std::string& text) override;
+    bool SendAudioFrames(const std::unique_ptr<AudioStreamPacket>* packets, size_t count) override;
     std::string GetHelloMessage();
 };
 
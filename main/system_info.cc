@@ -1,4 +1,6 @@
 #include "system_info.h"
+#include "pcm_frame_pool.h"
+#include "audio_packet_pool.h"
 
 #include <freertos/task.h>
 #include <esp_log.h>
@@ -143,3 +145,15 @@ void SystemInfo::PrintHeapStats() {
     int min_free_sram = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
     ESP_LOGI(TAG, "free sram: %u minimal sram: %u", free_sram, min_free_sram);
 }
+
+void SystemInfo::PrintPcmFramePoolStats() {
+    auto stats = PcmFramePool::GetInstance().GetStats();
+    ESP_LOGI(TAG, "pcm frames: %lu in use: %lu peak: %lu acquired: %lu heap allocations: %lu",
+        stats.frames, stats.in_use, stats.peak_in_use, stats.acquired, stats.heap_allocations);
+}
+
+void SystemInfo::PrintAudioPacketPoolStats() {
+    auto stats = AudioPacketPool::GetInstance().GetStats();
+    ESP_LOGI(TAG, "audio packets: free: %lu acquired: %lu released: %lu heap allocations: %lu",
+        stats.free, stats.acquired, stats.released, stats.heap_allocations);
+}
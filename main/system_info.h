@@ -16,6 +16,8 @@ public:
     static esp_err_t PrintTaskCpuUsage(TickType_t xTicksToWait);
     static void PrintTaskList();
     static void PrintHeapStats();
+    static void PrintPcmFramePoolStats();
+    static void PrintAudioPacketPoolStats();
 };
 
 #endif // _SYSTEM_INFO_H_
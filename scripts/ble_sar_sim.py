@@ -0,0 +1,180 @@
+import argparse
+import os
+import random
+import struct
+import sys
+
+
+'''
+  Reference encoder and decoder for the segmented BLE frames of main/ble/ble_protocol.c, see
+  main/ble/蓝牙配网协议.md.
+
+  check: round-trip random messages at several MTUs, and check that bad sequences are dropped
+  bench: estimate the time to send a message at each MTU, segmented and paced by the BLE stack,
+         against the old 200 byte packets with a fixed delay between them
+
+  Segment layout: |0x58 0x5B|cmd(1)|seq(1)|total_len(2, first segment only)|data|
+  seq is 0 for the first segment, then counts from 1 and wraps from 255 back to 1.
+'''
+
+HEADER = b'\x58\x5a'
+SAR_HEADER = b'\x58\x5b'
+SAR_HEADER_LEN = 4
+SAR_FIRST_HEADER_LEN = 6
+MAX_PACKET_LEN = 512
+MAX_MESSAGE_LEN = 4096
+
+
+def max_packet(mtu):
+    # ATT notification header takes 3 bytes
+    return min(mtu - 3, MAX_PACKET_LEN)
+
+
+def next_seq(seq):
+    return 1 if seq == 255 else seq + 1
+
+
+def encode(cmd, payload, mtu, sar=True):
+    limit = max_packet(mtu)
+    if 3 + len(payload) <= limit:
+        return [HEADER + bytes([cmd]) + payload]
+    if not sar or len(payload) > MAX_MESSAGE_LEN:
+        raise ValueError(f"{len(payload)} bytes do not fit in one notification")
+    packets = []
+    offset = 0
+    seq = 0
+    while offset < len(payload) or not packets:
+        if seq == 0:
+            header = SAR_HEADER + bytes([cmd, seq]) + struct.pack('<H', len(payload))
+        else:
+            header = SAR_HEADER + bytes([cmd, seq])
+        n = min(len(payload) - offset, limit - len(header))
+        packets.append(header + payload[offset:offset + n])
+        offset += n
+        seq = next_seq(seq)
+    return packets
+
+
+class Decoder:
+    def __init__(self):
+        self.reset()
+
+    def reset(self):
+        self.buffer = None
+        self.cmd = None
+        self.total_len = 0
+        self.next_seq = 0
+
+    def feed(self, data):
+        '''Returns (cmd, payload) once a message is complete, otherwise None'''
+        if len(data) < 3 or data[0] != 0x58:
+            return None
+        cmd = data[2]
+        if data[:2] == HEADER:
+            self.reset()
+            return cmd, bytes(data[3:])
+        if data[:2] != SAR_HEADER or len(data) < SAR_HEADER_LEN:
+            return None
+        seq = data[3]
+        if seq == 0:
+            self.reset()
+            if len(data) < SAR_FIRST_HEADER_LEN:
+                return None
+            self.total_len = struct.unpack_from('<H', data, 4)[0]
+            if self.total_len > MAX_MESSAGE_LEN:
+                return None
+            self.buffer = bytearray()
+            self.cmd = cmd
+            body = data[SAR_FIRST_HEADER_LEN:]
+        elif self.buffer is None or seq != self.next_seq or cmd != self.cmd:
+            self.reset()
+            return None
+        else:
+            body = data[SAR_HEADER_LEN:]
+        if len(self.buffer) + len(body) > self.total_len:
+            self.reset()
+            return None
+        self.buffer += body
+        self.next_seq = next_seq(seq)
+        if len(self.buffer) < self.total_len:
+            return None
+        message = (self.cmd, bytes(self.buffer))
+        self.reset()
+        return message
+
+
+def check(mtus, rounds):
+    rng = random.Random(1)
+    for mtu in mtus:
+        for _ in range(rounds):
+            payload = os.urandom(rng.randint(0, MAX_MESSAGE_LEN))
+            cmd = rng.randint(0, 255)
+            decoder = Decoder()
+            results = [m for m in (decoder.feed(p) for p in encode(cmd, payload, mtu)) if m is not None]
+            assert results == [(cmd, payload)], f"round trip failed at MTU {mtu}, {len(payload)} bytes"
+
+        # A lost segment drops the message, the next one is received again
+        payload = bytes(range(256)) * 8
+        packets = encode(0x02, payload, mtu)
+        decoder = Decoder()
+        assert all(decoder.feed(p) is None for p in packets[:1] + packets[2:])
+        assert [decoder.feed(p) for p in packets][-1] == (0x02, payload)
+        # A plain packet in between drops the unfinished message
+        decoder = Decoder()
+        decoder.feed(packets[0])
+        assert decoder.feed(HEADER + b'\x00') == (0x00, b'')
+        assert decoder.feed(packets[1]) is None
+    # seq wraps from 255 to 1 at the smallest MTU
+    payload = os.urandom(MAX_MESSAGE_LEN)
+    packets = encode(0x04, payload, 23)
+    assert len(packets) > 256 and packets[256][3] == 1
+    decoder = Decoder()
+    assert [decoder.feed(p) for p in packets][-1] == (0x04, payload)
+    print(f"OK: MTU {' '.join(str(m) for m in mtus)}, {rounds} messages each")
+
+
+def bench(mtus, size, interval, packets_per_event, old_packet, old_delay):
+    payload = bytes(size)
+    # Without pacing by the stack every old packet waited old_delay, and needed an MTU that fits it
+    old_count = (size + old_packet - 1) // old_packet
+    print(f"{size} bytes, connection interval {interval} ms, {packets_per_event} notifications per event")
+    print(f"  {'MTU':>5} {'segments':>9} {'overhead':>9} {'segmented':>10} {'old':>10}")
+    for mtu in mtus:
+        packets = encode(0x02, payload, mtu)
+        wire = sum(len(p) for p in packets)
+        # Notifications go out as fast as the controller frees its buffers, a few per event
+        events = (len(packets) + packets_per_event - 1) // packets_per_event
+        segmented = events * interval
+        if max_packet(mtu) >= old_packet + 3:
+            old = old_count * max(old_delay, interval / packets_per_event)
+            old_text = f"{old:>8.0f}ms"
+        else:
+            old_text = f"{'n/a':>10}"
+        print(f"  {mtu:>5} {len(packets):>9} {(wire - size) / size:>9.1%} {segmented:>8.0f}ms {old_text}")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='BLE 分段传输参考实现与吞吐估算')
+    subparsers = parser.add_subparsers(dest='command', required=True)
+
+    check_parser = subparsers.add_parser('check', help='分段与重组自检')
+    check_parser.add_argument('--mtu', type=int, nargs='+', default=[23, 185, 247, 512], help='MTU (默认: 23 185 247 512)')
+    check_parser.add_argument('--rounds', type=int, default=200, help='每个 MTU 的随机消息数 (默认: 200)')
+
+    bench_parser = subparsers.add_parser('bench', help='估算不同 MTU 下发送一条消息的耗时')
+    bench_parser.add_argument('--mtu', type=int, nargs='+', default=[23, 185, 247, 512], help='MTU (默认: 23 185 247 512)')
+    bench_parser.add_argument('--size', type=int, default=MAX_MESSAGE_LEN, help='消息长度 (默认: 4096)')
+    bench_parser.add_argument('--interval', type=float, default=30, help='连接间隔 ms (默认: 30)')
+    bench_parser.add_argument('--packets-per-event', type=int, default=4, help='每个连接事件发送的通知数 (默认: 4)')
+    bench_parser.add_argument('--old-packet', type=int, default=200, help='旧实现每包载荷 (默认: 200)')
+    bench_parser.add_argument('--old-delay', type=float, default=10, help='旧实现每包延时 ms (默认: 10)')
+
+    args = parser.parse_args()
+    if args.command == 'check':
+        try:
+            check(args.mtu, args.rounds)
+        except AssertionError as e:
+            print(f"Error: {e}")
+            sys.exit(1)
+    else:
+        bench(args.mtu, args.size, args.interval, args.packets_per_event, args.old_packet, args.old_delay)
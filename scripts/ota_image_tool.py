@@ -0,0 +1,229 @@
+import argparse
+import hashlib
+import struct
+import sys
+import time
+import zlib
+
+
+'''
+  Builds the compressed and delta OTA images decoded by main/ota_image_decoder.c.
+
+  compress: zlib-compress an app image
+  delta:    make a patch from the running firmware (old) to the new one, then compress it
+  apply:    decode an image on the host the same way the device does and check its hash
+  bench:    compare transfer size and update time of raw, compressed and delta images
+
+  Image layout, little endian:
+  |magic "OTAZ"(4)|version(1)|type(1)|reserved(2)|image_size(4)|source_size(4)|image_sha256(32)|source_sha256(32)|zlib stream|
+
+  The zlib stream holds the image itself (type 1) or a patch (type 2), a sequence of records
+  |op(1)|length(4)|source_offset(4)|data(length)|. ADD (0) outputs data + old[source_offset:] byte by
+  byte modulo 256, INSERT (1) outputs data as it is. Code that moved between versions differs from the
+  old image mostly by small address deltas, so ADD data is mostly zeros and compresses well.
+'''
+
+HEADER = struct.Struct('<4sBBHII32s32s')
+MAGIC = b'OTAZ'
+VERSION = 1
+TYPE_COMPRESSED = 1
+TYPE_DELTA = 2
+OP_ADD = 0
+OP_INSERT = 1
+RECORD = struct.Struct('<BII')
+
+KEY_SIZE = 16
+INDEX_STEP = 8
+# Stop extending a match after this many bytes without improving it
+MAX_MISMATCH_RUN = 64
+
+
+def build_index(source):
+    index = {}
+    for i in range(0, len(source) - KEY_SIZE + 1, INDEX_STEP):
+        index.setdefault(source[i:i + KEY_SIZE], i)
+    return index
+
+
+def extend_match(source, target, s, d):
+    # Extend forward while matching bytes outnumber mismatching ones, bsdiff style
+    best_length = 0
+    best_score = 0
+    score = 0
+    length = 0
+    limit = min(len(source) - s, len(target) - d)
+    while length < limit:
+        if length + 64 <= limit and source[s + length:s + length + 64] == target[d + length:d + length + 64]:
+            length += 64
+            score += 64
+        else:
+            score += 1 if source[s + length] == target[d + length] else -1
+            length += 1
+        if score > best_score:
+            best_score = score
+            best_length = length
+        elif length - best_length > MAX_MISMATCH_RUN:
+            break
+    return best_length
+
+
+def make_patch(source, target):
+    index = build_index(source)
+    patch = bytearray()
+    literal_start = 0
+    i = 0
+    while i + KEY_SIZE <= len(target):
+        j = index.get(target[i:i + KEY_SIZE])
+        if j is None:
+            i += 1
+            continue
+        # Extend backward into the pending literal bytes
+        back = 0
+        while i - back > literal_start and j - back > 0 and target[i - back - 1] == source[j - back - 1]:
+            back += 1
+        d = i - back
+        s = j - back
+        length = extend_match(source, target, s, d)
+        if length < KEY_SIZE:
+            i += 1
+            continue
+
+        if d > literal_start:
+            patch += RECORD.pack(OP_INSERT, d - literal_start, 0) + target[literal_start:d]
+        diff = bytes((target[d + k] - source[s + k]) & 0xFF for k in range(length))
+        patch += RECORD.pack(OP_ADD, length, s) + diff
+        i = literal_start = d + length
+    if literal_start < len(target):
+        patch += RECORD.pack(OP_INSERT, len(target) - literal_start, 0) + target[literal_start:]
+    return bytes(patch)
+
+
+def apply_patch(source, patch):
+    output = bytearray()
+    offset = 0
+    while offset < len(patch):
+        op, length, source_offset = RECORD.unpack_from(patch, offset)
+        offset += RECORD.size
+        data = patch[offset:offset + length]
+        offset += length
+        if op == OP_INSERT:
+            output += data
+        elif op == OP_ADD:
+            output += bytes((a + b) & 0xFF for a, b in zip(data, source[source_offset:source_offset + length]))
+        else:
+            raise ValueError(f"Invalid patch record {op}")
+    return bytes(output)
+
+
+def encode(target, source=None):
+    if source is None:
+        body = zlib.compress(target, 9)
+        header = HEADER.pack(MAGIC, VERSION, TYPE_COMPRESSED, 0, len(target), 0,
+                             hashlib.sha256(target).digest(), bytes(32))
+    else:
+        body = zlib.compress(make_patch(source, target), 9)
+        header = HEADER.pack(MAGIC, VERSION, TYPE_DELTA, 0, len(target), len(source),
+                             hashlib.sha256(target).digest(), hashlib.sha256(source).digest())
+    return header + body
+
+
+def decode(image, source=None):
+    if image[:4] != MAGIC:
+        return image
+    magic, version, type, _, image_size, source_size, image_sha256, source_sha256 = HEADER.unpack_from(image)
+    if version != VERSION:
+        raise ValueError(f"Unsupported version {version}")
+    body = zlib.decompress(image[HEADER.size:])
+    if type == TYPE_DELTA:
+        if source is None or hashlib.sha256(source[:source_size]).digest() != source_sha256:
+            raise ValueError("The delta image was made for another firmware")
+        output = apply_patch(source[:source_size], body)
+    else:
+        output = body
+    if len(output) != image_size or hashlib.sha256(output).digest() != image_sha256:
+        raise ValueError("Decoded image hash mismatch")
+    return output
+
+
+def read_file(filename):
+    with open(filename, 'rb') as f:
+        return f.read()
+
+
+def write_file(filename, data):
+    with open(filename, 'wb') as f:
+        f.write(data)
+
+
+def bench(old, new, rates, flash_rate):
+    print(f"old {len(old)} bytes, new {len(new)} bytes")
+    results = [('raw', new, 0.0)]
+    for name, source in (('compressed', None), ('delta', old)):
+        began = time.monotonic()
+        image = encode(new, source)
+        elapsed = time.monotonic() - began
+        began = time.monotonic()
+        assert decode(image, old) == new
+        print(f"  {name:<10} built in {elapsed:.1f}s, host decode {time.monotonic() - began:.2f}s")
+        results.append((name, image, elapsed))
+
+    header = f"  {'image':<10} {'bytes':>10} {'ratio':>6}"
+    for rate in rates:
+        header += f" {str(rate) + ' KB/s':>11}"
+    print(header)
+    for name, image, _ in results:
+        line = f"  {name:<10} {len(image):>10} {len(image) / len(new):>6.1%}"
+        for rate in rates:
+            # The flash writer overlaps with the transfer, the slower of the two sets the pace
+            seconds = max(len(image) / (rate * 1024), len(new) / (flash_rate * 1024))
+            line += f" {seconds:>10.1f}s"
+        print(line)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='生成压缩或差分 OTA 固件')
+    subparsers = parser.add_subparsers(dest='command', required=True)
+
+    compress_parser = subparsers.add_parser('compress', help='压缩固件')
+    compress_parser.add_argument('new', help='新固件，例如 build/xiaozhi.bin')
+    compress_parser.add_argument('--output', '-o', required=True, help='输出文件')
+
+    delta_parser = subparsers.add_parser('delta', help='生成相对于设备当前固件的差分固件')
+    delta_parser.add_argument('old', help='设备当前运行的固件')
+    delta_parser.add_argument('new', help='新固件')
+    delta_parser.add_argument('--output', '-o', required=True, help='输出文件')
+
+    apply_parser = subparsers.add_parser('apply', help='在电脑上还原固件并校验')
+    apply_parser.add_argument('image', help='压缩或差分固件')
+    apply_parser.add_argument('--old', help='差分固件对应的当前固件')
+    apply_parser.add_argument('--output', '-o', help='还原后的固件')
+
+    bench_parser = subparsers.add_parser('bench', help='比较原始、压缩、差分固件的大小与升级耗时')
+    bench_parser.add_argument('old', help='设备当前运行的固件')
+    bench_parser.add_argument('new', help='新固件')
+    bench_parser.add_argument('--rates', type=float, nargs='+', default=[5, 40, 200], help='传输速度 KB/s (默认: 5 40 200)')
+    bench_parser.add_argument('--flash-rate', type=float, default=400, help='Flash 擦写速度 KB/s (默认: 400)')
+
+    args = parser.parse_args()
+    if args.command == 'compress':
+        new = read_file(args.new)
+        image = encode(new)
+        write_file(args.output, image)
+        print(f"{args.output}: {len(image)} bytes ({len(image) / len(new):.1%} of {len(new)})")
+    elif args.command == 'delta':
+        old = read_file(args.old)
+        new = read_file(args.new)
+        image = encode(new, old)
+        write_file(args.output, image)
+        print(f"{args.output}: {len(image)} bytes ({len(image) / len(new):.1%} of {len(new)})")
+    elif args.command == 'apply':
+        try:
+            output = decode(read_file(args.image), read_file(args.old) if args.old else None)
+        except ValueError as e:
+            print(f"Error: {e}")
+            sys.exit(1)
+        if args.output:
+            write_file(args.output, output)
+        print(f"OK: {len(output)} bytes, sha256 {hashlib.sha256(output).hexdigest()}")
+    else:
+        bench(read_file(args.old), read_file(args.new), args.rates, args.flash_rate)
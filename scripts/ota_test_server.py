@@ -0,0 +1,167 @@
+import argparse
+import hashlib
+import http.server
+import os
+import random
+import socketserver
+import time
+import urllib.error
+import urllib.request
+
+
+'''
+  Firmware server for testing the resumable OTA download (main/firmware_downloader.cc).
+
+  serve: serve a firmware image with HTTP Range and ETag support, throttled to a given rate, and
+         drop connections at random to emulate a weak 4G link. Every request is logged with the
+         range it asked for and the throughput it got, so resumes can be checked in the log.
+  check: download from a running server the way the device does, reconnecting with Range from
+         the last received byte, and compare the result with the image.
+'''
+
+CHUNK_SIZE = 4096
+
+
+class FirmwareHandler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def do_GET(self):
+        config = self.server.config
+        data = config['data']
+        etag = config['etag']
+        start = 0
+        range_header = self.headers.get('Range')
+        if range_header and config['range'] and range_header.startswith('bytes='):
+            start = int(range_header[6:].split('-')[0])
+        if start >= len(data):
+            self.send_response(416)
+            self.send_header('Content-Range', f'bytes */{len(data)}')
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            return
+
+        if start > 0:
+            self.send_response(206)
+            self.send_header('Content-Range', f'bytes {start}-{len(data) - 1}/{len(data)}')
+        else:
+            self.send_response(200)
+        self.send_header('Content-Type', 'application/octet-stream')
+        self.send_header('Content-Length', str(len(data) - start))
+        self.send_header('ETag', etag)
+        self.send_header('Accept-Ranges', 'bytes' if config['range'] else 'none')
+        self.end_headers()
+
+        sent = 0
+        began = time.monotonic()
+        dropped = False
+        try:
+            for offset in range(start, len(data), CHUNK_SIZE):
+                if config['drop_rate'] > 0 and random.random() < config['drop_rate'] * CHUNK_SIZE / 65536:
+                    dropped = True
+                    break
+                chunk = data[offset:offset + CHUNK_SIZE]
+                self.wfile.write(chunk)
+                sent += len(chunk)
+                if config['rate'] > 0:
+                    # Keep the average rate of this connection at or below --rate
+                    wait = began + sent / (config['rate'] * 1024) - time.monotonic()
+                    if wait > 0:
+                        time.sleep(wait)
+        except (BrokenPipeError, ConnectionResetError):
+            dropped = True
+
+        elapsed = max(time.monotonic() - began, 0.001)
+        config['served'] += sent
+        status = 'dropped' if dropped else 'complete'
+        print(f"{self.client_address[0]} bytes={start}- sent {sent} in {elapsed:.1f}s "
+              f"({sent / 1024 / elapsed:.1f} KB/s) {status}, total served {config['served']} "
+              f"({config['served'] / len(data):.2f}x image)")
+        if dropped:
+            self.close_connection = True
+            self.connection.close()
+
+    def log_message(self, format, *args):
+        pass
+
+
+class ThreadingServer(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+
+def serve(args):
+    with open(args.firmware, 'rb') as f:
+        data = f.read()
+    config = {
+        'data': data,
+        'etag': '"' + hashlib.sha256(data).hexdigest()[:16] + '"',
+        'range': not args.no_range,
+        'rate': args.rate,
+        'drop_rate': args.drop_rate,
+        'served': 0,
+    }
+    server = ThreadingServer(('0.0.0.0', args.port), FirmwareHandler)
+    server.config = config
+    print(f"Serving {args.firmware} ({len(data)} bytes, ETag {config['etag']}) on port {args.port}, "
+          f"rate {args.rate or 'unlimited'} KB/s, drop rate {args.drop_rate} per 64KB, "
+          f"Range {'on' if config['range'] else 'off'}")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        server.shutdown()
+
+
+def check(args):
+    with open(args.firmware, 'rb') as f:
+        expected = f.read()
+    received = bytearray()
+    reconnects = 0
+    began = time.monotonic()
+    while len(received) < len(expected):
+        request = urllib.request.Request(args.url)
+        if received:
+            request.add_header('Range', f'bytes={len(received)}-')
+        try:
+            with urllib.request.urlopen(request, timeout=10) as response:
+                if response.status == 200 and received:
+                    # No Range support, skip what we already have
+                    response.read(len(received))
+                while True:
+                    chunk = response.read(CHUNK_SIZE)
+                    if not chunk:
+                        break
+                    received += chunk
+        except (urllib.error.URLError, ConnectionError, OSError):
+            pass
+        if len(received) < len(expected):
+            reconnects += 1
+            if reconnects > args.max_reconnects:
+                print(f"Gave up after {reconnects} reconnects at {len(received)}/{len(expected)}")
+                return False
+    elapsed = time.monotonic() - began
+    ok = bytes(received) == expected
+    print(f"{'OK' if ok else 'MISMATCH'}: {len(received)} bytes in {elapsed:.1f}s "
+          f"({len(received) / 1024 / elapsed:.1f} KB/s), {reconnects} reconnects")
+    return ok
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='OTA 断点续传测试服务器：限速、随机断开连接')
+    subparsers = parser.add_subparsers(dest='command', required=True)
+
+    serve_parser = subparsers.add_parser('serve', help='提供固件下载')
+    serve_parser.add_argument('firmware', help='固件文件，例如 build/xiaozhi.bin')
+    serve_parser.add_argument('--port', '-p', type=int, default=8080, help='HTTP端口 (默认: 8080)')
+    serve_parser.add_argument('--rate', '-r', type=float, default=0, help='每个连接的限速 KB/s (默认: 不限速)')
+    serve_parser.add_argument('--drop-rate', '-d', type=float, default=0, help='每 64KB 断开连接的概率 (默认: 0)')
+    serve_parser.add_argument('--no-range', action='store_true', help='忽略 Range 请求头，总是从头发送')
+
+    check_parser = subparsers.add_parser('check', help='按设备的续传方式下载并校验')
+    check_parser.add_argument('firmware', help='与服务器相同的固件文件')
+    check_parser.add_argument('--url', '-u', default='http://127.0.0.1:8080/firmware.bin', help='固件地址')
+    check_parser.add_argument('--max-reconnects', type=int, default=100, help='最大重连次数 (默认: 100)')
+
+    args = parser.parse_args()
+    if args.command == 'serve':
+        serve(args)
+    else:
+        exit(0 if check(args) else 1)
@@ -0,0 +1,430 @@
+import argparse
+import asyncio
+import json
+import socket
+import struct
+import time
+
+
+'''
+  Tools for the protocol traces recorded with CONFIG_USE_PROTOCOL_RECORDER.
+
+  record: receive trace records over UDP and append them to a trace file
+  report: print session timings, downlink loss and queue high-water marks of a trace
+  replay: act as the WebSocket server of a trace, so a device goes through the recorded sessions again
+  merge: line up the per-frame stage times of a trace (CONFIG_USE_AUDIO_LATENCY_TRACER) with a server trace
+
+  A server trace is JSON lines, one per audio frame:
+    {"session_id": "...", "direction": "up", "frame": 1, "time_us": 1700000000123456}
+  direction "up" is a frame the server received, "down" one it sent, time_us is the server clock.
+  frame counts the frames of the session in that direction from 1, as the device does; on MQTT/UDP
+  downlink frames use the sequence number of their datagram instead.
+
+  A trace file is a sequence of records, each a little endian header followed by its payload:
+  |index(4)|time_ms(4)|type(1)|reserved(1)|reserved(2)|timestamp(4)|sequence(4)|size(4)|payload(size)|
+'''
+
+RECORD_HEADER = struct.Struct('<IIBBHIII')
+
+OUTGOING_TEXT = 0
+OUTGOING_AUDIO = 1
+INCOMING_TEXT = 2
+INCOMING_AUDIO = 3
+OPEN_AUDIO_CHANNEL = 4
+AUDIO_CHANNEL_OPENED = 5
+AUDIO_CHANNEL_CLOSED = 6
+NETWORK_ERROR = 7
+CONNECTED = 8
+DISCONNECTED = 9
+LATENCY = 10
+
+# LatencyFrame: direction, frame, 5 stage times in the device's 32-bit microsecond clock
+LATENCY_FRAME = struct.Struct('<B3xI5I')
+UPLINK = 0
+DOWNLINK = 1
+
+
+class Record:
+    def __init__(self, index, time_ms, type, timestamp, sequence, payload):
+        self.index = index
+        self.time_ms = time_ms
+        self.type = type
+        self.timestamp = timestamp
+        self.sequence = sequence
+        self.payload = payload
+
+    def json(self):
+        try:
+            return json.loads(self.payload.decode('utf-8'))
+        except (UnicodeDecodeError, ValueError):
+            return {}
+
+
+def read_trace(filename):
+    records = []
+    with open(filename, 'rb') as f:
+        data = f.read()
+    offset = 0
+    while offset + RECORD_HEADER.size <= len(data):
+        index, time_ms, type, _, _, timestamp, sequence, size = RECORD_HEADER.unpack_from(data, offset)
+        offset += RECORD_HEADER.size
+        payload = data[offset:offset + size]
+        offset += size
+        records.append(Record(index, time_ms, type, timestamp, sequence, payload))
+    if offset != len(data):
+        print(f"Warning: {len(data) - offset} bytes of a truncated record at the end of the trace")
+    return records
+
+
+def record(port, output):
+    server_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    server_socket.bind(('0.0.0.0', port))
+    print(f"Saving protocol trace records from 0.0.0.0:{port} to {output}...")
+    count = 0
+    with open(output, 'ab') as f:
+        try:
+            while True:
+                message, address = server_socket.recvfrom(2048)
+                if len(message) < RECORD_HEADER.size:
+                    continue
+                f.write(message)
+                f.flush()
+                count += 1
+                if count % 100 == 0:
+                    print(f"Received {count} records from {address}")
+        except KeyboardInterrupt:
+            print(f"\nSaved {count} records to {output}")
+        finally:
+            server_socket.close()
+
+
+def message_signature(message):
+    # Outgoing messages are matched on their type and state, the rest differs between runs
+    return (message.get('type'), message.get('state'))
+
+
+def split_sessions(records):
+    sessions = []
+    session = None
+    for r in records:
+        if r.type == OPEN_AUDIO_CHANNEL:
+            session = {'open_ms': r.time_ms, 'records': []}
+            sessions.append(session)
+        elif session is not None:
+            session['records'].append(r)
+            if r.type == AUDIO_CHANNEL_CLOSED:
+                session = None
+    return sessions
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def report(filename):
+    records = read_trace(filename)
+    if not records:
+        print("Empty trace")
+        return
+
+    lost = sum(max(b.index - a.index - 1, 0) for a, b in zip(records, records[1:]))
+    print(f"{len(records)} records over {(records[-1].time_ms - records[0].time_ms) / 1000:.1f} s, {lost} lost on the way to the recorder")
+
+    connect_ms = []
+    listen_to_stt_ms = []
+    listen_to_speaking_ms = []
+    speaking_to_audio_ms = []
+    uplink_gaps_ms = []
+    received = dropped = reordered = underruns = 0
+    max_backlog_ms = 0
+    max_backlog_packets = 0
+    errors = []
+
+    for session in split_sessions(records):
+        frame_duration = 60
+        listening_ms = None
+        speaking_ms = None
+        waiting_stt = False
+        first_audio = False
+        last_sequence = None
+        last_uplink_ms = None
+        # Playout model of the downlink: packets add their duration, playback drains in real time
+        backlog_ms = 0
+        backlog_time_ms = None
+
+        for r in session['records']:
+            if r.type == AUDIO_CHANNEL_OPENED:
+                connect_ms.append(r.time_ms - session['open_ms'])
+                frame_duration = r.json().get('frame_duration', frame_duration)
+            elif r.type == NETWORK_ERROR:
+                errors.append(r.payload.decode('utf-8', 'replace'))
+            elif r.type == OUTGOING_TEXT:
+                signature = message_signature(r.json())
+                if signature in (('listen', 'start'), ('listen', 'detect')):
+                    listening_ms = r.time_ms
+                    waiting_stt = True
+                last_uplink_ms = None
+            elif r.type == OUTGOING_AUDIO:
+                if last_uplink_ms is not None:
+                    uplink_gaps_ms.append(r.time_ms - last_uplink_ms)
+                last_uplink_ms = r.time_ms
+            elif r.type == INCOMING_TEXT:
+                message = r.json()
+                if message.get('type') == 'stt' and waiting_stt and listening_ms is not None:
+                    listen_to_stt_ms.append(r.time_ms - listening_ms)
+                    waiting_stt = False
+                elif message_signature(message) == ('tts', 'start'):
+                    speaking_ms = r.time_ms
+                    first_audio = True
+                    backlog_ms = 0
+                    backlog_time_ms = None
+                    if listening_ms is not None:
+                        listen_to_speaking_ms.append(r.time_ms - listening_ms)
+                        listening_ms = None
+                elif message_signature(message) == ('tts', 'stop'):
+                    speaking_ms = None
+            elif r.type == INCOMING_AUDIO:
+                received += 1
+                if first_audio and speaking_ms is not None:
+                    speaking_to_audio_ms.append(r.time_ms - speaking_ms)
+                    first_audio = False
+                if r.sequence != 0:
+                    if last_sequence is not None:
+                        if r.sequence > last_sequence + 1:
+                            dropped += r.sequence - last_sequence - 1
+                        elif r.sequence <= last_sequence:
+                            reordered += 1
+                    last_sequence = max(r.sequence, last_sequence or 0)
+                if backlog_time_ms is not None:
+                    backlog_ms -= r.time_ms - backlog_time_ms
+                    if backlog_ms < 0:
+                        underruns += 1
+                        backlog_ms = 0
+                backlog_time_ms = r.time_ms
+                backlog_ms += frame_duration
+                max_backlog_ms = max(max_backlog_ms, backlog_ms)
+                max_backlog_packets = max(max_backlog_packets, backlog_ms // frame_duration)
+
+    def timing(name, values):
+        if values:
+            print(f"  {name:<28} n={len(values):<4} p50={percentile(values, 50):>6} ms  p95={percentile(values, 95):>6} ms  max={max(values):>6} ms")
+
+    print("Timings:")
+    timing("connecting -> channel opened", connect_ms)
+    timing("listening -> stt", listen_to_stt_ms)
+    timing("listening -> speaking", listen_to_speaking_ms)
+    timing("speaking -> first audio", speaking_to_audio_ms)
+    timing("uplink frame interval", uplink_gaps_ms)
+    print("Downlink:")
+    print(f"  {received} packets received, {dropped} dropped, {reordered} late or duplicated, {underruns} underruns")
+    print(f"  decode queue high-water mark {max_backlog_ms} ms ({max_backlog_packets} packets)")
+    if errors:
+        print("Network errors:")
+        for error in errors:
+            print(f"  {error}")
+
+
+class Unwrapper:
+    # The device clock is the low 32 bits of esp_timer, it wraps every 71 minutes
+    def __init__(self):
+        self.base = 0
+        self.last = None
+
+    def __call__(self, value):
+        if self.last is not None and value + (1 << 31) < self.last:
+            self.base += 1 << 32
+        self.last = value
+        return self.base + value
+
+
+def read_server_trace(filename):
+    frames = {}
+    with open(filename) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            entry = json.loads(line)
+            key = (entry['session_id'], DOWNLINK if entry['direction'] == 'down' else UPLINK, entry['frame'])
+            frames[key] = entry['time_us']
+    return frames
+
+
+def merge(filename, server_filename, output):
+    server = read_server_trace(server_filename)
+    unwrap = Unwrapper()
+    sessions = []
+    for session in split_sessions(read_trace(filename)):
+        session_id = next((r.json().get('session_id', '') for r in session['records'] if r.type == AUDIO_CHANNEL_OPENED), '')
+        frames = []
+        for r in session['records']:
+            if r.type != LATENCY or len(r.payload) < LATENCY_FRAME.size:
+                continue
+            direction, _, *stages = LATENCY_FRAME.unpack_from(r.payload)
+            stages = [unwrap(t) if t else None for t in stages]
+            frames.append((direction, r.sequence, stages, server.get((session_id, direction, r.sequence))))
+        sessions.append((session_id, frames))
+
+    rows = []
+    stats = {}
+    for session_id, frames in sessions:
+        # Each way the clock offset (server minus device) adds to or takes from the one way delay. The fastest
+        # frame each way has the least queueing, and the link is taken as symmetric: the offset is half the
+        # difference of the two minima
+        up = [t - s[4] for d, _, s, t in frames if d == UPLINK and t is not None and s[4]]
+        down = [s[0] - t for d, _, s, t in frames if d == DOWNLINK and t is not None and s[0]]
+        offset = (min(up) - min(down)) / 2 if up and down else None
+        if offset is None:
+            print(f"Session {session_id}: no frames matched the server trace both ways, the clocks cannot be aligned")
+
+        for direction, number, stages, server_us in frames:
+            if direction == UPLINK:
+                capture, processed, encode_start, encode_end, send = stages
+                values = {
+                    'device capture -> send': send - capture if capture and send else None,
+                    'network send -> server': (server_us - offset) - send if offset is not None and server_us and send else None,
+                    'capture -> server': (server_us - offset) - capture if offset is not None and server_us and capture else None,
+                }
+            else:
+                receive, decode_start, decode_end, play, _ = stages
+                values = {
+                    'device receive -> play': play - receive if receive and play else None,
+                    'network server -> receive': receive - (server_us - offset) if offset is not None and server_us and receive else None,
+                    'server -> play': play - (server_us - offset) if offset is not None and server_us and play else None,
+                }
+            for name, value in values.items():
+                if value is not None:
+                    stats.setdefault(name, []).append(value / 1000)
+            rows.append([session_id, 'up' if direction == UPLINK else 'down', number, server_us] + list(values.values()))
+
+    matched = sum(1 for _, frames in sessions for f in frames if f[3] is not None)
+    total = sum(len(frames) for _, frames in sessions)
+    print(f"{total} traced frames in {len(sessions)} sessions, {matched} matched in the server trace")
+    for name, values in stats.items():
+        print(f"  {name:<26} n={len(values):<6} p50={percentile(values, 50):>8.1f} ms  p95={percentile(values, 95):>8.1f} ms  p99={percentile(values, 99):>8.1f} ms")
+
+    if output:
+        import csv
+        with open(output, 'w', newline='') as f:
+            writer = csv.writer(f)
+            writer.writerow(['session_id', 'direction', 'frame', 'server_us', 'device_us', 'network_us', 'end_to_end_us'])
+            for row in rows:
+                writer.writerow(['' if v is None else (round(v) if isinstance(v, float) else v) for v in row])
+        print(f"Merged frames written to {output}")
+
+
+def binary_frame(r, version):
+    if version == 2:
+        return struct.pack('>HHIII', 2, 0, 0, r.timestamp, len(r.payload)) + r.payload
+    if version == 3:
+        return struct.pack('>BBH', 0, 0, len(r.payload)) + r.payload
+    return r.payload
+
+
+def replay_steps(session):
+    # Incoming records are replayed after the outgoing message they followed in the trace
+    steps = []
+    anchor = ('hello', None)
+    anchor_ms = session['open_ms']
+    step = None
+    for r in session['records']:
+        if r.type == AUDIO_CHANNEL_OPENED:
+            anchor_ms = r.time_ms
+        elif r.type == OUTGOING_TEXT:
+            anchor = message_signature(r.json())
+            anchor_ms = r.time_ms
+            step = None
+        elif r.type in (INCOMING_TEXT, INCOMING_AUDIO):
+            if step is None:
+                step = {'anchor': anchor, 'records': []}
+                steps.append(step)
+            step['records'].append((r.time_ms - anchor_ms, r))
+    return steps
+
+
+async def replay(filename, port, speed, version):
+    import websockets
+
+    sessions = [s for s in split_sessions(read_trace(filename)) if s['records']]
+    print(f"Replaying {len(sessions)} sessions on ws://0.0.0.0:{port} at {speed}x")
+    queue = list(sessions)
+
+    async def handler(websocket):
+        if not queue:
+            print("No sessions left to replay")
+            await websocket.close()
+            return
+        session = queue.pop(0)
+        params = next((r.json() for r in session['records'] if r.type == AUDIO_CHANNEL_OPENED), {})
+        steps = replay_steps(session)
+        print(f"Session {params.get('session_id', '')}: {len(steps)} steps")
+
+        async for message in websocket:
+            if isinstance(message, bytes):
+                continue
+            signature = message_signature(json.loads(message))
+            if signature[0] == 'hello':
+                await websocket.send(json.dumps({
+                    'type': 'hello',
+                    'transport': 'websocket',
+                    'session_id': params.get('session_id', 'replay'),
+                    'audio_params': {
+                        'format': 'opus',
+                        'sample_rate': params.get('sample_rate', 24000),
+                        'channels': 1,
+                        'frame_duration': params.get('frame_duration', 60),
+                    },
+                }))
+            if not steps or steps[0]['anchor'] != signature:
+                continue
+            step = steps.pop(0)
+            start = time.monotonic()
+            for delay_ms, r in step['records']:
+                wait = start + delay_ms / 1000 / speed - time.monotonic()
+                if wait > 0:
+                    await asyncio.sleep(wait)
+                if r.type == INCOMING_TEXT:
+                    await websocket.send(r.payload.decode('utf-8'))
+                else:
+                    await websocket.send(binary_frame(r, version))
+            if not steps:
+                print("Session replayed")
+
+    async with websockets.serve(handler, '0.0.0.0', port):
+        await asyncio.Future()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='协议 trace 工具：接收、统计、回放与延迟合并')
+    subparsers = parser.add_subparsers(dest='command', required=True)
+
+    record_parser = subparsers.add_parser('record', help='通过UDP接收 trace 记录并保存')
+    record_parser.add_argument('--port', '-p', type=int, default=8001, help='UDP端口 (默认: 8001)')
+    record_parser.add_argument('--output', '-o', default='protocol.trace', help='trace 文件 (默认: protocol.trace)')
+
+    report_parser = subparsers.add_parser('report', help='统计会话耗时、丢包与队列水位')
+    report_parser.add_argument('trace', help='trace 文件')
+
+    replay_parser = subparsers.add_parser('replay', help='作为 WebSocket 服务器向设备回放 trace')
+    replay_parser.add_argument('trace', help='trace 文件')
+    replay_parser.add_argument('--port', '-p', type=int, default=8765, help='WebSocket端口 (默认: 8765)')
+    replay_parser.add_argument('--speed', '-s', type=float, default=1.0, help='回放速度倍数 (默认: 1.0)')
+    replay_parser.add_argument('--version', '-v', type=int, default=1, choices=[1, 2, 3], help='二进制协议版本 (默认: 1)')
+
+    merge_parser = subparsers.add_parser('merge', help='按帧合并设备与服务器的延迟 trace')
+    merge_parser.add_argument('trace', help='设备 trace 文件')
+    merge_parser.add_argument('server_trace', help='服务器 trace 文件 (JSON lines)')
+    merge_parser.add_argument('--output', '-o', help='逐帧合并结果 CSV 文件')
+
+    args = parser.parse_args()
+    if args.command == 'record':
+        record(args.port, args.output)
+    elif args.command == 'report':
+        report(args.trace)
+    elif args.command == 'merge':
+        merge(args.trace, args.server_trace, args.output)
+    else:
+        asyncio.run(replay(args.trace, args.port, args.speed, args.version))
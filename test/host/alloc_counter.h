@@ -0,0 +1,45 @@
+#ifndef HOST_ALLOC_COUNTER_H
+#define HOST_ALLOC_COUNTER_H
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <malloc.h>
+
+// Replaces the global operator new to count heap allocations and live bytes, include from exactly one
+// file per executable. Sizes are the usable sizes reported by glibc.
+static std::atomic<unsigned long> host_allocations{0};
+static std::atomic<long> host_live_bytes{0};
+static std::atomic<long> host_peak_bytes{0};
+
+// Start measuring the peak from the current live bytes
+static inline void HostResetPeakBytes() {
+    host_peak_bytes = host_live_bytes.load();
+}
+
+void* operator new(std::size_t size) {
+    void* p = std::malloc(size ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    host_allocations++;
+    long live = host_live_bytes += malloc_usable_size(p);
+    long peak = host_peak_bytes;
+    while (live > peak && !host_peak_bytes.compare_exchange_weak(peak, live)) {
+    }
+    return p;
+}
+
+// Not inlined, GCC would take the free() of a pointer from operator new for a mismatched deallocation
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    if (p != nullptr) {
+        host_live_bytes -= malloc_usable_size(p);
+    }
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    operator delete(p);
+}
+
+#endif // HOST_ALLOC_COUNTER_H
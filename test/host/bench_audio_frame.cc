@@ -0,0 +1,96 @@
+#include "audio_frame.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+/*
+ * Input path resampling of 60ms frames into 16kHz mic + reference, per output sample:
+ * - fused: one AudioFrameResampler pass over the interleaved frame, interleaved output
+ * - three pass: deinterleave, two mono resamplers, reinterleave, the shape of the code before it
+ * - mono: the mic channel only, as the wake word and the audio testing path take it
+ * TSC cycles are reference cycles of the host, not core cycles of the ESP32-S3.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int kIterations = 2000;
+
+struct Timer {
+    Clock::time_point start = Clock::now();
+#if HAVE_TSC
+    unsigned long long tsc = __rdtsc();
+#endif
+    void Report(const char* name, size_t samples) {
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / samples;
+#if HAVE_TSC
+        double cycles = (double)(__rdtsc() - tsc) / samples;
+        printf("  %-12s %7.2f ns/sample %8.1f cycles/sample\n", name, ns, cycles);
+#else
+        printf("  %-12s %7.2f ns/sample\n", name, ns);
+#endif
+    }
+};
+
+static void Bench(int input_rate) {
+    size_t frames = input_rate * 60 / 1000;
+    std::vector<int16_t> input(frames * 2);
+    std::mt19937 rng(1);
+    for (auto& s : input) {
+        s = (int16_t)(rng() % 20000) - 10000;
+    }
+    printf("%d Hz stereo -> 16000 Hz\n", input_rate);
+
+    AudioFrameResampler fused;
+    fused.Configure(input_rate, 16000, 2, frames);
+    std::vector<int16_t> out(fused.GetOutputFrames(frames) * 2);
+    size_t produced = 0;
+    Timer fused_timer;
+    for (int i = 0; i < kIterations; i++) {
+        produced += fused.Process(input.data(), frames, out.data()) * 2;
+    }
+    fused_timer.Report("fused", produced);
+
+    AudioFrameResampler mic, reference;
+    mic.Configure(input_rate, 16000, 1, frames);
+    reference.Configure(input_rate, 16000, 1, frames);
+    std::vector<int16_t> mic_in(frames), reference_in(frames);
+    std::vector<int16_t> mic_out(mic.GetOutputFrames(frames)), reference_out(mic_out.size());
+    produced = 0;
+    Timer three_pass_timer;
+    for (int i = 0; i < kIterations; i++) {
+        AudioFrameExtractChannel(input.data(), frames, 2, 0, mic_in.data());
+        AudioFrameExtractChannel(input.data(), frames, 2, 1, reference_in.data());
+        size_t n = mic.Process(mic_in.data(), frames, mic_out.data());
+        reference.Process(reference_in.data(), frames, reference_out.data());
+        for (size_t j = 0; j < n; j++) {
+            out[2 * j] = mic_out[j];
+            out[2 * j + 1] = reference_out[j];
+        }
+        produced += n * 2;
+    }
+    three_pass_timer.Report("three pass", produced);
+
+    AudioFrameResampler mono;
+    mono.Configure(input_rate, 16000, 2, frames);
+    produced = 0;
+    Timer mono_timer;
+    for (int i = 0; i < kIterations; i++) {
+        produced += mono.Process(input.data(), frames, out.data(), true);
+    }
+    mono_timer.Report("mono", produced);
+}
+
+int main() {
+    Bench(24000);
+    Bench(48000);
+    return 0;
+}
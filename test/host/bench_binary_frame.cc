@@ -0,0 +1,103 @@
+#include "binary_frame.h"
+#include "audio_packet_pool.h"
+#include "alloc_counter.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+/*
+ * Downlink receive of version 3 messages, from the WebSocket buffer to a packet on the decode queue and back
+ * after decoding, like AudioService does:
+ * - per frame: the handler before the parser, one frame per message, byte swapped in place and copied into
+ *   a new AudioStreamPacket
+ * - pooled: ParseBinaryFrames and AudioPacketPool, with 1 and 4 frames per message
+ * Payloads are 24kHz TTS sized (~120 bytes per 60ms frame). A few packets stay queued before the decoder.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int kMessages = 500000;
+static constexpr size_t kPayloadSize = 120;
+static constexpr size_t kQueueDepth = 8;
+
+static std::vector<uint8_t> Message(int frames) {
+    std::vector<uint8_t> message;
+    for (int i = 0; i < frames; i++) {
+        BinaryProtocol3 bp3 = {};
+        bp3.payload_size = htons(kPayloadSize);
+        size_t offset = message.size();
+        message.resize(offset + sizeof(bp3) + kPayloadSize, (uint8_t)i);
+        memcpy(&message[offset], &bp3, sizeof(bp3));
+    }
+    return message;
+}
+
+static void Report(const char* name, int frames, Clock::time_point start, unsigned long allocations) {
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    printf("%-18s %12.0f frames/s %8.2f allocations/frame\n", name, frames / seconds,
+        (double)(host_allocations - allocations) / frames);
+}
+
+static void PerFrame() {
+    auto message = Message(1);
+    // The oldest queued packet is decoded (freed) when a new one comes in
+    std::unique_ptr<AudioStreamPacket> queue[kQueueDepth];
+    std::vector<uint8_t> data(message.size());
+    unsigned long allocations = host_allocations;
+    auto start = Clock::now();
+    for (int i = 0; i < kMessages; i++) {
+        memcpy(data.data(), message.data(), message.size());
+        BinaryProtocol3* bp3 = (BinaryProtocol3*)data.data();
+        bp3->payload_size = ntohs(bp3->payload_size);
+        auto payload = (uint8_t*)bp3->payload;
+        auto packet = std::make_unique<AudioStreamPacket>();
+        packet->sample_rate = 24000;
+        packet->frame_duration = 60;
+        packet->payload = std::vector<uint8_t>(payload, payload + bp3->payload_size);
+        queue[i % kQueueDepth] = std::move(packet);
+    }
+    Report("per frame", kMessages, start, allocations);
+}
+
+static void Pooled(int frames_per_message) {
+    auto message = Message(frames_per_message);
+    auto& pool = AudioPacketPool::GetInstance();
+    pool.Initialize(kQueueDepth + 2);
+    std::unique_ptr<AudioStreamPacket> queue[kQueueDepth];
+    size_t next = 0;
+    // Let the pool and the queue reach their working size first
+    int frames = 0;
+    unsigned long allocations = 0;
+    Clock::time_point start;
+    for (int i = -1000; i < kMessages; i++) {
+        if (i == 0) {
+            frames = 0;
+            allocations = host_allocations;
+            start = Clock::now();
+        }
+        ParseBinaryFrames(3, message.data(), message.size(), [&](const BinaryFrame& frame) {
+            auto packet = pool.Acquire();
+            packet->sample_rate = 24000;
+            packet->frame_duration = 60;
+            packet->payload.assign(frame.payload, frame.payload + frame.payload_size);
+            auto& slot = queue[next++ % kQueueDepth];
+            pool.Release(std::move(slot));
+            slot = std::move(packet);
+            frames++;
+        });
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "pooled, %d/message", frames_per_message);
+    Report(name, frames, start, allocations);
+}
+
+int main() {
+    PerFrame();
+    Pooled(1);
+    Pooled(4);
+    auto stats = AudioPacketPool::GetInstance().GetStats();
+    printf("pool: %u acquired, %u heap allocations\n", stats.acquired, stats.heap_allocations);
+    return 0;
+}
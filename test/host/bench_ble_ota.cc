@@ -0,0 +1,391 @@
+#include "ble_ota.h"
+#include "ble_route.h"
+#include "ble_crc32.h"
+#include "ota_image_decoder.h"
+
+#include <esp_ota_ops.h>
+#include <spi_flash_mmap.h>
+#include <nvs.h>
+#include <host/ble_hs.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * BLE OTA throughput per window, ble_ota.c and ble_protocol.c as they are. The APP keeps up to window
+ * packets without a 0x05 reply, the device hands each verified packet to its flash writer task and
+ * waits in ble_ota_submit_block() while all window + 1 blocks are taken.
+ *
+ *   bench_ble_ota [--size KB] [--rate KB/s] [--latency ms] [--erase ms] [--page ms] [--speedup n]
+ *
+ * Link: writes leave the APP at the link rate and arrive one latency later, notifications take one
+ * latency back. Flash: a 4 KB sector erase and a 256 byte page program take the given time, the defaults
+ * are the typical figures of the SPI NOR chips on ESP32-S3 boards. The whole run is sped up by --speedup
+ * on the host clock and reported in device time. Each window runs in a child process with its own
+ * ble_ota_init().
+ */
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+static constexpr uint16_t kConn = 1;
+static constexpr uint16_t kMtu = 247;
+static constexpr size_t kWriteSize = kMtu - 3 - BLE_PROTOCOL_MIN_PACKET_LEN;
+static constexpr size_t kPacketSize = 4096;
+
+static int image_kb = 256;
+static double rate_kbps = 80;
+static double latency_ms = 15;
+static double erase_ms = 45;
+static double page_ms = 0.7;
+static double speedup = 4;
+
+// Device time to host time
+static Clock::duration Scaled(double ms) {
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(ms / speedup));
+}
+
+static std::vector<uint8_t> flash(2 * 1024 * 1024, 0xFF);
+static const esp_partition_t kRunning = {0x10000, 2 * 1024 * 1024, "ota_0"};
+static const esp_partition_t kUpdate = {0x210000, 2 * 1024 * 1024, "ota_1"};
+static std::atomic<int64_t> flash_busy_us{0};
+
+static void FlashDelay(double ms) {
+    auto start = Clock::now();
+    std::this_thread::sleep_for(Scaled(ms));
+    flash_busy_us += std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+}
+
+extern "C" esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* dst, size_t size) {
+    memcpy(dst, flash.data() + offset, size);
+    return ESP_OK;
+}
+
+extern "C" esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* src, size_t size) {
+    FlashDelay(page_ms * ((size + 255) / 256));
+    memcpy(flash.data() + offset, src, size);
+    return ESP_OK;
+}
+
+extern "C" esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    FlashDelay(erase_ms * (size / SPI_FLASH_SEC_SIZE));
+    memset(flash.data() + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+extern "C" const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from) {
+    return &kUpdate;
+}
+
+extern "C" const esp_partition_t* esp_ota_get_running_partition(void) {
+    return &kRunning;
+}
+
+extern "C" esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition) {
+    return ESP_OK;
+}
+
+extern "C" const esp_app_desc_t* esp_app_get_description(void) {
+    static const esp_app_desc_t desc = {"1.0.0", "xiaozhi"};
+    return &desc;
+}
+
+// Checkpoints go nowhere, the bench never resumes
+extern "C" esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle) {
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+extern "C" void nvs_close(nvs_handle_t handle) {
+}
+
+extern "C" esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length) {
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+extern "C" esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+extern "C" esp_err_t nvs_commit(nvs_handle_t handle) {
+    return ESP_OK;
+}
+
+// Raw images: the decoder hands the bytes through
+struct ota_image_decoder {
+    ota_image_write_cb_t write_cb;
+    void* ctx;
+};
+
+ota_image_decoder_t* ota_image_decoder_create(const esp_partition_t* source, ota_image_write_cb_t write_cb, void* ctx) {
+    return new ota_image_decoder{write_cb, ctx};
+}
+
+void ota_image_decoder_destroy(ota_image_decoder_t* decoder) {
+    delete decoder;
+}
+
+esp_err_t ota_image_decoder_feed(ota_image_decoder_t* decoder, const uint8_t* data, size_t len) {
+    return decoder->write_cb(decoder->ctx, data, len);
+}
+
+esp_err_t ota_image_decoder_finish(ota_image_decoder_t* decoder) {
+    return ESP_OK;
+}
+
+ota_image_type_t ota_image_decoder_get_type(const ota_image_decoder_t* decoder) {
+    return OTA_IMAGE_TYPE_RAW;
+}
+
+size_t ota_image_decoder_get_image_size(const ota_image_decoder_t* decoder) {
+    return 0;
+}
+
+// Both directions of the link: what was sent and when it arrives
+struct Frame {
+    Clock::time_point arrival;
+    std::vector<uint8_t> data;
+};
+static std::mutex link_mutex;
+static std::condition_variable link_cv;
+static std::deque<Frame> to_device;
+static std::deque<Frame> to_app;
+
+extern "C" int esp_ble_register_evt_callback(ble_evt_callback_t callback) {
+    return ESP_OK;
+}
+
+extern "C" int esp_ble_unregister_evt_callback(ble_evt_callback_t callback) {
+    return ESP_OK;
+}
+
+extern "C" uint16_t esp_ble_get_notify_handle(void) {
+    return 42;
+}
+
+extern "C" uint16_t esp_ble_get_mtu(uint16_t conn_id) {
+    return kMtu;
+}
+
+extern "C" int esp_ble_notify_data(uint16_t conn_id, uint16_t handle, uint8_t* p_data, uint16_t len) {
+    std::lock_guard<std::mutex> lock(link_mutex);
+    to_app.push_back({Clock::now() + Scaled(latency_ms), std::vector<uint8_t>(p_data, p_data + len)});
+    link_cv.notify_all();
+    return 0;
+}
+
+extern "C" int ble_gap_set_prefered_le_phy(uint16_t conn_handle, uint8_t tx_phys_mask, uint8_t rx_phys_mask, uint16_t phy_opts) {
+    return 0;
+}
+
+static void OnProgress(int progress, const char* message) {
+}
+
+// Hands the APP's writes to the device once they arrived
+static void DeviceReceiver(std::atomic<bool>* stop) {
+    std::unique_lock<std::mutex> lock(link_mutex);
+    while (!*stop) {
+        if (to_device.empty()) {
+            link_cv.wait_for(lock, 10ms);
+            continue;
+        }
+        if (Clock::now() < to_device.front().arrival) {
+            link_cv.wait_until(lock, to_device.front().arrival);
+            continue;
+        }
+        auto frame = std::move(to_device.front());
+        to_device.pop_front();
+        lock.unlock();
+        os_mbuf om = {frame.data.data(), (uint16_t)frame.data.size(), nullptr};
+        ble_route_dispatch(kConn, &om);
+        lock.lock();
+    }
+}
+
+class App {
+public:
+    explicit App(const std::string& image) : image_(image) {}
+
+    // Writes leave back to back at the link rate, the schedule is kept even when a host thread oversleeps
+    void Write(uint8_t cmd, const uint8_t* payload, size_t len) {
+        std::vector<uint8_t> packet = {BLE_PROTOCOL_HEADER_0, BLE_PROTOCOL_HEADER_1, cmd};
+        packet.insert(packet.end(), payload, payload + len);
+        link_free_ += Scaled(packet.size() / rate_kbps);
+        std::this_thread::sleep_until(link_free_);
+        std::lock_guard<std::mutex> lock(link_mutex);
+        to_device.push_back({link_free_ + Scaled(latency_ms), std::move(packet)});
+        link_cv.notify_all();
+    }
+
+    // Next notification once it reached the APP, acknowledgements must be successful
+    uint8_t Receive() {
+        std::unique_lock<std::mutex> lock(link_mutex);
+        for (;;) {
+            if (!to_app.empty() && Clock::now() >= to_app.front().arrival) {
+                break;
+            }
+            if (to_app.empty()) {
+                if (!link_cv.wait_for(lock, 10s, [] { return !to_app.empty(); })) {
+                    fprintf(stderr, "No response from the device\n");
+                    _exit(1);
+                }
+            } else {
+                link_cv.wait_until(lock, to_app.front().arrival);
+            }
+        }
+        auto data = std::move(to_app.front().data);
+        // The link was idle while the APP waited for this
+        link_free_ = std::max(link_free_, to_app.front().arrival);
+        to_app.pop_front();
+        if (data.size() < 4 || data[3] != BLE_OTA_ACK_SUCCESS) {
+            fprintf(stderr, "Device answered 0x%02X with an error\n", data.size() > 2 ? data[2] : 0);
+            _exit(1);
+        }
+        return data[2];
+    }
+
+    // window 0 is an APP without window support: it waits for the 0x04 reply before sending the CRC
+    void Run(uint8_t window) {
+        std::vector<uint8_t> info = {1, 0, 2};
+        PutU32(info, image_.size());
+        PutU32(info, ble_crc32_update(0, image_.data(), image_.size()));
+        if (window > 0) {
+            info.push_back(window);
+        }
+        link_free_ = Clock::now();
+        Write(BLE_OTA_CMD_SEND_FILE_INFO, info.data(), info.size());
+        Expect(BLE_OTA_CMD_SEND_FILE_INFO);
+
+        size_t outstanding = 0;
+        for (size_t offset = 0; offset < image_.size(); offset += kPacketSize) {
+            while (outstanding >= std::max<size_t>(window, 1)) {
+                if (Receive() == BLE_OTA_CMD_SEND_PACKET_CRC) {
+                    outstanding--;
+                }
+            }
+            size_t len = std::min(kPacketSize, image_.size() - offset);
+            for (size_t pos = 0; pos < len; pos += kWriteSize) {
+                Write(BLE_OTA_CMD_SEND_FILE_DATA, (const uint8_t*)image_.data() + offset + pos,
+                    std::min(kWriteSize, len - pos));
+            }
+            if (window == 0) {
+                Expect(BLE_OTA_CMD_SEND_FILE_DATA);
+            }
+            std::vector<uint8_t> crc;
+            PutU32(crc, ble_crc32_update(0, image_.data() + offset, len));
+            Write(BLE_OTA_CMD_SEND_PACKET_CRC, crc.data(), crc.size());
+            outstanding++;
+        }
+        while (outstanding > 0) {
+            if (Receive() == BLE_OTA_CMD_SEND_PACKET_CRC) {
+                outstanding--;
+            }
+        }
+    }
+
+private:
+    const std::string& image_;
+    Clock::time_point link_free_;
+
+    static void PutU32(std::vector<uint8_t>& out, uint32_t value) {
+        for (int i = 0; i < 4; i++) {
+            out.push_back(value >> (8 * i));
+        }
+    }
+
+    // The 0x04 replies of a windowed APP are read along the way
+    void Expect(uint8_t cmd) {
+        while (Receive() != cmd) {
+        }
+    }
+};
+
+static void RunWindow(const char* name, uint8_t window) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        std::string image(image_kb * 1024, '\0');
+        for (size_t i = 0; i < image.size(); i++) {
+            image[i] = (char)(i * 2654435761u >> 24);
+        }
+        ble_ota_init(OnProgress);
+        // ble_ota_task looks for the session once a second after it started
+        std::this_thread::sleep_for(1100ms);
+        std::atomic<bool> stop{false};
+        std::thread receiver(DeviceReceiver, &stop);
+
+        App app(image);
+        auto start = Clock::now();
+        app.Run(window);
+        double host_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        double seconds = host_ms * speedup / 1000;
+        printf("  %-10s %7.2f s %7.1f KB/s   flash busy %3.0f%%\n", name, seconds, image_kb / seconds,
+            100.0 * flash_busy_us / 1000 / host_ms);
+        fflush(stdout);
+        stop = true;
+        receiver.join();
+        // The OTA tasks are still running, skip the static destructors
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s failed\n", name);
+        exit(1);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        double value = atof(argv[i + 1]);
+        if (strcmp(argv[i], "--size") == 0) {
+            image_kb = (int)value;
+        } else if (strcmp(argv[i], "--rate") == 0) {
+            rate_kbps = value;
+        } else if (strcmp(argv[i], "--latency") == 0) {
+            latency_ms = value;
+        } else if (strcmp(argv[i], "--erase") == 0) {
+            erase_ms = value;
+        } else if (strcmp(argv[i], "--page") == 0) {
+            page_ms = value;
+        } else if (strcmp(argv[i], "--speedup") == 0) {
+            speedup = value;
+        }
+    }
+    if (image_kb <= 0 || image_kb > 2048 || rate_kbps <= 0 || speedup <= 0) {
+        fprintf(stderr, "Usage: %s [--size KB] [--rate KB/s] [--latency ms] [--erase ms] [--page ms] [--speedup n]\n",
+            argv[0]);
+        return 1;
+    }
+
+    double flash_ms = erase_ms + page_ms * kPacketSize / 256;
+    printf("%d KB raw image, %.0f KB/s link, %.0f ms latency, %.1f ms flash per 4 KB block (%.0f erase + %.1f "
+        "program), %d byte writes\n", image_kb, rate_kbps, latency_ms, flash_ms, erase_ms, page_ms * kPacketSize / 256,
+        (int)kWriteSize);
+    RunWindow("legacy", 0);
+    for (int window = 1; window <= CONFIG_BLE_OTA_WINDOW_MAX; window++) {
+        RunWindow(("window " + std::to_string(window)).c_str(), window);
+    }
+    printf("  %-10s %7.2f s %7.1f KB/s\n", "link max", image_kb / rate_kbps, rate_kbps);
+    printf("  %-10s %7.2f s %7.1f KB/s\n", "flash max", image_kb / 4 * flash_ms / 1000, 4 * 1000 / flash_ms);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "ble_protocol.h"
+#include "ble_route.h"
+
+#include <esp_err.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+ * Segmented responses per MTU: ble_protocol_send_response() on the device and the reassembly on the other
+ * end, done by ble_route_dispatch() here, which takes the same frames.
+ * - notifications per message and the share of the protocol headers (frame and segment headers)
+ * - link layer packets and the air time on the 1M PHY, sent back to back in one connection event: L2CAP
+ *   and ATT headers on top, 27 byte link layer payloads at MTU 23 and 251 with data length extension
+ *   otherwise, each packet answered by an empty one after the 150 us inter frame space
+ * - host CPU for sending and for reassembling a message
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint16_t kConn = 1;
+static constexpr uint8_t kCmd = BLE_PROTOCOL_CMD_GET_WIFI_SCAN;
+static const uint16_t kMtus[] = {23, 185, 247, 512};
+static const size_t kMessageSizes[] = {64, 512, 4096};
+
+static uint16_t mtu = 23;
+static std::vector<std::vector<uint8_t>> notifications;
+
+extern "C" int esp_ble_register_evt_callback(ble_evt_callback_t callback) {
+    return ESP_OK;
+}
+
+extern "C" uint16_t esp_ble_get_notify_handle(void) {
+    return 42;
+}
+
+extern "C" uint16_t esp_ble_get_mtu(uint16_t conn_id) {
+    return mtu;
+}
+
+static size_t notify_count = 0;
+
+extern "C" int esp_ble_notify_data(uint16_t conn_id, uint16_t handle, uint8_t* p_data, uint16_t len) {
+    // Kept in preallocated slots, the timing is not about the host allocator
+    auto& slot = notifications[notify_count++ % notifications.size()];
+    slot.assign(p_data, p_data + len);
+    return 0;
+}
+
+static bool Dispatch(std::vector<uint8_t>& data) {
+    os_mbuf om = {data.data(), (uint16_t)data.size(), nullptr};
+    return ble_route_dispatch(kConn, &om);
+}
+
+// Air time of one notification: preamble, access address, LL header, payload and CRC per packet at 1 us per bit
+static double AirUs(size_t value_len, size_t ll_payload) {
+    size_t l2cap = 4 + 3 + value_len;
+    double us = 0;
+    for (size_t sent = 0; sent < l2cap; sent += ll_payload) {
+        size_t n = l2cap - sent < ll_payload ? l2cap - sent : ll_payload;
+        us += (1 + 4 + 2 + n + 3) * 8 + 150 + (1 + 4 + 2 + 3) * 8 + 150;
+    }
+    return us;
+}
+
+int main() {
+    ble_protocol_init();
+    ble_route_handle_t route = nullptr;
+    esp_ble_register_route(0x00, 0x02, 16 * 1024, &route);
+    // The APP sent a segment, so the device segments its responses
+    std::vector<uint8_t> segment = {BLE_PROTOCOL_HEADER_0, BLE_PROTOCOL_SAR_HEADER_1, kCmd, 0, 1, 0, 'x'};
+    Dispatch(segment);
+    esp_ble_route_return(route, esp_ble_route_receive(route, 0));
+    notifications.resize(512);
+    for (auto& slot : notifications) {
+        slot.reserve(512);
+    }
+
+    printf("%5s %7s %6s %8s %6s %9s %10s %10s\n", "mtu", "message", "notify", "headers", "ll", "air ms",
+        "send us", "recv us");
+    for (uint16_t new_mtu : kMtus) {
+        mtu = new_mtu;
+        size_t ll_payload = mtu == 23 ? 27 : 251;
+        for (size_t size : kMessageSizes) {
+            std::string message(size, 'm');
+            notify_count = 0;
+            ble_protocol_send_response(kConn, kCmd, (const uint8_t*)message.data(), message.size());
+            size_t count = notify_count;
+            size_t wire = 0;
+            size_t ll_packets = 0;
+            double air_us = 0;
+            for (size_t i = 0; i < count; i++) {
+                size_t len = notifications[i].size();
+                wire += len;
+                ll_packets += (4 + 3 + len + ll_payload - 1) / ll_payload;
+                air_us += AirUs(len, ll_payload);
+            }
+
+            const int iterations = 20000000 / (int)(size * 8 + 1000);
+            auto start = Clock::now();
+            for (int i = 0; i < iterations; i++) {
+                notify_count = 0;
+                ble_protocol_send_response(kConn, kCmd, (const uint8_t*)message.data(), message.size());
+            }
+            double send_us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / iterations;
+
+            start = Clock::now();
+            for (int i = 0; i < iterations; i++) {
+                for (size_t j = 0; j < count; j++) {
+                    Dispatch(notifications[j]);
+                }
+                esp_ble_route_return(route, esp_ble_route_receive(route, 0));
+            }
+            double receive_us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / iterations;
+
+            printf("%5u %7zu %6zu %7.1f%% %6zu %9.2f %10.2f %10.2f\n", mtu, size, count,
+                100.0 * (wire - size) / wire, ll_packets, air_us / 1000, send_us, receive_us);
+        }
+    }
+    esp_ble_unregister_route(route);
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "ble_crc32.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/*
+ * BLE OTA CRC32 throughput, built once per CONFIG_BLE_OTA_CRC32_* backend like test_crc32:
+ * - write: BLE write sized chunks, as ble_ota_handle_file_data() accumulates them
+ * - sector: 4KB flash sectors, as the resume check re-reads the written image
+ * - combine: the cost of folding one packet crc into the running total
+ * On the host the rom backend runs the table based esp_crc32_le() of stubs/host_stubs.c, not the ROM code.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t kImageSize = 4 * 1024 * 1024;
+
+static double MegabytesPerSecond(const std::vector<uint8_t>& image, size_t chunk, uint32_t* crc) {
+    auto start = Clock::now();
+    uint32_t value = 0;
+    for (size_t pos = 0; pos < image.size(); pos += chunk) {
+        size_t n = image.size() - pos < chunk ? image.size() - pos : chunk;
+        value = ble_crc32_update(value, image.data() + pos, n);
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    *crc = value;
+    return image.size() / seconds / (1024 * 1024);
+}
+
+int main() {
+    std::vector<uint8_t> image(kImageSize);
+    std::mt19937 rng(1);
+    for (auto& byte : image) {
+        byte = rng();
+    }
+
+    printf("backend %s\n", BENCH_CRC32_BACKEND);
+    uint32_t warmup, crc;
+    MegabytesPerSecond(image, 4096, &warmup);
+    const size_t chunks[] = {20, 244, 512, 4096};
+    for (size_t chunk : chunks) {
+        double mbps = MegabytesPerSecond(image, chunk, &crc);
+        printf("  %5zu byte chunks %9.1f MB/s\n", chunk, mbps);
+        if (crc != warmup) {
+            fprintf(stderr, "crc mismatch for %zu byte chunks\n", chunk);
+            return 1;
+        }
+    }
+
+    constexpr int kCombines = 100000;
+    uint32_t total = 0;
+    auto start = Clock::now();
+    for (int i = 0; i < kCombines; i++) {
+        total = ble_crc32_combine(total, (uint32_t)i, 4096);
+    }
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / kCombines;
+    printf("  combine, 4096 byte packet %6.0f ns (%08x)\n", ns, (unsigned)total);
+    return 0;
+}
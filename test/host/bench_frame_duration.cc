@@ -0,0 +1,147 @@
+#include "pcm_frame_pool.h"
+#include "audio_packet_pool.h"
+#include "spsc_queue.h"
+#include "alloc_counter.h"
+
+#include <mbedtls/aes.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * 20ms against 40ms and 60ms uplink frames, the choice SelectFrameDuration() makes per session:
+ * - wire: bytes per second of audio per transport, the Opus payload at a fixed bitrate plus every header
+ *   a frame carries on its way (transport framing, TLS record, TCP or UDP, IPv4). ACKs are left out.
+ * - cpu: the per frame work around the encoder on the host, from the pooled capture frame through the
+ *   encode queue to an encrypted MQTT/UDP datagram, per second of audio.
+ * The Opus encode time itself needs the codec, which is not built on the host: on the device enable
+ * CONFIG_USE_AUDIO_LATENCY_TRACER and read the "encode" stage of self.audio.get_latency_stats for each
+ * frame duration.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int kSampleRate = 16000;
+static constexpr int kBitrate = 16000;
+static constexpr int kAudioSeconds = 600;
+static const int kFrameDurations[] = {20, 40, 60};
+
+struct Transport {
+    const char* name;
+    size_t frame_header;    // per Opus frame, inside the message
+    size_t message_header;  // per message, WebSocket framing of a masked client frame
+    size_t record_header;   // TLS 1.2 AES-GCM record: header, explicit nonce and tag
+    size_t network_header;  // IPv4 and UDP or TCP
+};
+
+static const Transport kTransports[] = {
+    {"mqtt/udp", 16, 0, 0, 20 + 8},
+    {"websocket v1", 0, 2 + 4, 5 + 8 + 16, 20 + 20},
+    {"websocket v2", 16, 2 + 4, 5 + 8 + 16, 20 + 20},
+    {"websocket v3", 4, 2 + 4, 5 + 8 + 16, 20 + 20},
+};
+
+static size_t OpusFrameBytes(int frame_duration_ms) {
+    // One TOC byte and the bitrate's share of the frame
+    return 1 + kBitrate / 8 * frame_duration_ms / 1000;
+}
+
+static void Wire() {
+    printf("wire, %d bit/s Opus, bytes per second of audio (header share)\n", kBitrate);
+    printf("  %-14s", "");
+    for (int duration : kFrameDurations) {
+        printf("  %9d ms frames", duration);
+    }
+    printf("\n");
+    for (auto& transport : kTransports) {
+        printf("  %-14s", transport.name);
+        for (int duration : kFrameDurations) {
+            size_t frames = 1000 / duration;
+            size_t payload = OpusFrameBytes(duration);
+            size_t headers = transport.frame_header + transport.message_header + transport.record_header +
+                transport.network_header;
+            size_t total = frames * (payload + headers);
+            printf("  %7zu B/s (%4.1f%%)", total, 100.0 * frames * headers / total);
+        }
+        printf("\n");
+    }
+}
+
+struct EncodeTask {
+    PcmFrame pcm;
+};
+
+static void Cpu() {
+    printf("cpu around the encoder, capture frame to encrypted datagram\n");
+    const unsigned char key[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+    mbedtls_aes_context aes;
+    mbedtls_aes_init(&aes);
+    mbedtls_aes_setkey_enc(&aes, key, 128);
+    const std::string aes_nonce("\x01\x00\x00\x00\x12\x34\x56\x78\x00\x00\x00\x00\x00\x00\x00\x00", 16);
+
+    auto& frame_pool = PcmFramePool::GetInstance();
+    frame_pool.Initialize(4, kSampleRate * 60 / 1000);
+    auto& packet_pool = AudioPacketPool::GetInstance();
+    packet_pool.Initialize(4);
+    SpscQueue<EncodeTask, 4> encode_queue;
+    std::string send_buffer;
+    uint32_t sequence = 0;
+    volatile uint8_t sink = 0;
+
+    for (int duration : kFrameDurations) {
+        int samples = kSampleRate * duration / 1000;
+        int frames = kAudioSeconds * 1000 / duration;
+        std::vector<uint8_t> opus(OpusFrameBytes(duration), 0x5A);
+        unsigned long allocations = host_allocations;
+        auto start = Clock::now();
+        for (int i = 0; i < frames; i++) {
+            // Input task: a pooled capture frame into the encode queue
+            EncodeTask task;
+            task.pcm = frame_pool.Acquire();
+            task.pcm->resize(samples);
+            task.pcm->data()[0] = (int16_t)i;
+            encode_queue.Push(std::move(task));
+
+            // Encode task: the frame out again, the encoded packet from the pool
+            EncodeTask encoded;
+            encode_queue.Pop(encoded);
+            auto packet = packet_pool.Acquire();
+            packet->payload.assign(opus.begin(), opus.end());
+            packet->frame_duration = duration;
+            encoded.pcm.Reset();
+
+            // Main task: MqttProtocol::SendAudioFrames for one frame
+            send_buffer.clear();
+            send_buffer.resize(aes_nonce.size() + packet->payload.size());
+            auto header = (uint8_t*)&send_buffer[0];
+            uint8_t nonce[16];
+            memcpy(nonce, aes_nonce.data(), sizeof(nonce));
+            uint16_t payload_size = htons(packet->payload.size());
+            uint32_t network_sequence = htonl(++sequence);
+            memcpy(&nonce[2], &payload_size, sizeof(payload_size));
+            memcpy(&nonce[12], &network_sequence, sizeof(network_sequence));
+            memcpy(header, nonce, sizeof(nonce));
+            size_t nc_off = 0;
+            uint8_t stream_block[16] = {0};
+            mbedtls_aes_crypt_ctr(&aes, packet->payload.size(), &nc_off, nonce, stream_block, packet->payload.data(),
+                header + aes_nonce.size());
+            sink = sink + send_buffer[16];
+            packet_pool.Release(std::move(packet));
+        }
+        double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        printf("  %2d ms frames %8.3f us/frame %8.2f us per second of audio %5.2f allocations/frame\n", duration,
+            us / frames, us / kAudioSeconds, (double)(host_allocations - allocations) / frames);
+    }
+    mbedtls_aes_free(&aes);
+}
+
+int main() {
+    Wire();
+    printf("\n");
+    Cpu();
+    return 0;
+}
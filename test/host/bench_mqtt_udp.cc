@@ -0,0 +1,294 @@
+#include "replay_window.h"
+#include "audio_packet_pool.h"
+#include "alloc_counter.h"
+
+#include <mbedtls/aes.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Per packet cost of the MQTT/UDP audio channel crypto path, send and receive, before and after the replay
+ * window / reused AES context change. The loops follow MqttProtocol, the UDP socket is left out.
+ * AES runs on the host's OpenSSL through stubs/mbedtls, so the AES share is the host's, not the ESP32
+ * hardware engine's. The "AES only" line gives that share, the difference between the others is the
+ * bookkeeping around it.
+ *
+ * The batching table follows the uplink from the send queue to the socket for frames_per_packet 1..4
+ * against the unbatched path from before, and counts the datagrams (one sendto() each) and the bytes on
+ * the wire per frame, IPv4 and UDP headers included.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int kPackets = 500000;
+static constexpr size_t kPayloadSize = 120;
+static constexpr size_t kQueueDepth = 8;
+static constexpr size_t kUdpIpHeaderSize = 28;
+static constexpr size_t kMaxFramesPerPacket = 4;
+
+struct Channel {
+    mbedtls_aes_context aes;
+    std::string aes_nonce = std::string("\x01\x00\x00\x00\x12\x34\x56\x78\x00\x00\x00\x00\x00\x00\x00\x00", 16);
+    uint32_t local_sequence = 0;
+
+    Channel() {
+        const unsigned char key[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+        mbedtls_aes_init(&aes);
+        mbedtls_aes_setkey_enc(&aes, key, 128);
+    }
+    ~Channel() { mbedtls_aes_free(&aes); }
+};
+
+template <typename Body>
+static void Measure(const char* name, Body body) {
+    // Warm up the caches, the key schedule and the pool
+    for (int i = 0; i < kPackets / 10; i++) {
+        body(i);
+    }
+    unsigned long allocations = host_allocations;
+    auto start = Clock::now();
+    for (int i = 0; i < kPackets; i++) {
+        body(i);
+    }
+    double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / kPackets;
+    printf("%-22s %8.3f us/packet %8.2f allocations/packet\n", name, us, (double)(host_allocations - allocations) / kPackets);
+}
+
+// Stands in for Udp::Send(), every call is one sendto()
+struct Socket {
+    unsigned long sends = 0;
+    unsigned long bytes = 0;
+
+    int Send(const std::string& datagram) {
+        sends++;
+        bytes += kUdpIpHeaderSize + datagram.size();
+        return datagram.size();
+    }
+};
+
+// Runs body, which sends frames_per_call frames, until kPackets frames went out
+template <typename Body>
+static void MeasureSend(const char* name, size_t frames_per_call, Socket& socket, Body body) {
+    for (int i = 0; i < kPackets / 10; i += frames_per_call) {
+        body();
+    }
+    unsigned long allocations = host_allocations;
+    unsigned long sends = socket.sends, bytes = socket.bytes;
+    auto start = Clock::now();
+    for (int i = 0; i < kPackets; i += frames_per_call) {
+        body();
+    }
+    double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / kPackets;
+    printf("%-22s %8.3f us/frame %8.2f allocations/frame %6.3f sendto/frame %7.1f bytes/frame\n", name, us,
+        (double)(host_allocations - allocations) / kPackets, (double)(socket.sends - sends) / kPackets,
+        (double)(socket.bytes - bytes) / kPackets);
+}
+
+// Encrypted datagrams as the server sends them, one frame each
+static std::vector<std::string> Datagrams(Channel& channel) {
+    std::vector<std::string> datagrams(64);
+    std::vector<uint8_t> payload(kPayloadSize, 0x5A);
+    for (size_t i = 0; i < datagrams.size(); i++) {
+        uint8_t nonce[16];
+        memcpy(nonce, channel.aes_nonce.data(), sizeof(nonce));
+        uint16_t size = htons(kPayloadSize);
+        uint32_t sequence = htonl(i + 1);
+        memcpy(&nonce[2], &size, sizeof(size));
+        memcpy(&nonce[12], &sequence, sizeof(sequence));
+        datagrams[i].assign((const char*)nonce, sizeof(nonce));
+        datagrams[i].resize(sizeof(nonce) + kPayloadSize);
+        size_t nc_off = 0;
+        uint8_t stream_block[16] = {0};
+        mbedtls_aes_crypt_ctr(&channel.aes, kPayloadSize, &nc_off, nonce, stream_block, payload.data(),
+            (uint8_t*)&datagrams[i][16]);
+    }
+    return datagrams;
+}
+
+int main() {
+    Channel channel;
+    std::vector<uint8_t> payload(kPayloadSize, 0x5A);
+    std::vector<uint8_t> out(kPayloadSize);
+    volatile uint8_t sink = 0;
+
+    Measure("AES only", [&](int) {
+        uint8_t nonce[16] = {0};
+        size_t nc_off = 0;
+        uint8_t stream_block[16] = {0};
+        mbedtls_aes_crypt_ctr(&channel.aes, kPayloadSize, &nc_off, nonce, stream_block, payload.data(), out.data());
+        sink = sink + out[0];
+    });
+
+    // Send: a nonce string and a datagram string per packet
+    Measure("send, before", [&](int) {
+        std::string nonce(channel.aes_nonce);
+        *(uint16_t*)&nonce[2] = htons(payload.size());
+        *(uint32_t*)&nonce[8] = htonl(0);
+        *(uint32_t*)&nonce[12] = htonl(++channel.local_sequence);
+        std::string encrypted;
+        encrypted.resize(channel.aes_nonce.size() + payload.size());
+        memcpy(encrypted.data(), nonce.data(), nonce.size());
+        size_t nc_off = 0;
+        uint8_t stream_block[16] = {0};
+        mbedtls_aes_crypt_ctr(&channel.aes, payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
+            payload.data(), (uint8_t*)&encrypted[nonce.size()]);
+        sink = sink + encrypted[20];
+    });
+
+    // Send: the header is the nonce, written into the reused send buffer
+    std::string send_buffer;
+    Measure("send, after", [&](int) {
+        send_buffer.clear();
+        send_buffer.resize(channel.aes_nonce.size() + payload.size());
+        auto header = (uint8_t*)&send_buffer[0];
+        uint8_t nonce[16];
+        memcpy(nonce, channel.aes_nonce.data(), sizeof(nonce));
+        uint16_t payload_size = htons(payload.size());
+        uint32_t timestamp = htonl(0);
+        uint32_t sequence = htonl(++channel.local_sequence);
+        memcpy(&nonce[2], &payload_size, sizeof(payload_size));
+        memcpy(&nonce[8], &timestamp, sizeof(timestamp));
+        memcpy(&nonce[12], &sequence, sizeof(sequence));
+        memcpy(header, nonce, sizeof(nonce));
+        size_t nc_off = 0;
+        uint8_t stream_block[16] = {0};
+        mbedtls_aes_crypt_ctr(&channel.aes, payload.size(), &nc_off, nonce, stream_block, payload.data(),
+            header + channel.aes_nonce.size());
+        sink = sink + send_buffer[20];
+    });
+
+    auto datagrams = Datagrams(channel);
+
+    // Receive: strict sequence check, a new packet per datagram, the counter advanced in the receive buffer
+    {
+        std::unique_ptr<AudioStreamPacket> queue[kQueueDepth];
+        uint32_t remote_sequence = 0;
+        std::string data;
+        Measure("receive, before", [&](int i) {
+            data = datagrams[i % datagrams.size()];
+            uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
+            if (sequence < remote_sequence) {
+                remote_sequence = 0;
+            }
+            size_t decrypted_size = data.size() - channel.aes_nonce.size();
+            size_t nc_off = 0;
+            uint8_t stream_block[16] = {0};
+            auto nonce = (uint8_t*)data.data();
+            auto encrypted = (uint8_t*)data.data() + channel.aes_nonce.size();
+            auto packet = std::make_unique<AudioStreamPacket>();
+            packet->payload.resize(decrypted_size);
+            mbedtls_aes_crypt_ctr(&channel.aes, decrypted_size, &nc_off, nonce, stream_block, encrypted,
+                packet->payload.data());
+            remote_sequence = sequence;
+            queue[i % kQueueDepth] = std::move(packet);
+        });
+    }
+
+    // Receive: replay window, a stack copy of the counter, decrypted straight into a pooled packet
+    {
+        auto& pool = AudioPacketPool::GetInstance();
+        pool.Initialize(kQueueDepth + 2);
+        std::unique_ptr<AudioStreamPacket> queue[kQueueDepth];
+        ReplayWindow window;
+        std::string data;
+        Measure("receive, after", [&](int i) {
+            data = datagrams[i % datagrams.size()];
+            uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
+            if (i % datagrams.size() == 0) {
+                window.Reset();
+            }
+            if (!window.Accept(sequence)) {
+                return;
+            }
+            uint8_t nonce[16];
+            memcpy(nonce, data.data(), sizeof(nonce));
+            size_t decrypted_size = data.size() - channel.aes_nonce.size();
+            size_t nc_off = 0;
+            uint8_t stream_block[16] = {0};
+            auto encrypted = (const uint8_t*)data.data() + channel.aes_nonce.size();
+            auto packet = pool.Acquire();
+            packet->payload.resize(decrypted_size);
+            mbedtls_aes_crypt_ctr(&channel.aes, decrypted_size, &nc_off, nonce, stream_block, encrypted,
+                packet->payload.data());
+            auto& slot = queue[i % kQueueDepth];
+            pool.Release(std::move(slot));
+            slot = std::move(packet);
+        });
+        if (queue[0]->payload != payload) {
+            fprintf(stderr, "Decryption mismatch\n");
+            return 1;
+        }
+    }
+
+    // Batching: the send queue holds pooled encoded frames, the application drains them into a batch
+    printf("\n");
+    auto& pool = AudioPacketPool::GetInstance();
+    auto encoded = [&]() {
+        auto packet = pool.Acquire();
+        packet->payload.assign(payload.begin(), payload.end());
+        return packet;
+    };
+    Socket socket;
+
+    // Before: a frame per datagram, a nonce string and a datagram string each
+    MeasureSend("unbatched, before", 1, socket, [&]() {
+        auto packet = encoded();
+        std::string nonce(channel.aes_nonce);
+        *(uint16_t*)&nonce[2] = htons(packet->payload.size());
+        *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
+        *(uint32_t*)&nonce[12] = htonl(++channel.local_sequence);
+        std::string encrypted;
+        encrypted.resize(channel.aes_nonce.size() + packet->payload.size());
+        memcpy(encrypted.data(), nonce.data(), nonce.size());
+        size_t nc_off = 0;
+        uint8_t stream_block[16] = {0};
+        mbedtls_aes_crypt_ctr(&channel.aes, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
+            packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]);
+        socket.Send(encrypted);
+        pool.Release(std::move(packet));
+    });
+
+    // After: Application::SendQueuedAudio and MqttProtocol::SendAudioFrames, reused batch and send buffer
+    std::vector<std::unique_ptr<AudioStreamPacket>> batch;
+    batch.reserve(kMaxFramesPerPacket);
+    send_buffer.clear();
+    for (size_t frames_per_packet = 1; frames_per_packet <= kMaxFramesPerPacket; frames_per_packet++) {
+        char name[32];
+        snprintf(name, sizeof(name), "frames_per_packet %zu", frames_per_packet);
+        MeasureSend(name, frames_per_packet, socket, [&]() {
+            batch.clear();
+            while (batch.size() < frames_per_packet) {
+                batch.push_back(encoded());
+            }
+            send_buffer.clear();
+            for (auto& packet : batch) {
+                size_t offset = send_buffer.size();
+                send_buffer.resize(offset + channel.aes_nonce.size() + packet->payload.size());
+                auto header = (uint8_t*)&send_buffer[offset];
+                uint8_t nonce[16];
+                memcpy(nonce, channel.aes_nonce.data(), sizeof(nonce));
+                uint16_t payload_size = htons(packet->payload.size());
+                uint32_t timestamp = htonl(packet->timestamp);
+                uint32_t sequence = htonl(++channel.local_sequence);
+                memcpy(&nonce[2], &payload_size, sizeof(payload_size));
+                memcpy(&nonce[8], &timestamp, sizeof(timestamp));
+                memcpy(&nonce[12], &sequence, sizeof(sequence));
+                memcpy(header, nonce, sizeof(nonce));
+                size_t nc_off = 0;
+                uint8_t stream_block[16] = {0};
+                mbedtls_aes_crypt_ctr(&channel.aes, packet->payload.size(), &nc_off, nonce, stream_block,
+                    packet->payload.data(), header + channel.aes_nonce.size());
+            }
+            socket.Send(send_buffer);
+            for (auto& packet : batch) {
+                pool.Release(std::move(packet));
+            }
+        });
+    }
+    return 0;
+}
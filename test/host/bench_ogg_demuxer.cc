@@ -0,0 +1,158 @@
+#include "ogg_demuxer.h"
+#include "protocol.h"
+#include "alloc_counter.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Parse time and peak heap per sound over every asset under main/assets:
+ * - copy: the PlaySound loop it replaced, which scanned for "OggS" and queued a heap copy of every
+ *   packet before playback started, so the whole sound was in RAM at once
+ * - demuxer: OggDemuxer handing out views into the mapped data, one packet at a time
+ * Only parsing and packet memory are measured, not decoding.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int kRounds = 20;
+
+static size_t CopyPackets(const std::string& ogg) {
+    auto buf = reinterpret_cast<const uint8_t*>(ogg.data());
+    size_t size = ogg.size();
+    size_t offset = 0;
+    auto find_page = [&](size_t start) -> size_t {
+        for (size_t i = start; i + 4 <= size; ++i) {
+            if (buf[i] == 'O' && buf[i + 1] == 'g' && buf[i + 2] == 'g' && buf[i + 3] == 'S') return i;
+        }
+        return static_cast<size_t>(-1);
+    };
+
+    std::vector<std::unique_ptr<AudioStreamPacket>> queue;
+    bool seen_head = false;
+    bool seen_tags = false;
+    int sample_rate = 16000;
+    while (true) {
+        size_t pos = find_page(offset);
+        if (pos == static_cast<size_t>(-1)) break;
+        offset = pos;
+        if (offset + 27 > size) break;
+        const uint8_t* page = buf + offset;
+        uint8_t page_segments = page[26];
+        size_t seg_table_off = offset + 27;
+        if (seg_table_off + page_segments > size) break;
+        size_t body_size = 0;
+        for (size_t i = 0; i < page_segments; ++i) body_size += page[27 + i];
+        size_t body_off = seg_table_off + page_segments;
+        if (body_off + body_size > size) break;
+
+        size_t cur = body_off;
+        size_t seg_idx = 0;
+        while (seg_idx < page_segments) {
+            size_t pkt_len = 0;
+            size_t pkt_start = cur;
+            bool continued = false;
+            do {
+                uint8_t l = page[27 + seg_idx++];
+                pkt_len += l;
+                cur += l;
+                continued = (l == 255);
+            } while (continued && seg_idx < page_segments);
+            if (pkt_len == 0) continue;
+            const uint8_t* pkt_ptr = buf + pkt_start;
+            if (!seen_head) {
+                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
+                    seen_head = true;
+                    sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) | (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
+                }
+                continue;
+            }
+            if (!seen_tags) {
+                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
+                    seen_tags = true;
+                }
+                continue;
+            }
+            auto packet = std::make_unique<AudioStreamPacket>();
+            packet->sample_rate = sample_rate;
+            packet->frame_duration = 60;
+            packet->payload.resize(pkt_len);
+            std::memcpy(packet->payload.data(), pkt_ptr, pkt_len);
+            queue.push_back(std::move(packet));
+        }
+        offset = cur;
+    }
+    return queue.size();
+}
+
+static size_t DemuxPackets(const std::string& ogg) {
+    OggDemuxer demuxer;
+    demuxer.Open(ogg);
+    size_t packets = 0;
+    size_t bytes = 0;
+    std::string_view packet;
+    while (demuxer.Next(packet)) {
+        packets++;
+        bytes += packet.size();
+    }
+    demuxer.Close();
+    return bytes > 0 ? packets : 0;
+}
+
+struct Totals {
+    double total_us = 0;
+    double max_us = 0;
+    long max_peak_bytes = 0;
+    double total_peak_bytes = 0;
+    size_t packets = 0;
+};
+
+template <typename Parse>
+static void Measure(Totals& totals, const std::string& ogg, Parse parse) {
+    HostResetPeakBytes();
+    long base = host_live_bytes;
+    totals.packets += parse(ogg);
+    long peak = host_peak_bytes - base;
+    totals.max_peak_bytes = std::max(totals.max_peak_bytes, peak);
+    totals.total_peak_bytes += peak;
+
+    auto start = Clock::now();
+    for (int i = 0; i < kRounds; i++) {
+        parse(ogg);
+    }
+    double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / kRounds;
+    totals.total_us += us;
+    totals.max_us = std::max(totals.max_us, us);
+}
+
+int main() {
+    std::vector<std::string> sounds;
+    size_t total_bytes = 0;
+    for (auto& entry : std::filesystem::recursive_directory_iterator(ASSETS_DIR)) {
+        if (entry.path().extension() == ".ogg") {
+            std::ifstream file(entry.path(), std::ios::binary);
+            sounds.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            total_bytes += sounds.back().size();
+        }
+    }
+    printf("%zu sounds, %zu bytes\n", sounds.size(), total_bytes);
+    printf("%-9s %10s %13s %13s %14s %14s\n", "parser", "packets", "mean us/snd", "max us/snd", "mean peak B", "max peak B");
+
+    Totals copy, demux;
+    for (auto& sound : sounds) {
+        Measure(copy, sound, CopyPackets);
+        Measure(demux, sound, DemuxPackets);
+    }
+    for (auto [name, totals] : {std::pair{"copy", &copy}, std::pair{"demuxer", &demux}}) {
+        printf("%-9s %10zu %13.2f %13.2f %14.0f %14ld\n", name, totals->packets, totals->total_us / sounds.size(),
+            totals->max_us, totals->total_peak_bytes / sounds.size(), totals->max_peak_bytes);
+    }
+    return 0;
+}
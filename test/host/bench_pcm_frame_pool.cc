@@ -0,0 +1,56 @@
+#include "pcm_frame_pool.h"
+#include "alloc_counter.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+/*
+ * Capture -> process -> encode queue hand-off of one 60ms stereo frame, with the PCM buffers allocated
+ * per frame as before the pool, and taken from PcmFramePool. A few frames stay queued, like the encode queue.
+ * The per frame buffers are heap allocated vectors, like the AudioTask objects that were queued by pointer before.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t kCaptureSamples = 960 * 2;
+static constexpr size_t kQueueDepth = 4;
+static constexpr int kFrames = 200000;
+
+template <typename Buffer, typename NewBuffer>
+static void Run(const char* name, NewBuffer new_buffer) {
+    // The oldest queued frame is dropped when a new one comes in
+    Buffer queue[kQueueDepth];
+    unsigned long allocations = host_allocations;
+    auto start = Clock::now();
+    for (int i = 0; i < kFrames; i++) {
+        Buffer capture = new_buffer();
+        capture->resize(kCaptureSamples);
+        memset(capture->data(), i, kCaptureSamples * sizeof(int16_t));
+
+        // Keep the left channel, like the processor output
+        Buffer processed = new_buffer();
+        processed->resize(kCaptureSamples / 2);
+        for (size_t j = 0; j < processed->size(); j++) {
+            (*processed)[j] = (*capture)[2 * j];
+        }
+        queue[i % kQueueDepth] = std::move(processed);
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    printf("%-12s %12.0f frames/s %8.2f allocations/frame\n", name, kFrames / seconds,
+        (double)(host_allocations - allocations) / kFrames);
+}
+
+int main() {
+    using VectorPtr = std::unique_ptr<std::vector<int16_t>>;
+    Run<VectorPtr>("per frame", []() { return std::make_unique<std::vector<int16_t>>(); });
+
+    auto& pool = PcmFramePool::GetInstance();
+    pool.Initialize(kQueueDepth + 4, kCaptureSamples);
+    Run<PcmFrame>("pooled", [&pool]() { return pool.Acquire(); });
+    auto stats = pool.GetStats();
+    printf("pool: %u frames, peak %u in use, %u heap allocations after Initialize\n", stats.frames,
+        stats.peak_in_use, stats.heap_allocations);
+    return 0;
+}
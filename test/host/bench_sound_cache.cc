@@ -0,0 +1,77 @@
+#include "sound_cache.h"
+#include "ogg_demuxer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+/*
+ * Host side of the PlaySound -> first sample path:
+ * - Lookup() cost for hits and misses as the cache fills, the entries are a linear LRU list
+ * - hit: Lookup() and copying the first 60ms frame of PCM out, what a cached sound does before playback
+ * - miss: Lookup() and demuxing the first Opus packet, after which the sound still needs a decode
+ * Opus decoding is not built on the host, measure the full miss latency on the device.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int kIterations = 200000;
+static constexpr size_t kFrameSamples = 960;
+
+template <typename Body>
+static double NsPerCall(Body body) {
+    auto start = Clock::now();
+    for (int i = 0; i < kIterations; i++) {
+        body(i);
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / kIterations;
+}
+
+int main() {
+    std::vector<std::string> sounds;
+    for (auto& entry : std::filesystem::recursive_directory_iterator(ASSETS_DIR)) {
+        if (entry.path().extension() == ".ogg") {
+            std::ifstream file(entry.path(), std::ios::binary);
+            sounds.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+    }
+
+    // One second of 16kHz PCM per entry
+    std::vector<int16_t> pcm(16000, 1);
+    int16_t frame[kFrameSamples];
+    volatile int16_t sink = 0;
+
+    printf("%-8s %12s %12s %16s %18s\n", "entries", "hit ns", "miss ns", "hit+frame ns", "miss+demux ns");
+    for (size_t entries : {1, 4, 16, 64}) {
+        SoundCache cache;
+        cache.Initialize(entries * pcm.size() * sizeof(int16_t) * 4);
+        for (size_t i = 0; i < entries; i++) {
+            cache.Insert(sounds[i], pcm.data(), pcm.size());
+        }
+        const std::string& missing = sounds[entries];
+
+        // Cycling in insertion order always looks up the least recently used entry, the longest list walk
+        double hit_ns = NsPerCall([&](int i) { sink = sink + cache.Lookup(sounds[i % entries])->samples; });
+        double miss_ns = NsPerCall([&](int) { sink = sink + (cache.Lookup(missing) == nullptr); });
+        double hit_frame_ns = NsPerCall([&](int i) {
+            auto entry = cache.Lookup(sounds[i % entries]);
+            memcpy(frame, entry->pcm, sizeof(frame));
+            sink = sink + frame[0];
+        });
+        double miss_demux_ns = NsPerCall([&](int) {
+            if (cache.Lookup(missing) == nullptr) {
+                OggDemuxer demuxer;
+                demuxer.Open(missing);
+                std::string_view packet;
+                sink = sink + (demuxer.Next(packet) ? packet.size() : 0);
+            }
+        });
+        printf("%-8zu %12.1f %12.1f %16.1f %18.1f\n", entries, hit_ns, miss_ns, hit_frame_ns, miss_demux_ns);
+    }
+    return 0;
+}
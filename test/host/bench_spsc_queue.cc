@@ -0,0 +1,213 @@
+#include "spsc_queue.h"
+#include "host_event.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Audio queue hand-off: the per-queue SpscQueue with transition-only wakeups against the design it replaced,
+ * where every queue sat behind one mutex and one condition variable that was notify_all()'d on every change.
+ *
+ * Two pipelines run at once (like encode and playback), one producer and one consumer thread each.
+ * - uncontended: push + pop on one thread, the bare queues and then with the wakeup signalling
+ * - burst: the producers push as fast as they can, throughput and wakeups per frame
+ * - paced: one frame per period, hand-off latency from push to pop
+ * A wakeup is every return from a wait, including the ones where the condition still does not hold.
+ */
+
+using Clock = std::chrono::steady_clock;
+using namespace std::chrono_literals;
+
+static constexpr size_t kCapacity = 16;
+
+struct Frame {
+    Clock::time_point pushed;
+};
+using FramePtr = std::unique_ptr<Frame>;
+
+struct Counters {
+    uint64_t wakeups = 0;
+    std::vector<double> latencies_us;
+};
+
+class SharedLockQueues {
+public:
+    void Push(int queue, FramePtr frame, Counters& counters) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (queues_[queue].size() >= kCapacity) {
+            cv_.wait(lock);
+            counters.wakeups++;
+        }
+        queues_[queue].push_back(std::move(frame));
+        cv_.notify_all();
+    }
+
+    FramePtr Pop(int queue, Counters& counters) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (queues_[queue].empty()) {
+            cv_.wait(lock);
+            counters.wakeups++;
+        }
+        auto frame = std::move(queues_[queue].front());
+        queues_[queue].pop_front();
+        cv_.notify_all();
+        return frame;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<FramePtr> queues_[2];
+};
+
+class SpscQueues {
+public:
+    void Push(int queue, FramePtr frame, Counters& counters) {
+        auto& pipe = pipes_[queue];
+        bool was_empty;
+        while (!pipe.queue.Push(std::move(frame), &was_empty)) {
+            pipe.not_full.Wait(1s);
+            counters.wakeups++;
+        }
+        if (was_empty) {
+            pipe.not_empty.Set();
+        }
+    }
+
+    FramePtr Pop(int queue, Counters& counters) {
+        auto& pipe = pipes_[queue];
+        FramePtr frame;
+        for (;;) {
+            bool was_full;
+            bool popped = pipe.queue.Pop(frame, &was_full);
+            if (was_full) {
+                pipe.not_full.Set();
+            }
+            if (popped) {
+                return frame;
+            }
+            pipe.not_empty.Wait(1s);
+            counters.wakeups++;
+        }
+    }
+
+private:
+    struct Pipe {
+        SpscQueue<FramePtr, kCapacity> queue;
+        HostEvent not_empty;
+        HostEvent not_full;
+    };
+    Pipe pipes_[2];
+};
+
+struct Result {
+    double frames_per_second;
+    double wakeups_per_frame;
+    double p50_us;
+    double p99_us;
+};
+
+template <typename Queues>
+static Result Run(int frames, std::chrono::microseconds period) {
+    Queues queues;
+    Counters counters[4];
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int q = 0; q < 2; q++) {
+        threads.emplace_back([&, q]() {
+            auto next = Clock::now();
+            for (int i = 0; i < frames; i++) {
+                if (period.count() > 0) {
+                    next += period;
+                    std::this_thread::sleep_until(next);
+                }
+                auto frame = std::make_unique<Frame>();
+                frame->pushed = Clock::now();
+                queues.Push(q, std::move(frame), counters[q]);
+            }
+        });
+        threads.emplace_back([&, q]() {
+            auto& stats = counters[2 + q];
+            stats.latencies_us.reserve(frames);
+            for (int i = 0; i < frames; i++) {
+                auto frame = queues.Pop(q, stats);
+                stats.latencies_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - frame->pushed).count());
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> latencies;
+    uint64_t wakeups = 0;
+    for (auto& c : counters) {
+        wakeups += c.wakeups;
+        latencies.insert(latencies.end(), c.latencies_us.begin(), c.latencies_us.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    int total = 2 * frames;
+    return Result{total / seconds, (double)wakeups / total, latencies[latencies.size() / 2],
+        latencies[latencies.size() * 99 / 100]};
+}
+
+template <typename Queues>
+static double UncontendedNs(int frames) {
+    Queues queues;
+    Counters counters;
+    auto start = Clock::now();
+    for (int i = 0; i < frames; i++) {
+        queues.Push(0, FramePtr(), counters);
+        queues.Pop(0, counters);
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / frames;
+}
+
+static double BareNs(int frames) {
+    std::mutex mutex;
+    std::deque<FramePtr> deque;
+    auto start = Clock::now();
+    for (int i = 0; i < frames; i++) {
+        std::lock_guard<std::mutex> lock(mutex);
+        deque.push_back(FramePtr());
+        deque.pop_front();
+    }
+    double locked = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / frames;
+
+    SpscQueue<FramePtr, kCapacity> queue;
+    FramePtr frame;
+    start = Clock::now();
+    for (int i = 0; i < frames; i++) {
+        queue.Push(FramePtr());
+        queue.Pop(frame);
+    }
+    double spsc = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / frames;
+    printf("uncontended push + pop, bare:      mutex+deque %6.1f ns, spsc %6.1f ns\n", locked, spsc);
+    return spsc;
+}
+
+int main() {
+    BareNs(1000000);
+    // Every push is an empty -> non-empty transition here, so the spsc side pays one event Set() per frame
+    printf("uncontended push + pop, signalled: mutex+cv    %6.1f ns, spsc %6.1f ns\n\n",
+        UncontendedNs<SharedLockQueues>(1000000), UncontendedNs<SpscQueues>(1000000));
+    printf("%-10s %-12s %14s %16s %10s %10s\n", "design", "mode", "frames/s", "wakeups/frame", "p50 us", "p99 us");
+
+    auto print = [](const char* design, const char* mode, const Result& r) {
+        printf("%-10s %-12s %14.0f %16.3f %10.1f %10.1f\n", design, mode, r.frames_per_second, r.wakeups_per_frame,
+            r.p50_us, r.p99_us);
+    };
+    print("mutex+cv", "burst", Run<SharedLockQueues>(200000, 0us));
+    print("spsc", "burst", Run<SpscQueues>(200000, 0us));
+    print("mutex+cv", "paced 200us", Run<SharedLockQueues>(5000, 200us));
+    print("spsc", "paced 200us", Run<SpscQueues>(5000, 200us));
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef HOST_EVENT_H
+#define HOST_EVENT_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// One FreeRTOS event group bit, waited on with xClearOnExit: a Set() before the Wait() is not lost
+class HostEvent {
+public:
+    void Set() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            set_ = true;
+        }
+        cv_.notify_one();
+    }
+
+    // Returns false on timeout
+    bool Wait(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!cv_.wait_for(lock, timeout, [this]() { return set_; })) {
+            return false;
+        }
+        set_ = false;
+        return true;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool set_ = false;
+};
+
+#endif // HOST_EVENT_H
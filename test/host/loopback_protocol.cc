@@ -0,0 +1,203 @@
+#include "loopback_protocol.h"
+#include "audio_packet_pool.h"
+#include "binary_frame.h"
+
+#include <esp_log.h>
+#include <arpa/inet.h>
+
+#define TAG "Loopback"
+
+// Long enough for a hello round trip on a loaded machine
+#define LOOPBACK_HELLO_TIMEOUT_MS 1000
+
+void LoopbackLink::Send(LoopbackMessage message) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        messages_.emplace_back(Clock::now() + latency_, std::move(message));
+    }
+    cv_.notify_all();
+}
+
+bool LoopbackLink::Receive(LoopbackMessage& message, std::chrono::milliseconds timeout) {
+    auto deadline = Clock::now() + timeout;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        auto now = Clock::now();
+        if (!messages_.empty() && messages_.front().first <= now) {
+            message = std::move(messages_.front().second);
+            messages_.pop_front();
+            return true;
+        }
+        if (now >= deadline) {
+            return false;
+        }
+        cv_.wait_until(lock, messages_.empty() ? deadline : std::min(deadline, messages_.front().first));
+    }
+}
+
+std::string LoopbackJsonValue(const std::string& json, const char* key) {
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t start = json.find(pattern);
+    if (start == std::string::npos) {
+        return "";
+    }
+    start += pattern.size();
+    while (start < json.size() && json[start] == ' ') {
+        start++;
+    }
+    if (start < json.size() && json[start] == '"') {
+        size_t end = json.find('"', start + 1);
+        return end == std::string::npos ? "" : json.substr(start + 1, end - start - 1);
+    }
+    size_t end = json.find_first_of(",}", start);
+    return json.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+LoopbackProtocol::LoopbackProtocol(LoopbackLink& uplink, LoopbackLink& downlink)
+    : uplink_(uplink), downlink_(downlink) {
+}
+
+LoopbackProtocol::~LoopbackProtocol() {
+    stopped_ = true;
+    if (receive_thread_.joinable()) {
+        receive_thread_.join();
+    }
+}
+
+bool LoopbackProtocol::Start() {
+    receive_thread_ = std::thread([this]() {
+        ReceiveTask();
+    });
+    return true;
+}
+
+bool LoopbackProtocol::OpenAudioChannel() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        hello_received_ = false;
+    }
+    error_occurred_ = false;
+    session_id_.clear();
+
+    std::string message = "{\"type\":\"hello\",\"version\":2,\"transport\":\"loopback\",\"audio_params\":{"
+        "\"format\":\"opus\",\"sample_rate\":16000,\"channels\":1,\"frame_duration\":" + std::to_string(frame_duration_) + "}}";
+    if (!SendText(message)) {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!hello_cv_.wait_for(lock, std::chrono::milliseconds(LOOPBACK_HELLO_TIMEOUT_MS), [this]() { return hello_received_; })) {
+        lock.unlock();
+        ESP_LOGE(TAG, "Failed to receive server hello");
+        SetError("Server timeout");
+        return false;
+    }
+    lock.unlock();
+
+    channel_opened_ = true;
+    if (on_audio_channel_opened_ != nullptr) {
+        on_audio_channel_opened_();
+    }
+    return true;
+}
+
+void LoopbackProtocol::CloseAudioChannel() {
+    if (!channel_opened_.exchange(false)) {
+        return;
+    }
+    SendText("{\"session_id\":\"" + session_id_ + "\",\"type\":\"goodbye\"}");
+    if (on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+}
+
+bool LoopbackProtocol::IsAudioChannelOpened() const {
+    return channel_opened_ && !error_occurred_ && !IsTimeout();
+}
+
+void LoopbackProtocol::OnServerText(std::function<void(const std::string& text)> callback) {
+    on_server_text_ = callback;
+}
+
+bool LoopbackProtocol::SendText(const std::string& text) {
+    uplink_.Send({false, text});
+    return true;
+}
+
+bool LoopbackProtocol::SendAudioFrames(const std::unique_ptr<AudioStreamPacket>* packets, size_t count) {
+    if (!channel_opened_) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i += audio_frames_per_packet_) {
+        send_buffer_.clear();
+        for (size_t j = i; j < count && j < i + audio_frames_per_packet_; j++) {
+            auto& packet = *packets[j];
+            size_t offset = send_buffer_.size();
+            send_buffer_.resize(offset + sizeof(BinaryProtocol2) + packet.payload.size());
+            auto bp2 = (BinaryProtocol2*)&send_buffer_[offset];
+            bp2->version = htons(2);
+            bp2->type = 0;
+            bp2->reserved = 0;
+            bp2->timestamp = htonl(packet.timestamp);
+            bp2->payload_size = htonl(packet.payload.size());
+            memcpy(bp2->payload, packet.payload.data(), packet.payload.size());
+        }
+        uplink_.Send({true, send_buffer_});
+    }
+    return true;
+}
+
+void LoopbackProtocol::ParseServerHello(const std::string& text) {
+    session_id_ = LoopbackJsonValue(text, "session_id");
+    auto sample_rate = LoopbackJsonValue(text, "sample_rate");
+    if (!sample_rate.empty()) {
+        server_sample_rate_ = std::stoi(sample_rate);
+    }
+    auto frame_duration = LoopbackJsonValue(text, "frame_duration");
+    if (!frame_duration.empty()) {
+        server_frame_duration_ = std::stoi(frame_duration);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        hello_received_ = true;
+    }
+    hello_cv_.notify_all();
+}
+
+void LoopbackProtocol::ReceiveTask() {
+    auto& pool = AudioPacketPool::GetInstance();
+    while (!stopped_) {
+        LoopbackMessage message;
+        if (!downlink_.Receive(message, std::chrono::milliseconds(50))) {
+            continue;
+        }
+        last_incoming_time_ = std::chrono::steady_clock::now();
+
+        if (message.binary) {
+            if (!channel_opened_ || on_incoming_audio_ == nullptr) {
+                continue;
+            }
+            auto data = (const uint8_t*)message.data.data();
+            ParseBinaryFrames(2, data, message.data.size(), [this, &pool](const BinaryFrame& frame) {
+                auto packet = pool.Acquire();
+                packet->sample_rate = server_sample_rate_;
+                packet->frame_duration = server_frame_duration_;
+                packet->timestamp = frame.timestamp;
+                packet->payload.assign(frame.payload, frame.payload + frame.payload_size);
+                on_incoming_audio_(std::move(packet));
+            });
+            continue;
+        }
+
+        auto type = LoopbackJsonValue(message.data, "type");
+        if (type == "hello") {
+            ParseServerHello(message.data);
+        } else if (type == "goodbye") {
+            if (channel_opened_.exchange(false) && on_audio_channel_closed_ != nullptr) {
+                on_audio_channel_closed_();
+            }
+        } else if (on_server_text_ != nullptr) {
+            on_server_text_(message.data);
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef LOOPBACK_PROTOCOL_H
+#define LOOPBACK_PROTOCOL_H
+
+#include "protocol.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct LoopbackMessage {
+    bool binary = false;
+    std::string data;
+};
+
+// One direction of a connection inside the process, messages arrive in order `latency` after they were sent
+class LoopbackLink {
+public:
+    explicit LoopbackLink(std::chrono::milliseconds latency) : latency_(latency) {}
+
+    void Send(LoopbackMessage message);
+    // False when nothing arrived in time
+    bool Receive(LoopbackMessage& message, std::chrono::milliseconds timeout);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    const std::chrono::milliseconds latency_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::pair<Clock::time_point, LoopbackMessage>> messages_;
+};
+
+// The raw value of a top level or nested "key" in a flat JSON message, without the quotes of a string, empty if
+// there is none. Enough for the few fields the loopback ends read, there is no cJSON on the host
+std::string LoopbackJsonValue(const std::string& json, const char* key);
+
+/*
+ * Protocol over a pair of loopback links, framed like the WebSocket protocol version 2: text messages are the
+ * JSON the device and the server exchange, audio goes both ways as BinaryProtocol2 frames, one message per
+ * audio_frames_per_packet() frames. The hello and the goodbye are handled here, every other text message
+ * from the server goes to OnServerText() as it is, in place of the cJSON tree OnIncomingJson() would get.
+ */
+class LoopbackProtocol : public Protocol {
+public:
+    LoopbackProtocol(LoopbackLink& uplink, LoopbackLink& downlink);
+    ~LoopbackProtocol();
+
+    bool Start() override;
+    bool OpenAudioChannel() override;
+    void CloseAudioChannel() override;
+    bool IsAudioChannelOpened() const override;
+
+    void OnServerText(std::function<void(const std::string& text)> callback);
+
+private:
+    LoopbackLink& uplink_;
+    LoopbackLink& downlink_;
+    std::function<void(const std::string& text)> on_server_text_;
+
+    std::mutex mutex_;
+    std::condition_variable hello_cv_;
+    bool hello_received_ = false;
+    std::atomic<bool> channel_opened_ = false;
+    std::atomic<bool> stopped_ = false;
+    std::thread receive_thread_;
+    std::string send_buffer_;
+
+    bool SendText(const std::string& text) override;
+    bool SendAudioFrames(const std::unique_ptr<AudioStreamPacket>* packets, size_t count) override;
+    void ReceiveTask();
+    void ParseServerHello(const std::string& text);
+};
+
+#endif // LOOPBACK_PROTOCOL_H
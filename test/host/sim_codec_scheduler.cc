@@ -0,0 +1,410 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Runs the audio tasks of a listening / speaking device on a simulated dual core FreeRTOS scheduler and
+ * compares the single OpusCodecTask with the split encode / decode tasks, with the fixed start priorities
+ * and with the swap of AudioService::UpdateCodecPriorities().
+ *
+ *   sim_codec_scheduler [--frame 20|60] [--seconds 60]
+ *
+ * Scheduler: preemptive fixed priorities per core in 100 us steps. Tasks of equal priority take turns at
+ * each 1 ms tick, an unpinned task runs on whichever core is free. Blocking is modelled as having no work.
+ *
+ * Tasks, with the priorities and cores AudioService and the AFE use:
+ * - audio_input (8, core 1): reads a frame from the codec and feeds the AFE, every frame duration
+ * - afe (1, core 1): the AFE pipeline, AEC and NS in realtime mode, VAD only otherwise
+ * - audio_communication (3, any): fetches the processed frame into the encode queue (2 frames, drop newest)
+ * - opus_codec (2, any): one decode then one encode per loop, or
+ *   opus_encode (core 0) and opus_decode (core 1) at 2 and 4, swapped while listening or when the encode
+ *   queue is full
+ * - main (3, core 0): the application loop, sends and receives every audio packet and handles the JSON and
+ *   display updates at the start of each sentence
+ * - wifi (23, core 0): a short burst per sent or received packet
+ * - ui (1, any, or 5 on core 0 for the emote boards): a display refresh every 33 ms
+ * Downlink sentences arrive twice as fast as real time into the jitter buffer, the decoder keeps a
+ * playback queue of two frames ahead of the speaker.
+ *
+ * The CPU costs are assumptions for an ESP32-S3 at 240 MHz, not measurements. Take the "encode" and
+ * "decode" stages of the latency tracer and the task list of SystemInfo::PrintTaskCpuUsage() of a board to
+ * replace them.
+ *
+ * Reported per scenario and scheduling mode: the largest encode queue depth, frames dropped in front of
+ * the encoder, frames encoded past their deadline (the next capture), p95 of capture to encoded, the
+ * largest jitter buffer depth, speaker underruns while a sentence plays, and the CPU share of the codec.
+ */
+
+static constexpr int64_t kStepUs = 100;
+static constexpr int64_t kTickUs = 1000;
+static constexpr size_t kEncodeQueue = 2;
+static constexpr size_t kPlaybackQueue = 2;
+static constexpr int kDecodeQueueMs = 2400;
+static constexpr int kPriority = 2;
+static constexpr int kPriorityBoost = 4;
+
+enum Mode {
+    kSingleTask,
+    kSplitFixed,
+    kSplitSwap,
+};
+
+static const char* kModeNames[] = {"single", "split", "split+swap"};
+
+struct Scenario {
+    const char* name;
+    bool listening;
+    bool speaking;
+    bool aec;
+    double ui_load;
+    bool ui_pinned_high;
+};
+
+struct Costs {
+    int64_t input_us;
+    int64_t afe_us;
+    int64_t fetch_us;
+    int64_t encode_us;
+    int64_t decode_us;
+    int64_t wifi_us;
+    int64_t send_us;
+    int64_t receive_us;
+    int64_t sentence_us;
+};
+
+static Costs CostsFor(int frame_ms, bool aec) {
+    // 60 ms figures scaled to the frame duration, plus a fixed part per call
+    auto scale = [frame_ms](int64_t fixed_us, int64_t per_60ms_us) { return fixed_us + per_60ms_us * frame_ms / 60; };
+    return {
+        .input_us = scale(200, 400),
+        .afe_us = aec ? scale(500, 22000) : scale(300, 4000),
+        .fetch_us = scale(100, 200),
+        .encode_us = scale(400, 6000),
+        .decode_us = scale(200, 1800),
+        .wifi_us = 300,
+        .send_us = 500,
+        .receive_us = 400,
+        .sentence_us = 20000,
+    };
+}
+
+struct Job {
+    int64_t remaining_us;
+    std::function<void()> done;
+};
+
+struct Task {
+    std::string name;
+    int priority;
+    int core;  // -1 for any
+    std::deque<Job> jobs;
+    // Pulls the next job for tasks that loop over queues, returns false when the task would block
+    std::function<bool(Task&)> next;
+    bool has_job = false;
+    Job job;
+    int running_on = -1;
+    int64_t last_run_us = -1;
+    int64_t busy_us = 0;
+};
+
+struct Result {
+    size_t max_encode_queue = 0;
+    uint32_t encode_drops = 0;
+    uint32_t deadline_misses = 0;
+    std::vector<int64_t> uplink_us;
+    size_t max_decode_queue = 0;
+    uint32_t underruns = 0;
+    double codec_cpu_percent = 0;
+};
+
+static Result Simulate(const Scenario& scenario, Mode mode, int frame_ms, int seconds) {
+    const int64_t frame_us = frame_ms * 1000;
+    const int64_t end_us = (int64_t)seconds * 1000000;
+    const Costs costs = CostsFor(frame_ms, scenario.aec);
+    Result result;
+
+    struct EncodeItem {
+        int64_t capture_us;
+        int64_t deadline_us;
+    };
+    std::deque<EncodeItem> encode_queue;
+    std::deque<int> decode_queue;  // sentence of each packet
+    size_t playback_queue = 0;
+    size_t decoding = 0;
+    int64_t now = 0;
+
+    std::vector<Task> tasks;
+    tasks.reserve(9);
+    auto add = [&tasks](const char* name, int priority, int core) -> Task& {
+        tasks.push_back(Task{name, priority, core});
+        return tasks.back();
+    };
+    Task& input = add("audio_input", 8, 1);
+    Task& afe = add("afe", 1, 1);
+    Task& fetch = add("audio_communication", 3, -1);
+    Task& main_loop = add("main", 3, 0);
+    Task& wifi = add("wifi", 23, 0);
+    Task& ui = scenario.ui_pinned_high ? add("ui", 5, 0) : add("ui", 1, -1);
+
+    auto can_encode = [&]() { return !encode_queue.empty(); };
+    auto can_decode = [&]() { return !decode_queue.empty() && playback_queue + decoding < kPlaybackQueue; };
+    auto encode_job = [&]() -> Job {
+        EncodeItem item = encode_queue.front();
+        encode_queue.pop_front();
+        return {costs.encode_us, [&, item]() {
+            result.deadline_misses += now > item.deadline_us;
+            result.uplink_us.push_back(now - item.capture_us);
+            main_loop.jobs.push_back({costs.send_us, [&]() { wifi.jobs.push_back({costs.wifi_us, nullptr}); }});
+        }};
+    };
+    auto decode_job = [&]() -> Job {
+        decode_queue.pop_front();
+        decoding++;
+        return {costs.decode_us, [&]() {
+            decoding--;
+            playback_queue++;
+        }};
+    };
+
+    Task* encoder = nullptr;
+    Task* decoder = nullptr;
+    if (mode == kSingleTask) {
+        // One decode and one encode per loop, like OpusCodecTask
+        Task& codec = add("opus_codec", kPriority, -1);
+        auto decode_turn = std::make_shared<bool>(true);
+        codec.next = [&, decode_turn](Task& task) {
+            for (int attempt = 0; attempt < 2; attempt++) {
+                bool decode = *decode_turn;
+                *decode_turn = !decode;
+                if (decode && can_decode()) {
+                    task.job = decode_job();
+                    return true;
+                }
+                if (!decode && can_encode()) {
+                    task.job = encode_job();
+                    return true;
+                }
+            }
+            return false;
+        };
+        encoder = decoder = &codec;
+    } else {
+        Task& encode = add("opus_encode", kPriority, 0);
+        Task& decode = add("opus_decode", kPriorityBoost, 1);
+        encoder = &encode;
+        decoder = &decode;
+        // Uplink first while listening or when the encode queue is full, at the top of each loop of either task
+        auto update_priorities = [&, mode]() {
+            if (mode != kSplitSwap) {
+                return;
+            }
+            bool uplink_first = scenario.listening || encode_queue.size() >= kEncodeQueue;
+            encoder->priority = uplink_first ? kPriorityBoost : kPriority;
+            decoder->priority = uplink_first ? kPriority : kPriorityBoost;
+        };
+        encode.next = [&, update_priorities](Task& task) {
+            update_priorities();
+            if (!can_encode()) {
+                return false;
+            }
+            task.job = encode_job();
+            return true;
+        };
+        decode.next = [&, update_priorities](Task& task) {
+            update_priorities();
+            if (!can_decode()) {
+                return false;
+            }
+            task.job = decode_job();
+            return true;
+        };
+    }
+
+    // Downlink: a sentence of 4 s every 6 s, sent twice as fast as it plays
+    const int sentence_frames = 4000 / frame_ms;
+    const int64_t sentence_period_us = 6000000;
+    int sentence = -1;
+    int sentence_played = 0;
+    int sentence_dropped = 0;
+    int64_t next_arrival_us = -1;
+    int arrived = 0;
+    bool playing = false;
+
+    for (now = 0; now < end_us; now += kStepUs) {
+        bool tick = now % kTickUs == 0;
+
+        // Capture: one frame through the input task, the AFE and the fetch into the encode queue
+        if (scenario.listening && now > 0 && now % frame_us == 0) {
+            int64_t capture_us = now - frame_us;
+            input.jobs.push_back({costs.input_us, [&, capture_us]() {
+                afe.jobs.push_back({costs.afe_us, [&, capture_us]() {
+                    fetch.jobs.push_back({costs.fetch_us, [&, capture_us]() {
+                        if (encode_queue.size() >= kEncodeQueue) {
+                            result.encode_drops++;
+                            return;
+                        }
+                        // AudioTask::deadline_us, the frame is due before the next one is captured
+                        encode_queue.push_back({capture_us, now + frame_us});
+                        result.max_encode_queue = std::max(result.max_encode_queue, encode_queue.size());
+                    }});
+                }});
+            }});
+        }
+
+        // Downlink arrivals
+        if (scenario.speaking) {
+            if (now % sentence_period_us == 0) {
+                sentence++;
+                arrived = 0;
+                next_arrival_us = now;
+                main_loop.jobs.push_back({costs.sentence_us, nullptr});
+            }
+            if (next_arrival_us >= 0 && now >= next_arrival_us && arrived < sentence_frames) {
+                if (decode_queue.size() < (size_t)(kDecodeQueueMs / frame_ms)) {
+                    decode_queue.push_back(sentence);
+                } else {
+                    sentence_dropped++;
+                }
+                result.max_decode_queue = std::max(result.max_decode_queue, decode_queue.size());
+                wifi.jobs.push_back({costs.wifi_us, nullptr});
+                main_loop.jobs.push_back({costs.receive_us, nullptr});
+                arrived++;
+                next_arrival_us += frame_us / 2;
+            }
+        }
+
+        // Speaker: one frame every frame duration, an underrun while a sentence is playing
+        if (now % frame_us == 0) {
+            if (playback_queue > 0) {
+                playback_queue--;
+                playing = true;
+                sentence_played++;
+                if (sentence_played + sentence_dropped >= sentence_frames) {
+                    playing = false;
+                    sentence_played = 0;
+                    sentence_dropped = 0;
+                }
+            } else if (playing) {
+                result.underruns++;
+            }
+        }
+
+        // Display refresh
+        if (scenario.ui_load > 0 && now % 33000 == 0) {
+            ui.jobs.push_back({(int64_t)(33000 * scenario.ui_load), nullptr});
+        }
+
+        // Pick up work
+        for (auto& task : tasks) {
+            if (task.has_job) {
+                continue;
+            }
+            if (!task.jobs.empty()) {
+                task.job = std::move(task.jobs.front());
+                task.jobs.pop_front();
+                task.has_job = true;
+            } else if (task.next && task.next(task)) {
+                task.has_job = true;
+            }
+        }
+
+        // Schedule each core: highest priority first, equal priorities take turns at the tick
+        Task* running[2] = {nullptr, nullptr};
+        for (int core = 0; core < 2; core++) {
+            Task* best = nullptr;
+            for (auto& task : tasks) {
+                if (!task.has_job || (task.core >= 0 && task.core != core) || &task == running[0]) {
+                    continue;
+                }
+                if (best == nullptr || task.priority > best->priority) {
+                    best = &task;
+                    continue;
+                }
+                if (task.priority < best->priority) {
+                    continue;
+                }
+                bool task_current = !tick && task.running_on == core;
+                bool best_current = !tick && best->running_on == core;
+                if (task_current != best_current ? task_current : task.last_run_us < best->last_run_us) {
+                    best = &task;
+                }
+            }
+            running[core] = best;
+        }
+        for (auto& task : tasks) {
+            task.running_on = -1;
+        }
+        for (int core = 0; core < 2; core++) {
+            Task* task = running[core];
+            if (task == nullptr) {
+                continue;
+            }
+            task->running_on = core;
+            task->last_run_us = now;
+            task->busy_us += kStepUs;
+            task->job.remaining_us -= kStepUs;
+            if (task->job.remaining_us <= 0) {
+                task->has_job = false;
+                auto done = std::move(task->job.done);
+                if (done) {
+                    done();
+                }
+            }
+        }
+    }
+
+    int64_t codec_us = encoder->busy_us + (decoder != encoder ? decoder->busy_us : 0);
+    result.codec_cpu_percent = 100.0 * codec_us / (2 * end_us);
+    return result;
+}
+
+static int64_t Percentile(std::vector<int64_t> values, int percent) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, values.size() * percent / 100)];
+}
+
+int main(int argc, char* argv[]) {
+    int frame_ms = 60;
+    int seconds = 60;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--frame") == 0) {
+            frame_ms = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--seconds") == 0) {
+            seconds = atoi(argv[i + 1]);
+        }
+    }
+    if (frame_ms <= 0 || seconds <= 0) {
+        fprintf(stderr, "Usage: %s [--frame 20|60] [--seconds 60]\n", argv[0]);
+        return 1;
+    }
+
+    const Scenario scenarios[] = {
+        {"listening", true, false, false, 0.2, false},
+        {"speaking", false, true, false, 0.2, false},
+        {"realtime", true, true, true, 0.2, false},
+        {"realtime, busy ui", true, true, true, 0.6, false},
+        {"realtime, emote ui", true, true, true, 0.6, true},
+    };
+    printf("%d ms frames, %d s per run\n", frame_ms, seconds);
+    printf("%-20s %-10s %6s %6s %6s %8s %6s %6s %6s\n", "scenario", "mode", "encq", "drops", "late", "p95 ms",
+        "decq", "under", "codec");
+    for (auto& scenario : scenarios) {
+        for (Mode mode : {kSingleTask, kSplitFixed, kSplitSwap}) {
+            auto result = Simulate(scenario, mode, frame_ms, seconds);
+            printf("%-20s %-10s %6zu %6u %6u %8.1f %6zu %6u %5.1f%%\n", scenario.name, kModeNames[mode],
+                result.max_encode_queue, result.encode_drops, result.deadline_misses,
+                Percentile(result.uplink_us, 95) / 1000.0, result.max_decode_queue, result.underruns,
+                result.codec_cpu_percent);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include "jitter_buffer.h"
+
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * Replays an incoming packet trace through JitterBuffer on a simulated clock, with a decoder that keeps a
+ * short playback queue filled and a speaker that takes one frame every frame duration.
+ *
+ *   sim_jitter_buffer                                  built-in network scenarios
+ *   sim_jitter_buffer --loss 5 --reorder 2 --jitter 80 [--packets 3000] [--seed 1]
+ *   sim_jitter_buffer --trace file                     one "<sequence> <arrival_ms>" per line
+ *
+ * Reported: speaker underruns (ticks with nothing to play while the stream is running), concealed (PLC)
+ * frames, late / skipped packets, the playout delay added at the start of the utterance and the average
+ * time from sending to playing.
+ */
+
+static constexpr int kFrameMs = 60;
+// Decoded frames the playback queue holds ahead of the speaker
+static constexpr size_t kPlaybackDepth = 2;
+static constexpr int kBaseDelayMs = 40;
+
+struct Arrival {
+    uint32_t sequence;
+    int64_t arrival_ms;
+};
+
+struct Network {
+    const char* name;
+    double loss_percent;
+    double reorder_percent;
+    int jitter_ms;
+};
+
+static std::vector<Arrival> Generate(const Network& network, int packets, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> percent(0, 100);
+    // Mostly small delays with a long tail, like Wi-Fi retransmissions
+    std::exponential_distribution<double> jitter(network.jitter_ms > 0 ? 1.0 / network.jitter_ms : 1.0);
+    std::vector<Arrival> arrivals;
+    for (int i = 1; i <= packets; i++) {
+        if (percent(rng) < network.loss_percent) {
+            continue;
+        }
+        int64_t delay = kBaseDelayMs + (network.jitter_ms > 0 ? (int64_t)jitter(rng) : 0);
+        if (percent(rng) < network.reorder_percent) {
+            delay += kFrameMs + rng() % kFrameMs;
+        }
+        arrivals.push_back({(uint32_t)i, (int64_t)i * kFrameMs + delay});
+    }
+    std::stable_sort(arrivals.begin(), arrivals.end(),
+        [](const Arrival& a, const Arrival& b) { return a.arrival_ms < b.arrival_ms; });
+    return arrivals;
+}
+
+static std::vector<Arrival> Load(const char* path) {
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        exit(1);
+    }
+    std::vector<Arrival> arrivals;
+    Arrival arrival;
+    while (file >> arrival.sequence >> arrival.arrival_ms) {
+        arrivals.push_back(arrival);
+    }
+    std::stable_sort(arrivals.begin(), arrivals.end(),
+        [](const Arrival& a, const Arrival& b) { return a.arrival_ms < b.arrival_ms; });
+    return arrivals;
+}
+
+static void Simulate(const char* name, const std::vector<Arrival>& arrivals) {
+    if (arrivals.empty()) {
+        return;
+    }
+    host_fake_time_us = 0;
+    JitterBuffer buffer;
+    std::deque<std::unique_ptr<AudioStreamPacket>> playback;
+    uint32_t last_sequence = 0;
+    for (auto& arrival : arrivals) {
+        last_sequence = std::max(last_sequence, arrival.sequence);
+    }
+
+    size_t next_arrival = 0;
+    int64_t decoder_wakeup_ms = 0;
+    int64_t next_tick_ms = -1;
+    bool finished = false;
+    uint32_t underruns = 0;
+    double total_latency_ms = 0;
+    uint32_t latency_samples = 0;
+
+    for (int64_t now = 0; !finished; now++) {
+        host_fake_time_us = now * 1000;
+        while (next_arrival < arrivals.size() && arrivals[next_arrival].arrival_ms <= now) {
+            auto packet = std::make_unique<AudioStreamPacket>();
+            packet->sample_rate = 16000;
+            packet->frame_duration = kFrameMs;
+            packet->sequence = arrivals[next_arrival].sequence;
+            packet->payload.assign(1, 0);
+            buffer.Put(std::move(packet));
+            next_arrival++;
+        }
+
+        // Decoder: keep the playback queue topped up
+        while (playback.size() < kPlaybackDepth && now >= decoder_wakeup_ms) {
+            std::unique_ptr<AudioStreamPacket> packet;
+            int wait_ms = 0;
+            auto result = buffer.Get(packet, wait_ms);
+            if (result == kJitterBufferWait) {
+                decoder_wakeup_ms = now + wait_ms;
+            } else if (result == kJitterBufferEmpty) {
+                break;
+            } else {
+                playback.push_back(std::move(packet));
+            }
+        }
+
+        // Speaker: starts with the first decoded frame, then one frame per tick
+        if (next_tick_ms < 0 && !playback.empty()) {
+            next_tick_ms = now;
+        }
+        if (next_tick_ms >= 0 && now >= next_tick_ms) {
+            next_tick_ms += kFrameMs;
+            if (playback.empty()) {
+                underruns++;
+            } else {
+                auto packet = std::move(playback.front());
+                playback.pop_front();
+                if (!packet->payload.empty()) {
+                    total_latency_ms += now - (int64_t)packet->sequence * kFrameMs;
+                    latency_samples++;
+                }
+                finished = packet->sequence >= last_sequence;
+            }
+        }
+        if (next_arrival == arrivals.size() && buffer.Empty() && playback.empty() && now > arrivals.back().arrival_ms + 10000) {
+            finished = true;
+        }
+    }
+
+    auto& stats = buffer.stats();
+    printf("%-16s %8u %9u %9u %6u %8u %8u %9u %10.0f\n", name, stats.received, underruns, stats.concealed, stats.late,
+        stats.skipped, stats.jitter_ms, stats.max_added_latency_ms, latency_samples ? total_latency_ms / latency_samples : 0);
+}
+
+static void PrintHeader() {
+    printf("%-16s %8s %9s %9s %6s %8s %8s %9s %10s\n", "network", "received", "underrun", "concealed", "late", "skipped",
+        "jitter", "added ms", "latency ms");
+}
+
+int main(int argc, char* argv[]) {
+    Network custom = {"custom", 0, 0, 0};
+    int packets = 3000;
+    unsigned seed = 1;
+    const char* trace = nullptr;
+    bool has_custom = false;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--loss") == 0) {
+            custom.loss_percent = atof(argv[i + 1]);
+            has_custom = true;
+        } else if (strcmp(argv[i], "--reorder") == 0) {
+            custom.reorder_percent = atof(argv[i + 1]);
+            has_custom = true;
+        } else if (strcmp(argv[i], "--jitter") == 0) {
+            custom.jitter_ms = atoi(argv[i + 1]);
+            has_custom = true;
+        } else if (strcmp(argv[i], "--packets") == 0) {
+            packets = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            trace = argv[i + 1];
+        }
+    }
+
+    PrintHeader();
+    if (trace != nullptr) {
+        Simulate(trace, Load(trace));
+    } else if (has_custom) {
+        Simulate(custom.name, Generate(custom, packets, seed));
+    } else {
+        const Network networks[] = {
+            {"clean", 0, 0, 0},
+            {"jitter 20ms", 0, 0, 20},
+            {"jitter 80ms", 0, 0, 80},
+            {"loss 5%", 5, 0, 10},
+            {"reorder 5%", 0, 5, 10},
+            {"congested wifi", 3, 3, 120},
+        };
+        for (auto& network : networks) {
+            Simulate(network.name, Generate(network, packets, seed));
+        }
+    }
+    return 0;
+}
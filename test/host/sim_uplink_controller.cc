@@ -0,0 +1,262 @@
+#include "uplink_controller.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <random>
+#include <vector>
+
+/*
+ * Replays bandwidth / loss traces through UplinkController, the way the encode task of AudioService feeds
+ * it, and reports latency against a MOS proxy per trace, next to the fixed settings the controller replaces
+ * (complexity 0, one frame per datagram).
+ *
+ *   sim_uplink_controller                               built-in traces
+ *   sim_uplink_controller --trace file [--frame 20|60]  one "<time_s> <kbit/s> <loss %> [<cpu factor>]" per line
+ *
+ * Model, one millisecond per step:
+ * - capture: a frame every frame duration, encoded in order by one encoder. The encode time grows with
+ *   the complexity and the cpu factor of the trace (other tasks competing for the core). EncodeUs() is a
+ *   cost model, not a measurement: replace it with the "encode" stage of the latency tracer of a board.
+ * - send queue: MAX_SEND_QUEUE_DURATION_MS of frames, a frame that finds it full is dropped, as
+ *   AudioService does. The main task sends a batch of frames_per_packet frames as soon as it is complete.
+ * - link: MQTT/UDP datagrams (28 bytes IPv4 + UDP, 16 bytes header per frame) leave one after another at
+ *   the trace bandwidth through a socket buffer of kSocketBuffer datagrams, a send into a full buffer
+ *   fails and the frames stay queued. Each datagram is lost with the trace loss rate.
+ * - latency: from the start of a frame's capture to its arrival at the server, kPropagationMs included.
+ * - MOS proxy: the ITU-T G.107 E-model in the simplified form of Cole and Rosenbluth, with the latency as
+ *   the one-way delay, the queue drops and link losses as packet loss (Bpl 20, Opus with PLC), and an
+ *   equipment impairment Ie that falls from 12 at complexity 0 to 2 at complexity 10.
+ */
+
+static constexpr int kBitrate = 16000;
+static constexpr int kMaxSendQueueDurationMs = 1440;
+static constexpr size_t kMaxFramesPerPacket = 4;
+static constexpr size_t kSocketBuffer = 4;
+static constexpr int kPropagationMs = 40;
+static constexpr int kMaxComplexity = 10;
+static constexpr int kDurationS = 120;
+
+struct TracePoint {
+    double time_s;
+    double kbps;
+    double loss_percent;
+    double cpu_factor;
+};
+
+struct Trace {
+    const char* name;
+    std::vector<TracePoint> points;
+};
+
+struct Result {
+    uint32_t frames = 0;
+    uint32_t delivered = 0;
+    uint32_t queue_drops = 0;
+    uint32_t link_losses = 0;
+    uint32_t deadline_misses = 0;
+    std::vector<int> latencies_ms;
+    double complexity_sum = 0;
+    double frames_per_packet_sum = 0;
+    uint32_t congestion_events = 0;
+    uint32_t complexity_changes = 0;
+};
+
+static const TracePoint& PointAt(const Trace& trace, double time_s) {
+    size_t i = 0;
+    while (i + 1 < trace.points.size() && trace.points[i + 1].time_s <= time_s) {
+        i++;
+    }
+    return trace.points[i];
+}
+
+static int64_t EncodeUs(int complexity, int frame_ms, double cpu_factor) {
+    // 60 ms frames: about 3 ms at complexity 0, 1 ms more per step
+    return (int64_t)(cpu_factor * (600 + (2400 + 1000 * complexity) * frame_ms / 60));
+}
+
+static Result Simulate(const Trace& trace, int frame_ms, bool adaptive, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> percent(0, 100);
+    UplinkController controller(kMaxComplexity);
+    UplinkSettings fixed;
+    Result result;
+
+    size_t payload = 1 + kBitrate / 8 * frame_ms / 1000;
+    size_t queue_limit = kMaxSendQueueDurationMs / frame_ms;
+    std::deque<int64_t> send_queue;  // capture start of each encoded frame
+    struct Datagram {
+        int64_t done_us;
+        std::vector<int64_t> frames;
+        bool lost;
+    };
+    std::deque<Datagram> socket;
+    int64_t link_free_us = 0;
+    int64_t encoder_free_us = 0;
+
+    for (int64_t now_ms = 0; now_ms < kDurationS * 1000; now_ms++) {
+        int64_t now_us = now_ms * 1000;
+        auto& point = PointAt(trace, now_ms / 1000.0);
+        auto& settings = adaptive ? controller.settings() : fixed;
+
+        // A captured frame is encoded once the encoder is free, then queued for sending
+        if (now_ms > 0 && now_ms % frame_ms == 0) {
+            int64_t capture_us = now_us - frame_ms * 1000;
+            int64_t start_us = std::max(now_us, encoder_free_us);
+            int64_t encode_us = EncodeUs(settings.complexity, frame_ms, point.cpu_factor);
+            encoder_free_us = start_us + encode_us;
+            bool deadline_missed = encoder_free_us > now_us + frame_ms * 1000;
+            result.frames++;
+            result.deadline_misses += deadline_missed;
+            if (send_queue.size() >= queue_limit) {
+                result.queue_drops++;
+            } else {
+                send_queue.push_back(capture_us);
+            }
+            if (adaptive) {
+                UplinkSample sample = {
+                    .queued_frames = send_queue.size(),
+                    .encode_us = encode_us,
+                    .frame_us = frame_ms * 1000,
+                    .deadline_missed = deadline_missed,
+                    .max_frames_per_packet = kMaxFramesPerPacket,
+                };
+                controller.Update(sample);
+            }
+            result.complexity_sum += settings.complexity;
+            result.frames_per_packet_sum += settings.frames_per_packet;
+        }
+
+        // Datagrams leave the socket buffer at the link rate
+        while (!socket.empty() && socket.front().done_us <= now_us) {
+            auto& datagram = socket.front();
+            for (int64_t capture_us : datagram.frames) {
+                if (datagram.lost) {
+                    result.link_losses++;
+                } else {
+                    result.delivered++;
+                    result.latencies_ms.push_back((int)((datagram.done_us - capture_us) / 1000) + kPropagationMs);
+                }
+            }
+            socket.pop_front();
+        }
+
+        // The main task sends complete batches while the socket takes them
+        while (send_queue.size() >= settings.frames_per_packet && socket.size() < kSocketBuffer) {
+            Datagram datagram;
+            for (size_t i = 0; i < settings.frames_per_packet; i++) {
+                datagram.frames.push_back(send_queue.front());
+                send_queue.pop_front();
+            }
+            size_t bytes = 28 + datagram.frames.size() * (16 + payload);
+            int64_t transmit_us = (int64_t)(bytes * 8 * 1000000.0 / (point.kbps * 1000));
+            link_free_us = std::max(link_free_us, now_us) + transmit_us;
+            datagram.done_us = link_free_us;
+            datagram.lost = percent(rng) < point.loss_percent;
+            socket.push_back(std::move(datagram));
+        }
+    }
+    if (adaptive) {
+        result.congestion_events = controller.stats().congestion_events;
+        result.complexity_changes = controller.stats().complexity_changes;
+    }
+    return result;
+}
+
+static int Percentile(std::vector<int> values, int percent) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, values.size() * percent / 100)];
+}
+
+static double MosProxy(const Result& result) {
+    if (result.frames == 0) {
+        return 1;
+    }
+    double delay = Percentile(result.latencies_ms, 50);
+    double loss = 100.0 * (result.frames - result.delivered) / result.frames;
+    double complexity = result.complexity_sum / result.frames;
+    double ie = 12 - complexity;
+    double ie_eff = ie + (95 - ie) * loss / (loss + 20);
+    double id = 0.024 * delay + (delay > 177.3 ? 0.11 * (delay - 177.3) : 0);
+    double r = 93.2 - id - ie_eff;
+    if (r <= 0) {
+        return 1;
+    }
+    if (r >= 100) {
+        return 4.5;
+    }
+    return 1 + 0.035 * r + 7e-6 * r * (r - 60) * (100 - r);
+}
+
+static void Print(const char* trace, const char* mode, const Result& result) {
+    printf("%-16s %-8s %6u %6.1f%% %6.1f%% %6u %7d %7d %6.1f %5.2f %5u %5u %5.2f\n", trace, mode, result.frames,
+        100.0 * result.queue_drops / std::max(result.frames, 1u), 100.0 * result.link_losses / std::max(result.frames, 1u),
+        result.deadline_misses, Percentile(result.latencies_ms, 50), Percentile(result.latencies_ms, 95),
+        result.complexity_sum / std::max(result.frames, 1u), result.frames_per_packet_sum / std::max(result.frames, 1u),
+        result.congestion_events, result.complexity_changes, MosProxy(result));
+}
+
+static void Run(const Trace& trace, int frame_ms) {
+    Print(trace.name, "fixed", Simulate(trace, frame_ms, false, 1));
+    Print(trace.name, "adaptive", Simulate(trace, frame_ms, true, 1));
+}
+
+static Trace Load(const char* path) {
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        exit(1);
+    }
+    Trace trace = {path, {}};
+    std::string line;
+    while (std::getline(file, line)) {
+        TracePoint point = {0, 0, 0, 1};
+        int fields = sscanf(line.c_str(), "%lf %lf %lf %lf", &point.time_s, &point.kbps, &point.loss_percent, &point.cpu_factor);
+        if (fields >= 3 && point.kbps > 0) {
+            trace.points.push_back(point);
+        }
+    }
+    if (trace.points.empty()) {
+        fprintf(stderr, "No trace points in %s\n", path);
+        exit(1);
+    }
+    return trace;
+}
+
+int main(int argc, char* argv[]) {
+    const char* path = nullptr;
+    int frame_ms = 60;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--trace") == 0) {
+            path = argv[i + 1];
+        } else if (strcmp(argv[i], "--frame") == 0) {
+            frame_ms = atoi(argv[i + 1]);
+        }
+    }
+
+    printf("%d ms frames, %d bit/s Opus over MQTT/UDP\n", frame_ms, kBitrate);
+    printf("%-16s %-8s %6s %7s %7s %6s %7s %7s %6s %5s %5s %5s %5s\n", "trace", "mode", "frames", "qdrop", "lost",
+        "late", "p50 ms", "p95 ms", "cmplx", "batch", "cong", "steps", "MOS");
+    if (path != nullptr) {
+        Run(Load(path), frame_ms);
+        return 0;
+    }
+    const Trace traces[] = {
+        {"wifi", {{0, 1000, 0, 1}}},
+        {"wifi, busy cpu", {{0, 1000, 0, 1}, {40, 1000, 0, 5}, {80, 1000, 0, 1}}},
+        {"weak link", {{0, 24, 0.5, 1}}},
+        {"drop to 17k", {{0, 200, 0, 1}, {30, 17, 1, 1}, {70, 200, 0, 1}}},
+        {"cellular", {{0, 40, 3, 1}, {20, 22, 5, 1}, {50, 60, 2, 1}, {90, 19, 4, 1}}},
+        {"congested wifi", {{0, 100, 2, 1}, {10, 18, 8, 1.5}, {25, 100, 2, 1}, {40, 16, 10, 1.5}, {60, 100, 2, 1}}},
+    };
+    for (auto& trace : traces) {
+        Run(trace, frame_ms);
+    }
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include "simulated_audio_codec.h"
+
+#include <esp_timer.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+static uint32_t ReadLe32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t ReadLe16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static void PutLe32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back((value >> (i * 8)) & 0xFF);
+    }
+}
+
+static void PutLe16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+bool ReadWav(const std::string& path, std::vector<int16_t>& samples, int& sample_rate) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + n);
+    }
+    fclose(file);
+
+    if (data.size() < 12 || memcmp(&data[0], "RIFF", 4) != 0 || memcmp(&data[8], "WAVE", 4) != 0) {
+        return false;
+    }
+    bool has_format = false;
+    size_t offset = 12;
+    while (offset + 8 <= data.size()) {
+        uint32_t chunk_size = ReadLe32(&data[offset + 4]);
+        const uint8_t* chunk = &data[offset + 8];
+        if (chunk_size > data.size() - offset - 8) {
+            return false;
+        }
+        if (memcmp(&data[offset], "fmt ", 4) == 0) {
+            // PCM, mono, 16 bits
+            if (chunk_size < 16 || ReadLe16(chunk) != 1 || ReadLe16(chunk + 2) != 1 || ReadLe16(chunk + 14) != 16) {
+                return false;
+            }
+            sample_rate = ReadLe32(chunk + 4);
+            has_format = true;
+        } else if (memcmp(&data[offset], "data", 4) == 0) {
+            if (!has_format) {
+                return false;
+            }
+            samples.resize(chunk_size / sizeof(int16_t));
+            for (size_t i = 0; i < samples.size(); i++) {
+                samples[i] = (int16_t)ReadLe16(chunk + i * 2);
+            }
+            return true;
+        }
+        // Chunks are padded to an even size
+        offset += 8 + chunk_size + (chunk_size & 1);
+    }
+    return false;
+}
+
+bool WriteWav(const std::string& path, const std::vector<int16_t>& samples, int sample_rate) {
+    uint32_t data_size = samples.size() * sizeof(int16_t);
+    std::vector<uint8_t> out;
+    out.reserve(44 + data_size);
+    out.insert(out.end(), {'R', 'I', 'F', 'F'});
+    PutLe32(out, 36 + data_size);
+    out.insert(out.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+    PutLe32(out, 16);
+    PutLe16(out, 1);
+    PutLe16(out, 1);
+    PutLe32(out, sample_rate);
+    PutLe32(out, sample_rate * sizeof(int16_t));
+    PutLe16(out, sizeof(int16_t));
+    PutLe16(out, 16);
+    out.insert(out.end(), {'d', 'a', 't', 'a'});
+    PutLe32(out, data_size);
+    for (int16_t sample : samples) {
+        PutLe16(out, (uint16_t)sample);
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool written = fwrite(out.data(), 1, out.size(), file) == out.size();
+    return fclose(file) == 0 && written;
+}
+
+SimulatedAudioCodec::SimulatedAudioCodec(int input_sample_rate, int output_sample_rate) {
+    duplex_ = true;
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+
+    clock_thread_ = std::thread([this]() {
+        auto start = Clock::now();
+        int64_t start_us = host_fake_time_us;
+        while (!stopped_) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            host_fake_time_us = start_us + std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+        }
+    });
+}
+
+SimulatedAudioCodec::~SimulatedAudioCodec() {
+    stopped_ = true;
+    clock_thread_.join();
+}
+
+bool SimulatedAudioCodec::LoadInputWav(const std::string& path) {
+    int sample_rate = 0;
+    std::vector<int16_t> samples;
+    if (!ReadWav(path, samples, sample_rate) || sample_rate != input_sample_rate_) {
+        return false;
+    }
+    input_ = std::move(samples);
+    input_position_ = 0;
+    return true;
+}
+
+bool SimulatedAudioCodec::SaveOutputWav(const std::string& path) {
+    return WriteWav(path, output(), output_sample_rate_);
+}
+
+std::vector<int16_t> SimulatedAudioCodec::output() {
+    std::lock_guard<std::mutex> lock(output_mutex_);
+    return output_;
+}
+
+int SimulatedAudioCodec::Read(int16_t* dest, int samples) {
+    /* The DMA captures in the background, a read waits for the samples it asks for. One that comes later than the
+       DMA buffers last starts over from now instead of counting the lost audio */
+    auto duration = std::chrono::microseconds((int64_t)samples * 1000000 / input_sample_rate_);
+    auto buffered = std::chrono::microseconds((int64_t)AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM * 1000000 / input_sample_rate_);
+    auto now = Clock::now();
+    if (input_due_ + buffered < now) {
+        input_due_ = now;
+    }
+    input_due_ += duration;
+    std::this_thread::sleep_until(input_due_);
+
+    size_t available = std::min<size_t>(samples, input_.size() - input_position_);
+    std::copy_n(input_.begin() + input_position_, available, dest);
+    std::fill(dest + available, dest + samples, 0);
+    input_position_ += available;
+    return samples;
+}
+
+int SimulatedAudioCodec::Write(const int16_t* data, int samples) {
+    /* The samples go to the DMA buffers, a write only waits while they are full */
+    auto duration = std::chrono::microseconds((int64_t)samples * 1000000 / output_sample_rate_);
+    auto buffered = std::chrono::microseconds((int64_t)AUDIO_CODEC_DMA_DESC_NUM * AUDIO_CODEC_DMA_FRAME_NUM * 1000000 / output_sample_rate_);
+    Clock::time_point due;
+    {
+        std::lock_guard<std::mutex> lock(output_mutex_);
+        output_.insert(output_.end(), data, data + samples);
+        output_due_ = std::max(output_due_, Clock::now()) + duration;
+        due = output_due_;
+    }
+    std::this_thread::sleep_until(due - buffered);
+    return samples;
+}
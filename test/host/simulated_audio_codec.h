@@ -0,0 +1,54 @@
+#ifndef SIMULATED_AUDIO_CODEC_H
+#define SIMULATED_AUDIO_CODEC_H
+
+#include "audio_codec.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 16-bit mono PCM WAV files, false if the file is anything else
+bool ReadWav(const std::string& path, std::vector<int16_t>& samples, int& sample_rate);
+bool WriteWav(const std::string& path, const std::vector<int16_t>& samples, int sample_rate);
+
+/*
+ * A mono codec without hardware: the microphone plays a WAV file from its start (silence once it runs out)
+ * and the speaker records into memory, to be saved as a WAV file. Reads and writes take as long as the I2S
+ * DMA would, so the audio tasks run at the pace they have on the device, and like the board it keeps the
+ * esp_timer_get_time() clock running in real time while it exists.
+ */
+class SimulatedAudioCodec : public AudioCodec {
+public:
+    SimulatedAudioCodec(int input_sample_rate, int output_sample_rate);
+    virtual ~SimulatedAudioCodec();
+
+    bool LoadInputWav(const std::string& path);
+    bool SaveOutputWav(const std::string& path);
+
+    // Everything played so far
+    std::vector<int16_t> output();
+    // Loaded before the audio service starts, only its input task reads it afterwards
+    const std::vector<int16_t>& input() const { return input_; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<int16_t> input_;
+    size_t input_position_ = 0;
+    Clock::time_point input_due_;
+
+    Clock::time_point output_due_;
+    std::mutex output_mutex_;
+    std::vector<int16_t> output_;
+
+    std::atomic<bool> stopped_ = false;
+    std::thread clock_thread_;
+
+    int Read(int16_t* dest, int samples) override;
+    int Write(const int16_t* data, int samples) override;
+};
+
+#endif // SIMULATED_AUDIO_CODEC_H
@@ -0,0 +1,21 @@
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+#include <http.h>
+#include <network_interface.h>
+
+// The part of Board the modules built on the host reach for, a test defines create_board()
+void* create_board();
+
+class Board {
+public:
+    static Board& GetInstance() {
+        static Board* instance = static_cast<Board*>(create_board());
+        return *instance;
+    }
+
+    virtual ~Board() = default;
+    virtual NetworkInterface* GetNetwork() = 0;
+};
+
+#endif // HOST_BOARD_H
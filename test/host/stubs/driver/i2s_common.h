@@ -0,0 +1,14 @@
+#ifndef HOST_DRIVER_I2S_COMMON_H
+#define HOST_DRIVER_I2S_COMMON_H
+
+#include "esp_err.h"
+
+// AudioCodec keeps the channel handles, codecs on the host have none and never get here
+typedef struct i2s_channel_obj_t *i2s_chan_handle_t;
+
+static inline esp_err_t i2s_channel_enable(i2s_chan_handle_t handle)
+{
+    return handle != NULL ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+#endif // HOST_DRIVER_I2S_COMMON_H
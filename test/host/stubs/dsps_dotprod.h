@@ -0,0 +1,29 @@
+#ifndef HOST_DSPS_DOTPROD_H
+#define HOST_DSPS_DOTPROD_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Counts the calls, so a test can tell which path ran
+extern unsigned host_dsps_dotprod_calls;
+
+// Model of the esp-dsp ANSI reference: rounds, shifts and truncates to int16 without saturating
+static inline int dsps_dotprod_s16(const int16_t *src1, const int16_t *src2, int16_t *dest, int len, int8_t shift)
+{
+    host_dsps_dotprod_calls++;
+    long long acc = 0x7fff >> shift;
+    for (int i = 0; i < len; i++) {
+        acc += (int32_t)src1[i] * (int32_t)src2[i];
+    }
+    *dest = (int16_t)(acc >> (15 - shift));
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_DSPS_DOTPROD_H
@@ -0,0 +1,39 @@
+#ifndef HOST_ESP_APP_FORMAT_H
+#define HOST_ESP_APP_FORMAT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP_IMAGE_HEADER_MAGIC 0xE9
+
+// Same sizes as in ESP-IDF, the fields past the magic are not looked at on the host
+typedef struct {
+    uint8_t magic;
+    uint8_t segment_count;
+    uint8_t spi_mode;
+    uint8_t spi_speed_size;
+    uint32_t entry_addr;
+    uint8_t reserved[16];
+} esp_image_header_t;
+
+typedef struct {
+    uint32_t load_addr;
+    uint32_t data_len;
+} esp_image_segment_header_t;
+
+// The leading fields only, an image built on the host puts them after the two headers
+typedef struct {
+    char version[32];
+    char project_name[32];
+} esp_app_desc_t;
+
+const esp_app_desc_t *esp_app_get_description(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_ESP_APP_FORMAT_H
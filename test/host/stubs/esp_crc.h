@@ -0,0 +1,17 @@
+#ifndef HOST_ESP_CRC_H
+#define HOST_ESP_CRC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Same contract as the ROM function: zlib-style CRC-32, the caller passes and gets back the complemented value
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_ESP_CRC_H
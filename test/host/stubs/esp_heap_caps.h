@@ -0,0 +1,36 @@
+#ifndef HOST_ESP_HEAP_CAPS_H
+#define HOST_ESP_HEAP_CAPS_H
+
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_DMA      (1 << 3)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_DEFAULT  (1 << 12)
+
+static inline void *heap_caps_malloc(size_t size, unsigned int caps)
+{
+    (void)caps;
+    return malloc(size);
+}
+
+// The preferred capabilities do not matter on the host
+static inline void *heap_caps_malloc_prefer(size_t size, size_t num, ...)
+{
+    (void)num;
+    return malloc(size);
+}
+
+// No PSRAM on the host
+static inline size_t heap_caps_get_total_size(unsigned int caps)
+{
+    return (caps & MALLOC_CAP_SPIRAM) ? 0 : 512 * 1024;
+}
+
+static inline void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
+
+#endif // HOST_ESP_HEAP_CAPS_H
@@ -0,0 +1,26 @@
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+
+// Logging compiles away on the host, the tests report through their own checks. The arguments still go
+// to a call that never runs, so a value read only for a log line counts as used. Formats are not checked,
+// they are written for the ESP32 where uint32_t is unsigned long
+static inline void host_log_discard(const char *format, ...)
+{
+    (void)format;
+}
+
+#define HOST_LOG_DISCARD(tag, format, ...) \
+    do { \
+        (void)(tag); \
+        if (0) { \
+            host_log_discard(format, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG_DISCARD(tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG_DISCARD(tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG_DISCARD(tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG_DISCARD(tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) HOST_LOG_DISCARD(tag, format, ##__VA_ARGS__)
+
+#endif // HOST_ESP_LOG_H
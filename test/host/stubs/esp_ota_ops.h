@@ -0,0 +1,22 @@
+#ifndef HOST_ESP_OTA_OPS_H
+#define HOST_ESP_OTA_OPS_H
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "esp_app_format.h"
+
+#define ESP_ERR_OTA_VALIDATE_FAILED 0x1503
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from);
+const esp_partition_t *esp_ota_get_running_partition(void);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_ESP_OTA_OPS_H
@@ -0,0 +1,35 @@
+#ifndef HOST_FREERTOS_RINGBUF_H
+#define HOST_FREERTOS_RINGBUF_H
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * No-split ring buffer. Items are received in the order they were acquired, an acquired item blocks the ones
+ * behind it until it is completed. Space is counted like ESP-IDF does, an 8 byte header per item and the
+ * data rounded up to 4 bytes, an item may take at most half of the buffer.
+ */
+typedef struct HostRingbuf *RingbufHandle_t;
+
+typedef enum {
+    RINGBUF_TYPE_NOSPLIT = 0,
+} RingbufferType_t;
+
+RingbufHandle_t xRingbufferCreate(size_t buffer_size, RingbufferType_t type);
+void vRingbufferDelete(RingbufHandle_t ring);
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t ring, void **item, size_t size, TickType_t ticks_to_wait);
+BaseType_t xRingbufferSendComplete(RingbufHandle_t ring, void *item);
+void *xRingbufferReceive(RingbufHandle_t ring, size_t *item_size, TickType_t ticks_to_wait);
+void vRingbufferReturnItem(RingbufHandle_t ring, void *item);
+
+// Host only: bytes taken by acquired and not yet returned items
+size_t host_ringbuf_used(RingbufHandle_t ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_FREERTOS_RINGBUF_H
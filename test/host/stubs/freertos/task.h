@@ -0,0 +1,33 @@
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Tasks are detached pthreads, stack size and priority are ignored
+typedef struct HostTask *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle);
+// Only a task deleting itself is supported, a pthread cannot be stopped safely from outside
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+// The core is ignored, priorities are only kept for a test to look at
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id);
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+TickType_t xTaskGetTickCount(void);
+
+// Host only: moves the tick count forward, lets a test jump over long timeouts
+void host_tick_advance(TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_FREERTOS_TASK_H
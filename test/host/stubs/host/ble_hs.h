@@ -0,0 +1,18 @@
+#ifndef HOST_BLE_HS_H
+#define HOST_BLE_HS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BLE_GAP_LE_PHY_2M_MASK  0x02
+
+int ble_gap_set_prefered_le_phy(uint16_t conn_handle, uint8_t tx_phys_mask, uint8_t rx_phys_mask, uint16_t phy_opts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_BLE_HS_H
@@ -0,0 +1,434 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+
+#include <pthread.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Waits until ready() holds or the ticks run out, portMAX_DELAY waits forever
+template <typename Ready>
+static bool WaitFor(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TickType_t ticks, Ready ready) {
+    if (ticks == portMAX_DELAY) {
+        cv.wait(lock, ready);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), ready);
+}
+
+struct HostTask {
+    pthread_t thread;
+    TaskFunction_t function;
+    void* arg;
+    // Nobody holds a handle, the task frees itself once started
+    bool unreferenced;
+    std::atomic<UBaseType_t> priority{0};
+};
+
+// The running task, for the calls that take NULL for the caller. Unreferenced tasks are gone, they have none
+static thread_local HostTask* current_task = nullptr;
+
+static std::atomic<TickType_t> tick_offset{0};
+
+static void* RunTask(void* arg) {
+    auto task = static_cast<HostTask*>(arg);
+    TaskFunction_t function = task->function;
+    void* function_arg = task->arg;
+    if (task->unreferenced) {
+        delete task;
+    } else {
+        current_task = task;
+    }
+    function(function_arg);
+    fprintf(stderr, "Task returned without vTaskDelete(NULL)\n");
+    abort();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_depth, void* arg,
+                       UBaseType_t priority, TaskHandle_t* handle) {
+    // A handed out handle is never freed, the task may still look at it after vTaskDelete()
+    auto task = new HostTask{pthread_t(), function, arg, handle == nullptr};
+    task->priority = priority;
+    // An unreferenced task may be gone by the time pthread_create() returns
+    pthread_t thread;
+    if (pthread_create(handle != nullptr ? &task->thread : &thread, nullptr, RunTask, task) != 0) {
+        delete task;
+        return pdFAIL;
+    }
+    if (handle != nullptr) {
+        thread = task->thread;
+        *handle = task;
+    }
+    pthread_detach(thread);
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task != nullptr && !pthread_equal(task->thread, pthread_self())) {
+        fprintf(stderr, "vTaskDelete() of another task is not supported on the host\n");
+        abort();
+    }
+    pthread_exit(nullptr);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stack_depth, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core_id) {
+    return xTaskCreate(function, name, stack_depth, arg, priority, handle);
+}
+
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority) {
+    task = task != nullptr ? task : current_task;
+    if (task != nullptr) {
+        task->priority = priority;
+    }
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+    task = task != nullptr ? task : current_task;
+    return task != nullptr ? task->priority.load() : 0;
+}
+
+void host_tick_advance(TickType_t ticks) {
+    tick_offset += ticks;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (TickType_t)std::chrono::duration_cast<std::chrono::milliseconds>(now).count() / portTICK_PERIOD_MS + tick_offset;
+}
+
+struct HostQueue {
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t length;
+    size_t item_size;
+    std::deque<std::vector<uint8_t>> items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    auto queue = new HostQueue;
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    delete queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!WaitFor(queue->cv, lock, ticks_to_wait, [queue] { return queue->items.size() < queue->length; })) {
+        return pdFALSE;
+    }
+    auto bytes = static_cast<const uint8_t*>(item);
+    queue->items.emplace_back(bytes, bytes + queue->item_size);
+    queue->cv.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* buffer, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    if (!WaitFor(queue->cv, lock, ticks_to_wait, [queue] { return !queue->items.empty(); })) {
+        return pdFALSE;
+    }
+    memcpy(buffer, queue->items.front().data(), queue->item_size);
+    queue->items.pop_front();
+    queue->cv.notify_all();
+    return pdTRUE;
+}
+
+struct HostSemaphore {
+    std::mutex mutex;
+    std::condition_variable cv;
+    UBaseType_t count;
+    UBaseType_t max_count;
+};
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count) {
+    auto semaphore = new HostSemaphore;
+    semaphore->count = initial_count;
+    semaphore->max_count = max_count;
+    return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    if (!WaitFor(semaphore->cv, lock, ticks_to_wait, [semaphore] { return semaphore->count > 0; })) {
+        return pdFALSE;
+    }
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->count >= semaphore->max_count) {
+        return pdFALSE;
+    }
+    semaphore->count++;
+    semaphore->cv.notify_one();
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete semaphore;
+}
+
+struct HostEventGroup {
+    std::mutex mutex;
+    std::condition_variable cv;
+    EventBits_t bits = 0;
+};
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    return new HostEventGroup;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+    delete group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->bits |= bits;
+    group->cv.notify_all();
+    return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    EventBits_t before = group->bits;
+    group->bits &= ~bits;
+    return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
+
+// Returns the bits as they were when the wait ended, before clear_on_exit
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto ready = [group, bits, wait_for_all] {
+        return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+    bool satisfied = WaitFor(group->cv, lock, ticks_to_wait, ready);
+    EventBits_t result = group->bits;
+    if (satisfied && clear_on_exit) {
+        group->bits &= ~bits;
+    }
+    return result;
+}
+
+struct HostRingbufItem {
+    void* data;
+    size_t size;
+    bool complete;
+};
+
+struct HostRingbuf {
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t capacity;
+    size_t used = 0;
+    // Acquired or sent items in order, then the received ones that were not returned yet
+    std::deque<HostRingbufItem> items;
+    std::deque<HostRingbufItem> received;
+};
+
+static size_t ItemCost(size_t size) {
+    return 8 + ((size + 3) & ~(size_t)3);
+}
+
+RingbufHandle_t xRingbufferCreate(size_t buffer_size, RingbufferType_t type) {
+    auto ring = new HostRingbuf;
+    ring->capacity = (buffer_size + 3) & ~(size_t)3;
+    return ring;
+}
+
+void vRingbufferDelete(RingbufHandle_t ring) {
+    for (auto& item : ring->items) {
+        free(item.data);
+    }
+    for (auto& item : ring->received) {
+        free(item.data);
+    }
+    delete ring;
+}
+
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t ring, void** item, size_t size, TickType_t ticks_to_wait) {
+    size_t cost = ItemCost(size);
+    if (cost > ring->capacity / 2) {
+        return pdFALSE;
+    }
+    std::unique_lock<std::mutex> lock(ring->mutex);
+    if (!WaitFor(ring->cv, lock, ticks_to_wait, [ring, cost] { return ring->used + cost <= ring->capacity; })) {
+        return pdFALSE;
+    }
+    ring->used += cost;
+    *item = malloc(size > 0 ? size : 1);
+    ring->items.push_back({*item, size, false});
+    return pdTRUE;
+}
+
+BaseType_t xRingbufferSendComplete(RingbufHandle_t ring, void* item) {
+    std::lock_guard<std::mutex> lock(ring->mutex);
+    for (auto& entry : ring->items) {
+        if (entry.data == item) {
+            entry.complete = true;
+            ring->cv.notify_all();
+            return pdTRUE;
+        }
+    }
+    return pdFALSE;
+}
+
+void* xRingbufferReceive(RingbufHandle_t ring, size_t* item_size, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(ring->mutex);
+    auto ready = [ring] { return !ring->items.empty() && ring->items.front().complete; };
+    if (!WaitFor(ring->cv, lock, ticks_to_wait, ready)) {
+        return nullptr;
+    }
+    auto item = ring->items.front();
+    ring->items.pop_front();
+    ring->received.push_back(item);
+    *item_size = item.size;
+    return item.data;
+}
+
+void vRingbufferReturnItem(RingbufHandle_t ring, void* item) {
+    std::lock_guard<std::mutex> lock(ring->mutex);
+    for (auto it = ring->received.begin(); it != ring->received.end(); ++it) {
+        if (it->data == item) {
+            ring->used -= ItemCost(it->size);
+            free(it->data);
+            ring->received.erase(it);
+            ring->cv.notify_all();
+            return;
+        }
+    }
+    abort();
+}
+
+size_t host_ringbuf_used(RingbufHandle_t ring) {
+    std::lock_guard<std::mutex> lock(ring->mutex);
+    return ring->used;
+}
+
+struct esp_timer {
+    esp_timer_create_args_t args;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool active = false;
+    bool deleted = false;
+    uint64_t period_us = 0;
+    std::chrono::steady_clock::time_point due;
+    std::thread thread;
+};
+
+static void RunTimer(esp_timer_handle_t timer) {
+    std::unique_lock<std::mutex> lock(timer->mutex);
+    while (!timer->deleted) {
+        if (!timer->active) {
+            timer->cv.wait(lock);
+            continue;
+        }
+        auto due = timer->due;
+        if (timer->cv.wait_until(lock, due) != std::cv_status::timeout || !timer->active || timer->due != due) {
+            // Stopped, restarted or deleted meanwhile
+            continue;
+        }
+        if (timer->period_us == 0) {
+            timer->active = false;
+        } else {
+            timer->due += std::chrono::microseconds(timer->period_us);
+            auto now = std::chrono::steady_clock::now();
+            if (timer->args.skip_unhandled_events && timer->due < now) {
+                timer->due = now + std::chrono::microseconds(timer->period_us);
+            }
+        }
+        lock.unlock();
+        timer->args.callback(timer->args.arg);
+        lock.lock();
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle) {
+    if (create_args == nullptr || create_args->callback == nullptr || out_handle == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    auto timer = new esp_timer;
+    timer->args = *create_args;
+    timer->thread = std::thread(RunTimer, timer);
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t StartTimer(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us) {
+    std::lock_guard<std::mutex> lock(timer->mutex);
+    if (timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->active = true;
+    timer->period_us = period_us;
+    timer->due = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout_us);
+    timer->cv.notify_all();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return StartTimer(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+    return StartTimer(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    std::lock_guard<std::mutex> lock(timer->mutex);
+    if (!timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->active = false;
+    timer->cv.notify_all();
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+    std::lock_guard<std::mutex> lock(timer->mutex);
+    return timer->active;
+}
+
+// Like on the device a running timer has to be stopped first, and a callback must not delete its own timer
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    {
+        std::lock_guard<std::mutex> lock(timer->mutex);
+        if (timer->active) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        timer->deleted = true;
+        timer->cv.notify_all();
+    }
+    timer->thread.join();
+    delete timer;
+    return ESP_OK;
+}
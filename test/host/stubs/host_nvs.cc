@@ -0,0 +1,140 @@
+#include "nvs.h"
+
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// NVS in memory for the tests that do not look at it, values are kept as bytes whatever their type
+static std::mutex nvs_mutex;
+static std::vector<std::string> namespaces;
+static std::map<std::string, std::map<std::string, std::string>> entries;
+
+static std::map<std::string, std::string>* Namespace(nvs_handle_t handle) {
+    if (handle == 0 || handle > namespaces.size()) {
+        return nullptr;
+    }
+    return &entries[namespaces[handle - 1]];
+}
+
+static esp_err_t Get(nvs_handle_t handle, const char* key, std::string* value) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto values = Namespace(handle);
+    if (values == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    auto it = values->find(key);
+    if (it == values->end()) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *value = it->second;
+    return ESP_OK;
+}
+
+static esp_err_t Set(nvs_handle_t handle, const char* key, const void* data, size_t length) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto values = Namespace(handle);
+    if (values == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    (*values)[key].assign((const char*)data, length);
+    return ESP_OK;
+}
+
+template <typename T>
+static esp_err_t GetValue(nvs_handle_t handle, const char* key, T* out_value) {
+    std::string value;
+    esp_err_t err = Get(handle, key, &value);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (value.size() != sizeof(T)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(out_value, value.data(), sizeof(T));
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    for (size_t i = 0; i < namespaces.size(); i++) {
+        if (namespaces[i] == name) {
+            *out_handle = i + 1;
+            return ESP_OK;
+        }
+    }
+    namespaces.push_back(name);
+    *out_handle = namespaces.size();
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length) {
+    std::string value;
+    esp_err_t err = Get(handle, key, &value);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (out_value != nullptr) {
+        if (*length < value.size()) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memcpy(out_value, value.data(), value.size());
+    }
+    *length = value.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+    return Set(handle, key, value, length);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length) {
+    return nvs_get_blob(handle, key, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value) {
+    return Set(handle, key, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char* key, int32_t* out_value) {
+    return GetValue(handle, key, out_value);
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char* key, int32_t value) {
+    return Set(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char* key, uint8_t* out_value) {
+    return GetValue(handle, key, out_value);
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char* key, uint8_t value) {
+    return Set(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto values = Namespace(handle);
+    if (values == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return values->erase(key) > 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle) {
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto values = Namespace(handle);
+    if (values == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    values->clear();
+    return ESP_OK;
+}
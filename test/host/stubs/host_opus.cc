@@ -0,0 +1,60 @@
+#include "opus_encoder.h"
+#include "opus_decoder.h"
+#include "opus_resampler.h"
+
+#include <algorithm>
+#include <cstring>
+
+// TOC byte of a SILK wideband packet with one mono frame of the duration, config 8 + log2(duration / 10)
+static uint8_t TocByte(int duration_ms) {
+    int config = duration_ms >= 60 ? 11 : duration_ms >= 40 ? 10 : duration_ms >= 20 ? 9 : 8;
+    return (uint8_t)(config << 3);
+}
+
+OpusEncoderWrapper::OpusEncoderWrapper(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), duration_ms_(duration_ms), frame_size_(sample_rate / 1000 * channels * duration_ms) {
+}
+
+bool OpusEncoderWrapper::Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus) {
+    if ((int)pcm.size() != frame_size_) {
+        return false;
+    }
+    opus.resize(1 + pcm.size() * sizeof(int16_t));
+    opus[0] = TocByte(duration_ms_);
+    memcpy(&opus[1], pcm.data(), pcm.size() * sizeof(int16_t));
+    return true;
+}
+
+OpusDecoderWrapper::OpusDecoderWrapper(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), duration_ms_(duration_ms), frame_size_(sample_rate / 1000 * channels * duration_ms) {
+}
+
+bool OpusDecoderWrapper::Decode(std::vector<uint8_t>&& opus, std::vector<int16_t>& pcm) {
+    pcm.resize(frame_size_);
+    if (opus.size() == 1 + pcm.size() * sizeof(int16_t) && opus[0] == TocByte(duration_ms_)) {
+        memcpy(pcm.data(), &opus[1], pcm.size() * sizeof(int16_t));
+    } else {
+        std::fill(pcm.begin(), pcm.end(), 0);
+    }
+    return true;
+}
+
+void OpusResampler::Configure(int input_sample_rate, int output_sample_rate) {
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+}
+
+int OpusResampler::GetOutputSamples(int input_samples) const {
+    return (int)((int64_t)input_samples * output_sample_rate_ / input_sample_rate_);
+}
+
+void OpusResampler::Process(const int16_t* input, int input_samples, int16_t* output) {
+    int output_samples = GetOutputSamples(input_samples);
+    for (int i = 0; i < output_samples; i++) {
+        int64_t position = (int64_t)i * input_sample_rate_ * 256 / output_sample_rate_;
+        int index = (int)(position >> 8);
+        int fraction = (int)(position & 255);
+        int next = index + 1 < input_samples ? index + 1 : index;
+        output[i] = (int16_t)((input[index] * (256 - fraction) + input[next] * fraction) >> 8);
+    }
+}
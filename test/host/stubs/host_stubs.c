@@ -0,0 +1,26 @@
+#include "esp_timer.h"
+#include "esp_crc.h"
+#include "dsps_dotprod.h"
+
+int64_t host_fake_time_us = 0;
+unsigned host_dsps_dotprod_calls = 0;
+
+// Byte-table CRC-32, written independently of ble_crc32.c so the ROM backend is checked against something else
+uint32_t esp_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc = table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
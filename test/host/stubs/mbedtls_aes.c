@@ -0,0 +1,43 @@
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include "mbedtls/aes.h"
+
+#include <string.h>
+#include <openssl/aes.h>
+
+_Static_assert(sizeof(AES_KEY) <= sizeof(mbedtls_aes_context), "AES_KEY does not fit");
+
+void mbedtls_aes_init(mbedtls_aes_context *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_aes_free(mbedtls_aes_context *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+int mbedtls_aes_setkey_enc(mbedtls_aes_context *ctx, const unsigned char *key, unsigned int keybits)
+{
+    return AES_set_encrypt_key(key, keybits, (AES_KEY *)ctx) == 0 ? 0 : -0x0020;
+}
+
+// Same counter handling as mbedtls: big-endian increment of the whole 16-byte block
+int mbedtls_aes_crypt_ctr(mbedtls_aes_context *ctx, size_t length, size_t *nc_off, unsigned char nonce_counter[16],
+                          unsigned char stream_block[16], const unsigned char *input, unsigned char *output)
+{
+    size_t n = *nc_off;
+    for (size_t i = 0; i < length; i++) {
+        if (n == 0) {
+            AES_encrypt(nonce_counter, stream_block, (const AES_KEY *)ctx);
+            for (int j = 16; j > 0; j--) {
+                if (++nonce_counter[j - 1] != 0) {
+                    break;
+                }
+            }
+        }
+        output[i] = input[i] ^ stream_block[n];
+        n = (n + 1) & 0x0F;
+    }
+    *nc_off = n;
+    return 0;
+}
@@ -0,0 +1,33 @@
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include "mbedtls/sha256.h"
+
+#include <string.h>
+#include <openssl/sha.h>
+
+_Static_assert(sizeof(SHA256_CTX) <= sizeof(mbedtls_sha256_context), "SHA256_CTX does not fit");
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int is224)
+{
+    int ok = is224 ? SHA224_Init((SHA256_CTX *)ctx) : SHA256_Init((SHA256_CTX *)ctx);
+    return ok ? 0 : -0x007B;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char *input, size_t ilen)
+{
+    return SHA256_Update((SHA256_CTX *)ctx, input, ilen) ? 0 : -0x007B;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context *ctx, unsigned char output[32])
+{
+    return SHA256_Final(output, (SHA256_CTX *)ctx) ? 0 : -0x007B;
+}
@@ -0,0 +1,70 @@
+#include "rom/miniz.h"
+
+#include <string.h>
+#include <zlib.h>
+
+_Static_assert(sizeof(z_stream) <= sizeof(((tinfl_decompressor *)0)->stream), "z_stream does not fit");
+
+static voidpf arena_alloc(voidpf opaque, uInt items, uInt size)
+{
+    tinfl_decompressor *r = opaque;
+    size_t n = ((size_t)items * size + 7) & ~(size_t)7;
+    if (r->arena_used + n > sizeof(r->arena)) {
+        return Z_NULL;
+    }
+    void *p = (uint8_t *)r->arena + r->arena_used;
+    r->arena_used += n;
+    return p;
+}
+
+static void arena_free(voidpf opaque, voidpf address)
+{
+    (void)opaque;
+    (void)address;
+}
+
+void tinfl_init(tinfl_decompressor *r)
+{
+    r->started = 0;
+    r->arena_used = 0;
+}
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in_next, size_t *in_size, uint8_t *out_start,
+                              uint8_t *out_next, size_t *out_size, uint32_t flags)
+{
+    (void)out_start;
+    z_stream *stream = (z_stream *)r->stream;
+    if (!r->started) {
+        memset(stream, 0, sizeof(*stream));
+        stream->zalloc = arena_alloc;
+        stream->zfree = arena_free;
+        stream->opaque = r;
+        if (inflateInit2(stream, (flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? MAX_WBITS : -MAX_WBITS) != Z_OK) {
+            *in_size = *out_size = 0;
+            return TINFL_STATUS_BAD_PARAM;
+        }
+        r->started = 1;
+    }
+
+    stream->next_in = (Bytef *)in_next;
+    stream->avail_in = (uInt)*in_size;
+    stream->next_out = out_next;
+    stream->avail_out = (uInt)*out_size;
+    int ret = inflate(stream, Z_NO_FLUSH);
+    *in_size -= stream->avail_in;
+    *out_size -= stream->avail_out;
+
+    if (ret == Z_STREAM_END) {
+        return TINFL_STATUS_DONE;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        return TINFL_STATUS_FAILED;
+    }
+    if (stream->avail_out == 0) {
+        return TINFL_STATUS_HAS_MORE_OUTPUT;
+    }
+    if (stream->avail_in == 0) {
+        return (flags & TINFL_FLAG_HAS_MORE_INPUT) ? TINFL_STATUS_NEEDS_MORE_INPUT : TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS;
+    }
+    return TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS;
+}
@@ -0,0 +1,15 @@
+#ifndef HOST_NETWORK_INTERFACE_H
+#define HOST_NETWORK_INTERFACE_H
+
+#include <memory>
+
+#include "http.h"
+
+// HTTP only, the host tests have no other transport yet
+class NetworkInterface {
+public:
+    virtual ~NetworkInterface() = default;
+    virtual std::unique_ptr<Http> CreateHttp(int connect_id) = 0;
+};
+
+#endif // HOST_NETWORK_INTERFACE_H
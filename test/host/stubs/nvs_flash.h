@@ -0,0 +1,7 @@
+#ifndef HOST_NVS_FLASH_H
+#define HOST_NVS_FLASH_H
+
+// Settings includes this one, the calls it makes are all in nvs.h
+#include "nvs.h"
+
+#endif // HOST_NVS_FLASH_H
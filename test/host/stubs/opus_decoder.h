@@ -0,0 +1,27 @@
+#ifndef HOST_OPUS_DECODER_H
+#define HOST_OPUS_DECODER_H
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Decodes the packets of the OpusEncoderWrapper stand-in back to their PCM. Anything else, a lost packet
+ * (empty payload) or real Opus from a sound asset, decodes to one frame of silence.
+ */
+class OpusDecoderWrapper {
+public:
+    OpusDecoderWrapper(int sample_rate, int channels, int duration_ms = 60);
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int duration_ms() const { return duration_ms_; }
+
+    bool Decode(std::vector<uint8_t>&& opus, std::vector<int16_t>& pcm);
+    void ResetState() {}
+
+private:
+    int sample_rate_;
+    int duration_ms_;
+    int frame_size_;
+};
+
+#endif // HOST_OPUS_DECODER_H
@@ -0,0 +1,34 @@
+#ifndef HOST_OPUS_ENCODER_H
+#define HOST_OPUS_ENCODER_H
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Stand-in for the esp-opus-encoder wrapper, there is no libopus on the host. It is not a codec: a packet is
+ * an Opus TOC byte announcing one mono frame of the duration (SILK wideband configurations 8 to 11), followed
+ * by the frame as 16-bit little endian PCM. The TOC keeps the packet readable by code that parses Opus
+ * headers, the PCM lets a test compare what comes out of the other end sample for sample.
+ */
+class OpusEncoderWrapper {
+public:
+    OpusEncoderWrapper(int sample_rate, int channels, int duration_ms = 60);
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int duration_ms() const { return duration_ms_; }
+    inline int complexity() const { return complexity_; }
+
+    void SetDtx(bool enable) {}
+    void SetComplexity(int complexity) { complexity_ = complexity; }
+    // Takes exactly one frame, like the real wrapper when it is given whole frames
+    bool Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus);
+    void ResetState() {}
+
+private:
+    int sample_rate_;
+    int duration_ms_;
+    int frame_size_;
+    int complexity_ = 0;
+};
+
+#endif // HOST_OPUS_ENCODER_H
@@ -0,0 +1,50 @@
+#ifndef HOST_OS_MBUF_H
+#define HOST_OS_MBUF_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Chain of NimBLE mbufs, a GATT write arrives split across several when it is longer than one mbuf block
+struct os_mbuf {
+    uint8_t *om_data;
+    uint16_t om_len;
+    struct os_mbuf *om_next;
+};
+
+static inline uint16_t host_os_mbuf_pktlen(const struct os_mbuf *om)
+{
+    uint16_t len = 0;
+    for (; om != NULL; om = om->om_next) {
+        len += om->om_len;
+    }
+    return len;
+}
+
+#define OS_MBUF_PKTLEN(om) host_os_mbuf_pktlen(om)
+
+static inline int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst)
+{
+    uint8_t *out = (uint8_t *)dst;
+    for (; om != NULL && len > 0; om = om->om_next) {
+        if (off >= om->om_len) {
+            off -= om->om_len;
+            continue;
+        }
+        int n = om->om_len - off < len ? om->om_len - off : len;
+        memcpy(out, om->om_data + off, n);
+        out += n;
+        len -= n;
+        off = 0;
+    }
+    return len > 0 ? -1 : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_OS_MBUF_H
@@ -0,0 +1,43 @@
+#ifndef HOST_ROM_MINIZ_H
+#define HOST_ROM_MINIZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The streaming tinfl API of the miniz copy in the ESP32 ROM, on top of the host's zlib. zlib keeps its
+// own window, the caller's dictionary is only where the output goes, as with tinfl.
+#define TINFL_FLAG_PARSE_ZLIB_HEADER    1
+#define TINFL_FLAG_HAS_MORE_INPUT       2
+#define TINFL_LZ_DICT_SIZE              32768
+
+typedef enum {
+    TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS = -4,
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+} tinfl_status;
+
+// zlib allocates its state and window from the arena, freeing the decompressor frees them, as in miniz
+typedef struct {
+    int started;
+    size_t arena_used;
+    uint64_t stream[16];
+    uint64_t arena[6 * 1024];
+} tinfl_decompressor;
+
+void tinfl_init(tinfl_decompressor *r);
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in_next, size_t *in_size, uint8_t *out_start,
+                              uint8_t *out_next, size_t *out_size, uint32_t flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_ROM_MINIZ_H
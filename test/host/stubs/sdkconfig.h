@@ -0,0 +1,6 @@
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+// Options are given per target as compile definitions, everything else is off
+
+#endif // HOST_SDKCONFIG_H
@@ -0,0 +1,6 @@
+#ifndef HOST_SPI_FLASH_MMAP_H
+#define HOST_SPI_FLASH_MMAP_H
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+#endif // HOST_SPI_FLASH_MMAP_H
@@ -0,0 +1,196 @@
+#include "audio_frame.h"
+#include "test_util.h"
+
+// The ESP32-S3 build of the same file, renamed in CMakeLists.txt
+#undef AUDIO_FRAME_H
+#define AudioFrameResampler AudioFrameResamplerS3
+#define AudioFrameExtractChannel AudioFrameExtractChannelS3
+#include "audio_frame.h"
+#undef AudioFrameResampler
+#undef AudioFrameExtractChannel
+
+#include <dsps_dotprod.h>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Feeds `in` through the resampler in blocks of `block` frames
+template <typename Resampler>
+static std::vector<int16_t> Resample(Resampler& resampler, const std::vector<int16_t>& in, size_t block,
+    bool mono_output = false) {
+    int channels = resampler.channels();
+    int output_channels = mono_output ? 1 : channels;
+    std::vector<int16_t> out;
+    std::vector<int16_t> buffer(resampler.GetOutputFrames(block) * channels);
+    for (size_t offset = 0; offset < in.size(); offset += block * channels) {
+        size_t frames = std::min(block, (in.size() - offset) / channels);
+        size_t produced = resampler.Process(in.data() + offset, frames, buffer.data(), mono_output);
+        CHECK(produced <= resampler.GetOutputFrames(frames));
+        out.insert(out.end(), buffer.begin(), buffer.begin() + produced * output_channels);
+    }
+    return out;
+}
+
+static std::vector<int16_t> Sine(int sample_rate, double frequency, double amplitude, size_t frames) {
+    std::vector<int16_t> pcm(frames);
+    for (size_t i = 0; i < frames; i++) {
+        pcm[i] = (int16_t)std::lround(amplitude * std::sin(2 * M_PI * frequency * i / sample_rate));
+    }
+    return pcm;
+}
+
+static double Rms(const std::vector<int16_t>& pcm, size_t begin, size_t end) {
+    double sum = 0;
+    for (size_t i = begin; i < end; i++) {
+        sum += (double)pcm[i] * pcm[i];
+    }
+    return std::sqrt(sum / (end - begin));
+}
+
+static void TestOutputCount() {
+    const int rates[][2] = {{16000, 48000}, {48000, 16000}, {24000, 16000}, {16000, 24000}, {44100, 16000}};
+    for (auto& rate : rates) {
+        AudioFrameResampler resampler;
+        resampler.Configure(rate[0], rate[1], 1, 960);
+        std::vector<int16_t> in(rate[0], 0);
+        auto out = Resample(resampler, in, 960 * rate[0] / 16000 / 3);
+        // One second in, one second out
+        CHECK(std::abs((long)out.size() - rate[1]) <= 1);
+    }
+}
+
+static void TestDcGain() {
+    const int rates[][2] = {{16000, 48000}, {48000, 16000}, {24000, 16000}};
+    for (auto& rate : rates) {
+        AudioFrameResampler resampler;
+        resampler.Configure(rate[0], rate[1], 1, 960);
+        std::vector<int16_t> in(rate[0] / 4, 10000);
+        auto out = Resample(resampler, in, 320);
+        // Skip the filter delay
+        for (size_t i = out.size() / 2; i < out.size(); i++) {
+            CHECK(std::abs(out[i] - 10000) <= 50);
+        }
+    }
+}
+
+static void TestPassbandAndStopband() {
+    // 1kHz passes at unity gain
+    AudioFrameResampler up;
+    up.Configure(16000, 48000, 1, 960);
+    auto out = Resample(up, Sine(16000, 1000, 10000, 16000), 960);
+    double gain = Rms(out, out.size() / 2, out.size()) / (10000 / std::sqrt(2));
+    CHECK(std::abs(20 * std::log10(gain)) < 0.2);
+
+    // 12kHz does not fold back into the 16kHz output
+    AudioFrameResampler down;
+    down.Configure(48000, 16000, 1, 2880);
+    out = Resample(down, Sine(48000, 12000, 10000, 48000), 2880);
+    gain = Rms(out, out.size() / 2, out.size()) / (10000 / std::sqrt(2));
+    CHECK(20 * std::log10(gain + 1e-9) < -40);
+}
+
+static void TestStereoToMono() {
+    auto left = Sine(48000, 440, 8000, 4800);
+    auto right = Sine(48000, 3000, 8000, 4800);
+    std::vector<int16_t> stereo(left.size() * 2);
+    for (size_t i = 0; i < left.size(); i++) {
+        stereo[2 * i] = left[i];
+        stereo[2 * i + 1] = right[i];
+    }
+
+    AudioFrameResampler stereo_resampler, mono_resampler, interleaved_resampler;
+    stereo_resampler.Configure(48000, 16000, 2, 480);
+    mono_resampler.Configure(48000, 16000, 1, 480);
+    interleaved_resampler.Configure(48000, 16000, 2, 480);
+    auto mono_from_stereo = Resample(stereo_resampler, stereo, 480, true);
+    auto mono = Resample(mono_resampler, left, 480);
+    CHECK(mono_from_stereo == mono);
+
+    auto interleaved = Resample(interleaved_resampler, stereo, 480);
+    CHECK_EQ(interleaved.size(), 2 * mono.size());
+    for (size_t i = 0; i < mono.size(); i++) {
+        CHECK_EQ(interleaved[2 * i], mono[i]);
+    }
+}
+
+static void TestInPlace() {
+    auto in = Sine(16000, 700, 12000, 1600);
+    AudioFrameResampler separate, in_place;
+    separate.Configure(16000, 24000, 1, 160);
+    in_place.Configure(16000, 24000, 1, 160);
+    auto expected = Resample(separate, in, 160);
+
+    std::vector<int16_t> out;
+    std::vector<int16_t> buffer(in_place.GetOutputFrames(160));
+    for (size_t offset = 0; offset < in.size(); offset += 160) {
+        std::copy(in.begin() + offset, in.begin() + offset + 160, buffer.begin());
+        size_t produced = in_place.Process(buffer.data(), 160, buffer.data());
+        out.insert(out.end(), buffer.begin(), buffer.begin() + produced);
+    }
+    CHECK(out == expected);
+}
+
+static void TestExtractChannel() {
+    std::vector<int16_t> pcm = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    AudioFrameExtractChannel(pcm.data(), 3, 3, 1, pcm.data());
+    CHECK_EQ(pcm[0], 2);
+    CHECK_EQ(pcm[1], 5);
+    CHECK_EQ(pcm[2], 8);
+}
+
+// A full scale step overshoots, the output must clip instead of wrapping around
+static void TestSaturation() {
+    std::vector<int16_t> in(4000);
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = (i / 1000) % 2 ? INT16_MAX : INT16_MIN;
+    }
+    AudioFrameResampler scalar;
+    AudioFrameResamplerS3 fast;
+    scalar.Configure(16000, 48000, 1, 1000);
+    fast.Configure(16000, 48000, 1, 1000);
+    auto out = Resample(scalar, in, 1000);
+    CHECK(Resample(fast, in, 1000) == out);
+    for (size_t i = 1; i < out.size(); i++) {
+        CHECK(std::abs(out[i] - out[i - 1]) < 50000);
+    }
+}
+
+// The esp-dsp path must produce the same samples as the portable one, at every level
+static void TestEspDspPathMatchesScalar() {
+    std::mt19937 rng(1);
+    const int rates[][2] = {{16000, 48000}, {48000, 16000}, {24000, 16000}};
+    const int peaks[] = {100, 4000, 20000, 32767};
+    for (auto& rate : rates) {
+        for (int peak : peaks) {
+            std::uniform_int_distribution<int> sample(-peak, peak);
+            std::vector<int16_t> in(rate[0] / 10);
+            for (auto& s : in) {
+                s = sample(rng);
+            }
+            AudioFrameResampler scalar;
+            AudioFrameResamplerS3 fast;
+            scalar.Configure(rate[0], rate[1], 1, 480);
+            fast.Configure(rate[0], rate[1], 1, 480);
+            unsigned calls = host_dsps_dotprod_calls;
+            auto expected = Resample(scalar, in, 480);
+            CHECK(host_dsps_dotprod_calls == calls);
+            CHECK(Resample(fast, in, 480) == expected);
+            // Quiet blocks take the esp-dsp path
+            if (peak <= 4000) {
+                CHECK(host_dsps_dotprod_calls - calls >= expected.size());
+            }
+        }
+    }
+}
+
+int main() {
+    RUN_TEST(TestOutputCount);
+    RUN_TEST(TestDcGain);
+    RUN_TEST(TestPassbandAndStopband);
+    RUN_TEST(TestStereoToMono);
+    RUN_TEST(TestInPlace);
+    RUN_TEST(TestExtractChannel);
+    RUN_TEST(TestSaturation);
+    RUN_TEST(TestEspDspPathMatchesScalar);
+    return 0;
+}
@@ -0,0 +1,676 @@
+#include "audio_service.h"
+#include "loopback_protocol.h"
+#include "simulated_audio_codec.h"
+#include "binary_frame.h"
+#include "test_util.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * AudioService end to end: a simulated codec with a WAV file for a microphone, a loopback network with
+ * 30 ms of latency each way and a server that answers every turn with what it heard. The device side is
+ * HostApplication, the part of Application's state machine that drives the audio service and the protocol,
+ * with the same transitions and the same calls in each state.
+ */
+
+using std::chrono::milliseconds;
+
+#define SAMPLE_RATE 16000
+#define LINK_LATENCY_MS 30
+
+static int64_t Samples(int sample_rate, int ms) {
+    return (int64_t)sample_rate * ms / 1000;
+}
+
+/*
+ * The server: hello, listen, abort and goodbye like the real one. A turn ends with "listen stop", or in auto
+ * mode once it heard `auto_stop_ms` of audio. The answer is "tts start", the audio heard played back at the
+ * server's sample rate, in 60 ms frames (three right away, then in real time), and "tts stop" once the device
+ * must have played it all.
+ */
+class MockServer {
+public:
+    MockServer(LoopbackLink& uplink, LoopbackLink& downlink) : uplink_(uplink), downlink_(downlink) {
+        thread_ = std::thread([this]() {
+            Run();
+        });
+    }
+
+    ~MockServer() {
+        stopped_ = true;
+        thread_.join();
+    }
+
+    void set_sample_rate(int sample_rate) { sample_rate_ = sample_rate; }
+    void set_auto_stop_ms(int auto_stop_ms) { auto_stop_ms_ = auto_stop_ms; }
+    void set_reply_hello(bool reply_hello) { reply_hello_ = reply_hello; }
+
+    void SendGoodbye() {
+        downlink_.Send({false, "{\"type\":\"goodbye\"}"});
+    }
+
+    // What the device sent in each turn, and the audio of each answer
+    std::vector<std::vector<int16_t>> heard() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return heard_;
+    }
+    std::vector<std::vector<int16_t>> spoken() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return spoken_;
+    }
+    std::vector<std::string> texts() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return texts_;
+    }
+    bool speaking() const { return speaking_; }
+
+    void Reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        heard_.clear();
+        spoken_.clear();
+        texts_.clear();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    LoopbackLink& uplink_;
+    LoopbackLink& downlink_;
+    std::thread thread_;
+    std::atomic<bool> stopped_ = false;
+    std::atomic<int> sample_rate_ = SAMPLE_RATE;
+    std::atomic<int> auto_stop_ms_ = 0;
+    std::atomic<bool> reply_hello_ = true;
+    std::string session_id_;
+    int sessions_ = 0;
+    int uplink_frame_duration_ = 60;
+
+    std::mutex mutex_;
+    std::vector<std::vector<int16_t>> heard_;
+    std::vector<std::vector<int16_t>> spoken_;
+    std::vector<std::string> texts_;
+
+    bool listening_ = false;
+    bool auto_mode_ = false;
+    bool answer_due_ = false;
+    std::atomic<bool> speaking_ = false;
+    Clock::time_point next_event_;
+    std::vector<int16_t> answer_;
+    size_t answer_position_ = 0;
+    std::unique_ptr<OpusEncoderWrapper> encoder_;
+
+    void Run() {
+        while (!stopped_) {
+            auto timeout = milliseconds(20);
+            if (answer_due_ || speaking_) {
+                auto until = std::chrono::duration_cast<milliseconds>(next_event_ - Clock::now());
+                timeout = std::max(milliseconds(0), std::min(timeout, until));
+            }
+            LoopbackMessage message;
+            if (uplink_.Receive(message, timeout)) {
+                if (message.binary) {
+                    OnAudio(message.data);
+                } else {
+                    OnText(message.data);
+                }
+            }
+            if ((answer_due_ || speaking_) && Clock::now() >= next_event_) {
+                Speak();
+            }
+        }
+    }
+
+    void OnText(const std::string& text) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            texts_.push_back(text);
+        }
+        auto type = LoopbackJsonValue(text, "type");
+        if (type == "hello") {
+            if (!reply_hello_) {
+                return;
+            }
+            session_id_ = "loopback-" + std::to_string(++sessions_);
+            auto frame_duration = LoopbackJsonValue(text, "frame_duration");
+            uplink_frame_duration_ = frame_duration.empty() ? 60 : std::stoi(frame_duration);
+            downlink_.Send({false, "{\"type\":\"hello\",\"transport\":\"loopback\",\"session_id\":\"" + session_id_ +
+                "\",\"audio_params\":{\"format\":\"opus\",\"sample_rate\":" + std::to_string(sample_rate_) +
+                ",\"channels\":1,\"frame_duration\":60}}"});
+        } else if (type == "listen") {
+            auto state = LoopbackJsonValue(text, "state");
+            if (state == "start") {
+                std::lock_guard<std::mutex> lock(mutex_);
+                listening_ = true;
+                auto_mode_ = LoopbackJsonValue(text, "mode") == "auto";
+                heard_.emplace_back();
+            } else if (state == "stop" && listening_) {
+                EndTurn();
+            }
+        } else if (type == "abort") {
+            if (speaking_) {
+                speaking_ = false;
+                downlink_.Send({false, "{\"type\":\"tts\",\"state\":\"stop\"}"});
+            }
+        } else if (type == "goodbye") {
+            listening_ = false;
+            answer_due_ = false;
+            speaking_ = false;
+        }
+    }
+
+    void OnAudio(const std::string& message) {
+        bool end_turn;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!listening_) {
+                return;
+            }
+            OpusDecoderWrapper decoder(SAMPLE_RATE, 1, uplink_frame_duration_);
+            auto data = (const uint8_t*)message.data();
+            ParseBinaryFrames(2, data, message.size(), [this, &decoder](const BinaryFrame& frame) {
+                std::vector<int16_t> pcm;
+                decoder.Decode(std::vector<uint8_t>(frame.payload, frame.payload + frame.payload_size), pcm);
+                heard_.back().insert(heard_.back().end(), pcm.begin(), pcm.end());
+            });
+            end_turn = auto_mode_ && (int64_t)heard_.back().size() >= Samples(SAMPLE_RATE, auto_stop_ms_);
+        }
+        if (end_turn) {
+            EndTurn();
+        }
+    }
+
+    void EndTurn() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listening_ = false;
+        answer_due_ = true;
+        // The first audio comes a moment after "tts start", like it does from a TTS engine
+        next_event_ = Clock::now() + milliseconds(100);
+        answer_ = heard_.back();
+        int frame_samples = Samples(sample_rate_, 60);
+        answer_.resize((answer_.size() + frame_samples - 1) / frame_samples * frame_samples);
+        answer_position_ = 0;
+        spoken_.push_back(answer_);
+        encoder_ = std::make_unique<OpusEncoderWrapper>(sample_rate_, 1, 60);
+        downlink_.Send({false, "{\"type\":\"tts\",\"state\":\"start\"}"});
+    }
+
+    void Speak() {
+        if (answer_due_) {
+            answer_due_ = false;
+            speaking_ = true;
+            for (int i = 0; i < 3 && speaking_; i++) {
+                SendFrame();
+            }
+            return;
+        }
+        SendFrame();
+    }
+
+    void SendFrame() {
+        size_t frame_samples = Samples(sample_rate_, 60);
+        if (answer_position_ >= answer_.size()) {
+            // All the audio was sent a frame ago, what the device buffered plays within the next half second
+            speaking_ = false;
+            std::thread([this]() {
+                std::this_thread::sleep_for(milliseconds(500));
+                downlink_.Send({false, "{\"type\":\"tts\",\"state\":\"stop\"}"});
+            }).detach();
+            return;
+        }
+        std::vector<int16_t> pcm(answer_.begin() + answer_position_, answer_.begin() + answer_position_ + frame_samples);
+        answer_position_ += frame_samples;
+        std::vector<uint8_t> opus;
+        encoder_->Encode(std::move(pcm), opus);
+
+        std::string message(sizeof(BinaryProtocol2) + opus.size(), '\0');
+        auto bp2 = (BinaryProtocol2*)&message[0];
+        bp2->version = htons(2);
+        bp2->type = 0;
+        bp2->reserved = 0;
+        bp2->timestamp = 0;
+        bp2->payload_size = htonl(opus.size());
+        memcpy(bp2->payload, opus.data(), opus.size());
+        downlink_.Send({true, std::move(message)});
+        next_event_ = Clock::now() + milliseconds(60);
+    }
+};
+
+enum DeviceState {
+    kDeviceStateIdle,
+    kDeviceStateConnecting,
+    kDeviceStateListening,
+    kDeviceStateSpeaking,
+};
+
+#define MAIN_EVENT_SCHEDULE (1 << 0)
+#define MAIN_EVENT_SEND_AUDIO (1 << 1)
+#define MAIN_EVENT_ERROR (1 << 2)
+
+// Application's main loop and state machine, minus the board, the display and MCP
+class HostApplication {
+public:
+    HostApplication(AudioService& audio_service, LoopbackProtocol& protocol)
+        : audio_service_(audio_service), protocol_(protocol) {
+        event_group_ = xEventGroupCreate();
+
+        AudioServiceCallbacks callbacks;
+        callbacks.on_send_queue_available = [this]() {
+            xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
+        };
+        audio_service_.SetCallbacks(callbacks);
+
+        protocol_.OnNetworkError([this](const std::string& message) {
+            xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
+        });
+        protocol_.OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
+            if (device_state_ == kDeviceStateSpeaking) {
+                audio_service_.PushPacketToDecodeQueue(std::move(packet));
+            }
+        });
+        protocol_.OnAudioChannelClosed([this]() {
+            Schedule([this]() {
+                SetDeviceState(kDeviceStateIdle);
+            });
+        });
+        protocol_.OnServerText([this](const std::string& text) {
+            if (LoopbackJsonValue(text, "type") != "tts") {
+                return;
+            }
+            auto state = LoopbackJsonValue(text, "state");
+            if (state == "start") {
+                Schedule([this]() {
+                    if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
+                        SetDeviceState(kDeviceStateSpeaking);
+                    }
+                });
+            } else if (state == "stop") {
+                Schedule([this]() {
+                    if (device_state_ == kDeviceStateSpeaking) {
+                        if (listening_mode_ == kListeningModeManualStop) {
+                            SetDeviceState(kDeviceStateIdle);
+                        } else {
+                            SetDeviceState(kDeviceStateListening);
+                        }
+                    }
+                });
+            }
+        });
+        protocol_.Start();
+
+        xTaskCreate([](void* arg) {
+            static_cast<HostApplication*>(arg)->MainEventLoop();
+            vTaskDelete(NULL);
+        }, "main_event_loop", 4096 * 2, this, 3, nullptr);
+    }
+
+    void Schedule(std::function<void()> callback) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            main_tasks_.push_back(std::move(callback));
+        }
+        xEventGroupSetBits(event_group_, MAIN_EVENT_SCHEDULE);
+    }
+
+    // Application::StartListening(), or ToggleChatState() with the mode of a wake word in auto mode
+    void StartListening(ListeningMode mode) {
+        Schedule([this, mode]() {
+            if (device_state_ == kDeviceStateIdle) {
+                if (!protocol_.IsAudioChannelOpened()) {
+                    SetDeviceState(kDeviceStateConnecting);
+                    if (!protocol_.OpenAudioChannel()) {
+                        return;
+                    }
+                }
+                SetListeningMode(mode);
+            } else if (device_state_ == kDeviceStateSpeaking) {
+                protocol_.SendAbortSpeaking(kAbortReasonNone);
+                SetListeningMode(mode);
+            }
+        });
+    }
+
+    void StopListening() {
+        Schedule([this]() {
+            if (device_state_ == kDeviceStateListening) {
+                protocol_.SendStopListening();
+                SetDeviceState(kDeviceStateIdle);
+            }
+        });
+    }
+
+    void CloseAudioChannel() {
+        Schedule([this]() {
+            protocol_.CloseAudioChannel();
+        });
+    }
+
+    DeviceState device_state() const { return device_state_; }
+
+    // The states entered since the last call
+    std::vector<DeviceState> TakeStates() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return std::move(states_);
+    }
+
+    // Waits until the device entered the state and set up its audio for it
+    bool WaitForState(DeviceState state, milliseconds timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (entered_state_ != state) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(milliseconds(5));
+        }
+        return true;
+    }
+
+private:
+    AudioService& audio_service_;
+    LoopbackProtocol& protocol_;
+    EventGroupHandle_t event_group_;
+    std::atomic<DeviceState> device_state_ = kDeviceStateIdle;
+    std::atomic<DeviceState> entered_state_ = kDeviceStateIdle;
+    ListeningMode listening_mode_ = kListeningModeAutoStop;
+    std::mutex mutex_;
+    std::vector<std::function<void()>> main_tasks_;
+    std::vector<DeviceState> states_;
+    std::vector<std::unique_ptr<AudioStreamPacket>> send_batch_;
+
+    void MainEventLoop() {
+        while (true) {
+            auto bits = xEventGroupWaitBits(event_group_, MAIN_EVENT_SCHEDULE | MAIN_EVENT_SEND_AUDIO | MAIN_EVENT_ERROR,
+                pdTRUE, pdFALSE, portMAX_DELAY);
+            if (bits & MAIN_EVENT_ERROR) {
+                SetDeviceState(kDeviceStateIdle);
+            }
+            if (bits & MAIN_EVENT_SEND_AUDIO) {
+                SendQueuedAudio();
+            }
+            if (bits & MAIN_EVENT_SCHEDULE) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                auto tasks = std::move(main_tasks_);
+                lock.unlock();
+                for (auto& task : tasks) {
+                    task();
+                }
+            }
+        }
+    }
+
+    void SendQueuedAudio() {
+        audio_service_.DropStaleSendPackets();
+        size_t queued = audio_service_.GetSendQueueSize();
+        size_t frames_per_packet = audio_service_.GetUplinkFramesPerPacket(protocol_.audio_frames_per_packet());
+        bool flush = !audio_service_.IsAudioProcessorRunning();
+        while (queued >= frames_per_packet || (flush && queued > 0)) {
+            send_batch_.clear();
+            while (send_batch_.size() < frames_per_packet) {
+                auto packet = audio_service_.PopPacketFromSendQueue();
+                if (!packet) {
+                    break;
+                }
+                send_batch_.push_back(std::move(packet));
+            }
+            bool sent = !send_batch_.empty() && protocol_.SendAudio(send_batch_);
+            send_batch_.clear();
+            if (!sent) {
+                break;
+            }
+            queued = audio_service_.GetSendQueueSize();
+        }
+    }
+
+    void SetListeningMode(ListeningMode mode) {
+        listening_mode_ = mode;
+        SetDeviceState(kDeviceStateListening);
+    }
+
+    void SetDeviceState(DeviceState state) {
+        if (device_state_ == state) {
+            return;
+        }
+        device_state_ = state;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            states_.push_back(state);
+        }
+        switch (state) {
+        case kDeviceStateIdle:
+            audio_service_.EnableVoiceProcessing(false);
+            audio_service_.EnableWakeWordDetection(true);
+            break;
+        case kDeviceStateListening:
+            if (!audio_service_.IsAudioProcessorRunning()) {
+                protocol_.SendStartListening(listening_mode_);
+                audio_service_.EnableVoiceProcessing(true);
+                audio_service_.EnableWakeWordDetection(false);
+            }
+            break;
+        case kDeviceStateSpeaking:
+            if (listening_mode_ != kListeningModeRealtime) {
+                audio_service_.EnableVoiceProcessing(false);
+                audio_service_.EnableWakeWordDetection(false);
+            }
+            audio_service_.ResetDecoder();
+            break;
+        default:
+            break;
+        }
+        entered_state_ = state;
+    }
+};
+
+// Everything lives for the whole run, the audio tasks cannot be stopped from outside
+static SimulatedAudioCodec* codec;
+static AudioService* audio_service;
+static MockServer* server;
+static HostApplication* app;
+
+static bool WaitUntilIdle(milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!audio_service->IsIdle()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+    // The output task may still be writing the frame it took last
+    std::this_thread::sleep_for(milliseconds(200));
+    return true;
+}
+
+// Where the turn starts in the microphone input, the device sends what it captured without gaps
+static size_t FindInInput(const std::vector<int16_t>& heard, size_t from) {
+    auto& input = codec->input();
+    CHECK(!heard.empty() && heard.size() <= input.size());
+    for (size_t start = from; start + heard.size() <= input.size(); start++) {
+        if (std::equal(heard.begin(), heard.end(), input.begin() + start)) {
+            return start;
+        }
+    }
+    fprintf(stderr, "The %u samples heard are not a slice of the input after %u\n", (unsigned)heard.size(), (unsigned)from);
+    exit(1);
+}
+
+static void CheckStates(const std::vector<DeviceState>& expected) {
+    auto states = app->TakeStates();
+    CHECK_EQ(states.size(), expected.size());
+    for (size_t i = 0; i < states.size(); i++) {
+        CHECK_EQ(states[i], expected[i]);
+    }
+}
+
+// Push to talk: the device plays the answer sample for sample
+static void TestManualConversation() {
+    server->Reset();
+    server->set_sample_rate(SAMPLE_RATE);
+    size_t played = codec->output().size();
+
+    app->StartListening(kListeningModeManualStop);
+    CHECK(app->WaitForState(kDeviceStateListening, milliseconds(2000)));
+    CHECK(audio_service->IsAudioProcessorRunning());
+    std::this_thread::sleep_for(milliseconds(1200));
+    app->StopListening();
+    CHECK(app->WaitForState(kDeviceStateSpeaking, milliseconds(2000)));
+    CHECK(!audio_service->IsAudioProcessorRunning());
+    CHECK(app->WaitForState(kDeviceStateIdle, milliseconds(5000)));
+    CHECK(WaitUntilIdle(milliseconds(2000)));
+    CheckStates({kDeviceStateConnecting, kDeviceStateListening, kDeviceStateIdle, kDeviceStateSpeaking, kDeviceStateIdle});
+
+    auto heard = server->heard();
+    CHECK_EQ(heard.size(), 1);
+    // 1.2 s of listening, less the warm-up of the input task and the frames still on their way at the end
+    CHECK(heard[0].size() >= (size_t)Samples(SAMPLE_RATE, 600));
+    FindInInput(heard[0], 0);
+
+    auto output = codec->output();
+    auto spoken = server->spoken();
+    CHECK_EQ(spoken.size(), 1);
+    CHECK_EQ(output.size() - played, spoken[0].size());
+    CHECK(std::equal(spoken[0].begin(), spoken[0].end(), output.begin() + played));
+
+    auto texts = server->texts();
+    CHECK(texts.size() >= 3);
+    CHECK(LoopbackJsonValue(texts[0], "type") == "hello");
+    CHECK(LoopbackJsonValue(texts[1], "mode") == "manual");
+    CHECK(LoopbackJsonValue(texts[2], "state") == "stop");
+    // The session the server opened is named in every message after the hello
+    CHECK(LoopbackJsonValue(texts[2], "session_id") == "loopback-1");
+}
+
+// Two turns over the channel that stays open, the server ends each turn and speaks at 24 kHz
+static void TestAutoConversation() {
+    server->Reset();
+    server->set_sample_rate(24000);
+    server->set_auto_stop_ms(900);
+    size_t played = codec->output().size();
+
+    app->StartListening(kListeningModeAutoStop);
+    for (int turn = 0; turn < 2; turn++) {
+        CHECK(app->WaitForState(kDeviceStateSpeaking, milliseconds(3000)));
+        CHECK(app->WaitForState(kDeviceStateListening, milliseconds(5000)));
+    }
+    app->CloseAudioChannel();
+    CHECK(app->WaitForState(kDeviceStateIdle, milliseconds(2000)));
+    CHECK(WaitUntilIdle(milliseconds(2000)));
+    // The channel stayed open, the first turn was the only one to connect
+    CheckStates({kDeviceStateListening, kDeviceStateSpeaking, kDeviceStateListening, kDeviceStateSpeaking,
+        kDeviceStateListening, kDeviceStateIdle});
+
+    // Back in listening after the second answer, the device started a third turn before it closed the channel
+    auto heard = server->heard();
+    CHECK_EQ(heard.size(), 3);
+    size_t next = 0;
+    for (int turn = 0; turn < 2; turn++) {
+        CHECK(heard[turn].size() >= (size_t)Samples(SAMPLE_RATE, 900));
+        next = FindInInput(heard[turn], next) + heard[turn].size();
+    }
+
+    // 60 ms frames of 1440 samples, resampled to 960 each
+    size_t spoken_samples = 0;
+    for (auto& answer : server->spoken()) {
+        spoken_samples += answer.size();
+    }
+    CHECK_EQ(codec->output().size() - played, spoken_samples * SAMPLE_RATE / 24000);
+}
+
+// Talking over the answer stops it at once
+static void TestAbortWhileSpeaking() {
+    server->Reset();
+    server->set_sample_rate(SAMPLE_RATE);
+
+    app->StartListening(kListeningModeManualStop);
+    CHECK(app->WaitForState(kDeviceStateListening, milliseconds(2000)));
+    std::this_thread::sleep_for(milliseconds(2000));
+    app->StopListening();
+    CHECK(app->WaitForState(kDeviceStateSpeaking, milliseconds(2000)));
+    std::this_thread::sleep_for(milliseconds(400));
+    CHECK(server->speaking());
+    app->StartListening(kListeningModeManualStop);
+    CHECK(app->WaitForState(kDeviceStateListening, milliseconds(2000)));
+    std::this_thread::sleep_for(milliseconds(300));
+    size_t played = codec->output().size();
+    std::this_thread::sleep_for(milliseconds(500));
+    CHECK_EQ(codec->output().size(), played);
+    CHECK(!server->speaking());
+
+    bool aborted = false;
+    for (auto& text : server->texts()) {
+        aborted = aborted || LoopbackJsonValue(text, "type") == "abort";
+    }
+    CHECK(aborted);
+
+    app->CloseAudioChannel();
+    CHECK(app->WaitForState(kDeviceStateIdle, milliseconds(2000)));
+    CHECK(WaitUntilIdle(milliseconds(2000)));
+    CheckStates({kDeviceStateConnecting, kDeviceStateListening, kDeviceStateIdle, kDeviceStateSpeaking,
+        kDeviceStateListening, kDeviceStateIdle});
+}
+
+// A server that goes away or never answers leaves the device idle with the microphone off
+static void TestServerGone() {
+    server->Reset();
+    app->StartListening(kListeningModeManualStop);
+    CHECK(app->WaitForState(kDeviceStateListening, milliseconds(2000)));
+    std::this_thread::sleep_for(milliseconds(300));
+    server->SendGoodbye();
+    CHECK(app->WaitForState(kDeviceStateIdle, milliseconds(2000)));
+    CHECK(!audio_service->IsAudioProcessorRunning());
+    CHECK(WaitUntilIdle(milliseconds(2000)));
+    CheckStates({kDeviceStateConnecting, kDeviceStateListening, kDeviceStateIdle});
+
+    server->set_reply_hello(false);
+    app->StartListening(kListeningModeManualStop);
+    CHECK(app->WaitForState(kDeviceStateConnecting, milliseconds(2000)));
+    CHECK(app->WaitForState(kDeviceStateIdle, milliseconds(3000)));
+    CheckStates({kDeviceStateConnecting, kDeviceStateIdle});
+    CHECK(!audio_service->IsAudioProcessorRunning());
+    server->set_reply_hello(true);
+}
+
+int main() {
+    // Noise from an LCG, no stretch of it repeats, so each turn can be found in it
+    std::vector<int16_t> input(Samples(SAMPLE_RATE, 20000));
+    uint32_t seed = 12345;
+    for (auto& sample : input) {
+        seed = seed * 1664525 + 1013904223;
+        sample = (int16_t)(seed >> 16);
+    }
+    CHECK(WriteWav("test_audio_service_input.wav", input, SAMPLE_RATE));
+
+    codec = new SimulatedAudioCodec(SAMPLE_RATE, SAMPLE_RATE);
+    CHECK(codec->LoadInputWav("test_audio_service_input.wav"));
+    CHECK(codec->input() == input);
+
+    auto uplink = new LoopbackLink(milliseconds(LINK_LATENCY_MS));
+    auto downlink = new LoopbackLink(milliseconds(LINK_LATENCY_MS));
+    server = new MockServer(*uplink, *downlink);
+    auto protocol = new LoopbackProtocol(*uplink, *downlink);
+    audio_service = new AudioService();
+    audio_service->Initialize(codec);
+    audio_service->Start();
+    app = new HostApplication(*audio_service, *protocol);
+
+    RUN_TEST(TestManualConversation);
+    RUN_TEST(TestAutoConversation);
+    RUN_TEST(TestAbortWhileSpeaking);
+    RUN_TEST(TestServerGone);
+
+    // What the speaker played, to listen to
+    CHECK(codec->SaveOutputWav("test_audio_service_output.wav"));
+    audio_service->Stop();
+    std::this_thread::sleep_for(milliseconds(200));
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include "binary_frame.h"
+#include "test_util.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+// Serializes frames like WebsocketProtocol::SendAudioFrames
+static std::vector<uint8_t> Build(int version, const std::vector<std::vector<uint8_t>>& payloads, uint16_t type = 0) {
+    std::vector<uint8_t> message;
+    for (size_t i = 0; i < payloads.size(); i++) {
+        auto& payload = payloads[i];
+        size_t offset = message.size();
+        if (version == 2) {
+            message.resize(offset + sizeof(BinaryProtocol2));
+            BinaryProtocol2 bp2 = {};
+            bp2.version = htons(2);
+            bp2.type = htons(type);
+            bp2.timestamp = htonl(1000 + i);
+            bp2.payload_size = htonl(payload.size());
+            memcpy(&message[offset], &bp2, sizeof(bp2));
+        } else if (version == 3) {
+            message.resize(offset + sizeof(BinaryProtocol3));
+            BinaryProtocol3 bp3 = {};
+            bp3.type = type;
+            bp3.payload_size = htons(payload.size());
+            memcpy(&message[offset], &bp3, sizeof(bp3));
+        }
+        message.insert(message.end(), payload.begin(), payload.end());
+    }
+    return message;
+}
+
+// Invariants that hold for any input: frames are in order, back to back, and inside the message
+static size_t CheckInvariants(int version, const std::vector<uint8_t>& message, std::vector<BinaryFrame>* frames) {
+    const uint8_t* begin = message.data();
+    const uint8_t* end = begin + message.size();
+    const uint8_t* next = begin;
+    size_t header = version == 2 ? sizeof(BinaryProtocol2) : version == 3 ? sizeof(BinaryProtocol3) : 0;
+    size_t consumed = ParseBinaryFrames(version, message.data(), message.size(), [&](const BinaryFrame& frame) {
+        CHECK(frame.payload == next + header);
+        CHECK(frame.payload >= begin && frame.payload + frame.payload_size <= end);
+        next = frame.payload + frame.payload_size;
+        if (frames != nullptr) {
+            frames->push_back(frame);
+        }
+    });
+    CHECK(consumed <= message.size());
+    CHECK(begin + consumed == next);
+    return consumed;
+}
+
+static void TestRoundTrip() {
+    std::mt19937 rng(11);
+    for (int version : {1, 2, 3}) {
+        for (int count = 1; count <= 8; count++) {
+            if (version == 1 && count > 1) {
+                break;
+            }
+            std::vector<std::vector<uint8_t>> payloads;
+            for (int i = 0; i < count; i++) {
+                payloads.emplace_back(rng() % 400);
+                for (auto& byte : payloads.back()) {
+                    byte = rng();
+                }
+            }
+            auto message = Build(version, payloads);
+            std::vector<BinaryFrame> frames;
+            CHECK_EQ(CheckInvariants(version, message, &frames), message.size());
+            CHECK_EQ(frames.size(), version == 1 && message.empty() ? 0 : payloads.size());
+            for (size_t i = 0; i < frames.size(); i++) {
+                CHECK(std::vector<uint8_t>(frames[i].payload, frames[i].payload + frames[i].payload_size) == payloads[i]);
+                CHECK_EQ(frames[i].type, 0);
+                CHECK_EQ(frames[i].timestamp, version == 2 ? 1000 + i : 0);
+            }
+        }
+    }
+}
+
+static void TestEmptyPayloadAndType() {
+    auto message = Build(3, {{}, {1, 2}}, 1);
+    std::vector<BinaryFrame> frames;
+    CHECK_EQ(CheckInvariants(3, message, &frames), message.size());
+    CHECK_EQ(frames.size(), 2);
+    CHECK_EQ(frames[0].payload_size, 0);
+    CHECK_EQ(frames[1].type, 1);
+}
+
+static void TestTruncated() {
+    for (int version : {2, 3}) {
+        auto message = Build(version, {{1, 2, 3}, {4, 5, 6, 7}});
+        size_t first = message.size() - 4 - (version == 2 ? sizeof(BinaryProtocol2) : sizeof(BinaryProtocol3));
+        for (size_t len = 0; len < message.size(); len++) {
+            std::vector<uint8_t> truncated(message.begin(), message.begin() + len);
+            size_t consumed = CheckInvariants(version, truncated, nullptr);
+            CHECK_EQ(consumed, len >= first ? first : 0);
+        }
+    }
+}
+
+static void TestOversizedLength() {
+    // A payload_size that would wrap the offset arithmetic
+    auto message = Build(2, {{1, 2, 3}});
+    BinaryProtocol2 bp2;
+    memcpy(&bp2, message.data(), sizeof(bp2));
+    bp2.payload_size = htonl(0xFFFFFFFF);
+    memcpy(message.data(), &bp2, sizeof(bp2));
+    CHECK_EQ(CheckInvariants(2, message, nullptr), 0);
+}
+
+// Random and mutated well-formed messages, run with -DHOST_TEST_SANITIZERS=ON to catch out of bounds reads
+static void TestFuzz() {
+    std::mt19937 rng(12);
+    for (int iteration = 0; iteration < 200000; iteration++) {
+        int version = 1 + rng() % 3;
+        std::vector<uint8_t> message;
+        if (rng() % 2) {
+            message.resize(rng() % 64);
+            for (auto& byte : message) {
+                byte = rng();
+            }
+        } else {
+            std::vector<std::vector<uint8_t>> payloads(1 + rng() % 4);
+            for (auto& payload : payloads) {
+                payload.resize(rng() % 32);
+            }
+            message = Build(version, payloads);
+            for (int flips = rng() % 4; flips > 0 && !message.empty(); flips--) {
+                message[rng() % message.size()] ^= 1 << (rng() % 8);
+            }
+            if (rng() % 4 == 0 && !message.empty()) {
+                message.resize(rng() % message.size());
+            }
+        }
+        // Exact size allocation, so ASan sees a read one past the end
+        std::vector<uint8_t> exact(message);
+        exact.shrink_to_fit();
+        CheckInvariants(version, exact, nullptr);
+    }
+}
+
+int main() {
+    RUN_TEST(TestRoundTrip);
+    RUN_TEST(TestEmptyPayloadAndType);
+    RUN_TEST(TestTruncated);
+    RUN_TEST(TestOversizedLength);
+    RUN_TEST(TestFuzz);
+    return 0;
+}
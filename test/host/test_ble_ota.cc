@@ -0,0 +1,680 @@
+#include "ble_ota.h"
+#include "ble_route.h"
+#include "ble_crc32.h"
+#include "ota_image_decoder.h"
+#include "test_util.h"
+
+#include <esp_ota_ops.h>
+#include <spi_flash_mmap.h>
+#include <nvs.h>
+#include <freertos/task.h>
+#include <host/ble_hs.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * BLE OTA end to end on the host: ble_ota.c, ble_protocol.c, ble_route.c and the CRC32 code as they are,
+ * with the APP played by the test. Writes go in through ble_route_dispatch(), responses come back through
+ * esp_ble_notify_data(). Flash, NVS and the image decoder are fakes, the decoder passes raw images through.
+ *
+ * Each scenario runs in a child process with its own ble_ota_init(). The update partition and NVS live in
+ * shared memory, so a child that exits mid-transfer is a power cut and the next child is the device after
+ * the reboot.
+ */
+
+using namespace std::chrono_literals;
+
+static constexpr uint32_t kPartitionSize = 1024 * 1024;
+static constexpr uint16_t kMtu = 247;
+static constexpr size_t kWriteSize = 240;
+static constexpr size_t kPacketSize = 4096;
+static constexpr uint32_t kCheckpointInterval = 64 * 1024;
+
+// State that outlives a child process
+struct Persistent {
+    uint8_t flash[kPartitionSize];
+    bool checkpoint_saved;
+    size_t checkpoint_size;
+    uint8_t checkpoint[64];
+    bool boot_partition_set;
+};
+static Persistent* persistent;
+
+static const esp_partition_t kRunning = {0x10000, kPartitionSize, "ota_0"};
+static const esp_partition_t kUpdate = {0x110000, kPartitionSize, "ota_1"};
+static std::mutex flash_mutex;
+
+extern "C" esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* dst, size_t size) {
+    CHECK(partition == &kUpdate && offset + size <= partition->size);
+    std::lock_guard<std::mutex> lock(flash_mutex);
+    memcpy(dst, persistent->flash + offset, size);
+    return ESP_OK;
+}
+
+// NOR flash: a write only clears bits, writing over bytes that were not erased corrupts them
+extern "C" esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* src, size_t size) {
+    CHECK(partition == &kUpdate && offset + size <= partition->size);
+    // Flash encryption writes in 16 byte units
+    CHECK(offset % 16 == 0 && size % 16 == 0);
+    std::lock_guard<std::mutex> lock(flash_mutex);
+    auto bytes = static_cast<const uint8_t*>(src);
+    for (size_t i = 0; i < size; i++) {
+        persistent->flash[offset + i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+extern "C" esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    CHECK(partition == &kUpdate && offset + size <= partition->size);
+    CHECK(offset % SPI_FLASH_SEC_SIZE == 0 && size % SPI_FLASH_SEC_SIZE == 0);
+    std::lock_guard<std::mutex> lock(flash_mutex);
+    memset(persistent->flash + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+extern "C" const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from) {
+    return &kUpdate;
+}
+
+extern "C" const esp_partition_t* esp_ota_get_running_partition(void) {
+    return &kRunning;
+}
+
+extern "C" esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition) {
+    CHECK(partition == &kUpdate);
+    persistent->boot_partition_set = true;
+    return ESP_OK;
+}
+
+extern "C" const esp_app_desc_t* esp_app_get_description(void) {
+    static const esp_app_desc_t desc = {"1.0.0", "xiaozhi"};
+    return &desc;
+}
+
+// NVS with the one key ble_ota uses
+extern "C" esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle) {
+    CHECK(strcmp(name, "ble_ota") == 0);
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+extern "C" void nvs_close(nvs_handle_t handle) {
+}
+
+extern "C" esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length) {
+    CHECK(strcmp(key, "checkpoint") == 0);
+    if (!persistent->checkpoint_saved) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    CHECK(*length >= persistent->checkpoint_size);
+    memcpy(out_value, persistent->checkpoint, persistent->checkpoint_size);
+    *length = persistent->checkpoint_size;
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+    CHECK(strcmp(key, "checkpoint") == 0 && length <= sizeof(persistent->checkpoint));
+    memcpy(persistent->checkpoint, value, length);
+    persistent->checkpoint_size = length;
+    persistent->checkpoint_saved = true;
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    if (!persistent->checkpoint_saved) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    persistent->checkpoint_saved = false;
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_commit(nvs_handle_t handle) {
+    return ESP_OK;
+}
+
+// Raw images only: the decoder hands the bytes through
+struct ota_image_decoder {
+    ota_image_write_cb_t write_cb;
+    void* ctx;
+};
+static std::atomic<int> decoders_created{0};
+
+ota_image_decoder_t* ota_image_decoder_create(const esp_partition_t* source, ota_image_write_cb_t write_cb, void* ctx) {
+    CHECK(source == &kRunning);
+    decoders_created++;
+    return new ota_image_decoder{write_cb, ctx};
+}
+
+void ota_image_decoder_destroy(ota_image_decoder_t* decoder) {
+    delete decoder;
+}
+
+esp_err_t ota_image_decoder_feed(ota_image_decoder_t* decoder, const uint8_t* data, size_t len) {
+    return decoder->write_cb(decoder->ctx, data, len);
+}
+
+esp_err_t ota_image_decoder_finish(ota_image_decoder_t* decoder) {
+    CHECK(decoder != nullptr);
+    return ESP_OK;
+}
+
+ota_image_type_t ota_image_decoder_get_type(const ota_image_decoder_t* decoder) {
+    CHECK(decoder != nullptr);
+    return OTA_IMAGE_TYPE_RAW;
+}
+
+size_t ota_image_decoder_get_image_size(const ota_image_decoder_t* decoder) {
+    return 0;
+}
+
+// The BLE side: event callbacks, notifications to the APP
+struct Notification {
+    uint16_t conn_id;
+    std::vector<uint8_t> data;
+};
+static std::mutex ble_mutex;
+static std::condition_variable ble_cv;
+static std::deque<Notification> notifications;
+static std::vector<ble_evt_callback_t> callbacks;
+static std::atomic<bool> finished{false};
+
+extern "C" int esp_ble_register_evt_callback(ble_evt_callback_t callback) {
+    std::lock_guard<std::mutex> lock(ble_mutex);
+    callbacks.push_back(callback);
+    return ESP_OK;
+}
+
+extern "C" int esp_ble_unregister_evt_callback(ble_evt_callback_t callback) {
+    return ESP_OK;
+}
+
+extern "C" uint16_t esp_ble_get_notify_handle(void) {
+    return 42;
+}
+
+extern "C" uint16_t esp_ble_get_mtu(uint16_t conn_id) {
+    return kMtu;
+}
+
+extern "C" int esp_ble_notify_data(uint16_t conn_id, uint16_t handle, uint8_t* p_data, uint16_t len) {
+    std::lock_guard<std::mutex> lock(ble_mutex);
+    notifications.push_back({conn_id, std::vector<uint8_t>(p_data, p_data + len)});
+    ble_cv.notify_all();
+    return 0;
+}
+
+extern "C" int ble_gap_set_prefered_le_phy(uint16_t conn_handle, uint8_t tx_phys_mask, uint8_t rx_phys_mask, uint16_t phy_opts) {
+    return 0;
+}
+
+static void OnProgress(int progress, const char* message) {
+    if (progress == 100) {
+        finished = true;
+    }
+}
+
+static void PutU32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(value >> (8 * i));
+    }
+}
+
+static uint32_t GetU32(const uint8_t* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static std::string MakeImage(size_t size, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::string image(size, '\0');
+    for (auto& c : image) {
+        c = (char)rng();
+    }
+    return image;
+}
+
+static uint32_t Crc(const std::string& data, size_t offset, size_t len) {
+    return ble_crc32_update(0, data.data() + offset, len);
+}
+
+// The phone side of the protocol, one packet in flight at a time
+class App {
+public:
+    App(const std::string& image, uint16_t conn_id, uint8_t version = 2) : image_(image), conn_id_(conn_id) {
+        info_ = {1, 0, version};
+        PutU32(info_, image.size());
+        PutU32(info_, Crc(image, 0, image.size()));
+    }
+
+    void Write(uint8_t cmd, const uint8_t* payload, size_t len) {
+        std::vector<uint8_t> packet = {BLE_PROTOCOL_HEADER_0, BLE_PROTOCOL_HEADER_1, cmd};
+        packet.insert(packet.end(), payload, payload + len);
+        os_mbuf om = {packet.data(), (uint16_t)packet.size(), nullptr};
+        CHECK(ble_route_dispatch(conn_id_, &om));
+    }
+
+    void Write(uint8_t cmd, const std::vector<uint8_t>& payload) {
+        Write(cmd, payload.data(), payload.size());
+    }
+
+    std::vector<uint8_t> Response(uint8_t cmd) {
+        std::unique_lock<std::mutex> lock(ble_mutex);
+        CHECK(ble_cv.wait_for(lock, 10s, [] { return !notifications.empty(); }));
+        auto notification = std::move(notifications.front());
+        notifications.pop_front();
+        CHECK_EQ(notification.conn_id, conn_id_);
+        auto& data = notification.data;
+        CHECK(data.size() >= 4);
+        CHECK(data[0] == BLE_PROTOCOL_HEADER_0 && data[1] == BLE_PROTOCOL_HEADER_1);
+        CHECK_EQ(data[2], cmd);
+        return std::vector<uint8_t>(data.begin() + 3, data.end());
+    }
+
+    void QueryResume(uint32_t* offset, uint32_t* crc) {
+        Write(BLE_OTA_CMD_QUERY_RESUME, info_);
+        auto response = Response(BLE_OTA_CMD_QUERY_RESUME);
+        CHECK_EQ(response.size(), 9);
+        CHECK_EQ(response[0], BLE_OTA_ACK_SUCCESS);
+        *offset = GetU32(&response[1]);
+        *crc = GetU32(&response[5]);
+    }
+
+    // Without a window the device answers like before the window existed
+    void Start(uint8_t window = 0) {
+        auto info = info_;
+        if (window > 0) {
+            info.push_back(window);
+        }
+        Write(BLE_OTA_CMD_SEND_FILE_INFO, info);
+        auto response = Response(BLE_OTA_CMD_SEND_FILE_INFO);
+        CHECK_EQ(response.size(), window > 0 ? 4 : 3);
+        CHECK_EQ(response[0], BLE_OTA_ACK_SUCCESS);
+        CHECK_EQ(response[1] | (response[2] << 8), kPacketSize);
+        if (window > 0) {
+            CHECK_EQ(response[3], window);
+        }
+    }
+
+    // Data of one packet in MTU sized writes, acknowledged once complete, then its CRC
+    void SendPacket(uint32_t offset) {
+        size_t len = std::min(kPacketSize, image_.size() - offset);
+        SendData(offset, len);
+        auto ack = Response(BLE_OTA_CMD_SEND_FILE_DATA);
+        CHECK(ack.size() == 1 && ack[0] == BLE_OTA_ACK_SUCCESS);
+
+        std::vector<uint8_t> crc;
+        PutU32(crc, Crc(image_, offset, len));
+        Write(BLE_OTA_CMD_SEND_PACKET_CRC, crc);
+        auto response = Response(BLE_OTA_CMD_SEND_PACKET_CRC);
+        CHECK_EQ(response.size(), 5);
+        CHECK_EQ(response[0], BLE_OTA_ACK_SUCCESS);
+        CHECK_EQ(GetU32(&response[1]), GetU32(crc.data()));
+    }
+
+    void SendData(uint32_t offset, size_t len) {
+        for (size_t pos = 0; pos < len; pos += kWriteSize) {
+            Write(BLE_OTA_CMD_SEND_FILE_DATA, (const uint8_t*)image_.data() + offset + pos, std::min(kWriteSize, len - pos));
+        }
+    }
+
+    // Packets from offset up to, not including, end
+    void SendPackets(uint32_t offset, uint32_t end) {
+        for (; offset < end; offset += kPacketSize) {
+            SendPacket(offset);
+        }
+    }
+
+    void Finish(uint32_t offset) {
+        SendPackets(offset, image_.size());
+        for (int i = 0; i < 100 && !finished; i++) {
+            std::this_thread::sleep_for(10ms);
+        }
+        CHECK(finished);
+    }
+
+    void Disconnect() {
+        ble_route_disconnected(conn_id_);
+        ble_evt_t evt = {};
+        evt.evt_id = BLE_EVT_DISCONNECTED;
+        evt.params.disconnected.conn_id = conn_id_;
+        std::vector<ble_evt_callback_t> current;
+        {
+            std::lock_guard<std::mutex> lock(ble_mutex);
+            current = callbacks;
+        }
+        for (auto callback : current) {
+            callback(&evt);
+        }
+    }
+
+    std::vector<uint8_t>& info() { return info_; }
+
+private:
+    const std::string& image_;
+    uint16_t conn_id_;
+    std::vector<uint8_t> info_;
+};
+
+static bool WaitForState(ble_ota_state_t state) {
+    for (int i = 0; i < 300; i++) {
+        if (ble_ota_get_state() == state) {
+            return true;
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+    return false;
+}
+
+static void CheckNothingPending() {
+    std::this_thread::sleep_for(20ms);
+    std::lock_guard<std::mutex> lock(ble_mutex);
+    CHECK(notifications.empty());
+}
+
+// The partition holds the image, the last 16 byte unit padded with 0xFF, and the device boots it
+static void CheckFlashed(const std::string& image) {
+    CHECK(persistent->boot_partition_set);
+    CHECK(!persistent->checkpoint_saved);
+    CHECK(memcmp(persistent->flash, image.data(), image.size()) == 0);
+    for (size_t i = image.size(); i % 16 != 0; i++) {
+        CHECK_EQ(persistent->flash[i], 0xFF);
+    }
+}
+
+// Runs one boot of the device in a child process, returns when it exited
+static void Boot(const std::function<void()>& body) {
+    fflush(stdout);
+    pid_t pid = fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        CHECK_EQ(ble_ota_init(OnProgress), ESP_OK);
+        body();
+        // The OTA tasks are still running, skip the static destructors
+        _exit(0);
+    }
+    int status = 0;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+// Flash left by the previous firmware, nothing erased
+static void ResetDevice() {
+    memset(persistent->flash, 0x5A, sizeof(persistent->flash));
+    persistent->checkpoint_saved = false;
+    persistent->boot_partition_set = false;
+}
+
+static const std::string kImage = MakeImage(300 * 1024 + 1234, 1);
+
+static void TestFreshTransfer() {
+    ResetDevice();
+    Boot([] {
+        App app(kImage, 1);
+        uint32_t offset, crc;
+        app.QueryResume(&offset, &crc);
+        CHECK(offset == 0 && crc == 0);
+        app.Start(4);
+        app.Finish(0);
+        CheckFlashed(kImage);
+        CHECK_EQ(decoders_created, 1);
+    });
+}
+
+// Legacy APP: no window, no 0x06
+static void TestLegacyApp() {
+    ResetDevice();
+    Boot([] {
+        App app(kImage, 1);
+        app.Start();
+        app.Finish(0);
+        CheckFlashed(kImage);
+    });
+}
+
+static void TestResumeAfterDisconnect() {
+    ResetDevice();
+    Boot([] {
+        App first(kImage, 1);
+        first.Start(4);
+        uint32_t acked = 10 * kPacketSize;
+        first.SendPackets(0, acked);
+        // Half a packet that is never acknowledged
+        first.SendData(acked, 1000);
+        first.Disconnect();
+        CHECK(WaitForState(BLE_OTA_STATE_SUSPENDED));
+        // Leftovers of the old connection do not touch the session
+        first.SendData(acked + 1000, 240);
+        CheckNothingPending();
+
+        App second(kImage, 2);
+        uint32_t offset, crc;
+        second.QueryResume(&offset, &crc);
+        CHECK_EQ(offset, acked);
+        CHECK_EQ(crc, Crc(kImage, 0, acked));
+        second.Start(4);
+        second.Finish(offset);
+        CheckFlashed(kImage);
+        // The session went on with the decoder it had
+        CHECK_EQ(decoders_created, 1);
+    });
+}
+
+// Interrupted twice, each time the session goes on from the last acknowledged packet
+static void TestResumeTwice() {
+    ResetDevice();
+    Boot([] {
+        App first(kImage, 1);
+        first.Start(2);
+        first.SendPackets(0, 5 * kPacketSize);
+        first.Disconnect();
+        CHECK(WaitForState(BLE_OTA_STATE_SUSPENDED));
+
+        App second(kImage, 2);
+        uint32_t offset, crc;
+        second.QueryResume(&offset, &crc);
+        CHECK_EQ(offset, 5 * kPacketSize);
+        second.Start(2);
+        second.SendPackets(offset, 30 * kPacketSize);
+        second.SendData(30 * kPacketSize, 2000);
+        second.Disconnect();
+        CHECK(WaitForState(BLE_OTA_STATE_SUSPENDED));
+
+        App third(kImage, 3);
+        third.QueryResume(&offset, &crc);
+        CHECK_EQ(offset, 30 * kPacketSize);
+        CHECK_EQ(crc, Crc(kImage, 0, offset));
+        third.Start(2);
+        third.Finish(offset);
+        CheckFlashed(kImage);
+    });
+}
+
+// Power cut with blocks still queued for flash, the next boot continues from the NVS checkpoint
+static void TestResumeAfterReboot() {
+    ResetDevice();
+    uint32_t acked = 40 * kPacketSize;
+    Boot([acked] {
+        App app(kImage, 1);
+        app.Start(4);
+        app.SendPackets(0, acked);
+        app.SendData(acked, 3000);
+    });
+    // The sector after the acknowledged data was partly written before the power went
+    memset(persistent->flash + acked, 0x00, 100);
+
+    Boot([acked] {
+        App app(kImage, 5);
+        uint32_t offset, crc;
+        app.QueryResume(&offset, &crc);
+        // A checkpoint is saved each time the flashed image crosses 64 KB, it may lag behind the acknowledged data
+        CHECK(offset > 0 && offset % kCheckpointInterval == 0 && offset <= acked);
+        CHECK(offset + kCheckpointInterval + 5 * kPacketSize > acked);
+        CHECK_EQ(crc, Crc(kImage, 0, offset));
+        app.Start(4);
+        app.Finish(offset);
+        CheckFlashed(kImage);
+        // Raw image written straight to the partition after the reboot
+        CHECK_EQ(decoders_created, 0);
+    });
+}
+
+// The flash before the checkpoint does not match its CRC: the APP is told to start over
+static void TestCorruptedCheckpoint() {
+    ResetDevice();
+    Boot([] {
+        App app(kImage, 1);
+        app.Start(4);
+        app.SendPackets(0, 40 * kPacketSize);
+    });
+    CHECK(persistent->checkpoint_saved);
+    persistent->flash[1000] ^= 0x01;
+
+    Boot([] {
+        App app(kImage, 1);
+        uint32_t offset, crc;
+        app.QueryResume(&offset, &crc);
+        CHECK(offset == 0 && crc == 0);
+        app.Start(4);
+        app.Finish(0);
+        CheckFlashed(kImage);
+    });
+}
+
+// A checkpoint inside a sector, as an older build or another packet size leaves it: resume from the sector start
+static void TestUnalignedCheckpoint() {
+    ResetDevice();
+    uint32_t written = 72 * 1024;
+    uint32_t checkpoint_offset = 70000;
+    memset(persistent->flash, 0xFF, sizeof(persistent->flash));
+    memcpy(persistent->flash, kImage.data(), written);
+    // ble_ota_checkpoint_t: version(3) reserved(1) file_size file_crc32 partition_address offset crc32
+    std::vector<uint8_t> checkpoint = {1, 0, 2, 0};
+    PutU32(checkpoint, kImage.size());
+    PutU32(checkpoint, Crc(kImage, 0, kImage.size()));
+    PutU32(checkpoint, kUpdate.address);
+    PutU32(checkpoint, checkpoint_offset);
+    PutU32(checkpoint, Crc(kImage, 0, checkpoint_offset));
+    memcpy(persistent->checkpoint, checkpoint.data(), checkpoint.size());
+    persistent->checkpoint_size = checkpoint.size();
+    persistent->checkpoint_saved = true;
+
+    Boot([checkpoint_offset] {
+        App app(kImage, 1);
+        uint32_t offset, crc;
+        app.QueryResume(&offset, &crc);
+        CHECK_EQ(offset, checkpoint_offset / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE);
+        CHECK_EQ(crc, Crc(kImage, 0, offset));
+        app.Start(4);
+        app.Finish(offset);
+        CheckFlashed(kImage);
+    });
+}
+
+// A suspended session is released after 5 minutes, the raw image still resumes from flash
+static void TestSuspendedSessionExpires() {
+    ResetDevice();
+    Boot([] {
+        App first(kImage, 1);
+        first.Start(4);
+        first.SendPackets(0, 20 * kPacketSize);
+        first.Disconnect();
+        CHECK(WaitForState(BLE_OTA_STATE_SUSPENDED));
+        host_tick_advance(pdMS_TO_TICKS(5 * 60 * 1000 + 1000));
+        CHECK(WaitForState(BLE_OTA_STATE_IDLE));
+
+        App second(kImage, 2);
+        uint32_t offset, crc;
+        second.QueryResume(&offset, &crc);
+        CHECK_EQ(offset, kCheckpointInterval);
+        CHECK_EQ(crc, Crc(kImage, 0, offset));
+        second.Start(4);
+        second.Finish(offset);
+        CheckFlashed(kImage);
+    });
+}
+
+// Another image, or a 0x03 that was not preceded by a query, starts from the beginning
+static void TestOtherImageStartsOver() {
+    static const std::string other = MakeImage(150 * 1024 + 7, 2);
+    ResetDevice();
+    Boot([] {
+        App first(kImage, 1);
+        first.Start(4);
+        first.SendPackets(0, 20 * kPacketSize);
+        first.Disconnect();
+        CHECK(WaitForState(BLE_OTA_STATE_SUSPENDED));
+
+        App second(other, 2, 3);
+        uint32_t offset, crc;
+        second.QueryResume(&offset, &crc);
+        CHECK(offset == 0 && crc == 0);
+        second.Start(4);
+        second.Finish(0);
+        CheckFlashed(other);
+    });
+
+    ResetDevice();
+    Boot([] {
+        App first(kImage, 1);
+        first.Start(4);
+        first.SendPackets(0, 20 * kPacketSize);
+        first.Disconnect();
+        CHECK(WaitForState(BLE_OTA_STATE_SUSPENDED));
+
+        App second(kImage, 2);
+        second.Start(4);
+        second.Finish(0);
+        CheckFlashed(kImage);
+    });
+}
+
+// The query only counts for the connection that made it
+static void TestQueryFromOtherConnection() {
+    ResetDevice();
+    Boot([] {
+        App first(kImage, 1);
+        first.Start(4);
+        first.SendPackets(0, 10 * kPacketSize);
+        first.Disconnect();
+        CHECK(WaitForState(BLE_OTA_STATE_SUSPENDED));
+
+        App asking(kImage, 2);
+        uint32_t offset, crc;
+        asking.QueryResume(&offset, &crc);
+        CHECK_EQ(offset, 10 * kPacketSize);
+
+        App starting(kImage, 3);
+        starting.Start(4);
+        starting.Finish(0);
+        CheckFlashed(kImage);
+    });
+}
+
+int main() {
+    persistent = static_cast<Persistent*>(mmap(nullptr, sizeof(Persistent), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    CHECK(persistent != MAP_FAILED);
+
+    RUN_TEST(TestFreshTransfer);
+    RUN_TEST(TestLegacyApp);
+    RUN_TEST(TestResumeAfterDisconnect);
+    RUN_TEST(TestResumeTwice);
+    RUN_TEST(TestResumeAfterReboot);
+    RUN_TEST(TestCorruptedCheckpoint);
+    RUN_TEST(TestUnalignedCheckpoint);
+    RUN_TEST(TestSuspendedSessionExpires);
+    RUN_TEST(TestOtherImageStartsOver);
+    RUN_TEST(TestQueryFromOtherConnection);
+    return 0;
+}
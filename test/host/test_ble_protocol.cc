@@ -0,0 +1,286 @@
+#include "ble_protocol.h"
+#include "ble_route.h"
+#include "test_util.h"
+
+#include <freertos/ringbuf.h>
+#include <esp_err.h>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * Responses from ble_protocol_send_response() as the APP receives them, fed back through ble_route_dispatch(),
+ * which reassembles segments the same way the APP does. NimBLE is a fake: the MTU is set per test and
+ * esp_ble_notify_data() keeps every notification, optionally running out of buffers first.
+ */
+
+static constexpr uint16_t kConn = 1;
+static constexpr uint8_t kCmd = BLE_PROTOCOL_CMD_GET_WIFI_SCAN;
+
+static uint16_t mtu = 247;
+static int out_of_buffers = 0;
+static int notify_calls = 0;
+static std::vector<std::vector<uint8_t>> notifications;
+static ble_evt_callback_t event_callback = nullptr;
+
+extern "C" int esp_ble_register_evt_callback(ble_evt_callback_t callback) {
+    event_callback = callback;
+    return ESP_OK;
+}
+
+extern "C" uint16_t esp_ble_get_notify_handle(void) {
+    return 42;
+}
+
+extern "C" uint16_t esp_ble_get_mtu(uint16_t conn_id) {
+    return mtu;
+}
+
+extern "C" int esp_ble_notify_data(uint16_t conn_id, uint16_t handle, uint8_t* p_data, uint16_t len) {
+    notify_calls++;
+    CHECK_EQ(conn_id, kConn);
+    CHECK_EQ(handle, 42);
+    if (out_of_buffers > 0) {
+        out_of_buffers--;
+        // The stack frees a buffer later, BLE_EVT_DATA_SENT arrives before the retry
+        ble_evt_t evt = {};
+        evt.evt_id = BLE_EVT_DATA_SENT;
+        event_callback(&evt);
+        return ESP_ERR_NO_MEM;
+    }
+    notifications.emplace_back(p_data, p_data + len);
+    return 0;
+}
+
+static std::string RandomMessage(size_t size, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::string message(size, '\0');
+    for (auto& c : message) {
+        c = (char)rng();
+    }
+    return message;
+}
+
+static bool Dispatch(std::vector<uint8_t>& data) {
+    os_mbuf om = {data.data(), (uint16_t)data.size(), nullptr};
+    return ble_route_dispatch(kConn, &om);
+}
+
+// The APP sends a segmented frame of its own first, which tells the device it takes segments too
+static void EnableSar(ble_route_handle_t route) {
+    std::vector<uint8_t> segment = {BLE_PROTOCOL_HEADER_0, BLE_PROTOCOL_SAR_HEADER_1, kCmd, 0, 1, 0, 'x'};
+    CHECK(Dispatch(segment));
+    ble_route_packet_t* packet = esp_ble_route_receive(route, 0);
+    CHECK(packet != nullptr);
+    esp_ble_route_return(route, packet);
+    CHECK(ble_protocol_sar_enabled(kConn));
+}
+
+static bool Receive(ble_route_handle_t route, std::string* payload) {
+    ble_route_packet_t* packet = esp_ble_route_receive(route, 0);
+    if (packet == nullptr) {
+        return false;
+    }
+    CHECK_EQ(packet->data[2], kCmd);
+    payload->assign((const char*)&packet->data[BLE_PROTOCOL_MIN_PACKET_LEN], packet->len - BLE_PROTOCOL_MIN_PACKET_LEN);
+    esp_ble_route_return(route, packet);
+    return true;
+}
+
+static std::vector<std::vector<uint8_t>> Send(const std::string& message) {
+    notifications.clear();
+    CHECK_EQ(ble_protocol_send_response(kConn, kCmd, (const uint8_t*)message.data(), message.size()), ESP_OK);
+    return notifications;
+}
+
+static ble_route_handle_t Setup(uint16_t new_mtu) {
+    mtu = new_mtu;
+    ble_route_handle_t route = nullptr;
+    CHECK_EQ(esp_ble_register_route(0x00, 0x02, 16 * 1024, &route), ESP_OK);
+    EnableSar(route);
+    return route;
+}
+
+static void Teardown(ble_route_handle_t route) {
+    ble_route_disconnected(kConn);
+    CHECK_EQ(host_ringbuf_used(route->ring), 0);
+    CHECK_EQ(esp_ble_unregister_route(route), ESP_OK);
+}
+
+static void TestSinglePacket() {
+    auto route = Setup(23);
+    // 20 bytes per notification, 3 of them header
+    auto packets = Send(std::string(17, 'a'));
+    CHECK_EQ(packets.size(), 1);
+    CHECK_EQ(packets[0].size(), 20);
+    uint8_t cmd;
+    const uint8_t* payload;
+    size_t payload_len;
+    CHECK(ble_protocol_parse_packet(packets[0].data(), packets[0].size(), &cmd, &payload, &payload_len));
+    CHECK(cmd == kCmd && payload_len == 17 && payload[16] == 'a');
+
+    packets = Send("");
+    CHECK_EQ(packets.size(), 1);
+    CHECK_EQ(packets[0].size(), BLE_PROTOCOL_MIN_PACKET_LEN);
+    Teardown(route);
+}
+
+static void TestRoundTrip() {
+    for (uint16_t new_mtu : {23, 185, 247, 512}) {
+        auto route = Setup(new_mtu);
+        size_t max_packet = mtu - 3;
+        for (size_t size : {max_packet - 3, max_packet - 2, (size_t)1000, (size_t)BLE_PROTOCOL_MAX_MESSAGE_LEN}) {
+            std::string message = RandomMessage(size, size);
+            auto packets = Send(message);
+            size_t expected = 1;
+            if (BLE_PROTOCOL_MIN_PACKET_LEN + size > max_packet) {
+                size_t rest = size - (max_packet - BLE_PROTOCOL_SAR_FIRST_HEADER_LEN);
+                expected += (rest + max_packet - BLE_PROTOCOL_SAR_HEADER_LEN - 1) / (max_packet - BLE_PROTOCOL_SAR_HEADER_LEN);
+            }
+            CHECK_EQ(packets.size(), expected);
+            for (auto& packet : packets) {
+                CHECK(packet.size() <= max_packet);
+                CHECK(Dispatch(packet));
+            }
+            std::string payload;
+            CHECK(Receive(route, &payload));
+            CHECK(payload == message);
+            CHECK(!Receive(route, &payload));
+        }
+        Teardown(route);
+    }
+}
+
+// 4 KB in 16 byte segments: the sequence runs from 0 over 255 and goes on at 1, never back to 0
+static void TestSequenceWrap() {
+    auto route = Setup(23);
+    std::string message = RandomMessage(BLE_PROTOCOL_MAX_MESSAGE_LEN, 7);
+    auto packets = Send(message);
+    CHECK(packets.size() > 256);
+    CHECK_EQ(packets[0][3], 0);
+    for (size_t i = 1; i < packets.size(); i++) {
+        CHECK_EQ(packets[i][1], BLE_PROTOCOL_SAR_HEADER_1);
+        CHECK_EQ(packets[i][3], i <= 255 ? i : i - 255);
+    }
+    for (auto& packet : packets) {
+        CHECK(Dispatch(packet));
+    }
+    std::string payload;
+    CHECK(Receive(route, &payload));
+    CHECK(payload == message);
+    Teardown(route);
+}
+
+static void TestOutOfOrderAndShortSegments() {
+    auto route = Setup(185);
+    std::string message = RandomMessage(1000, 1);
+    auto packets = Send(message);
+    CHECK(packets.size() >= 4);
+    std::string payload;
+
+    // Two segments swapped
+    auto swapped = packets;
+    std::swap(swapped[1], swapped[2]);
+    for (auto& packet : swapped) {
+        Dispatch(packet);
+    }
+    CHECK(!Receive(route, &payload));
+
+    // A segment cut short leaves the message short of its announced length, the next first segment drops it
+    auto truncated = packets;
+    truncated[1].resize(truncated[1].size() / 2);
+    for (auto& packet : truncated) {
+        Dispatch(packet);
+    }
+    CHECK(!Receive(route, &payload));
+
+    // A first segment too short to carry the length
+    std::vector<uint8_t> header_only(packets[0].begin(), packets[0].begin() + BLE_PROTOCOL_SAR_HEADER_LEN + 1);
+    Dispatch(header_only);
+    CHECK(!Receive(route, &payload));
+
+    // Nothing left behind, the message in order goes through
+    for (auto& packet : packets) {
+        CHECK(Dispatch(packet));
+    }
+    CHECK(Receive(route, &payload));
+    CHECK(payload == message);
+    Teardown(route);
+}
+
+// A message cut off by a new first segment or by a disconnect is dropped, the one after it is delivered
+static void TestInterruptedMessage() {
+    auto route = Setup(185);
+    std::string first = RandomMessage(1000, 1);
+    std::string second = RandomMessage(700, 2);
+    auto first_packets = Send(first);
+    auto second_packets = Send(second);
+    std::string payload;
+
+    Dispatch(first_packets[0]);
+    Dispatch(first_packets[1]);
+    for (auto& packet : second_packets) {
+        CHECK(Dispatch(packet));
+    }
+    CHECK(Receive(route, &payload));
+    CHECK(payload == second);
+    CHECK(!Receive(route, &payload));
+
+    Dispatch(first_packets[0]);
+    ble_route_disconnected(kConn);
+    for (size_t i = 1; i < first_packets.size(); i++) {
+        Dispatch(first_packets[i]);
+    }
+    CHECK(!Receive(route, &payload));
+    CHECK_EQ(host_ringbuf_used(route->ring), 0);
+
+    // Segmented responses need the APP to send a segment again after the disconnect
+    CHECK(!ble_protocol_sar_enabled(kConn));
+    notifications.clear();
+    CHECK_EQ(ble_protocol_send_response(kConn, kCmd, (const uint8_t*)first.data(), first.size()), ESP_ERR_INVALID_SIZE);
+    CHECK(notifications.empty());
+    CHECK_EQ(esp_ble_unregister_route(route), ESP_OK);
+}
+
+static void TestInvalidResponses() {
+    auto route = Setup(247);
+    std::string too_long(BLE_PROTOCOL_MAX_MESSAGE_LEN + 1, 'x');
+    notifications.clear();
+    CHECK_EQ(ble_protocol_send_response(kConn, kCmd, (const uint8_t*)too_long.data(), too_long.size()), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(ble_protocol_send_response(kConn, kCmd, nullptr, 1), ESP_ERR_INVALID_ARG);
+    // Not even room for the first segment header and one byte
+    mtu = 9;
+    CHECK_EQ(ble_protocol_send_response(kConn, kCmd, (const uint8_t*)"abcd", 4), ESP_ERR_INVALID_STATE);
+    CHECK(notifications.empty());
+    Teardown(route);
+}
+
+// Out of stack buffers, each segment is retried after the next BLE_EVT_DATA_SENT instead of failing
+static void TestOutOfBuffers() {
+    auto route = Setup(23);
+    std::string message = RandomMessage(100, 3);
+    out_of_buffers = 5;
+    notify_calls = 0;
+    auto packets = Send(message);
+    CHECK_EQ(out_of_buffers, 0);
+    CHECK_EQ(notify_calls, (int)packets.size() + 5);
+    for (auto& packet : packets) {
+        CHECK(Dispatch(packet));
+    }
+    std::string payload;
+    CHECK(Receive(route, &payload));
+    CHECK(payload == message);
+    Teardown(route);
+}
+
+int main() {
+    CHECK_EQ(ble_protocol_init(), ESP_OK);
+    RUN_TEST(TestSinglePacket);
+    RUN_TEST(TestRoundTrip);
+    RUN_TEST(TestSequenceWrap);
+    RUN_TEST(TestOutOfOrderAndShortSegments);
+    RUN_TEST(TestInterruptedMessage);
+    RUN_TEST(TestInvalidResponses);
+    RUN_TEST(TestOutOfBuffers);
+    return 0;
+}
@@ -0,0 +1,323 @@
+#include "ble_route.h"
+#include "ble_protocol.h"
+#include "test_util.h"
+
+#include <freertos/ringbuf.h>
+#include <esp_err.h>
+#include <random>
+#include <string>
+#include <vector>
+
+static constexpr uint16_t kConn = 1;
+static constexpr uint8_t kCmd = 0x04;
+
+// A GATT write as NimBLE hands it over, split into mbufs of at most block bytes
+struct Write {
+    std::vector<uint8_t> data;
+    std::vector<os_mbuf> chain;
+
+    Write(std::vector<uint8_t> bytes, size_t block = 64) : data(std::move(bytes)) {
+        for (size_t pos = 0; pos < data.size(); pos += block) {
+            size_t n = data.size() - pos < block ? data.size() - pos : block;
+            chain.push_back({&data[pos], (uint16_t)n, nullptr});
+        }
+        for (size_t i = 0; i + 1 < chain.size(); i++) {
+            chain[i].om_next = &chain[i + 1];
+        }
+    }
+
+    bool Dispatch(uint16_t conn_id = kConn) {
+        os_mbuf empty = {nullptr, 0, nullptr};
+        return ble_route_dispatch(conn_id, chain.empty() ? &empty : &chain[0]);
+    }
+};
+
+static std::vector<uint8_t> Packet(uint8_t cmd, const std::string& payload) {
+    std::vector<uint8_t> packet = {BLE_PROTOCOL_HEADER_0, BLE_PROTOCOL_HEADER_1, cmd};
+    packet.insert(packet.end(), payload.begin(), payload.end());
+    return packet;
+}
+
+static std::vector<uint8_t> Segment(uint8_t cmd, uint8_t seq, const std::string& data, int total_len = -1) {
+    std::vector<uint8_t> segment = {BLE_PROTOCOL_HEADER_0, BLE_PROTOCOL_SAR_HEADER_1, cmd, seq};
+    if (total_len >= 0) {
+        segment.push_back(total_len & 0xFF);
+        segment.push_back(total_len >> 8);
+    }
+    segment.insert(segment.end(), data.begin(), data.end());
+    return segment;
+}
+
+// Splits a message into segments of at most segment_size payload bytes, sequence numbers as the APP sends them
+static std::vector<std::vector<uint8_t>> Segments(uint8_t cmd, const std::string& message, size_t segment_size) {
+    std::vector<std::vector<uint8_t>> segments;
+    uint8_t seq = 0;
+    size_t pos = 0;
+    do {
+        std::string chunk = message.substr(pos, segment_size);
+        segments.push_back(Segment(cmd, seq, chunk, seq == 0 && pos == 0 ? (int)message.size() : -1));
+        pos += chunk.size();
+        seq = seq == 255 ? 1 : seq + 1;
+    } while (pos < message.size());
+    return segments;
+}
+
+// Next routed message as a string, the empty items of dropped messages are skipped
+static bool Receive(ble_route_handle_t route, std::string* payload, uint8_t* cmd = nullptr, uint16_t* conn_id = nullptr) {
+    ble_route_packet_t* packet = esp_ble_route_receive(route, 0);
+    if (packet == nullptr) {
+        return false;
+    }
+    CHECK(packet->len >= BLE_PROTOCOL_MIN_PACKET_LEN);
+    CHECK_EQ(packet->data[0], BLE_PROTOCOL_HEADER_0);
+    CHECK_EQ(packet->data[1], BLE_PROTOCOL_HEADER_1);
+    payload->assign((const char*)&packet->data[BLE_PROTOCOL_MIN_PACKET_LEN], packet->len - BLE_PROTOCOL_MIN_PACKET_LEN);
+    if (cmd != nullptr) {
+        *cmd = packet->data[2];
+    }
+    if (conn_id != nullptr) {
+        *conn_id = packet->conn_id;
+    }
+    esp_ble_route_return(route, packet);
+    return true;
+}
+
+static std::string RandomMessage(size_t size, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::string message(size, '\0');
+    for (auto& c : message) {
+        c = (char)rng();
+    }
+    return message;
+}
+
+static ble_route_handle_t Register(uint8_t cmd_min, uint8_t cmd_max, size_t buffer_size = 16 * 1024) {
+    ble_route_handle_t route = nullptr;
+    CHECK_EQ(esp_ble_register_route(cmd_min, cmd_max, buffer_size, &route), ESP_OK);
+    return route;
+}
+
+static void Unregister(ble_route_handle_t route) {
+    CHECK_EQ(esp_ble_unregister_route(route), ESP_OK);
+}
+
+static void TestPlainPackets() {
+    auto wifi = Register(0x00, 0x02);
+    auto ota = Register(0x03, 0x05);
+    CHECK(Write(Packet(0x01, "ssid")).Dispatch());
+    CHECK(Write(Packet(0x04, std::string(200, 'x'))).Dispatch(7));
+    CHECK(Write(Packet(0x05, "")).Dispatch());
+
+    std::string payload;
+    uint8_t cmd;
+    uint16_t conn_id;
+    CHECK(Receive(wifi, &payload, &cmd));
+    CHECK(payload == "ssid" && cmd == 0x01);
+    CHECK(!Receive(wifi, &payload));
+    CHECK(Receive(ota, &payload, &cmd, &conn_id));
+    CHECK(payload == std::string(200, 'x') && cmd == 0x04 && conn_id == 7);
+    CHECK(Receive(ota, &payload, &cmd));
+    CHECK(payload.empty() && cmd == 0x05);
+
+    // Not for a route: left to the event callbacks
+    CHECK(!Write(Packet(0x06, "x")).Dispatch());
+    CHECK(!Write({0x58, 0x00, 0x01}).Dispatch());
+    CHECK(!Write({0x58, 0x5A}).Dispatch());
+    CHECK(!Write({}).Dispatch());
+    CHECK(!esp_ble_route_sar_enabled(kConn));
+    Unregister(wifi);
+    Unregister(ota);
+}
+
+static void TestRegistration() {
+    auto ota = Register(0x03, 0x05);
+    ble_route_handle_t route;
+    CHECK_EQ(esp_ble_register_route(0x05, 0x06, 1024, &route), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(esp_ble_register_route(0x02, 0x01, 1024, &route), ESP_ERR_INVALID_ARG);
+    ble_route_handle_t more[BLE_ROUTE_MAX - 1];
+    for (int i = 0; i < BLE_ROUTE_MAX - 1; i++) {
+        more[i] = Register(0x10 + i, 0x10 + i, 1024);
+    }
+    CHECK_EQ(esp_ble_register_route(0x20, 0x20, 1024, &route), ESP_ERR_NO_MEM);
+    for (auto r : more) {
+        Unregister(r);
+    }
+    Unregister(ota);
+    CHECK_EQ(esp_ble_unregister_route(ota), ESP_ERR_INVALID_ARG);
+    CHECK(!Write(Packet(0x04, "x")).Dispatch());
+}
+
+static void TestReassembly() {
+    auto ota = Register(0x03, 0x05);
+    for (size_t size : {1, 20, 237, 238, 1000, BLE_PROTOCOL_MAX_MESSAGE_LEN}) {
+        std::string message = RandomMessage(size, size);
+        for (auto& segment : Segments(kCmd, message, 240)) {
+            CHECK(Write(segment, 50).Dispatch());
+        }
+        std::string payload;
+        uint8_t cmd;
+        CHECK(Receive(ota, &payload, &cmd));
+        CHECK(payload == message && cmd == kCmd);
+        CHECK(!Receive(ota, &payload));
+    }
+    CHECK_EQ(host_ringbuf_used(ota->ring), 0);
+    CHECK(esp_ble_route_sar_enabled(kConn));
+    CHECK(!esp_ble_route_sar_enabled(kConn + 1));
+    ble_route_disconnected(kConn);
+    CHECK(!esp_ble_route_sar_enabled(kConn));
+    Unregister(ota);
+}
+
+// 4 KB in 10 byte segments runs the sequence number past 255, it goes on at 1
+static void TestSequenceWrap() {
+    auto ota = Register(0x03, 0x05);
+    std::string message = RandomMessage(BLE_PROTOCOL_MAX_MESSAGE_LEN, 7);
+    auto segments = Segments(kCmd, message, 10);
+    CHECK(segments.size() > 256);
+    CHECK_EQ(segments[255][3], 255);
+    CHECK_EQ(segments[256][3], 1);
+    for (auto& segment : segments) {
+        CHECK(Write(segment).Dispatch());
+    }
+    std::string payload;
+    CHECK(Receive(ota, &payload));
+    CHECK(payload == message);
+
+    // A sender that reuses 0 after 255 starts a new message instead
+    segments[256][3] = 0;
+    for (auto& segment : segments) {
+        CHECK(Write(segment).Dispatch());
+    }
+    CHECK(!Receive(ota, &payload));
+    Unregister(ota);
+}
+
+static void TestDroppedMessages() {
+    auto ota = Register(0x03, 0x05);
+    std::string message = RandomMessage(1000, 1);
+    auto segments = Segments(kCmd, message, 240);
+    std::string payload;
+
+    // Lost segment
+    CHECK(Write(segments[0]).Dispatch());
+    CHECK(Write(segments[2]).Dispatch());
+    CHECK(Write(segments[3]).Dispatch());
+    CHECK(!Receive(ota, &payload));
+    CHECK_EQ(host_ringbuf_used(ota->ring), 0);
+
+    // Repeated segment
+    CHECK(Write(segments[0]).Dispatch());
+    CHECK(Write(segments[1]).Dispatch());
+    CHECK(Write(segments[1]).Dispatch());
+    CHECK(!Receive(ota, &payload));
+
+    // Segment of another command or from another connection
+    CHECK(Write(segments[0]).Dispatch());
+    CHECK(Write(Segment(0x05, 1, "x")).Dispatch());
+    CHECK(Write(segments[0]).Dispatch());
+    CHECK(Write(segments[1]).Dispatch(kConn + 1));
+    CHECK(!Receive(ota, &payload));
+
+    // More data than the first segment announced
+    auto longer = segments;
+    longer.back().push_back('!');
+    for (auto& segment : longer) {
+        CHECK(Write(segment).Dispatch());
+    }
+    CHECK(!Receive(ota, &payload));
+
+    // Announced more than any message may have, or too short to carry the length
+    CHECK(Write(Segment(kCmd, 0, "x", BLE_PROTOCOL_MAX_MESSAGE_LEN + 1)).Dispatch());
+    CHECK(Write(Segment(kCmd, 0, "")).Dispatch());
+    CHECK(Write({BLE_PROTOCOL_HEADER_0, BLE_PROTOCOL_SAR_HEADER_1, kCmd}).Dispatch());
+    CHECK(!Receive(ota, &payload));
+
+    // Every dropped message above left nothing behind, the next one goes through
+    CHECK_EQ(host_ringbuf_used(ota->ring), 0);
+    for (auto& segment : segments) {
+        CHECK(Write(segment).Dispatch());
+    }
+    CHECK(Receive(ota, &payload));
+    CHECK(payload == message);
+    Unregister(ota);
+}
+
+static void TestInterruptions() {
+    auto ota = Register(0x03, 0x05);
+    std::string first = RandomMessage(1000, 1);
+    std::string second = RandomMessage(700, 2);
+    auto first_segments = Segments(kCmd, first, 240);
+    auto second_segments = Segments(kCmd, second, 240);
+    std::string payload;
+    uint8_t cmd;
+
+    // A plain packet drops the message in progress, but is delivered itself
+    CHECK(Write(first_segments[0]).Dispatch());
+    CHECK(Write(Packet(0x05, "crc")).Dispatch());
+    CHECK(Write(first_segments[1]).Dispatch());
+    CHECK(Receive(ota, &payload, &cmd));
+    CHECK(payload == "crc" && cmd == 0x05);
+    CHECK(!Receive(ota, &payload));
+
+    // A new first segment restarts
+    CHECK(Write(first_segments[0]).Dispatch());
+    CHECK(Write(first_segments[1]).Dispatch());
+    for (auto& segment : second_segments) {
+        CHECK(Write(segment).Dispatch());
+    }
+    CHECK(Receive(ota, &payload));
+    CHECK(payload == second);
+    CHECK(!Receive(ota, &payload));
+
+    // Disconnecting drops only that connection's message
+    CHECK(Write(first_segments[0]).Dispatch());
+    ble_route_disconnected(kConn + 1);
+    CHECK(Write(first_segments[1]).Dispatch());
+    ble_route_disconnected(kConn);
+    CHECK(Write(first_segments[2]).Dispatch());
+    CHECK(!Receive(ota, &payload));
+    CHECK_EQ(host_ringbuf_used(ota->ring), 0);
+
+    // Unregistering with a message in progress
+    CHECK(Write(first_segments[0]).Dispatch());
+    Unregister(ota);
+    CHECK(!Write(first_segments[1]).Dispatch());
+}
+
+// A full ring drops what does not fit after the short wait and keeps what it holds
+static void TestRingFull() {
+    auto ota = Register(0x03, 0x05, 2048);
+    std::string payload;
+    int sent = 0;
+    for (int i = 0; i < 20; i++) {
+        CHECK(Write(Packet(kCmd, std::string(200, 'a' + i))).Dispatch());
+        sent++;
+    }
+    int received = 0;
+    while (Receive(ota, &payload)) {
+        CHECK(payload == std::string(200, 'a' + received));
+        received++;
+    }
+    CHECK(received > 0 && received < sent);
+    CHECK_EQ(ota->dropped, sent - received);
+
+    // A message larger than the ring can ever hold is dropped at its first segment
+    std::string message = RandomMessage(BLE_PROTOCOL_MAX_MESSAGE_LEN, 3);
+    for (auto& segment : Segments(kCmd, message, 240)) {
+        CHECK(Write(segment).Dispatch());
+    }
+    CHECK(!Receive(ota, &payload));
+    CHECK_EQ(host_ringbuf_used(ota->ring), 0);
+    Unregister(ota);
+}
+
+int main() {
+    RUN_TEST(TestPlainPackets);
+    RUN_TEST(TestRegistration);
+    RUN_TEST(TestReassembly);
+    RUN_TEST(TestSequenceWrap);
+    RUN_TEST(TestDroppedMessages);
+    RUN_TEST(TestInterruptions);
+    RUN_TEST(TestRingFull);
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include "channel_warmup.h"
+#include "test_util.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using Clock = ChannelWarmup::Clock;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+static const Clock::duration kTtl = seconds(20);
+static const Clock::time_point kStart = Clock::now();
+
+static void TestWarmAndClaimed() {
+    ChannelWarmup warmup(kTtl);
+    CHECK_EQ(warmup.Claim(), -1);
+    uint32_t attempt = warmup.Begin(kStart);
+    CHECK(attempt != 0);
+    CHECK_EQ(warmup.owner(), attempt);
+    warmup.Finish(attempt, true, kStart + milliseconds(350));
+    CHECK_EQ(warmup.owner(), attempt);
+    CHECK_EQ(warmup.Expired(kStart + seconds(10)), 0);
+
+    // From here on the session owns the channel and its errors
+    CHECK_EQ(warmup.Claim(), 350);
+    CHECK_EQ(warmup.owner(), 0);
+    CHECK_EQ(warmup.Claim(), -1);
+    CHECK(!warmup.Drop(attempt));
+}
+
+// A failed open leaves the channel to nobody, the next attempt still waits two TTLs
+static void TestFailedAndRateLimited() {
+    ChannelWarmup warmup(kTtl);
+    uint32_t attempt = warmup.Begin(kStart);
+    CHECK_EQ(warmup.Begin(kStart), 0);
+    warmup.Finish(attempt, false, kStart + seconds(3));
+    CHECK_EQ(warmup.owner(), 0);
+    CHECK_EQ(warmup.Claim(), -1);
+    CHECK_EQ(warmup.Begin(kStart + kTtl), 0);
+    uint32_t next = warmup.Begin(kStart + kTtl * 2);
+    CHECK(next != 0 && next != attempt);
+}
+
+static void TestExpired() {
+    ChannelWarmup warmup(kTtl);
+    uint32_t attempt = warmup.Begin(kStart);
+    CHECK_EQ(warmup.Expired(kStart + kTtl * 3), 0);
+    warmup.Finish(attempt, true, kStart + seconds(1));
+    CHECK_EQ(warmup.Expired(kStart + seconds(1) + kTtl), 0);
+    CHECK_EQ(warmup.Expired(kStart + seconds(2) + kTtl), attempt);
+    CHECK(warmup.Drop(attempt));
+    CHECK_EQ(warmup.Expired(kStart + kTtl * 3), 0);
+    CHECK(!warmup.Drop(attempt));
+}
+
+// The close of the first channel arrives after the second attempt started, it must not take the second one
+static void TestLateDrop() {
+    ChannelWarmup warmup(kTtl);
+    uint32_t first = warmup.Begin(kStart);
+    warmup.Finish(first, true, kStart + seconds(1));
+    uint32_t expired = warmup.Expired(kStart + kTtl * 2);
+    CHECK_EQ(expired, first);
+    // The server closed the channel before the clock timer's close ran
+    CHECK(warmup.Drop(warmup.owner()));
+    uint32_t second = warmup.Begin(kStart + kTtl * 2);
+    CHECK(second != 0);
+    CHECK(!warmup.Drop(expired));
+    CHECK_EQ(warmup.owner(), second);
+    // So is a finish of the first attempt that comes after all that
+    warmup.Finish(first, false, kStart + kTtl * 2);
+    CHECK_EQ(warmup.owner(), second);
+    warmup.Finish(second, true, kStart + kTtl * 2 + milliseconds(200));
+    CHECK_EQ(warmup.Claim(), 200);
+}
+
+// A session claims the channel while the warm-up task is still opening it, the late finish is ignored
+static void TestClaimedWhileOpening() {
+    ChannelWarmup warmup(kTtl);
+    uint32_t attempt = warmup.Begin(kStart);
+    CHECK_EQ(warmup.Claim(), -1);
+    warmup.Finish(attempt, true, kStart + seconds(1));
+    CHECK_EQ(warmup.owner(), 0);
+    CHECK_EQ(warmup.Expired(kStart + kTtl * 2), 0);
+}
+
+// Speech onsets from the audio task, claims from the main loop and closes from the network at once
+static void TestConcurrent() {
+    ChannelWarmup warmup(milliseconds(0));
+    std::atomic<bool> stop(false);
+    std::atomic<int> finished(0);
+    std::atomic<int> claimed(0);
+    std::thread warmer([&]() {
+        while (!stop) {
+            uint32_t attempt = warmup.Begin(Clock::now());
+            if (attempt != 0) {
+                warmup.Finish(attempt, attempt % 3 != 0, Clock::now());
+                finished++;
+            }
+        }
+    });
+    std::thread session([&]() {
+        while (!stop) {
+            if (warmup.Claim() >= 0) {
+                claimed++;
+            }
+        }
+    });
+    std::thread network([&]() {
+        while (!stop) {
+            warmup.Drop(warmup.owner());
+        }
+    });
+    std::this_thread::sleep_for(milliseconds(200));
+    stop = true;
+    warmer.join();
+    session.join();
+    network.join();
+    CHECK(finished > 0);
+    CHECK(claimed <= finished);
+    warmup.Drop(warmup.owner());
+    CHECK_EQ(warmup.owner(), 0);
+    CHECK(warmup.Begin(Clock::now()) != 0);
+}
+
+int main() {
+    RUN_TEST(TestWarmAndClaimed);
+    RUN_TEST(TestFailedAndRateLimited);
+    RUN_TEST(TestExpired);
+    RUN_TEST(TestLateDrop);
+    RUN_TEST(TestClaimedWhileOpening);
+    RUN_TEST(TestConcurrent);
+    return 0;
+}
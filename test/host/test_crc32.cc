@@ -0,0 +1,67 @@
+#include "ble_crc32.h"
+#include "test_util.h"
+
+#include <random>
+#include <vector>
+
+// Built once per CONFIG_BLE_OTA_CRC32_* backend, every backend must match the bitwise reference
+
+static void TestKnownValue() {
+    // Register value without the initial and final inversion of zlib's CRC-32
+    CHECK_EQ(ble_crc32_update(0, "123456789", 9), 0x2DFD2D88);
+    CHECK_EQ(ble_crc32_update(0x12345678, "", 0), 0x12345678);
+}
+
+static void TestMatchesReference() {
+    std::mt19937 rng(3);
+    std::vector<uint8_t> data(4096 + 8);
+    for (auto& byte : data) {
+        byte = rng();
+    }
+    // Every length around the 8 byte blocks, from every alignment
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t len = 0; len <= 72; len++) {
+            uint32_t seed = rng();
+            CHECK_EQ(ble_crc32_update(seed, data.data() + offset, len),
+                ble_crc32_update_bitwise(seed, data.data() + offset, len));
+        }
+    }
+    CHECK_EQ(ble_crc32_update(0, data.data() + 1, 4096), ble_crc32_update_bitwise(0, data.data() + 1, 4096));
+}
+
+static void TestIncremental() {
+    std::vector<uint8_t> data(1000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = i * 31 + 7;
+    }
+    uint32_t whole = ble_crc32_update(0, data.data(), data.size());
+    uint32_t crc = 0;
+    for (size_t pos = 0, chunk = 1; pos < data.size(); pos += chunk, chunk = chunk * 2 + 1) {
+        chunk = std::min(chunk, data.size() - pos);
+        crc = ble_crc32_update(crc, data.data() + pos, chunk);
+    }
+    CHECK_EQ(crc, whole);
+}
+
+static void TestCombine() {
+    std::mt19937 rng(5);
+    std::vector<uint8_t> data(3000);
+    for (auto& byte : data) {
+        byte = rng();
+    }
+    const size_t splits[] = {0, 1, 7, 8, 255, 1024, 2999, 3000};
+    uint32_t whole = ble_crc32_update_bitwise(0, data.data(), data.size());
+    for (size_t split : splits) {
+        uint32_t crc1 = ble_crc32_update(0, data.data(), split);
+        uint32_t crc2 = ble_crc32_update(0, data.data() + split, data.size() - split);
+        CHECK_EQ(ble_crc32_combine(crc1, crc2, data.size() - split), whole);
+    }
+}
+
+int main() {
+    RUN_TEST(TestKnownValue);
+    RUN_TEST(TestMatchesReference);
+    RUN_TEST(TestIncremental);
+    RUN_TEST(TestCombine);
+    return 0;
+}
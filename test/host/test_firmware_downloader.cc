@@ -0,0 +1,511 @@
+#include "firmware_downloader.h"
+#include "board.h"
+#include "host_event.h"
+#include "test_util.h"
+
+#include <esp_ota_ops.h>
+#include <nvs.h>
+#include <spi_flash_mmap.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+/*
+ * FirmwareDownloader with its writer task, Settings and ota_image_decoder.c as they are, on FreeRTOS over
+ * pthreads. The HTTP server, the flash and NVS are fakes.
+ *
+ * Flash and NVS live in shared memory: a download in a child process that exits is a power cut, and the
+ * next download in the parent is the device after the reboot.
+ */
+
+static constexpr uint32_t kPartitionSize = 1024 * 1024;
+static constexpr size_t kImageSize = 300 * 1024 + 123;
+static constexpr size_t kResumeInterval = 64 * 1024;
+static const char* kUrl = "http://ota.example.com/xiaozhi.bin";
+
+static const esp_partition_t kRunning = {0x10000, kPartitionSize, "ota_0"};
+static const esp_partition_t kUpdate = {0x110000, kPartitionSize, "ota_1"};
+
+struct NvsEntry {
+    bool used;
+    bool is_string;
+    char key[16];
+    int32_t value;
+    char string[128];
+};
+
+// State that outlives a child process
+struct Persistent {
+    uint8_t flash[kPartitionSize];
+    NvsEntry nvs[8];
+    bool boot_partition_set;
+};
+static Persistent* persistent;
+
+static std::mutex flash_mutex;
+static std::string expected_image;
+static size_t fail_writes_from = SIZE_MAX;
+static size_t first_erase = SIZE_MAX;
+
+extern "C" esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* dst, size_t size) {
+    CHECK(partition == &kUpdate && offset + size <= partition->size);
+    std::lock_guard<std::mutex> lock(flash_mutex);
+    memcpy(dst, persistent->flash + offset, size);
+    return ESP_OK;
+}
+
+// NOR flash: a write only clears bits
+extern "C" esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* src, size_t size) {
+    CHECK(partition == &kUpdate && offset + size <= partition->size);
+    CHECK(offset % 16 == 0 && size % 16 == 0);
+    if (offset + size > fail_writes_from) {
+        return ESP_FAIL;
+    }
+    std::lock_guard<std::mutex> lock(flash_mutex);
+    auto bytes = static_cast<const uint8_t*>(src);
+    for (size_t i = 0; i < size; i++) {
+        persistent->flash[offset + i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+extern "C" esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    CHECK(partition == &kUpdate && offset + size <= partition->size);
+    CHECK(offset % SPI_FLASH_SEC_SIZE == 0 && size % SPI_FLASH_SEC_SIZE == 0);
+    std::lock_guard<std::mutex> lock(flash_mutex);
+    first_erase = std::min(first_erase, offset);
+    memset(persistent->flash + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+extern "C" const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from) {
+    return &kUpdate;
+}
+
+extern "C" const esp_partition_t* esp_ota_get_running_partition(void) {
+    return &kRunning;
+}
+
+// Stands in for the image verification
+extern "C" esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition) {
+    CHECK(partition == &kUpdate);
+    std::lock_guard<std::mutex> lock(flash_mutex);
+    if (memcmp(persistent->flash, expected_image.data(), expected_image.size()) != 0) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    persistent->boot_partition_set = true;
+    return ESP_OK;
+}
+
+// NVS with the one namespace the downloader uses
+static NvsEntry* FindKey(const char* key, bool create) {
+    NvsEntry* free_entry = nullptr;
+    for (auto& entry : persistent->nvs) {
+        if (entry.used && strcmp(entry.key, key) == 0) {
+            return &entry;
+        }
+        if (!entry.used && free_entry == nullptr) {
+            free_entry = &entry;
+        }
+    }
+    if (!create) {
+        return nullptr;
+    }
+    CHECK(free_entry != nullptr && strlen(key) < sizeof(free_entry->key));
+    memset(free_entry, 0, sizeof(*free_entry));
+    free_entry->used = true;
+    strcpy(free_entry->key, key);
+    return free_entry;
+}
+
+extern "C" esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle) {
+    CHECK(strcmp(name, "ota_resume") == 0);
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+extern "C" void nvs_close(nvs_handle_t handle) {
+}
+
+extern "C" esp_err_t nvs_commit(nvs_handle_t handle) {
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length) {
+    auto entry = FindKey(key, false);
+    if (entry == nullptr || !entry->is_string) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    size_t size = strlen(entry->string) + 1;
+    if (out_value != nullptr) {
+        CHECK(*length >= size);
+        memcpy(out_value, entry->string, size);
+    }
+    *length = size;
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value) {
+    auto entry = FindKey(key, true);
+    CHECK(strlen(value) < sizeof(entry->string));
+    entry->is_string = true;
+    strcpy(entry->string, value);
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_get_i32(nvs_handle_t handle, const char* key, int32_t* out_value) {
+    auto entry = FindKey(key, false);
+    if (entry == nullptr || entry->is_string) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *out_value = entry->value;
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_set_i32(nvs_handle_t handle, const char* key, int32_t value) {
+    auto entry = FindKey(key, true);
+    entry->is_string = false;
+    entry->value = value;
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_get_u8(nvs_handle_t handle, const char* key, uint8_t* out_value) {
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+extern "C" esp_err_t nvs_set_u8(nvs_handle_t handle, const char* key, uint8_t value) {
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    auto entry = FindKey(key, false);
+    if (entry == nullptr) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    entry->used = false;
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_erase_all(nvs_handle_t handle) {
+    memset(persistent->nvs, 0, sizeof(persistent->nvs));
+    return ESP_OK;
+}
+
+static int32_t SavedOffset() {
+    auto entry = FindKey("offset", false);
+    return entry != nullptr ? entry->value : 0;
+}
+
+// The firmware server: Range requests, ETags, connections that drop after so many body bytes
+struct Server {
+    std::string image;
+    std::string etag;
+    bool honor_range = true;
+    std::map<int, size_t> drop_after;
+    std::vector<std::string> ranges;
+    int connections = 0;
+    size_t served = 0;
+    // Runs after every read, before the bytes reach the downloader
+    std::function<void()> on_read;
+};
+static Server server;
+
+class FakeHttp : public Http {
+public:
+    explicit FakeHttp(int connection) : connection_(connection) {}
+
+    void SetTimeout(int timeout_ms) override {}
+    void SetContent(std::string&& content) override {}
+    int Write(const char* buffer, size_t buffer_size) override { return -1; }
+    std::string ReadAll() override { return std::string(); }
+    void Close() override {}
+
+    void SetHeader(const std::string& key, const std::string& value) override {
+        headers_[key] = value;
+    }
+
+    bool Open(const std::string& method, const std::string& url) override {
+        CHECK(method == "GET" && url == kUrl);
+        auto range = headers_["Range"];
+        server.ranges.push_back(range);
+        size_t start = 0;
+        if (!range.empty()) {
+            CHECK(sscanf(range.c_str(), "bytes=%zu-", &start) == 1);
+        }
+        if (server.honor_range && !range.empty()) {
+            CHECK(start < server.image.size());
+            status_ = 206;
+            content_range_ = "bytes " + std::to_string(start) + "-" + std::to_string(server.image.size() - 1) + "/" +
+                std::to_string(server.image.size());
+            body_ = server.image.substr(start);
+        } else {
+            status_ = 200;
+            body_ = server.image;
+        }
+        etag_ = server.etag;
+        return true;
+    }
+
+    int Read(char* buffer, size_t buffer_size) override {
+        auto drop = server.drop_after.find(connection_);
+        if (drop != server.drop_after.end() && read_ >= drop->second) {
+            return -1;
+        }
+        size_t n = std::min({buffer_size, body_.size() - read_, (size_t)(1 + rng_() % 3000)});
+        if (drop != server.drop_after.end()) {
+            n = std::min(n, drop->second - read_);
+        }
+        memcpy(buffer, body_.data() + read_, n);
+        read_ += n;
+        server.served += n;
+        if (server.on_read) {
+            server.on_read();
+        }
+        return (int)n;
+    }
+
+    int GetStatusCode() override {
+        return status_;
+    }
+
+    std::string GetResponseHeader(const std::string& key) const override {
+        if (key == "Content-Range") {
+            return content_range_;
+        }
+        return key == "ETag" ? etag_ : std::string();
+    }
+
+    size_t GetBodyLength() override {
+        return body_.size();
+    }
+
+private:
+    int connection_;
+    std::map<std::string, std::string> headers_;
+    int status_ = 0;
+    std::string content_range_;
+    std::string etag_;
+    std::string body_;
+    size_t read_ = 0;
+    std::mt19937 rng_{(unsigned)connection_};
+};
+
+class FakeNetwork : public NetworkInterface {
+public:
+    std::unique_ptr<Http> CreateHttp(int connect_id) override {
+        return std::make_unique<FakeHttp>(server.connections++);
+    }
+};
+
+class TestBoard : public Board {
+public:
+    NetworkInterface* GetNetwork() override {
+        return &network_;
+    }
+
+private:
+    FakeNetwork network_;
+};
+
+void* create_board() {
+    return new TestBoard();
+}
+
+// An app image as far as the downloader looks at it: the magic and the app description after the headers
+static std::string MakeImage(size_t size, const char* version, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::string image(size, '\0');
+    for (auto& c : image) {
+        c = (char)rng();
+    }
+    image[0] = (char)ESP_IMAGE_HEADER_MAGIC;
+    esp_app_desc_t desc = {};
+    strcpy(desc.version, version);
+    strcpy(desc.project_name, "xiaozhi");
+    memcpy(&image[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], &desc, sizeof(desc));
+    return image;
+}
+
+// A clean device and a server with a new image
+static void Reset(const std::string& image, const std::string& etag) {
+    memset(persistent->flash, 0xFF, sizeof(persistent->flash));
+    memset(persistent->nvs, 0, sizeof(persistent->nvs));
+    persistent->boot_partition_set = false;
+    server = Server();
+    server.image = image;
+    server.etag = etag;
+    expected_image = image;
+    fail_writes_from = SIZE_MAX;
+    first_erase = SIZE_MAX;
+}
+
+// Rejects the running version, like Ota does
+static bool Download(int* last_progress = nullptr) {
+    FirmwareDownloader downloader(&kUpdate);
+    return downloader.Download(kUrl, [](const esp_app_desc_t& app_desc) {
+        return strcmp(app_desc.version, "1.0.0") != 0;
+    }, [last_progress](int progress, size_t speed) {
+        if (last_progress != nullptr) {
+            *last_progress = progress;
+        }
+    });
+}
+
+// Downloads in a child process that loses power once NVS records at least offset bytes
+static int32_t DownloadUntilPowerCut(size_t offset) {
+    fflush(stdout);
+    pid_t pid = fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        server.on_read = [offset]() {
+            if ((size_t)SavedOffset() >= offset) {
+                _exit(0);
+            }
+        };
+        Download();
+        // The download finished before the power cut
+        _exit(1);
+    }
+    int status = 0;
+    CHECK_EQ(waitpid(pid, &status, 0), pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(!persistent->boot_partition_set);
+    int32_t saved = SavedOffset();
+    CHECK(saved >= (int32_t)offset && saved < (int32_t)kImageSize && saved % kResumeInterval == 0);
+    return saved;
+}
+
+static std::string RangeFrom(size_t offset) {
+    return "bytes=" + std::to_string(offset) + "-";
+}
+
+// A connection lost in the middle continues where the reading stopped, the resume state goes once done
+static void TestDownload() {
+    Reset(MakeImage(kImageSize, "1.0.1", 1), "\"v1\"");
+    server.drop_after[0] = 100000;
+    int progress = 0;
+    CHECK(Download(&progress));
+    CHECK(persistent->boot_partition_set);
+    CHECK_EQ(progress, 100);
+    CHECK_EQ(server.ranges.size(), 2);
+    CHECK(server.ranges[0].empty());
+    CHECK(server.ranges[1] == RangeFrom(100000));
+    CHECK_EQ(server.served, kImageSize);
+    CHECK(FindKey("url", false) == nullptr && FindKey("offset", false) == nullptr);
+
+    // The running version is rejected with the header, before the first block reaches flash
+    Reset(MakeImage(kImageSize, "1.0.0", 2), "\"v0\"");
+    CHECK(!Download());
+    CHECK_EQ(first_erase, SIZE_MAX);
+    CHECK(!persistent->boot_partition_set);
+    CHECK(FindKey("url", false) == nullptr);
+}
+
+// After the reboot the download goes on from the offset in NVS, the flash before it is left alone
+static void TestResumeFromNvs() {
+    Reset(MakeImage(kImageSize, "1.0.1", 3), "\"v1\"");
+    int32_t saved = DownloadUntilPowerCut(128 * 1024);
+    CHECK(Download());
+    CHECK(persistent->boot_partition_set);
+    CHECK_EQ(server.ranges.size(), 1);
+    CHECK(server.ranges[0] == RangeFrom(saved));
+    CHECK_EQ(server.served, kImageSize - saved);
+    CHECK_EQ(first_erase, saved);
+    CHECK(FindKey("offset", false) == nullptr);
+}
+
+// A server that answers a Range request with the whole image: the bytes already in flash are read and skipped
+static void TestServerIgnoresRange() {
+    Reset(MakeImage(kImageSize, "1.0.1", 4), "\"v1\"");
+    int32_t saved = DownloadUntilPowerCut(64 * 1024);
+    server.honor_range = false;
+    CHECK(Download());
+    CHECK(persistent->boot_partition_set);
+    CHECK_EQ(server.ranges.size(), 1);
+    CHECK(server.ranges[0] == RangeFrom(saved));
+    CHECK_EQ(server.served, kImageSize);
+    CHECK_EQ(first_erase, saved);
+}
+
+static void TestImageChanged() {
+    // A new ETag after the reboot: the download starts over without a Range header
+    Reset(MakeImage(kImageSize, "1.0.1", 5), "\"v1\"");
+    DownloadUntilPowerCut(64 * 1024);
+    server.image = expected_image = MakeImage(kImageSize, "1.0.2", 6);
+    server.etag = "\"v2\"";
+    CHECK(Download());
+    CHECK(persistent->boot_partition_set);
+    CHECK_EQ(server.ranges.size(), 2);
+    CHECK(server.ranges[1].empty());
+    CHECK_EQ(first_erase, 0);
+
+    // A server without ETags, the size tells
+    Reset(MakeImage(kImageSize, "1.0.1", 7), "");
+    DownloadUntilPowerCut(64 * 1024);
+    server.image = expected_image = MakeImage(kImageSize + 4096, "1.0.2", 8);
+    CHECK(Download());
+    CHECK(persistent->boot_partition_set);
+    CHECK_EQ(server.ranges.size(), 2);
+    CHECK(server.ranges[1].empty());
+
+    // Replaced while the connection was down: the half written image is given up, so is the resume state
+    Reset(MakeImage(kImageSize, "1.0.1", 9), "\"v1\"");
+    server.drop_after[0] = 200000;
+    server.on_read = []() {
+        if (server.served == 200000) {
+            server.image = MakeImage(kImageSize, "1.0.2", 10);
+            server.etag = "\"v2\"";
+        }
+    };
+    CHECK(!Download());
+    CHECK(!persistent->boot_partition_set);
+    CHECK(FindKey("url", false) == nullptr && FindKey("offset", false) == nullptr);
+}
+
+// A flash write fails: the reader stops, the writer hands back its blocks and exits, Download() returns
+// through WaitForWrites() with the last committed offset still in NVS, and the next attempt resumes there
+static void TestWriteError() {
+    Reset(MakeImage(kImageSize, "1.0.1", 11), "\"v1\"");
+    fail_writes_from = 100 * 1024;
+    bool result = true;
+    HostEvent done;
+    std::thread download([&]() {
+        result = Download();
+        done.Set();
+    });
+    CHECK(done.Wait(10s));
+    download.join();
+    CHECK(!result);
+    CHECK(!persistent->boot_partition_set);
+    CHECK(server.served < kImageSize);
+    CHECK_EQ(SavedOffset(), kResumeInterval);
+
+    fail_writes_from = SIZE_MAX;
+    server.ranges.clear();
+    CHECK(Download());
+    CHECK(persistent->boot_partition_set);
+    CHECK_EQ(server.ranges.size(), 1);
+    CHECK(server.ranges[0] == RangeFrom(kResumeInterval));
+}
+
+int main() {
+    persistent = static_cast<Persistent*>(mmap(nullptr, sizeof(Persistent), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    CHECK(persistent != MAP_FAILED);
+    RUN_TEST(TestDownload);
+    RUN_TEST(TestResumeFromNvs);
+    RUN_TEST(TestServerIgnoresRange);
+    RUN_TEST(TestImageChanged);
+    RUN_TEST(TestWriteError);
+    return 0;
+}
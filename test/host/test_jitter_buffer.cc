@@ -0,0 +1,224 @@
+#include "jitter_buffer.h"
+#include "test_util.h"
+
+#include <esp_timer.h>
+#include <vector>
+
+static void AdvanceMs(int ms) {
+    host_fake_time_us += (int64_t)ms * 1000;
+}
+
+static std::unique_ptr<AudioStreamPacket> MakePacket(uint32_t sequence, uint8_t tag = 0) {
+    auto packet = std::make_unique<AudioStreamPacket>();
+    packet->sample_rate = 16000;
+    packet->frame_duration = 60;
+    packet->sequence = sequence;
+    packet->payload.assign(4, tag);
+    return packet;
+}
+
+// Drains everything that is ready now, lost frames show up as 0 in the returned sequence list
+static std::vector<uint32_t> Drain(JitterBuffer& buffer) {
+    std::vector<uint32_t> out;
+    for (;;) {
+        std::unique_ptr<AudioStreamPacket> packet;
+        int wait_ms = 0;
+        auto result = buffer.Get(packet, wait_ms);
+        if (result == kJitterBufferPacket) {
+            out.push_back(packet->sequence);
+        } else if (result == kJitterBufferLost) {
+            CHECK(packet->payload.empty());
+            out.push_back(0);
+        } else {
+            break;
+        }
+    }
+    return out;
+}
+
+static void TestInOrder() {
+    JitterBuffer buffer;
+    for (uint32_t seq = 1; seq <= 5; seq++) {
+        CHECK(buffer.Put(MakePacket(seq)));
+        AdvanceMs(60);
+    }
+    CHECK((Drain(buffer) == std::vector<uint32_t>{1, 2, 3, 4, 5}));
+    CHECK(buffer.Empty());
+    CHECK_EQ(buffer.stats().received, 5);
+}
+
+static void TestReorder() {
+    JitterBuffer buffer;
+    CHECK(buffer.Put(MakePacket(1)));
+    CHECK(buffer.Put(MakePacket(3)));
+    CHECK(buffer.Put(MakePacket(2)));
+    CHECK(buffer.Put(MakePacket(5)));
+    CHECK(buffer.Put(MakePacket(4)));
+    CHECK((Drain(buffer) == std::vector<uint32_t>{1, 2, 3, 4, 5}));
+    CHECK_EQ(buffer.stats().concealed, 0);
+}
+
+static void TestDuplicateAndLate() {
+    JitterBuffer buffer;
+    CHECK(buffer.Put(MakePacket(1)));
+    CHECK(buffer.Put(MakePacket(2)));
+    CHECK(!buffer.Put(MakePacket(2)));
+    CHECK_EQ(buffer.stats().duplicates, 1);
+    CHECK((Drain(buffer) == std::vector<uint32_t>{1, 2}));
+
+    // Already played out
+    CHECK(!buffer.Put(MakePacket(1)));
+    CHECK(!buffer.Put(MakePacket(2)));
+    CHECK_EQ(buffer.stats().late, 2);
+    CHECK(buffer.Put(MakePacket(3)));
+    CHECK((Drain(buffer) == std::vector<uint32_t>{3}));
+}
+
+static void TestLossConcealment() {
+    JitterBuffer buffer;
+    CHECK(buffer.Put(MakePacket(1)));
+    CHECK(buffer.Put(MakePacket(3)));
+    CHECK((Drain(buffer) == std::vector<uint32_t>{1}));
+
+    // 2 is missing, the buffer waits one frame for it before concealing
+    std::unique_ptr<AudioStreamPacket> packet;
+    int wait_ms = 0;
+    CHECK_EQ(buffer.Get(packet, wait_ms), kJitterBufferWait);
+    CHECK(wait_ms > 0 && wait_ms <= 60);
+    AdvanceMs(wait_ms);
+    CHECK((Drain(buffer) == std::vector<uint32_t>{0, 3}));
+    CHECK_EQ(buffer.stats().concealed, 1);
+}
+
+static void TestLateArrivalFillsGap() {
+    JitterBuffer buffer;
+    CHECK(buffer.Put(MakePacket(1)));
+    CHECK(buffer.Put(MakePacket(3)));
+    CHECK((Drain(buffer) == std::vector<uint32_t>{1}));
+    AdvanceMs(20);
+    CHECK(buffer.Put(MakePacket(2)));
+    CHECK((Drain(buffer) == std::vector<uint32_t>{2, 3}));
+    CHECK_EQ(buffer.stats().concealed, 0);
+}
+
+static void TestLongGapSkipped() {
+    JitterBuffer buffer;
+    CHECK(buffer.Put(MakePacket(1)));
+    CHECK(buffer.Put(MakePacket(10)));
+    CHECK((Drain(buffer) == std::vector<uint32_t>{1, 10}));
+    CHECK_EQ(buffer.stats().skipped, 8);
+    CHECK_EQ(buffer.stats().concealed, 0);
+}
+
+static void TestRestart() {
+    JitterBuffer buffer;
+    CHECK(buffer.Put(MakePacket(1000)));
+    CHECK((Drain(buffer) == std::vector<uint32_t>{1000}));
+    // Far behind the expected sequence: the server restarted the stream
+    CHECK(buffer.Put(MakePacket(1)));
+    CHECK(buffer.Put(MakePacket(2)));
+    CHECK((Drain(buffer) == std::vector<uint32_t>{1, 2}));
+    CHECK_EQ(buffer.stats().late, 0);
+}
+
+static void TestSequenceWraps() {
+    JitterBuffer buffer;
+    CHECK(buffer.Put(MakePacket(0xFFFFFFFE)));
+    CHECK(buffer.Put(MakePacket(2)));
+    CHECK(buffer.Put(MakePacket(0xFFFFFFFF)));
+    CHECK(buffer.Put(MakePacket(1)));
+    CHECK((Drain(buffer) == std::vector<uint32_t>{0xFFFFFFFE, 0xFFFFFFFF}));
+    // 0 means "no sequence" and is never sent, so the wrap costs one concealed frame
+    AdvanceMs(60);
+    CHECK((Drain(buffer) == std::vector<uint32_t>{0, 1, 2}));
+    CHECK_EQ(buffer.stats().concealed, 1);
+}
+
+static void TestUnsequencedPackets() {
+    JitterBuffer buffer;
+    for (int i = 0; i < 4; i++) {
+        CHECK(buffer.Put(MakePacket(0, i)));
+    }
+    std::vector<uint8_t> tags;
+    std::unique_ptr<AudioStreamPacket> packet;
+    int wait_ms;
+    while (buffer.Get(packet, wait_ms) == kJitterBufferPacket) {
+        tags.push_back(packet->payload[0]);
+    }
+    CHECK((tags == std::vector<uint8_t>{0, 1, 2, 3}));
+}
+
+static void TestCounters() {
+    JitterBuffer buffer;
+    CHECK(buffer.Put(MakePacket(1)));
+    CHECK(buffer.Put(MakePacket(2)));
+    CHECK(!buffer.Put(MakePacket(2)));
+    CHECK(buffer.Put(MakePacket(3)));
+    CHECK_EQ(buffer.accepted(), 3);
+    CHECK_EQ(buffer.released(), 0);
+
+    std::unique_ptr<AudioStreamPacket> packet;
+    int wait_ms;
+    CHECK_EQ(buffer.Get(packet, wait_ms), kJitterBufferPacket);
+    CHECK_EQ(buffer.released(), 1);
+    buffer.Reset();
+    CHECK_EQ(buffer.released(), buffer.accepted());
+    CHECK(buffer.Empty());
+}
+
+static void TestAdaptiveDelay() {
+    JitterBuffer buffer;
+    // Every other packet arrives a frame late
+    uint32_t seq = 1;
+    for (int i = 0; i < 100; i++) {
+        int lateness = (i % 2) ? 60 : 0;
+        AdvanceMs(lateness);
+        CHECK(buffer.Put(MakePacket(seq++)));
+        AdvanceMs(60 - lateness);
+        Drain(buffer);
+    }
+    const auto& stats = buffer.stats();
+    CHECK(stats.jitter_ms > 0);
+    CHECK(stats.target_delay_ms >= stats.jitter_ms);
+    CHECK(stats.target_delay_ms <= JITTER_BUFFER_MAX_DELAY_MS);
+    CHECK_EQ(stats.concealed, 0);
+
+    // After a pause, the next utterance waits for the playout delay before it starts
+    AdvanceMs(JITTER_BUFFER_MAX_DELAY_MS);
+    Drain(buffer);
+    CHECK(buffer.Empty());
+    AdvanceMs(JITTER_BUFFER_UNDERRUN_WINDOW_MS + 1000);
+    CHECK(buffer.Put(MakePacket(seq++)));
+    std::unique_ptr<AudioStreamPacket> packet;
+    int wait_ms = 0;
+    CHECK_EQ(buffer.Get(packet, wait_ms), kJitterBufferWait);
+    CHECK(wait_ms > 0 && wait_ms <= (int)stats.target_delay_ms);
+    AdvanceMs(wait_ms);
+    CHECK_EQ(buffer.Get(packet, wait_ms), kJitterBufferPacket);
+    CHECK(stats.added_latency_ms > 0);
+}
+
+static void TestUnderrun() {
+    JitterBuffer buffer;
+    CHECK(buffer.Put(MakePacket(1)));
+    CHECK((Drain(buffer) == std::vector<uint32_t>{1}));
+    AdvanceMs(100);
+    CHECK(buffer.Put(MakePacket(2)));
+    CHECK_EQ(buffer.stats().underruns, 1);
+}
+
+int main() {
+    RUN_TEST(TestInOrder);
+    RUN_TEST(TestReorder);
+    RUN_TEST(TestDuplicateAndLate);
+    RUN_TEST(TestLossConcealment);
+    RUN_TEST(TestLateArrivalFillsGap);
+    RUN_TEST(TestLongGapSkipped);
+    RUN_TEST(TestRestart);
+    RUN_TEST(TestSequenceWraps);
+    RUN_TEST(TestUnsequencedPackets);
+    RUN_TEST(TestCounters);
+    RUN_TEST(TestAdaptiveDelay);
+    RUN_TEST(TestUnderrun);
+    return 0;
+}
@@ -0,0 +1,156 @@
+#include "ogg_demuxer.h"
+#include "test_util.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// Straightforward reference: reassemble every packet into its own buffer, drop OpusHead and OpusTags
+static std::vector<std::string> ReferencePackets(const std::string& data, int* sample_rate) {
+    std::vector<std::string> packets;
+    std::string current;
+    size_t pos = 0;
+    while (pos + 27 <= data.size() && data.compare(pos, 4, "OggS") == 0) {
+        size_t segments = (uint8_t)data[pos + 26];
+        size_t body = pos + 27 + segments;
+        for (size_t i = 0; i < segments; i++) {
+            size_t lacing = (uint8_t)data[pos + 27 + i];
+            current.append(data, body, lacing);
+            body += lacing;
+            if (lacing < 255) {
+                packets.push_back(current);
+                current.clear();
+            }
+        }
+        pos = body;
+    }
+    CHECK(packets.size() >= 2);
+    CHECK(packets[0].compare(0, 8, "OpusHead") == 0);
+    CHECK(packets[1].compare(0, 8, "OpusTags") == 0);
+    auto head = reinterpret_cast<const uint8_t*>(packets[0].data());
+    *sample_rate = head[12] | (head[13] << 8) | (head[14] << 16) | (head[15] << 24);
+    packets.erase(packets.begin(), packets.begin() + 2);
+    return packets;
+}
+
+static std::vector<std::string> DemuxPackets(const std::string& data, int* sample_rate, size_t* views = nullptr) {
+    OggDemuxer demuxer;
+    demuxer.Open(data);
+    std::vector<std::string> packets;
+    std::string_view packet;
+    while (demuxer.Next(packet)) {
+        if (views != nullptr && packet.data() >= data.data() && packet.data() + packet.size() <= data.data() + data.size()) {
+            (*views)++;
+        }
+        packets.emplace_back(packet);
+    }
+    *sample_rate = demuxer.sample_rate();
+    demuxer.Close();
+    CHECK(!demuxer.IsOpen());
+    return packets;
+}
+
+static std::string ReadFile(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// Builds an Ogg page, without a valid CRC, the demuxer does not check it
+static std::string Page(const std::vector<std::string>& segments_data, const std::vector<uint8_t>& lacing) {
+    std::string page = "OggS";
+    page.append(22, '\0');
+    page.push_back((char)lacing.size());
+    page.append(lacing.begin(), lacing.end());
+    for (auto& data : segments_data) {
+        page += data;
+    }
+    return page;
+}
+
+static std::string Head() {
+    std::string head = "OpusHead";
+    const uint8_t fields[] = {1, 1, 0x38, 0x01, 0x80, 0xBB, 0x00, 0x00, 0, 0, 0};
+    head.append(reinterpret_cast<const char*>(fields), sizeof(fields));
+    return Page({head}, {(uint8_t)head.size()}) + Page({"OpusTags"}, {8});
+}
+
+static void TestAssets() {
+    size_t files = 0;
+    for (auto& entry : std::filesystem::recursive_directory_iterator(ASSETS_DIR)) {
+        if (entry.path().extension() != ".ogg") {
+            continue;
+        }
+        std::string data = ReadFile(entry.path());
+        int expected_rate, rate;
+        size_t views = 0;
+        auto expected = ReferencePackets(data, &expected_rate);
+        auto packets = DemuxPackets(data, &rate, &views);
+        if (packets != expected || rate != expected_rate) {
+            fprintf(stderr, "%s: %zu packets, expected %zu\n", entry.path().c_str(), packets.size(), expected.size());
+            CHECK(false);
+        }
+        // Only packets that span pages are copied
+        CHECK(views > 0);
+        files++;
+    }
+    CHECK(files > 0);
+}
+
+static void TestPacketSpanningPages() {
+    std::string a(300, 'a');
+    std::string b(100, 'b');
+    std::string data = Head();
+    // a: 255 + 45 across two pages, then b
+    data += Page({a.substr(0, 255)}, {255});
+    data += Page({a.substr(255), b}, {45, 100});
+    int rate;
+    size_t views = 0;
+    auto packets = DemuxPackets(data, &rate, &views);
+    CHECK(packets.size() == 2);
+    CHECK(packets[0] == a);
+    CHECK(packets[1] == b);
+    CHECK_EQ(views, 1);
+    CHECK_EQ(rate, 48000);
+}
+
+static void TestResyncAfterGarbage() {
+    std::string data = Head();
+    data += Page({"one"}, {3});
+    data += "garbage";
+    data += Page({"two"}, {3});
+    int rate;
+    auto packets = DemuxPackets(data, &rate);
+    CHECK((packets == std::vector<std::string>{"one", "two"}));
+}
+
+static void TestTruncated() {
+    std::string data = Head() + Page({"one"}, {3}) + Page({"two!"}, {4});
+    int rate;
+    auto packets = DemuxPackets(data.substr(0, data.size() - 1), &rate);
+    CHECK((packets == std::vector<std::string>{"one"}));
+    packets = DemuxPackets(data.substr(0, 10), &rate);
+    CHECK(packets.empty());
+}
+
+static void TestReopen() {
+    std::string first = Head() + Page({"one"}, {3});
+    std::string second = Head() + Page({"two"}, {3});
+    OggDemuxer demuxer;
+    std::string_view packet;
+    demuxer.Open(first);
+    CHECK(demuxer.Next(packet) && packet == "one");
+    demuxer.Open(second);
+    CHECK(demuxer.Next(packet) && packet == "two");
+    CHECK(!demuxer.Next(packet));
+}
+
+int main() {
+    RUN_TEST(TestAssets);
+    RUN_TEST(TestPacketSpanningPages);
+    RUN_TEST(TestResyncAfterGarbage);
+    RUN_TEST(TestTruncated);
+    RUN_TEST(TestReopen);
+    return 0;
+}
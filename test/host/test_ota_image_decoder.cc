@@ -0,0 +1,308 @@
+#include "ota_image_decoder.h"
+#include "test_util.h"
+
+#include <openssl/sha.h>
+#include <zlib.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * ota_image_decoder.c against images from scripts/ota_image_tool.py, inflated by the host's zlib behind the
+ * tinfl API of the ROM. The running firmware a delta image applies to is a string behind esp_partition_read().
+ * Every image is fed in odd chunk sizes, so headers, zlib blocks and patch records all get split.
+ */
+
+static const esp_partition_t kSource = {0x10000, 1024 * 1024, "ota_0"};
+static std::string source_flash;
+static std::string work_dir;
+
+extern "C" esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* dst, size_t size) {
+    CHECK(partition == &kSource && offset + size <= partition->size);
+    // Erased flash after the firmware
+    memset(dst, 0xFF, size);
+    if (offset < source_flash.size()) {
+        memcpy(dst, source_flash.data() + offset, std::min(size, source_flash.size() - offset));
+    }
+    return ESP_OK;
+}
+
+static std::string Sha256(const std::string& data) {
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256((const unsigned char*)data.data(), data.size(), digest);
+    return std::string((const char*)digest, sizeof(digest));
+}
+
+static std::string ReadFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    CHECK(file);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+static void WriteFile(const std::string& path, const std::string& data) {
+    std::ofstream file(path, std::ios::binary);
+    file.write(data.data(), data.size());
+    CHECK(file);
+}
+
+static std::string RunTool(const std::string& args, const std::string& output) {
+    std::string command = std::string(PYTHON) + " " + OTA_IMAGE_TOOL + " " + args + " -o " + work_dir + "/" + output +
+        " > /dev/null";
+    CHECK_EQ(system(command.c_str()), 0);
+    return ReadFile(work_dir + "/" + output);
+}
+
+static void PutU32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back((char)(value >> (8 * i)));
+    }
+}
+
+// A firmware of sorts: code words, addresses into itself and a string table
+static std::string MakeOldFirmware(size_t size) {
+    std::mt19937 rng(1);
+    std::string firmware;
+    while (firmware.size() < size) {
+        uint32_t kind = rng() % 8;
+        if (kind < 4) {
+            PutU32(firmware, rng());
+        } else if (kind < 7) {
+            PutU32(firmware, 0x42000000 + (rng() % (uint32_t)size & ~3u));
+        } else {
+            firmware += "E (%lu) ota: check failed\n";
+        }
+    }
+    firmware.resize(size);
+    return firmware;
+}
+
+// The next version: new code in the middle, everything after it moved and its addresses shifted
+static std::string MakeNewFirmware(const std::string& old) {
+    std::mt19937 rng(2);
+    std::string inserted(300, '\0');
+    for (auto& c : inserted) {
+        c = (char)rng();
+    }
+    std::string firmware = old.substr(0, 20000) + inserted + old.substr(20000);
+    for (size_t i = 20300; i + 4 <= firmware.size(); i += 4) {
+        uint32_t word;
+        memcpy(&word, &firmware[i], 4);
+        if ((word & 0xFF000000) == 0x42000000) {
+            word += 300;
+            memcpy(&firmware[i], &word, 4);
+        }
+    }
+    return firmware + std::string(2000, 'n');
+}
+
+struct Result {
+    esp_err_t feed = ESP_OK;
+    esp_err_t finish = ESP_OK;
+    ota_image_type_t type = OTA_IMAGE_TYPE_UNKNOWN;
+    size_t image_size = 0;
+    std::string output;
+};
+
+static esp_err_t Collect(void* ctx, const uint8_t* data, size_t len) {
+    static_cast<std::string*>(ctx)->append((const char*)data, len);
+    return ESP_OK;
+}
+
+// Feeds the image in chunks of the given sizes, round robin, until the first error
+static Result Decode(const std::string& image, const std::vector<size_t>& chunks) {
+    Result result;
+    ota_image_decoder_t* decoder = ota_image_decoder_create(&kSource, Collect, &result.output);
+    CHECK(decoder != nullptr);
+    size_t offset = 0;
+    for (size_t i = 0; offset < image.size(); i++) {
+        size_t n = std::min(chunks[i % chunks.size()], image.size() - offset);
+        result.feed = ota_image_decoder_feed(decoder, (const uint8_t*)image.data() + offset, n);
+        if (result.feed != ESP_OK) {
+            break;
+        }
+        offset += n;
+    }
+    if (result.feed == ESP_OK) {
+        result.finish = ota_image_decoder_finish(decoder);
+    }
+    result.type = ota_image_decoder_get_type(decoder);
+    result.image_size = ota_image_decoder_get_image_size(decoder);
+    ota_image_decoder_destroy(decoder);
+    return result;
+}
+
+static const std::vector<std::vector<size_t>> kChunkPatterns = {
+    {1}, {3, 7}, {79, 2, 13}, {81}, {4093}, {1000003}, {5, 65537, 251},
+};
+
+// A delta image made by hand, for patches the tool never makes
+static std::string Encode(const std::string& patch, const std::string& image, const std::string& source) {
+    std::string encoded = OTA_IMAGE_MAGIC;
+    encoded += {1, 2, 0, 0};
+    PutU32(encoded, image.size());
+    PutU32(encoded, source.size());
+    encoded += Sha256(image) + Sha256(source);
+    uLongf size = compressBound(patch.size());
+    std::string body(size, '\0');
+    CHECK_EQ(compress2((Bytef*)&body[0], &size, (const Bytef*)patch.data(), patch.size(), 9), Z_OK);
+    return encoded + body.substr(0, size);
+}
+
+static std::string Record(uint8_t op, uint32_t length, uint32_t source_offset) {
+    std::string record(1, (char)op);
+    PutU32(record, length);
+    PutU32(record, source_offset);
+    return record;
+}
+
+static std::string old_firmware;
+static std::string new_firmware;
+static std::string compressed;
+static std::string delta;
+
+static void TestRaw() {
+    for (auto& chunks : kChunkPatterns) {
+        auto result = Decode(new_firmware, chunks);
+        CHECK_EQ(result.feed, ESP_OK);
+        CHECK_EQ(result.finish, ESP_OK);
+        CHECK_EQ(result.type, OTA_IMAGE_TYPE_RAW);
+        CHECK(result.output == new_firmware);
+    }
+}
+
+static void TestCompressed() {
+    CHECK(compressed.size() < new_firmware.size());
+    for (auto& chunks : kChunkPatterns) {
+        auto result = Decode(compressed, chunks);
+        CHECK_EQ(result.feed, ESP_OK);
+        CHECK_EQ(result.finish, ESP_OK);
+        CHECK_EQ(result.type, OTA_IMAGE_TYPE_COMPRESSED);
+        CHECK_EQ(result.image_size, new_firmware.size());
+        CHECK(result.output == new_firmware);
+        CHECK(Sha256(result.output) == compressed.substr(16, 32));
+    }
+}
+
+static void TestDelta() {
+    CHECK(delta.size() < compressed.size() / 2);
+    for (auto& chunks : kChunkPatterns) {
+        auto result = Decode(delta, chunks);
+        CHECK_EQ(result.feed, ESP_OK);
+        CHECK_EQ(result.finish, ESP_OK);
+        CHECK_EQ(result.type, OTA_IMAGE_TYPE_DELTA);
+        CHECK_EQ(result.image_size, new_firmware.size());
+        CHECK(result.output == new_firmware);
+        CHECK(Sha256(result.output) == delta.substr(16, 32));
+    }
+}
+
+// A delta for another firmware is refused with the header, before anything is written
+static void TestWrongSource() {
+    source_flash[1000] ^= 1;
+    for (auto& chunks : kChunkPatterns) {
+        auto result = Decode(delta, chunks);
+        CHECK_EQ(result.feed, ESP_ERR_INVALID_VERSION);
+        CHECK(result.output.empty());
+    }
+    source_flash = old_firmware;
+}
+
+static void TestHashMismatch() {
+    for (auto image : {compressed, delta}) {
+        image[16] ^= 1;
+        auto result = Decode(image, {4093});
+        CHECK_EQ(result.feed, ESP_OK);
+        CHECK_EQ(result.finish, ESP_ERR_INVALID_CRC);
+    }
+}
+
+// Without its Adler-32 trailer the stream is not done either, even with the whole image written
+static void TestTruncated() {
+    for (auto& image : {compressed, delta}) {
+        for (size_t cut : {(size_t)1, (size_t)4, image.size() / 2, image.size() - OTA_IMAGE_HEADER_SIZE}) {
+            auto result = Decode(image.substr(0, image.size() - cut), {81});
+            CHECK_EQ(result.feed, ESP_OK);
+            CHECK_EQ(result.finish, ESP_ERR_INVALID_SIZE);
+        }
+    }
+}
+
+// Bytes after the end of the zlib stream, in the same feed as its end or in one of their own
+static void TestTrailingData() {
+    for (auto& image : {compressed, delta}) {
+        auto result = Decode(image + "x", {image.size() + 1});
+        CHECK_EQ(result.feed, ESP_ERR_INVALID_SIZE);
+        result = Decode(image + "x", {image.size(), 1});
+        CHECK_EQ(result.feed, ESP_ERR_INVALID_SIZE);
+        result = Decode(image + std::string(4096, '\0'), {4093});
+        CHECK_EQ(result.feed, ESP_ERR_INVALID_SIZE);
+    }
+}
+
+static void TestAddPastSource() {
+    std::string source = old_firmware.substr(0, 1000);
+    source_flash = source;
+    std::string image(20, '\0');
+
+    // The last byte of the source is the last one an ADD may read
+    auto result = Decode(Encode(Record(0, 20, 980) + std::string(20, '\0'), source.substr(980), source), {7});
+    CHECK_EQ(result.feed, ESP_OK);
+    CHECK_EQ(result.finish, ESP_OK);
+    CHECK(result.output == source.substr(980));
+
+    for (auto record : {Record(0, 20, 981), Record(0, 1001, 0), Record(0, 0x20, 0xFFFFFFF0)}) {
+        result = Decode(Encode(record + std::string(20, '\0'), image, source), {7});
+        CHECK_EQ(result.feed, ESP_ERR_INVALID_RESPONSE);
+        CHECK(result.output.empty());
+    }
+    // An INSERT takes no source bytes whatever its offset says, an unknown op is an error
+    result = Decode(Encode(Record(1, 20, 0xFFFFFFF0) + image, image, source), {7});
+    CHECK_EQ(result.finish, ESP_OK);
+    result = Decode(Encode(Record(2, 20, 0) + image, image, source), {7});
+    CHECK_EQ(result.feed, ESP_ERR_INVALID_RESPONSE);
+
+    // A source larger than the partition it is read from
+    std::string encoded = Encode(Record(1, 20, 0) + image, image, source);
+    encoded[12] = encoded[13] = encoded[14] = encoded[15] = (char)0x7F;
+    result = Decode(encoded, {7});
+    CHECK_EQ(result.feed, ESP_ERR_INVALID_ARG);
+    source_flash = old_firmware;
+}
+
+int main() {
+    char dir[] = "/tmp/ota_image_decoder.XXXXXX";
+    CHECK(mkdtemp(dir) != nullptr);
+    work_dir = dir;
+
+    old_firmware = MakeOldFirmware(160 * 1024);
+    new_firmware = MakeNewFirmware(old_firmware);
+    source_flash = old_firmware;
+    WriteFile(work_dir + "/old.bin", old_firmware);
+    WriteFile(work_dir + "/new.bin", new_firmware);
+    compressed = RunTool("compress " + work_dir + "/new.bin", "compressed.bin");
+    delta = RunTool("delta " + work_dir + "/old.bin " + work_dir + "/new.bin", "delta.bin");
+    printf("  %zu byte firmware, %zu compressed, %zu as a delta\n", new_firmware.size(), compressed.size(),
+        delta.size());
+
+    RUN_TEST(TestRaw);
+    RUN_TEST(TestCompressed);
+    RUN_TEST(TestDelta);
+    RUN_TEST(TestWrongSource);
+    RUN_TEST(TestHashMismatch);
+    RUN_TEST(TestTruncated);
+    RUN_TEST(TestTrailingData);
+    RUN_TEST(TestAddPastSource);
+
+    for (auto name : {"old.bin", "new.bin", "compressed.bin", "delta.bin"}) {
+        unlink((work_dir + "/" + name).c_str());
+    }
+    rmdir(dir);
+    return 0;
+}
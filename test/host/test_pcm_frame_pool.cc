@@ -0,0 +1,103 @@
+#include "pcm_frame_pool.h"
+#include "alloc_counter.h"
+#include "test_util.h"
+
+#include <utility>
+
+static constexpr size_t kFrames = 4;
+static constexpr size_t kFrameSamples = 960 * 2;
+
+// The pool is a process wide singleton, checks look at the change of its counters
+static PcmFramePool& pool = PcmFramePool::GetInstance();
+
+static void TestAcquireWithinPool() {
+    auto before = pool.GetStats();
+    unsigned long allocations = host_allocations;
+    {
+        PcmFrame frames[kFrames];
+        for (auto& frame : frames) {
+            frame = pool.Acquire();
+            CHECK(frame);
+            CHECK(frame->empty());
+            CHECK(frame->capacity() >= kFrameSamples);
+            frame->resize(kFrameSamples);
+        }
+        CHECK_EQ(pool.GetStats().in_use, kFrames);
+    }
+    auto after = pool.GetStats();
+    CHECK_EQ(host_allocations, allocations);
+    CHECK_EQ(after.in_use, 0);
+    CHECK_EQ(after.acquired - before.acquired, kFrames);
+    CHECK_EQ(after.heap_allocations, before.heap_allocations);
+    CHECK(after.peak_in_use >= kFrames);
+}
+
+static void TestSteadyStateIsAllocationFree() {
+    auto before = pool.GetStats();
+    unsigned long allocations = host_allocations;
+    for (int i = 0; i < 10000; i++) {
+        auto capture = pool.Acquire();
+        capture->resize(kFrameSamples);
+        auto processed = pool.Acquire();
+        processed->assign(capture->begin(), capture->begin() + kFrameSamples / 2);
+        // Handed over to another owner, like the encode queue
+        PcmFrame queued = std::move(processed);
+        CHECK(!processed);
+        CHECK(queued);
+    }
+    CHECK_EQ(host_allocations, allocations);
+    CHECK_EQ(pool.GetStats().heap_allocations, before.heap_allocations);
+}
+
+static void TestGrowWhenExhausted() {
+    auto before = pool.GetStats();
+    {
+        PcmFrame frames[kFrames + 1];
+        for (auto& frame : frames) {
+            frame = pool.Acquire();
+        }
+    }
+    auto after = pool.GetStats();
+    CHECK_EQ(after.frames, before.frames + 1);
+    CHECK_EQ(after.heap_allocations, before.heap_allocations + 1);
+    CHECK_EQ(after.in_use, 0);
+}
+
+static void TestReallocationIsCounted() {
+    auto before = pool.GetStats();
+    {
+        auto frame = pool.Acquire();
+        frame->resize(frame->capacity() + 1);
+    }
+    {
+        // Moving the vector out leaves an empty one behind, the pool reserves it again
+        auto frame = pool.Acquire();
+        frame->resize(kFrameSamples);
+        std::vector<int16_t> stolen = std::move(*frame);
+        CHECK_EQ(stolen.size(), kFrameSamples);
+    }
+    auto after = pool.GetStats();
+    CHECK_EQ(after.heap_allocations, before.heap_allocations + 2);
+    auto frame = pool.Acquire();
+    CHECK(frame->capacity() >= kFrameSamples);
+}
+
+static void TestReset() {
+    auto frame = pool.Acquire();
+    uint32_t in_use = pool.GetStats().in_use;
+    frame.Reset();
+    CHECK(!frame);
+    CHECK_EQ(pool.GetStats().in_use, in_use - 1);
+    frame.Reset();
+    CHECK_EQ(pool.GetStats().in_use, in_use - 1);
+}
+
+int main() {
+    pool.Initialize(kFrames, kFrameSamples);
+    RUN_TEST(TestAcquireWithinPool);
+    RUN_TEST(TestSteadyStateIsAllocationFree);
+    RUN_TEST(TestGrowWhenExhausted);
+    RUN_TEST(TestReallocationIsCounted);
+    RUN_TEST(TestReset);
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "replay_window.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+
+static void TestInOrderAndDuplicates() {
+    ReplayWindow window;
+    for (uint32_t seq = 1; seq <= 200; seq++) {
+        CHECK(window.Accept(seq));
+        CHECK(!window.Accept(seq));
+    }
+    CHECK_EQ(window.highest(), 200);
+}
+
+static void TestReordered() {
+    ReplayWindow window;
+    CHECK(window.Accept(10));
+    CHECK(window.Accept(12));
+    CHECK(window.Accept(11));
+    CHECK(window.Accept(5));
+    CHECK(!window.Accept(11));
+    CHECK(!window.Accept(5));
+    CHECK_EQ(window.highest(), 12);
+}
+
+static void TestWindowEdge() {
+    ReplayWindow window;
+    CHECK(window.Accept(100));
+    // 63 behind is the oldest one still tracked
+    CHECK(window.Accept(100 - (ReplayWindow::kSize - 1)));
+    CHECK(!window.Accept(100 - ReplayWindow::kSize));
+    CHECK(!window.Accept(1));
+
+    // Sliding by exactly the window size forgets everything before
+    CHECK(window.Accept(100 + ReplayWindow::kSize));
+    CHECK(!window.Accept(100));
+    CHECK(window.Accept(101));
+}
+
+static void TestLargeJump() {
+    ReplayWindow window;
+    CHECK(window.Accept(1));
+    CHECK(window.Accept(1000000));
+    CHECK(!window.Accept(1));
+    CHECK(!window.Accept(1000000));
+    CHECK(window.Accept(999999));
+}
+
+static void TestSequenceWrap() {
+    ReplayWindow window;
+    CHECK(window.Accept(0xFFFFFFF0u));
+    for (uint32_t seq = 0xFFFFFFF1u; seq != 20; seq++) {
+        CHECK(window.Accept(seq));
+        CHECK(!window.Accept(seq));
+    }
+    CHECK_EQ(window.highest(), 19);
+    // Reordered and replayed across the wrap
+    CHECK(!window.Accept(0xFFFFFFFFu));
+    CHECK(!window.Accept(0xFFFFFFF0u));
+    CHECK(window.Accept(21));
+    CHECK(window.Accept(20));
+    CHECK(!window.Accept(0xFFFFFFF0u - ReplayWindow::kSize));
+
+    // A sequence that went back over the wrap by less than the window is still accepted once
+    ReplayWindow reordered;
+    CHECK(reordered.Accept(3));
+    CHECK(reordered.Accept(0xFFFFFFFEu));
+    CHECK_EQ(reordered.highest(), 3);
+    CHECK(!reordered.Accept(0xFFFFFFFEu));
+}
+
+static void TestReset() {
+    ReplayWindow window;
+    CHECK(window.Accept(500));
+    window.Reset();
+    CHECK_EQ(window.highest(), 0);
+    CHECK(window.Accept(500));
+    CHECK(window.Accept(499));
+}
+
+// Against a set of everything seen: a shuffled stream with replays accepts each sequence exactly once,
+// unless it arrived more than a window behind the newest
+static void TestAgainstReference() {
+    std::mt19937 rng(7);
+    std::vector<uint32_t> stream;
+    for (uint32_t seq = 1; seq <= 5000; seq++) {
+        stream.push_back(seq);
+        if (rng() % 4 == 0) {
+            stream.push_back(seq - rng() % std::min<uint32_t>(seq, 100));
+        }
+    }
+    // Local reordering within 16 packets
+    for (size_t i = 0; i + 16 < stream.size(); i += 8) {
+        std::shuffle(stream.begin() + i, stream.begin() + i + 16, rng);
+    }
+
+    ReplayWindow window;
+    std::set<uint32_t> seen;
+    uint32_t highest = 0;
+    for (uint32_t seq : stream) {
+        bool expected = !seen.count(seq) && (highest == 0 || seq + ReplayWindow::kSize > highest);
+        CHECK_EQ(window.Accept(seq), expected);
+        if (expected) {
+            seen.insert(seq);
+            highest = std::max(highest, seq);
+        }
+    }
+}
+
+int main() {
+    RUN_TEST(TestInOrderAndDuplicates);
+    RUN_TEST(TestReordered);
+    RUN_TEST(TestWindowEdge);
+    RUN_TEST(TestLargeJump);
+    RUN_TEST(TestSequenceWrap);
+    RUN_TEST(TestReset);
+    RUN_TEST(TestAgainstReference);
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "sound_cache.h"
+#include "test_util.h"
+
+#include <string>
+#include <vector>
+
+// Keys are compared by address, like the embedded assets
+static const std::string kSounds[] = {"sound a", "sound b", "sound c", "sound d", "sound e"};
+
+static std::vector<int16_t> Pcm(size_t samples, int16_t value) {
+    return std::vector<int16_t>(samples, value);
+}
+
+static void TestHitAndMiss() {
+    SoundCache cache;
+    cache.Initialize(4000);
+    CHECK(cache.Lookup(kSounds[0]) == nullptr);
+    auto pcm = Pcm(100, 7);
+    cache.Insert(kSounds[0], pcm.data(), pcm.size());
+    auto entry = cache.Lookup(kSounds[0]);
+    CHECK(entry != nullptr);
+    CHECK_EQ(entry->samples, 100);
+    CHECK_EQ(entry->pcm[99], 7);
+
+    // Same contents at another address is another sound
+    std::string copy = kSounds[0];
+    CHECK(cache.Lookup(copy) == nullptr);
+    // So is a different length at the same address
+    CHECK(cache.Lookup(std::string_view(kSounds[0].data(), 3)) == nullptr);
+
+    auto stats = cache.GetStats();
+    CHECK_EQ(stats.hits, 1);
+    CHECK_EQ(stats.misses, 3);
+    CHECK_EQ(stats.entries, 1);
+    CHECK_EQ(stats.bytes, 200);
+}
+
+static void TestLruEviction() {
+    SoundCache cache;
+    // max_entry_bytes() is 1000, room for four 500 sample entries
+    cache.Initialize(4000);
+    auto pcm = Pcm(500, 1);
+    for (int i = 0; i < 4; i++) {
+        cache.Insert(kSounds[i], pcm.data(), pcm.size());
+    }
+    // a becomes the most recent, b is now the oldest
+    CHECK(cache.Lookup(kSounds[0]) != nullptr);
+    cache.Insert(kSounds[4], pcm.data(), pcm.size());
+
+    CHECK(cache.Lookup(kSounds[1]) == nullptr);
+    CHECK(cache.Lookup(kSounds[0]) != nullptr);
+    CHECK(cache.Lookup(kSounds[2]) != nullptr);
+    CHECK(cache.Lookup(kSounds[3]) != nullptr);
+    CHECK(cache.Lookup(kSounds[4]) != nullptr);
+    auto stats = cache.GetStats();
+    CHECK_EQ(stats.evictions, 1);
+    CHECK_EQ(stats.entries, 4);
+    CHECK(stats.bytes <= stats.capacity_bytes);
+}
+
+static void TestEntryTooLarge() {
+    SoundCache cache;
+    cache.Initialize(4000);
+    auto pcm = Pcm(cache.max_entry_bytes() / sizeof(int16_t) + 1, 1);
+    cache.Insert(kSounds[0], pcm.data(), pcm.size());
+    CHECK(cache.Lookup(kSounds[0]) == nullptr);
+    cache.Insert(kSounds[0], pcm.data(), 0);
+    CHECK(cache.Lookup(kSounds[0]) == nullptr);
+    CHECK_EQ(cache.GetStats().insertions, 0);
+}
+
+static void TestDuplicateInsert() {
+    SoundCache cache;
+    cache.Initialize(4000);
+    auto first = Pcm(100, 1);
+    auto second = Pcm(100, 2);
+    cache.Insert(kSounds[0], first.data(), first.size());
+    cache.Insert(kSounds[0], second.data(), second.size());
+    CHECK_EQ(cache.Lookup(kSounds[0])->pcm[0], 1);
+    auto stats = cache.GetStats();
+    CHECK_EQ(stats.insertions, 1);
+    CHECK_EQ(stats.bytes, 200);
+}
+
+static void TestEvictedEntryStaysValid() {
+    SoundCache cache;
+    cache.Initialize(4000);
+    auto pcm = Pcm(500, 3);
+    cache.Insert(kSounds[0], pcm.data(), pcm.size());
+    auto playing = cache.Lookup(kSounds[0]);
+    for (int i = 1; i < 5; i++) {
+        cache.Insert(kSounds[i], pcm.data(), pcm.size());
+    }
+    CHECK(cache.Lookup(kSounds[0]) == nullptr);
+    CHECK_EQ(playing->samples, 500);
+    CHECK_EQ(playing->pcm[499], 3);
+}
+
+int main() {
+    RUN_TEST(TestHitAndMiss);
+    RUN_TEST(TestLruEviction);
+    RUN_TEST(TestEntryTooLarge);
+    RUN_TEST(TestDuplicateInsert);
+    RUN_TEST(TestEvictedEntryStaysValid);
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include "spsc_queue.h"
+#include "host_event.h"
+#include "test_util.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+static void TestCapacityAndTransitions() {
+    SpscQueue<std::unique_ptr<int>, 3> queue;
+    bool was_empty = false, was_full = false;
+    CHECK(queue.Push(std::make_unique<int>(1), &was_empty) && was_empty);
+    CHECK(queue.Push(std::make_unique<int>(2), &was_empty) && !was_empty);
+    CHECK(queue.Push(std::make_unique<int>(3), &was_empty) && !was_empty);
+    CHECK(queue.Full());
+
+    // A rejected item is left with the caller
+    auto rejected = std::make_unique<int>(4);
+    CHECK(!queue.Push(std::move(rejected)));
+    CHECK(rejected != nullptr);
+
+    std::unique_ptr<int> item;
+    CHECK(queue.Pop(item, &was_full) && was_full && *item == 1);
+    CHECK(queue.Pop(item, &was_full) && !was_full && *item == 2);
+    CHECK(queue.Push(std::move(rejected)));
+    CHECK(queue.Pop(item) && *item == 3);
+    CHECK(queue.Pop(item) && *item == 4);
+    CHECK(!queue.Pop(item, &was_full) && !was_full);
+    CHECK(queue.Empty());
+}
+
+static void TestLimit() {
+    SpscQueue<int, 8> queue;
+    for (int i = 0; i < 6; i++) {
+        CHECK(queue.Push(int(i)));
+    }
+    // Items above a lowered limit stay queued, the queue reports full until they drain
+    queue.SetLimit(4);
+    CHECK(queue.Full());
+    CHECK(!queue.Push(6));
+    int item;
+    bool was_full;
+    CHECK(queue.Pop(item, &was_full) && item == 0 && was_full);
+    CHECK(queue.Pop(item) && queue.Pop(item) && item == 2);
+    CHECK(!queue.Full());
+    CHECK(queue.Push(6));
+    CHECK_EQ(queue.Size(), 4);
+
+    queue.SetLimit(0);
+    CHECK_EQ(queue.limit(), 1);
+    queue.SetLimit(100);
+    CHECK_EQ(queue.limit(), 8);
+}
+
+static void TestFlush() {
+    SpscQueue<std::unique_ptr<int>, 4> queue;
+    for (int i = 0; i < 3; i++) {
+        CHECK(queue.Push(std::make_unique<int>(i)));
+    }
+    queue.RequestFlush();
+    CHECK(queue.Push(std::make_unique<int>(3)));
+    std::unique_ptr<int> item;
+    CHECK(queue.Pop(item) && *item == 3);
+    CHECK(!queue.Pop(item));
+    // The slots wrap many times
+    for (int i = 0; i < 1000; i++) {
+        CHECK(queue.Push(std::make_unique<int>(i)));
+        CHECK(queue.Pop(item) && *item == i);
+    }
+}
+
+// Producer and consumer on two threads, each side sleeps on its event when it cannot proceed and is only
+// woken on the transition the other side reports, like AudioService does with its event group bits.
+// A lost wakeup shows up as a timeout.
+static void TestStress(bool with_flushes) {
+    constexpr uint32_t kItems = 500000;
+    SpscQueue<std::unique_ptr<uint32_t>, 8> queue;
+    HostEvent not_empty, not_full;
+    std::atomic<bool> producer_done = false;
+    std::atomic<bool> stop_flushing = false;
+
+    std::thread producer([&]() {
+        for (uint32_t i = 1; i <= kItems; i++) {
+            auto item = std::make_unique<uint32_t>(i);
+            bool was_empty;
+            while (!queue.Push(std::move(item), &was_empty)) {
+                CHECK(not_full.Wait(5s));
+            }
+            if (was_empty) {
+                not_empty.Set();
+            }
+        }
+        producer_done = true;
+        not_empty.Set();
+    });
+
+    std::thread flusher;
+    if (with_flushes) {
+        flusher = std::thread([&]() {
+            while (!stop_flushing) {
+                queue.RequestFlush();
+                std::this_thread::sleep_for(50us);
+            }
+        });
+    }
+
+    uint32_t last = 0;
+    uint32_t received = 0;
+    for (;;) {
+        std::unique_ptr<uint32_t> item;
+        bool was_full;
+        bool popped = queue.Pop(item, &was_full);
+        if (was_full) {
+            not_full.Set();
+        }
+        if (popped) {
+            // In order, with gaps only where a flush dropped items
+            CHECK(*item > last);
+            CHECK(with_flushes || *item == last + 1);
+            last = *item;
+            received++;
+            if (last == kItems) {
+                break;
+            }
+            continue;
+        }
+        if (producer_done && queue.Empty()) {
+            // Only a flush can drop the last item
+            CHECK(with_flushes);
+            break;
+        }
+        CHECK(not_empty.Wait(5s) || producer_done);
+    }
+    stop_flushing = true;
+    producer.join();
+    if (flusher.joinable()) {
+        flusher.join();
+    }
+    CHECK(with_flushes ? received <= kItems : received == kItems);
+    printf("  %u of %u items received\n", received, kItems);
+}
+
+static void TestStressNoFlush() {
+    TestStress(false);
+}
+
+static void TestStressWithFlushes() {
+    TestStress(true);
+}
+
+int main() {
+    RUN_TEST(TestCapacityAndTransitions);
+    RUN_TEST(TestLimit);
+    RUN_TEST(TestFlush);
+    RUN_TEST(TestStressNoFlush);
+    RUN_TEST(TestStressWithFlushes);
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include "uplink_overflow.h"
+#include "spsc_queue.h"
+#include "pcm_frame_pool.h"
+#include "host_event.h"
+#include "test_util.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+static constexpr size_t kEncodeQueue = 4;
+static constexpr size_t kSendQueue = 24;
+static constexpr size_t kFrameSamples = 960;
+
+// AudioTask and the encoded packet, as far as the overflow path looks at them
+struct Task {
+    PcmFrame pcm;
+    uint32_t index = 0;
+    bool voice = true;
+};
+
+static PcmFramePool& pool = PcmFramePool::GetInstance();
+
+static Task Capture(uint32_t index, bool voice = true) {
+    Task task;
+    task.pcm = pool.Acquire();
+    task.pcm->resize(kFrameSamples);
+    task.index = index;
+    task.voice = voice;
+    return task;
+}
+
+static void TestDropNewest() {
+    for (size_t queued = 0; queued < kSendQueue; queued++) {
+        CHECK(!ShouldDropUplinkFrame(kUplinkOverflowDropNewest, queued, kSendQueue, false));
+        CHECK(!ShouldDropUplinkFrame(kUplinkOverflowDropNewest, queued, kSendQueue, true));
+    }
+    CHECK(ShouldDropUplinkFrame(kUplinkOverflowDropNewest, kSendQueue, kSendQueue, true));
+    // Items above a lowered limit, see SpscQueue::SetLimit()
+    CHECK(ShouldDropUplinkFrame(kUplinkOverflowDropNewest, kSendQueue + 2, kSendQueue, true));
+}
+
+static void TestDropSilenceFirst() {
+    // Silence goes from three quarters of the queue on, speech only once it is full
+    CHECK(!ShouldDropUplinkFrame(kUplinkOverflowDropSilenceFirst, 17, kSendQueue, false));
+    CHECK(ShouldDropUplinkFrame(kUplinkOverflowDropSilenceFirst, 18, kSendQueue, false));
+    CHECK(!ShouldDropUplinkFrame(kUplinkOverflowDropSilenceFirst, 23, kSendQueue, true));
+    CHECK(ShouldDropUplinkFrame(kUplinkOverflowDropSilenceFirst, 24, kSendQueue, true));
+}
+
+// The encoder never pops: the input task keeps going, the frames that find the queue full are dropped,
+// counted and their buffers go back to the pool, the frames queued first are the ones kept
+static void TestSaturatedEncodeQueue() {
+    constexpr uint32_t kFrames = 1000;
+    SpscQueue<Task, kEncodeQueue> encode_queue;
+    uint32_t drops = 0;
+    uint32_t wakeups = 0;
+    HostEvent done;
+    auto in_use = pool.GetStats().in_use;
+
+    std::thread input([&]() {
+        for (uint32_t i = 0; i < kFrames; i++) {
+            bool was_empty = false;
+            if (PushOrDrop(encode_queue, Capture(i), drops, &was_empty) && was_empty) {
+                wakeups++;
+            }
+        }
+        done.Set();
+    });
+    // A push that waited for the consumer would never finish
+    CHECK(done.Wait(5s));
+    input.join();
+
+    CHECK_EQ(drops, kFrames - kEncodeQueue);
+    CHECK_EQ(wakeups, 1);
+    CHECK_EQ(encode_queue.Size(), kEncodeQueue);
+    CHECK_EQ(pool.GetStats().in_use - in_use, kEncodeQueue);
+    Task task;
+    for (uint32_t i = 0; i < kEncodeQueue; i++) {
+        CHECK(encode_queue.Pop(task));
+        CHECK_EQ(task.index, i);
+    }
+    task = Task();
+    CHECK_EQ(pool.GetStats().in_use, in_use);
+}
+
+// Input, encode and a stalled network on their own threads. While the network stalls the input task
+// finishes at its own pace, every captured frame is either sent once the network is back or counted by
+// one of the two drops, and what is sent is the audio from before the send queue filled up.
+static void TestStalledUplink() {
+    constexpr uint32_t kFrames = 5000;
+    SpscQueue<Task, kEncodeQueue> encode_queue;
+    SpscQueue<std::unique_ptr<uint32_t>, kSendQueue> send_queue;
+    uint32_t encode_queue_drops = 0;
+    std::atomic<uint32_t> overflow_drops = 0;
+    HostEvent encode_not_empty, input_done;
+    std::atomic<bool> stop = false;
+
+    std::thread encoder([&]() {
+        for (;;) {
+            Task task;
+            if (!encode_queue.Pop(task)) {
+                if (stop) {
+                    break;
+                }
+                encode_not_empty.Wait(10ms);
+                continue;
+            }
+            if (ShouldDropUplinkFrame(kUplinkOverflowDropNewest, send_queue.Size(), send_queue.limit(), task.voice)) {
+                overflow_drops++;
+                continue;
+            }
+            CHECK(send_queue.Push(std::make_unique<uint32_t>(task.index)));
+        }
+    });
+    // Captures until the encoder has dropped a frame for the full send queue, and kFrames more after that
+    uint32_t captured = 0;
+    std::thread input([&]() {
+        for (uint32_t after_drop = 0; after_drop < kFrames; captured++) {
+            after_drop += overflow_drops > 0;
+            bool was_empty = false;
+            if (PushOrDrop(encode_queue, Capture(captured, captured % 2 == 0), encode_queue_drops, &was_empty) &&
+                was_empty) {
+                encode_not_empty.Set();
+            }
+        }
+        input_done.Set();
+    });
+
+    // Nobody drains the send queue until the input task is done
+    CHECK(input_done.Wait(5s));
+    input.join();
+    stop = true;
+    encode_not_empty.Set();
+    encoder.join();
+
+    CHECK(send_queue.Full());
+    uint32_t sent = 0;
+    uint32_t last = 0;
+    std::unique_ptr<uint32_t> packet;
+    while (send_queue.Pop(packet)) {
+        CHECK(sent == 0 || *packet > last);
+        last = *packet;
+        sent++;
+    }
+    CHECK_EQ(sent, kSendQueue);
+    CHECK_EQ(sent + encode_queue_drops + overflow_drops, captured);
+    printf("  %u captured, %u sent, %u dropped behind the encoder, %u by the overflow policy\n", captured, sent,
+        encode_queue_drops, overflow_drops.load());
+}
+
+int main() {
+    pool.Initialize(kEncodeQueue + 2, kFrameSamples);
+    RUN_TEST(TestDropNewest);
+    RUN_TEST(TestDropSilenceFirst);
+    RUN_TEST(TestSaturatedEncodeQueue);
+    RUN_TEST(TestStalledUplink);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef HOST_TEST_UTIL_H
+#define HOST_TEST_UTIL_H
+
+#include <cstdio>
+#include <cstdlib>
+
+// Checks stay on in every build type, unlike assert()
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        long long _a = (long long)(a), _b = (long long)(b); \
+        if (_a != _b) { \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define RUN_TEST(test) \
+    do { \
+        test(); \
+        printf("%s passed\n", #test); \
+    } while (0)
+
+#endif // HOST_TEST_UTIL_H